@@ -26,9 +26,19 @@
 
 #include <sys/types.h>
 
+#include <cvb/msg.h>
+
+#include "sock.h"
+
+/*
+ * Send authentification request, without waiting for the reply
+ */
+int auth_request(int srvr, char *uname, size_t size);
+
 /*
- * Send authentification request
+ * Process authentification reply
  */
-int auth_request(int srvr, char *const uname, size_t size);
+int auth_reply(int8_t status, const char *uname,
+               const struct sock_hello *hello);
 
 #endif /* auth.h */
@@ -29,8 +29,83 @@
 #include <cvb/fdlist.h>
 #include <cvb/fdmap.h>
 #include <cvb/msg.h>
+#include <cvb/timer.h>
 
 #include "cmd.h"
+#include "sock.h"
+
+/*
+ * Silence of the server before pinging it and before giving up, in seconds
+ */
+#define CLNT_IDLE    30
+#define CLNT_TIMEOUT 90
+
+/*
+ * Maximum number of peers, connected or not, and of users allowed to connect,
+ * and delay before giving up a connection and relaying direct messages
+ * through the server, in seconds
+ */
+#define CLNT_MAXPEERS     64
+#define CLNT_PEER_TIMEOUT 5
+
+/*
+ * Maximum number of files sent at once, and bytes sent from a file in a
+ * single message
+ */
+#define CLNT_MAXFILES  8
+#define CLNT_FILECHUNK (64 * 1024)
+
+/*
+ * Peer connection states
+ */
+#define PEER_REQUESTED  0 /* Waiting for the peer address    */
+#define PEER_CONNECTING 1 /* Connecting to the peer          */
+#define PEER_ACCEPTED   2 /* Waiting for the peer connection */
+#define PEER_INCOMING   3 /* Connected, waiting for its name */
+#define PEER_OPEN       4 /* Connected, bypassing the server */
+
+/*
+ * Peer connection, cached for direct messages
+ */
+struct peer {
+        char *name;
+        struct msg_reader rd;
+        struct timer timer;
+        struct clnt *clnt;
+        char *pending[SOCK_MAXBATCH];
+        int npending;
+        uint32_t token;
+        int state;
+        int fd;
+};
+
+/*
+ * Name bound to a sender identifier
+ */
+struct sender {
+        uint32_t id;
+        char *name;
+};
+
+/*
+ * File sent to the server, as long as bytes are granted
+ */
+struct xfer {
+        char *name;
+        uint32_t id;
+        uint32_t size;
+        off_t offset;
+        uint32_t credit;
+        int fd;
+};
+
+/*
+ * Client structure initializer
+ */
+#define CLNT_INIT {CMD_INIT, "", "", FDLIST_INIT, FDMAP_INIT, TIMERWHEEL_INIT, \
+                   TIMER_INIT, 0, -1, MSG_READER_INIT, {MSG_V1, MSG_CAP_NONE}, \
+                   MSG_CODEC_INIT, {NULL}, 0, NULL, 0, 0, -1, NULL, 0, 0, 0, \
+                   {NULL}, 0, {NULL}, 0, {NULL}, 0, 0, NULL, -1, -1}
 
 /*
  * Client structure
@@ -41,6 +116,30 @@ struct clnt {
         char name_last_msg[MSG_BUFSIZ];
         struct fdlist fdl;
         struct fdmap fdm;
+        struct timerwheel tw;
+        struct timer idle;
+        long last;
+        long srtt;
+        struct msg_reader rd;
+        struct sock_hello hello;
+        struct msg_codec codec;
+        char *batch[SOCK_MAXBATCH];
+        int nbatch;
+        struct sender *senders;
+        int nsenders;
+        int sendersize;
+        long last_sender;
+        char **pending;
+        int npending;
+        int pendsize;
+        int authed;
+        struct peer *peers[CLNT_MAXPEERS];
+        int npeers;
+        char *allowed[CLNT_MAXPEERS];
+        int nallowed;
+        struct xfer *xfers[CLNT_MAXFILES];
+        int nxfers;
+        uint32_t nextfile;
         FILE *log_file;
         int srvr;
         int listener;
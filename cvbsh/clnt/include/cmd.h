@@ -41,6 +41,11 @@
  */
 #define CMD_LINE_CHAR_ID '/'
 
+/*
+ * Room message identifier
+ */
+#define CMD_ROOM_CHAR_ID '#'
+
 /*
  * Command line delimiters
  */
@@ -91,6 +96,6 @@ void cmd_prompt(struct cmd *cmd);
 /*
  * Restore input parameters
  */
-void cmd_restore(const struct cmd *cmd);
+void cmd_restore(struct cmd *cmd);
 
 #endif /* cmd.h */
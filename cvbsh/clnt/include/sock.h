@@ -24,36 +24,113 @@
 #ifndef SOCK_H
 #define SOCK_H
 
+#include <stdint.h>
+
 #include <sys/types.h>
 
+#include <cvb/msg.h>
+
+/*
+ * Features supported by the client
+ */
+#define SOCK_CAPS (MSG_CAP_BATCH | MSG_CAP_DEFLATE | MSG_CAP_SENDERID \
+                   | MSG_CAP_PING | MSG_CAP_FILE)
+
+/*
+ * Maximum number of public messages in a batch
+ */
+#define SOCK_MAXBATCH 64
+
+/*
+ * Protocol version and features agreed with the server
+ */
+struct sock_hello {
+        int version;
+        uint32_t caps;
+};
+
 /*
- * Send authentification request
+ * Send handshake, answered before the authentification
+ */
+int send_hello(int srvr, uint32_t caps);
+
+/*
+ * Send authentification request, answered later
  */
 int send_auth_request(int srvr, const char *uname, const char *psswd);
 
 /*
- * Send connection request
+ * Receive handshake reply
+ */
+void recv_hello(struct sock_hello *hello, const struct msg_frame *frame);
+
+/*
+ * Send connection request, to bypass the server
  */
-int8_t send_connect_request(int srvr, const char *name);
+int send_connect_request(int srvr, int version, const char *name);
+
+/*
+ * Send connection token, with the port listened to for the peer
+ */
+int send_connect(int sfd, int version, const char *name, uint16_t port,
+                 uint32_t token);
+
+/*
+ * Send direct message status
+ */
+int send_dm_status(int srvr, int version, const char *name, int8_t status);
 
 /*
  * Send public message
  */
-int send_public_message(int srvr, const char *msg);
+int send_public_message(int srvr, int version, const char *msg);
+
+/*
+ * Send public messages in a single batch
+ */
+int send_public_batch(int srvr, char *const *msgs, int nmsgs);
+
+/*
+ * Send private message, relayed by the server or sent to the peer
+ */
+int send_private_message(int srvr, int version, const char *name,
+                         const char *msg);
+
+/*
+ * Send room request, to join or leave it
+ */
+int send_room_request(int srvr, int version, int8_t code, const char *room);
+
+/*
+ * Send room message
+ */
+int send_room_message(int srvr, int version, const char *room,
+                      const char *msg);
+
+/*
+ * Send heartbeat, or the answer to one
+ */
+int send_heartbeat(int srvr, int version, int8_t code, uint32_t word);
+
+/*
+ * Send file offer, with version 2
+ */
+int send_file_offer(int srvr, uint32_t id, uint32_t size, const char *name);
 
 /*
- * Send private message
+ * Send file chunk, copied by the kernel from the file to the server
  */
-int send_private_message(int clnt, const char *msg);
+int send_file_chunk(int srvr, uint32_t id, int fd, off_t *offset,
+                    size_t count);
 
 /*
- * Receive IPv4 address
+ * Send file status, giving up a transfer, with version 2
  */
-short recv_ipv4_addr(int srvr, void *ip);
+int send_file_status(int srvr, uint32_t id, int8_t status);
 
 /*
- * Receive IPv6 address
+ * Receive peer address, IPv4 or IPv6
  */
-short recv_ipv6_addr(int srvr, void *ip);
+int recv_peer_addr(const struct msg_frame *frame, char *host, char *service);
 
 #endif /* sock.h */
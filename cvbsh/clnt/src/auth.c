@@ -48,35 +48,46 @@ static int auth_read_line(const char *const field, char *buf, const size_t size)
 }
 
 /*
- * Send authentification request
+ * Send authentification request, without waiting for the reply
  */
 int auth_request(const int srvr, char *const uname, const size_t size)
 {
         char pwd[MSG_BUFSIZ];
-        int auth = -1;
 
         assert(uname != NULL);
 
-        while (auth != 0) {
-                auth_read_line("username", uname, size);
-                auth_read_line("password", pwd, MSG_BUFSIZ);
+        if ((auth_read_line("username", uname, size) != 0)
+            || (auth_read_line("password", pwd, MSG_BUFSIZ) != 0))
+                return -1;
 
-                log_debug("[auth] Send logging request as %s", uname);
+        log_debug("[auth] Send logging request as %s", uname);
 
-                if (*pwd == '\0')
-                        auth = send_auth_request(srvr, uname, NULL);
-                else
-                        auth = send_auth_request(srvr, uname, pwd);
+        if (send_auth_request(srvr, uname, (*pwd == '\0') ? NULL : pwd) < 0) {
+                log_error("[auth] Connection to server lost");
 
-                if (auth == 1)
-                        fprintf(stderr, "Wrong username or password\n");
-                else if (auth == 2)
-                        fprintf(stderr, "Username already taken\n");
-                else if (auth == -1)
-                        log_error("[auth] Connection to server lost");
+                return -1;
         }
 
+        return 0;
+}
+
+/*
+ * Process authentification reply
+ */
+int auth_reply(const int8_t status, const char *const uname,
+               const struct sock_hello *const hello)
+{
+        if (status == 1)
+                fprintf(stderr, "\nWrong username or password\n");
+        else if (status == 2)
+                fprintf(stderr, "\nUsername already taken\n");
+
+        if (status != 0)
+                return -1;
+
         log_info("[auth] Logged in as %s", uname);
+        log_debug("[auth] Using protocol version %d with features %#x",
+                  hello->version, hello->caps);
 
         return 0;
 }
@@ -22,6 +22,7 @@
  * SOFTWARE.
  */
 #include <errno.h>
+#include <fcntl.h>
 #include <pthread.h>
 #include <signal.h>
 #include <stdio.h>
@@ -29,198 +30,1576 @@
 #include <string.h>
 #include <unistd.h>
 
+#include <arpa/inet.h>
+#include <linux/sockios.h>
+#include <sys/ioctl.h>
+#include <sys/random.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+
 #include <cvb/logger.h>
 #include <cvb/msg.h>
 #include <cvb/net.h>
 
-#include "auth.h"
-#include "clnt.h"
-#include "cmd.h"
-#include "sock.h"
+#include "auth.h"
+#include "clnt.h"
+#include "cmd.h"
+#include "sock.h"
+
+/*
+ * Initialize client logger
+ */
+void clnt_set_logger(struct clnt *const clnt, const char *const pathname)
+{
+        clnt->log_file = fopen(pathname, "w");
+
+        if (clnt->log_file != NULL)
+                log_callback(&file_callback, clnt->log_file, LOG_DEBUG);
+        else
+                log_error("[clnt] fopen(): %s: %s", pathname, strerror(errno));
+
+        log_debug("[clnt] Logging level set to %s", log_level(LOG_ERROR));
+        log_debug("[clnt] Using log file %s", pathname);
+}
+
+/*
+ * Client SIGINT handler
+ */
+_Noreturn static void clnt_handler(__attribute__((unused)) int signal)
+{
+        exit(EXIT_SUCCESS);
+}
+
+/*
+ * Update client signal handler
+ */
+int clnt_set_handler(void)
+{
+        struct sigaction act;
+
+        log_debug("[clnt] Set signal handler");
+
+        act.sa_handler = &clnt_handler;
+        sigemptyset(&act.sa_mask);
+        act.sa_flags = 0;
+
+        if (sigaction(SIGINT, &act, NULL) != 0)
+                return -1;
+
+        /* Files are sent by sendfile(), failing with EPIPE instead */
+        act.sa_handler = SIG_IGN;
+
+        return sigaction(SIGPIPE, &act, NULL);
+}
+
+/*
+ * Fetch the first available socket
+ */
+int clnt_fetch_socket(char *const service)
+{
+        int sfd = net_fetch_socket(NULL, service, 0);
+
+        while (sfd == -1) {
+                log_debug("[clnt] Port %s busy", service);
+
+                sfd = net_fetch_next();
+        }
+
+        return sfd;
+}
+
+/*
+ * Find a peer by name
+ */
+static struct peer *clnt_peer_find(const struct clnt *const clnt,
+                                   const char *const name)
+{
+        int i;
+
+        for (i = 0; i < clnt->npeers; ++i) {
+                if ((clnt->peers[i]->name != NULL)
+                    && (strcmp(clnt->peers[i]->name, name) == 0))
+                        return clnt->peers[i];
+        }
+
+        return NULL;
+}
+
+/*
+ * Find a connected peer by file descriptor
+ */
+static struct peer *clnt_peer_fd(const struct clnt *const clnt, const int fd)
+{
+        int i;
+
+        for (i = 0; i < clnt->npeers; ++i) {
+                if (clnt->peers[i]->fd == fd)
+                        return clnt->peers[i];
+        }
+
+        return NULL;
+}
+
+/*
+ * Close a peer connection, relaying the messages still waiting for it through
+ * the server
+ */
+static void clnt_peer_close(struct clnt *const clnt, struct peer *const peer)
+{
+        int i;
+
+        tw_cancel(&(clnt->tw), &(peer->timer));
+
+        if (peer->fd > -1) {
+                fdl_remove(&(clnt->fdl), peer->fd);
+                fdm_remove(&(clnt->fdm), peer->fd);
+                close(peer->fd);
+        }
+
+        for (i = 0; i < peer->npending; ++i) {
+                if (send_private_message(clnt->srvr, clnt->hello.version,
+                                         peer->name, peer->pending[i]) < 0)
+                        log_error("[clnt] send_private_message(): %s",
+                                  strerror(errno));
+
+                free(peer->pending[i]);
+        }
+
+        msg_reader_destroy(&(peer->rd));
+        free(peer->name);
+
+        for (i = 0; clnt->peers[i] != peer; ++i)
+                continue;
+
+        clnt->peers[i] = clnt->peers[--clnt->npeers];
+        free(peer);
+}
+
+/*
+ * Give up a peer connection taking too long
+ */
+static void clnt_peer_expire(void *const arg)
+{
+        struct peer *peer = (struct peer *) arg;
+
+        log_info("[clnt] Connection with '%s' timed out",
+                 (peer->name != NULL) ? peer->name : "unknown peer");
+
+        clnt_peer_close(peer->clnt, peer);
+}
+
+/*
+ * Add a peer, given up if not connected in time
+ */
+static struct peer *clnt_peer_new(struct clnt *const clnt,
+                                  const char *const name, const int state)
+{
+        struct msg_reader rd = MSG_READER_INIT;
+        struct peer *peer;
+
+        if (clnt->npeers == CLNT_MAXPEERS)
+                return NULL;
+
+        peer = (struct peer *) calloc(1, sizeof(struct peer));
+
+        if (peer == NULL)
+                return NULL;
+
+        if ((name != NULL) && ((peer->name = strdup(name)) == NULL)) {
+                free(peer);
+
+                return NULL;
+        }
+
+        peer->rd = rd;
+        peer->clnt = clnt;
+        peer->state = state;
+        peer->fd = -1;
+
+        tw_timer(&(peer->timer), &clnt_peer_expire, peer);
+        tw_add(&(clnt->tw), &(peer->timer), CLNT_PEER_TIMEOUT * 1000L);
+
+        clnt->peers[clnt->npeers++] = peer;
+
+        return peer;
+}
+
+/*
+ * Cache a peer connection, and send the messages waiting for it
+ */
+static int clnt_peer_open(struct clnt *const clnt, struct peer *const peer)
+{
+        int i, n;
+
+        if (fdm_put(&(clnt->fdm), peer->fd, peer->name) == (char *) -1) {
+                log_error("[clnt] fdm_put(): %s", strerror(errno));
+
+                return -1;
+        }
+
+        peer->state = PEER_OPEN;
+        tw_cancel(&(clnt->tw), &(peer->timer));
+
+        log_info("[clnt] Direct messages with '%s' bypass the server",
+                 peer->name);
+
+        for (i = 0; i < peer->npending; ++i) {
+                if (send_private_message(peer->fd, MSG_V2, clnt->uname,
+                                         peer->pending[i]) < 0)
+                        break;
+
+                free(peer->pending[i]);
+        }
+
+        /* The others are relayed when closing the connection */
+        n = peer->npending - i;
+        memmove(peer->pending, peer->pending + i, n * sizeof(char *));
+        peer->npending = n;
+
+        return (n > 0) ? -1 : 0;
+}
+
+/*
+ * Check whether a user may connect directly
+ */
+static int clnt_allowed(const struct clnt *const clnt, const char *const name)
+{
+        int i;
+
+        for (i = 0; i < clnt->nallowed; ++i) {
+                if (strcmp(clnt->allowed[i], name) == 0)
+                        return 1;
+        }
+
+        return 0;
+}
+
+/*
+ * Let a user connect directly, once sent a direct message
+ *
+ * Accepting a connection discloses the address of the client, so only the
+ * users it writes to may ask for one. The others are relayed by the server.
+ */
+static void clnt_allow(struct clnt *const clnt, const char *const name)
+{
+        if ((clnt->nallowed == CLNT_MAXPEERS) || clnt_allowed(clnt, name))
+                return;
+
+        clnt->allowed[clnt->nallowed] = strdup(name);
+
+        if (clnt->allowed[clnt->nallowed] != NULL)
+                ++clnt->nallowed;
+}
+
+/*
+ * Send a direct message, typed as /dm USER MESSAGE
+ *
+ * Messages bypass the server once connected to the peer, and are relayed by
+ * the server when the connection fails.
+ */
+static void clnt_send_dm(struct clnt *const clnt, const char *const name,
+                         const char *const msg)
+{
+        struct peer *peer;
+        int fd;
+
+        if ((name == NULL) || (msg == NULL)) {
+                fprintf(stderr, "\nUsage: /dm USER MESSAGE\n");
+
+                return;
+        }
+
+        clnt_allow(clnt, name);
+
+        fd = fdm_contains(&(clnt->fdm), name);
+
+        if (fd != -1) {
+                if (send_private_message(fd, MSG_V2, clnt->uname, msg) >= 0)
+                        return;
+
+                log_warn("[clnt] Connection with '%s' lost", name);
+                clnt_peer_close(clnt, clnt_peer_fd(clnt, fd));
+        } else if (strcmp(name, clnt->uname) != 0) {
+                peer = clnt_peer_find(clnt, name);
+
+                /* Kept until connected, or given up */
+                if (peer == NULL) {
+                        peer = clnt_peer_new(clnt, name, PEER_REQUESTED);
+
+                        if ((peer != NULL)
+                            && (send_connect_request(clnt->srvr,
+                                                     clnt->hello.version,
+                                                     name) < 0)) {
+                                log_error("[clnt] send_connect_request(): %s",
+                                          strerror(errno));
+                                clnt_peer_close(clnt, peer);
+                                peer = NULL;
+                        }
+                }
+
+                if ((peer != NULL) && (peer->npending < SOCK_MAXBATCH)
+                    && ((peer->pending[peer->npending] = strdup(msg))
+                        != NULL)) {
+                        ++peer->npending;
+
+                        return;
+                }
+        }
+
+        if (send_private_message(clnt->srvr, clnt->hello.version, name, msg)
+            < 0)
+                log_error("[clnt] send_private_message(): %s",
+                          strerror(errno));
+}
+
+/*
+ * Send the public messages kept for a batch
+ */
+static void clnt_flush(struct clnt *const clnt)
+{
+        int i;
+
+        if (clnt->nbatch == 0)
+                return;
+
+        if (send_public_batch(clnt->srvr, clnt->batch, clnt->nbatch) < 0)
+                log_error("[clnt] send_public_batch(): %s", strerror(errno));
+
+        for (i = 0; i < clnt->nbatch; ++i)
+                free(clnt->batch[i]);
+
+        clnt->nbatch = 0;
+}
+
+/*
+ * Keep a message sent before the authentification reply
+ */
+static void clnt_keep(struct clnt *const clnt, const char *const msg)
+{
+        char **pending;
+        int size;
+
+        if (clnt->npending == clnt->pendsize) {
+                size = (clnt->pendsize > 0) ? 2 * clnt->pendsize : 16;
+                pending = (char **) realloc(clnt->pending,
+                                            size * sizeof(char *));
+
+                if (pending == NULL) {
+                        log_error("[clnt] realloc(): %s", strerror(errno));
+
+                        return;
+                }
+
+                clnt->pending = pending;
+                clnt->pendsize = size;
+        }
+
+        clnt->pending[clnt->npending] = strdup(msg);
+
+        if (clnt->pending[clnt->npending] != NULL)
+                ++clnt->npending;
+        else
+                log_error("[clnt] strdup(): %s", strerror(errno));
+}
+
+/*
+ * Send a public message, batched with the next ones if possible
+ */
+static void clnt_send(struct clnt *const clnt, const char *const msg)
+{
+        /* Sent right away, rejected along with a failed authentification */
+        if (!clnt->authed)
+                clnt_keep(clnt, msg);
+
+        if (!(clnt->hello.caps & MSG_CAP_BATCH)) {
+                send_public_message(clnt->srvr, clnt->hello.version, msg);
+
+                return;
+        }
+
+        if (clnt->nbatch == SOCK_MAXBATCH)
+                clnt_flush(clnt);
+
+        clnt->batch[clnt->nbatch] = strdup(msg);
+
+        if (clnt->batch[clnt->nbatch] != NULL)
+                ++clnt->nbatch;
+        else
+                log_error("[clnt] strdup(): %s", strerror(errno));
+}
+
+/*
+ * Send a room message, typed as #ROOM MESSAGE
+ */
+static void clnt_send_room(struct clnt *const clnt)
+{
+        char *room = clnt->cmd.buf + 1;
+        char *msg = strpbrk(room, CMD_LINE_DELIM);
+
+        if ((msg == NULL) || (msg == room)) {
+                fprintf(stderr, "\nUsage: #ROOM MESSAGE\n");
+
+                return;
+        }
+
+        *msg = '\0';
+        msg = msg + 1 + strspn(msg + 1, CMD_LINE_DELIM);
+
+        if (send_room_message(clnt->srvr, clnt->hello.version, room, msg) < 0)
+                log_error("[clnt] send_room_message(): %s", strerror(errno));
+}
+
+/*
+ * Send a room request, to join or leave it
+ */
+static void clnt_room(struct clnt *const clnt, const int8_t code,
+                      const char *const room)
+{
+        if (room == NULL) {
+                fprintf(stderr, "\nMissing room name\n");
+
+                return;
+        }
+
+        if (send_room_request(clnt->srvr, clnt->hello.version, code, room) < 0)
+                log_error("[clnt] send_room_request(): %s", strerror(errno));
+}
+
+/*
+ * Find a file sent to the server
+ */
+static int clnt_xfer_find(const struct clnt *const clnt, const uint32_t id)
+{
+        int i;
+
+        for (i = 0; i < clnt->nxfers; ++i) {
+                if (clnt->xfers[i]->id == id)
+                        return i;
+        }
+
+        return -1;
+}
+
+/*
+ * Forget a file sent to the server
+ */
+static void clnt_xfer_close(struct clnt *const clnt, const int i)
+{
+        struct xfer *xfer = clnt->xfers[i];
+
+        close(xfer->fd);
+        free(xfer->name);
+        free(xfer);
+
+        clnt->xfers[i] = clnt->xfers[--clnt->nxfers];
+}
+
+/*
+ * Offer a file to the server, typed as /ft PATHNAME
+ *
+ * The file is sent once the server grants its first bytes.
+ */
+static void clnt_send_file(struct clnt *const clnt, const char *const pathname)
+{
+        struct xfer *xfer;
+        struct stat st;
+        const char *name;
+        int fd;
+
+        if (pathname == NULL) {
+                fprintf(stderr, "\nUsage: /ft PATHNAME\n");
+
+                return;
+        }
+
+        if (!(clnt->hello.caps & MSG_CAP_FILE)) {
+                fprintf(stderr, "\nFile transfer not supported\n");
+
+                return;
+        }
+
+        if (clnt->nxfers == CLNT_MAXFILES) {
+                fprintf(stderr, "\nToo many files sent at once\n");
+
+                return;
+        }
+
+        fd = open(pathname, O_RDONLY | O_CLOEXEC);
+
+        if (fd == -1) {
+                fprintf(stderr, "\n%s: %s\n", pathname, strerror(errno));
+
+                return;
+        }
+
+        if ((fstat(fd, &st) != 0) || !S_ISREG(st.st_mode)
+            || (st.st_size > UINT32_MAX)) {
+                fprintf(stderr, "\n%s: Not a regular file, or too large\n",
+                        pathname);
+                close(fd);
+
+                return;
+        }
+
+        name = strrchr(pathname, '/');
+        name = (name != NULL) ? name + 1 : pathname;
+
+        xfer = (struct xfer *) malloc(sizeof(struct xfer));
+
+        if ((xfer == NULL) || ((xfer->name = strdup(name)) == NULL)) {
+                log_error("[clnt] malloc(): %s", strerror(errno));
+                free(xfer);
+                close(fd);
+
+                return;
+        }
+
+        xfer->id = clnt->nextfile++;
+        xfer->size = (uint32_t) st.st_size;
+        xfer->offset = 0;
+        xfer->credit = 0;
+        xfer->fd = fd;
+
+        if (send_file_offer(clnt->srvr, xfer->id, xfer->size, xfer->name)
+            < 0) {
+                log_error("[clnt] send_file_offer(): %s", strerror(errno));
+                close(fd);
+                free(xfer->name);
+                free(xfer);
+
+                return;
+        }
+
+        clnt->xfers[clnt->nxfers++] = xfer;
+}
+
+/*
+ * User command processing
+ */
+static void clnt_cmd(struct clnt *const clnt)
+{
+        char **args;
+
+        if (clnt->cmd.buf[0] == CMD_ROOM_CHAR_ID) {
+                /* Keep the order of public and room messages */
+                clnt_flush(clnt);
+                clnt_send_room(clnt);
+                cmd_prompt(&(clnt->cmd));
+
+                return;
+        }
+
+        args = cmd_parse(&(clnt->cmd));
+
+        if (args == NULL) {
+                clnt_send(clnt, clnt->cmd.buf);
+        } else {
+                /* Keep the order of messages and commands */
+                clnt_flush(clnt);
+
+                switch (args[0][1]) {
+                case 'd':
+                        clnt_send_dm(clnt, args[1], args[2]);
+                        break;
+
+                case 'f':
+                        clnt_send_file(clnt, args[1]);
+                        break;
+
+                case 'h':
+                        cmd_help();
+                        break;
+
+                case 'j':
+                        clnt_room(clnt, MSG_CODE_JOIN, args[1]);
+                        break;
+
+                case 'l':
+                        clnt_room(clnt, MSG_CODE_LEAVE, args[1]);
+                        break;
+
+                case 'q':
+                case 'e':
+                        exit(EXIT_SUCCESS);
+                        break;
+
+                default:
+                        fprintf(stderr, "\nUnknown command '%s'\n", args[0]);
+                        break;
+                }
+        }
+
+        cmd_prompt(&(clnt->cmd));
+        free(args);
+}
+
+/*
+ * Print a public message, under its sender name unless it is the last one
+ */
+static void clnt_print(struct clnt *const clnt, const char *const name,
+                       const int len, const struct msg_frame *const frame,
+                       const int same)
+{
+        printf("\r \x1b[2K");
+
+        if (same)
+                printf("\t%.*s\n", (int) frame->size[0], frame->field[0]);
+        else
+                printf("\e\[1m%.*s:\e\[0m\n\t%.*s\n", len, name,
+                       (int) frame->size[0], frame->field[0]);
+
+        fflush(stdout);
+        cmd_prompt(&(clnt->cmd));
+}
+
+/*
+ * Print a room message under its sender and room names
+ */
+static void clnt_print_room(struct clnt *const clnt,
+                            const struct msg_frame *const frame)
+{
+        printf("\r \x1b[2K");
+        printf("\e\[1m%.*s in #%.*s:\e\[0m\n\t%.*s\n",
+               (int) frame->size[2], frame->field[2],
+               (int) frame->size[0], frame->field[0],
+               (int) frame->size[1], frame->field[1]);
+        fflush(stdout);
+        cmd_prompt(&(clnt->cmd));
+
+        /* The next public message is printed under its sender name */
+        clnt->name_last_msg[0] = '\0';
+        clnt->last_sender = -1;
+}
+
+/*
+ * Print a direct message under its sender name
+ */
+static void clnt_print_dm(struct clnt *const clnt, const char *const name,
+                          const int len, const struct msg_frame *const frame)
+{
+        printf("\r \x1b[2K");
+        printf("\e\[1m%.*s (direct):\e\[0m\n\t%.*s\n", len, name,
+               (int) frame->size[1], frame->field[1]);
+        fflush(stdout);
+        cmd_prompt(&(clnt->cmd));
+
+        /* The next public message is printed under its sender name */
+        clnt->name_last_msg[0] = '\0';
+        clnt->last_sender = -1;
+}
+
+/*
+ * Get the peer name held first by a message
+ */
+static int clnt_peer_name(const struct msg_frame *const frame,
+                          char *const name)
+{
+        if ((frame->size[0] == 0) || (frame->size[0] >= MSG_BUFSIZ))
+                return -1;
+
+        memcpy(name, frame->field[0], frame->size[0]);
+        name[frame->size[0]] = '\0';
+
+        return 0;
+}
+
+/*
+ * Print the refusal of a direct message, or fall back to the server when the
+ * peer refused a connection
+ */
+static void clnt_dm_status(struct clnt *const clnt,
+                           const struct msg_frame *const frame)
+{
+        char name[MSG_BUFSIZ];
+        struct peer *peer;
+
+        if (*frame->field[1] != MSG_DM_REFUSED)
+                return;
+
+        if (clnt_peer_name(frame, name) == 0) {
+                peer = clnt_peer_find(clnt, name);
+
+                if ((peer != NULL) && (peer->state == PEER_REQUESTED)) {
+                        log_info("[clnt] Connection with '%s' refused", name);
+                        clnt_peer_close(clnt, peer);
+
+                        return;
+                }
+        }
+
+        printf("\r \x1b[2K");
+        printf("User '%.*s' is not connected\n", (int) frame->size[0],
+               frame->field[0]);
+        fflush(stdout);
+        cmd_prompt(&(clnt->cmd));
+}
+
+/*
+ * Get the port of the listening socket, opened for the first peer
+ */
+static int clnt_listen(struct clnt *const clnt)
+{
+        struct sockaddr_storage addr;
+        socklen_t addrlen = sizeof(addr);
+
+        if (clnt->listener == -1) {
+                clnt->listener = net_fetch_next();
+
+                if (clnt->listener == -1)
+                        return -1;
+
+                if (fdl_add(&(clnt->fdl), clnt->listener, POLLIN) != 0) {
+                        log_error("[clnt] fdl_add(): %s", strerror(errno));
+                        close(clnt->listener);
+                        clnt->listener = -1;
+
+                        return -1;
+                }
+        }
+
+        if (getsockname(clnt->listener, (struct sockaddr *) &addr, &addrlen)
+            != 0) {
+                log_error("[clnt] getsockname(): %s", strerror(errno));
+
+                return -1;
+        }
+
+        if (addr.ss_family == AF_INET6)
+                return ntohs(((struct sockaddr_in6 *) &addr)->sin6_port);
+
+        return ntohs(((struct sockaddr_in *) &addr)->sin_port);
+}
+
+/*
+ * Accept a connection request of a peer, relayed by the server
+ */
+static void clnt_peer_accept(struct clnt *const clnt,
+                             const struct msg_frame *const frame)
+{
+        char name[MSG_BUFSIZ];
+        struct peer *peer;
+        uint32_t token;
+        int port;
+
+        if (clnt_peer_name(frame, name) != 0)
+                return;
+
+        peer = clnt_peer_find(clnt, name);
+
+        /* Crossed requests: the peer with the lowest name connects */
+        if ((peer != NULL) && (((peer->state == PEER_REQUESTED)
+                                && (strcmp(clnt->uname, name) < 0))
+                               || (peer->state == PEER_CONNECTING)))
+                return;
+
+        /* The peer lost its connection, not known here yet */
+        if ((peer != NULL) && (peer->state == PEER_OPEN)) {
+                clnt_peer_close(clnt, peer);
+                peer = NULL;
+        }
+
+        /* The address is only disclosed to the users written to */
+        port = clnt_allowed(clnt, name) ? clnt_listen(clnt) : -1;
+
+        if ((port > 0) && (peer == NULL))
+                peer = clnt_peer_new(clnt, name, PEER_ACCEPTED);
+
+        if ((port <= 0) || (peer == NULL)
+            || (getrandom(&token, sizeof(uint32_t), 0) != sizeof(uint32_t))) {
+                log_warn("[clnt] Connection with '%s' refused", name);
+
+                if (send_dm_status(clnt->srvr, clnt->hello.version, name,
+                                   MSG_DM_REFUSED) < 0)
+                        log_error("[clnt] send_dm_status(): %s",
+                                  strerror(errno));
+                return;
+        }
+
+        peer->state = PEER_ACCEPTED;
+        peer->token = token;
+        tw_add(&(clnt->tw), &(peer->timer), CLNT_PEER_TIMEOUT * 1000L);
+
+        if (send_connect(clnt->srvr, clnt->hello.version, name,
+                         (uint16_t) port, token) < 0)
+                log_error("[clnt] send_connect(): %s", strerror(errno));
+}
+
+/*
+ * Connect to a peer, at the address given by the server
+ */
+static void clnt_peer_connect(struct clnt *const clnt,
+                              const struct msg_frame *const frame)
+{
+        char name[MSG_BUFSIZ], host[INET6_ADDRSTRLEN], service[8];
+        struct peer *peer;
+        uint32_t token;
+        int sfd;
+
+        if (clnt_peer_name(frame, name) != 0)
+                return;
+
+        peer = clnt_peer_find(clnt, name);
+
+        if ((peer == NULL) || (peer->state != PEER_REQUESTED)) {
+                log_warn("[clnt] Unexpected address of '%s', ignored", name);
+
+                return;
+        }
+
+        if (recv_peer_addr(frame, host, service) != 0) {
+                log_warn("[clnt] Invalid address of '%s'", name);
+                clnt_peer_close(clnt, peer);
+
+                return;
+        }
+
+        /* Connected once writable, in time or relayed through the server */
+        sfd = net_fetch_socket(host, service, NET_NONBLOCK);
+
+        if ((sfd > -1) && (fdl_add(&(clnt->fdl), sfd, POLLOUT) != 0)) {
+                log_error("[clnt] fdl_add(): %s", strerror(errno));
+                close(sfd);
+                sfd = -1;
+        }
+
+        if (sfd == -1) {
+                clnt_peer_close(clnt, peer);
+
+                return;
+        }
+
+        memcpy(&token, frame->field[3], sizeof(uint32_t));
+
+        peer->fd = sfd;
+        peer->token = ntohl(token);
+        peer->state = PEER_CONNECTING;
+        tw_add(&(clnt->tw), &(peer->timer), CLNT_PEER_TIMEOUT * 1000L);
+}
+
+/*
+ * Finish connecting to a peer
+ */
+static void clnt_peer_connected(struct clnt *const clnt,
+                                struct peer *const peer)
+{
+        socklen_t len = sizeof(int);
+        int err, flags;
+
+        if (getsockopt(peer->fd, SOL_SOCKET, SO_ERROR, &err, &len) != 0)
+                err = errno;
+
+        if (err != 0) {
+                log_info("[clnt] Connection with '%s' failed: %s", peer->name,
+                         strerror(err));
+                clnt_peer_close(clnt, peer);
+
+                return;
+        }
+
+        /* Written to like the accepted peers */
+        flags = fcntl(peer->fd, F_GETFL);
+
+        if ((flags == -1)
+            || (fcntl(peer->fd, F_SETFL, flags & ~O_NONBLOCK) != 0)) {
+                log_error("[clnt] fcntl(): %s", strerror(errno));
+                clnt_peer_close(clnt, peer);
+
+                return;
+        }
+
+        fdl_get(&(clnt->fdl), peer->fd)->events = POLLIN;
+
+        /* The peer knows the token of the request it accepted */
+        if ((send_connect(peer->fd, MSG_V2, clnt->uname, 0, peer->token) < 0)
+            || (clnt_peer_open(clnt, peer) != 0))
+                clnt_peer_close(clnt, peer);
+}
+
+/*
+ * Identify a peer connected to the client, by the token of the request it
+ * made
+ */
+static struct peer *clnt_peer_identify(struct clnt *const clnt,
+                                       struct peer *const incoming,
+                                       const struct msg_frame *const frame)
+{
+        struct msg_reader rd = MSG_READER_INIT;
+        char name[MSG_BUFSIZ];
+        struct peer *peer = NULL;
+        uint32_t token = 0;
+
+        if ((frame->code == MSG_CODE_DM_CONNECT)
+            && (clnt_peer_name(frame, name) == 0)) {
+                peer = clnt_peer_find(clnt, name);
+                memcpy(&token, frame->field[3], sizeof(uint32_t));
+        }
+
+        if ((peer == NULL) || (peer->state != PEER_ACCEPTED)
+            || (peer->token != ntohl(token))) {
+                log_warn("[clnt] Unexpected peer connection, closed");
+                clnt_peer_close(clnt, incoming);
+
+                return NULL;
+        }
+
+        /* The accepted peer takes the connection over */
+        peer->fd = incoming->fd;
+        peer->rd = incoming->rd;
+        incoming->fd = -1;
+        incoming->rd = rd;
+        clnt_peer_close(clnt, incoming);
+
+        if (clnt_peer_open(clnt, peer) != 0) {
+                clnt_peer_close(clnt, peer);
+
+                return NULL;
+        }
+
+        return peer;
+}
+
+/*
+ * Print the answer to a room request
+ */
+static void clnt_room_status(struct clnt *const clnt,
+                             const struct msg_frame *const frame)
+{
+        printf("\r \x1b[2K");
+
+        switch (*frame->field[1]) {
+        case MSG_ROOM_JOINED:
+                printf("Joined #%.*s\n", (int) frame->size[0],
+                       frame->field[0]);
+                break;
+
+        case MSG_ROOM_LEFT:
+                printf("Left #%.*s\n", (int) frame->size[0], frame->field[0]);
+                break;
+
+        default:
+                printf("Request refused for #%.*s\n", (int) frame->size[0],
+                       frame->field[0]);
+                break;
+        }
+
+        fflush(stdout);
+        cmd_prompt(&(clnt->cmd));
+}
+
+/*
+ * Public message refusal processing
+ */
+static void clnt_public_status(struct clnt *const clnt,
+                               const struct msg_frame *const frame)
+{
+        /* Kept until the authentification succeeds, then sent again */
+        if (!clnt->authed) {
+                log_debug("[clnt] Message refused before authentification");
+
+                return;
+        }
+
+        printf("\r \x1b[2K");
+        printf("Message not delivered: %.*s\n", (int) frame->size[0],
+               frame->field[0]);
+
+        fflush(stdout);
+        cmd_prompt(&(clnt->cmd));
+}
+
+/*
+ * Find the position of a sender identifier among the bindings, sorted by
+ * identifier
+ */
+static int clnt_sender_pos(const struct clnt *const clnt, const uint32_t id)
+{
+        int lo = 0, hi = clnt->nsenders, mid;
+
+        while (lo < hi) {
+                mid = lo + (hi - lo) / 2;
+
+                if (clnt->senders[mid].id < id)
+                        lo = mid + 1;
+                else
+                        hi = mid;
+        }
+
+        return lo;
+}
+
+/*
+ * Get the name bound to a sender identifier
+ */
+static const char *clnt_sender_name(const struct clnt *const clnt,
+                                    const uint32_t id)
+{
+        int pos = clnt_sender_pos(clnt, id);
+
+        if ((pos < clnt->nsenders) && (clnt->senders[pos].id == id))
+                return clnt->senders[pos].name;
+
+        return NULL;
+}
+
+/*
+ * Bind a sender identifier to its name, or release it for an empty name
+ */
+static void clnt_sender(struct clnt *const clnt,
+                        const struct msg_frame *const frame)
+{
+        struct sender *senders;
+        char *name;
+        uint32_t id;
+        int pos, size;
+
+        memcpy(&id, frame->field[0], sizeof(uint32_t));
+        id = ntohl(id);
+        pos = clnt_sender_pos(clnt, id);
+
+        /* The identifier now belongs to someone else, or to no one */
+        if (clnt->last_sender == (long) id)
+                clnt->last_sender = -1;
+
+        if ((pos < clnt->nsenders) && (clnt->senders[pos].id == id)) {
+                free(clnt->senders[pos].name);
+                --clnt->nsenders;
+                memmove(clnt->senders + pos, clnt->senders + pos + 1,
+                        (clnt->nsenders - pos) * sizeof(struct sender));
+        }
+
+        if (frame->size[1] == 0)
+                return;
+
+        if (clnt->nsenders == clnt->sendersize) {
+                size = (clnt->sendersize > 0) ? 2 * clnt->sendersize : 16;
+                senders = (struct sender *) realloc(clnt->senders, size
+                                                    * sizeof(struct sender));
+
+                if (senders == NULL) {
+                        log_error("[clnt] realloc(): %s", strerror(errno));
+
+                        return;
+                }
+
+                clnt->senders = senders;
+                clnt->sendersize = size;
+        }
+
+        name = (char *) malloc(frame->size[1] + 1);
+
+        if (name == NULL) {
+                log_error("[clnt] malloc(): %s", strerror(errno));
+
+                return;
+        }
+
+        memcpy(name, frame->field[1], frame->size[1]);
+        name[frame->size[1]] = '\0';
+
+        /* New senders come last, with the greatest identifiers */
+        memmove(clnt->senders + pos + 1, clnt->senders + pos,
+                (clnt->nsenders - pos) * sizeof(struct sender));
+        clnt->senders[pos].id = id;
+        clnt->senders[pos].name = name;
+        ++clnt->nsenders;
+}
 
 /*
- * Initialize client logger
+ * Authentification reply processing
  */
-void clnt_set_logger(struct clnt *const clnt, const char *const pathname)
+static void clnt_auth(struct clnt *const clnt, const int8_t status)
 {
-        clnt->log_file = fopen(pathname, "w");
+        int i;
 
-        if (clnt->log_file != NULL)
-                log_callback(&file_callback, clnt->log_file, LOG_DEBUG);
-        else
-                log_error("[clnt] fopen(): %s: %s", pathname, strerror(errno));
+        if (auth_reply(status, clnt->uname, &(clnt->hello)) != 0) {
+                cmd_restore(&(clnt->cmd));
+                fprintf(stderr, "Sorry, try again\n");
+                clearerr(stdin);
 
-        log_debug("[clnt] Logging level set to %s", log_level(LOG_ERROR));
-        log_debug("[clnt] Using log file %s", pathname);
+                if ((auth_request(clnt->srvr, clnt->uname, MSG_BUFSIZ) != 0)
+                    || (cmd_init(&(clnt->cmd), STDIN_FILENO, clnt->uname)
+                        == -1)) {
+                        log_fatal("[clnt] Authentification failed");
+                        exit(EXIT_FAILURE);
+                }
+
+                /* Pipelined again after the new request */
+                for (i = 0; i < clnt->npending; ++i)
+                        send_public_message(clnt->srvr, clnt->hello.version,
+                                            clnt->pending[i]);
+
+                cmd_prompt(&(clnt->cmd));
+
+                return;
+        }
+
+        clnt->authed = 1;
+
+        for (i = 0; i < clnt->npending; ++i)
+                free(clnt->pending[i]);
+
+        free(clnt->pending);
+
+        clnt->pending = NULL;
+        clnt->npending = 0;
+        clnt->pendsize = 0;
 }
 
 /*
- * Client SIGINT handler
+ * Heartbeat answer processing
  */
-_Noreturn static void clnt_handler(__attribute__((unused)) int signal)
+static void clnt_rtt(struct clnt *const clnt,
+                     const struct msg_frame *const frame)
 {
-        exit(EXIT_SUCCESS);
+        uint32_t word;
+        long rtt;
+
+        memcpy(&word, frame->field[0], sizeof(uint32_t));
+        rtt = (long) ((uint32_t) tw_now(&(clnt->tw)) - ntohl(word));
+
+        if (rtt > CLNT_TIMEOUT * 1000L)
+                return;
+
+        clnt->srtt = (clnt->srtt < 0) ? rtt : (7 * clnt->srtt + rtt) / 8;
+
+        log_debug("[clnt] RTT %ld ms, smoothed %ld ms", rtt, clnt->srtt);
 }
 
 /*
- * Update client signal handler
+ * Check the server for silence, then ping it or give up
  */
-int clnt_set_handler(void)
+static void clnt_idle(void *const arg)
 {
-        struct sigaction act;
+        struct clnt *clnt = (struct clnt *) arg;
+        long silent = tw_now(&(clnt->tw)) - clnt->last;
+        long delay = CLNT_IDLE * 1000L;
 
-        log_debug("[clnt] Set signal handler");
+        /* Servers without heartbeats are left to the system */
+        if (!(clnt->hello.caps & MSG_CAP_PING)) {
+                tw_add(&(clnt->tw), &(clnt->idle), delay);
 
-        act.sa_handler = &clnt_handler;
-        sigemptyset(&act.sa_mask);
-        act.sa_flags = 0;
+                return;
+        }
+
+        if (silent >= CLNT_TIMEOUT * 1000L) {
+                log_fatal("[clnt] Server silent for %ld ms", silent);
+                fprintf(stderr, "\nConnection to server lost\n");
+                exit(EXIT_FAILURE);
+        }
+
+        if (silent < delay) {
+                delay -= silent;
+        } else if (send_heartbeat(clnt->srvr, clnt->hello.version,
+                                  MSG_CODE_PING,
+                                  (uint32_t) tw_now(&(clnt->tw))) < 0) {
+                log_error("[clnt] send_heartbeat(): %s", strerror(errno));
+        }
+
+        if (CLNT_TIMEOUT * 1000L - silent < delay)
+                delay = CLNT_TIMEOUT * 1000L - silent;
 
-        return sigaction(SIGINT, &act, NULL);
+        tw_add(&(clnt->tw), &(clnt->idle), delay);
 }
 
 /*
- * Fetch the first available socket
+ * Add bytes granted by the server to a file, sent when the server is ready
  */
-int clnt_fetch_socket(char *const service)
+static void clnt_file_ack(struct clnt *const clnt,
+                          const struct msg_frame *const frame)
 {
-        int sfd = net_fetch_socket(NULL, service);
+        uint32_t id, count;
+        int i;
 
-        while (sfd == -1) {
-                log_debug("[clnt] Port %s busy", service);
+        memcpy(&id, frame->field[0], sizeof(uint32_t));
+        memcpy(&count, frame->field[1], sizeof(uint32_t));
 
-                sfd = net_fetch_next(NULL, service);
+        i = clnt_xfer_find(clnt, ntohl(id));
+
+        if (i == -1) {
+                log_warn("[clnt] Bytes granted to unknown file %u, ignored",
+                         ntohl(id));
+
+                return;
         }
 
-        return sfd;
+        clnt->xfers[i]->credit += ntohl(count);
+        fdl_get(&(clnt->fdl), clnt->srvr)->events |= POLLOUT;
 }
 
 /*
- * Send direct message
+ * Print the end of a file transfer, and forget the file
  */
-/* static int clnt_send_dm(struct clnt *const clnt, const char *const name,
-                        const char *const msg)
+static void clnt_xfer_end(struct clnt *const clnt, const int i,
+                          const int8_t status)
 {
-        int sfd = fdm_contains(&(clnt->fdm), name);
-        char ip[16];
-        short port;
+        const char *end;
 
-        if (sfd == -1) {
-                log_info("[clnt] Try to connect with '%s'", name);
+        switch (status) {
+        case MSG_FILE_DONE:
+                end = "transferred";
+                break;
 
-                if (send_connect_request(clnt->srvr, name) != 1) {
-                        log_error("[clnt] Failed to connect with '%s'", name);
+        case MSG_FILE_REFUSED:
+                end = "refused";
+                break;
 
-                        return -1;
-                }
+        default:
+                end = "failed";
+                break;
+        }
 
-                if (msg_recv_code(clnt->srvr) == 0)
-                        port = recv_ipv4_addr(clnt->srvr, ip);
-                else
-                        port = recv_ipv6_addr(clnt->srvr, ip);
+        printf("\r \x1b[2K");
+        printf("File '%s' %s\n", clnt->xfers[i]->name, end);
+        fflush(stdout);
+        cmd_prompt(&(clnt->cmd));
 
-                if (port == -1) {
-                        log_error("[clnt] error");
+        clnt_xfer_close(clnt, i);
+}
 
-                        return -1;
-                }
+/*
+ * Process the end of a file transfer
+ */
+static void clnt_file_status(struct clnt *const clnt,
+                             const struct msg_frame *const frame)
+{
+        uint32_t id;
+        int i;
+
+        memcpy(&id, frame->field[0], sizeof(uint32_t));
+
+        i = clnt_xfer_find(clnt, ntohl(id));
+
+        if (i != -1)
+                clnt_xfer_end(clnt, i, *frame->field[1]);
+}
+
+/*
+ * Get the number of bytes the server socket takes without blocking
+ *
+ * The reported buffer size accounts for the kernel overhead, so only half of
+ * the free space is used.
+ */
+static size_t clnt_sndroom(const struct clnt *const clnt)
+{
+        socklen_t len = sizeof(int);
+        int size, queued;
 
+        if ((getsockopt(clnt->srvr, SOL_SOCKET, SO_SNDBUF, &size, &len) != 0)
+            || (ioctl(clnt->srvr, SIOCOUTQ, &queued) != 0)) {
+                log_warn("[clnt] Send buffer unknown: %s", strerror(errno));
+
+                return CLNT_FILECHUNK;
         }
 
-        return send_private_message(sfd, name);
-} */
+        return (queued < size) ? (size_t) (size - queued) / 2 : 0;
+}
 
 /*
- * User command processing
+ * Send a chunk of each file with granted bytes, while the server is ready
+ *
+ * A file never takes more than the bytes granted on the connection, so that
+ * other messages wait for a chunk at most, nor more than the socket takes
+ * without blocking. A file shorter than announced only fails its transfer.
  */
-static void clnt_cmd(struct clnt *const clnt)
+static void clnt_upload(struct clnt *const clnt)
 {
-        char **args = cmd_parse(&(clnt->cmd));
+        const size_t over = MSG_HDRSIZ + 2 * sizeof(uint32_t);
+        size_t count, room = clnt_sndroom(clnt);
+        struct xfer *xfer;
+        int i, more = 0;
 
-        if (args == NULL) {
-                send_public_message(clnt->srvr, clnt->cmd.buf);
-        } else {
-                switch (args[0][1]) {
-                /* case 'd':
-                        clnt_send_dm(clnt, args[1], args[2]);
-                        break; */
+        for (i = 0; i < clnt->nxfers; ++i) {
+                xfer = clnt->xfers[i];
+                count = (xfer->credit < CLNT_FILECHUNK) ? xfer->credit
+                        : CLNT_FILECHUNK;
 
-                /* case 'f':
-                        log_error("[clnt] Command not supported");
-                        break; */
+                if (count == 0)
+                        continue;
 
-                case 'h':
-                        cmd_help();
-                        break;
+                /* Sent once the server has read some bytes */
+                if (room <= over) {
+                        more = 1;
+                        continue;
+                }
 
-                case 'q':
-                case 'e':
-                        exit(EXIT_SUCCESS);
-                        break;
+                if (count > room - over)
+                        count = room - over;
 
-                default:
-                        fprintf(stderr, "\nUnknown command '%s'\n", args[0]);
-                        break;
+                if (send_file_chunk(clnt->srvr, xfer->id, xfer->fd,
+                                    &(xfer->offset), count) >= 0) {
+                        room -= over + count;
+                        xfer->credit -= count;
+                        more |= (xfer->credit > 0);
+                } else if (errno == EIO) {
+                        log_error("[clnt] File '%s' shrank", xfer->name);
+                        room = (room > over + count) ? room - over - count : 0;
+
+                        if (send_file_status(clnt->srvr, xfer->id,
+                                             MSG_FILE_FAILED) < 0) {
+                                log_fatal("[clnt] send_file_status(): %s",
+                                          strerror(errno));
+                                exit(EXIT_FAILURE);
+                        }
+
+                        /* The last file takes its place */
+                        clnt_xfer_end(clnt, i--, MSG_FILE_FAILED);
+                } else {
+                        /* The frame is already started */
+                        log_fatal("[clnt] send_file_chunk(): %s",
+                                  strerror(errno));
+                        exit(EXIT_FAILURE);
                 }
         }
 
-        cmd_prompt(&(clnt->cmd));
-        free(args);
+        if (!more)
+                fdl_get(&(clnt->fdl), clnt->srvr)->events &= ~POLLOUT;
 }
 
 /*
  * Client message processing
  */
-static void clnt_recv(struct clnt *const clnt, int sfd)
+static void clnt_dispatch(struct clnt *const clnt,
+                          const struct msg_frame *const frame)
 {
-        char msg[MSG_BUFSIZ];
-        char name[MSG_BUFSIZ];
-        int8_t code = msg_recv_code(sfd);
-
-        log_debug("[clnt] Incoming message");
+        const char *name;
+        uint32_t id;
+        int len, same;
 
-        switch (code) {
+        switch (frame->code) {
         case MSG_CODE_RECV_PUBLIC:
-                if ((msg_recv_text(sfd, msg) == -1)
-                    || (msg_recv_text(sfd, name) == -1)) {
-                        log_error("[clnt] msg_recv_text(): %s",
+                name = frame->field[1];
+                len = (int) frame->size[1];
+                same = (frame->size[1] < MSG_BUFSIZ)
+                       && (strlen(clnt->name_last_msg) == frame->size[1])
+                       && (memcmp(name, clnt->name_last_msg, len) == 0);
+
+                clnt_print(clnt, name, len, frame, same);
+
+                if (!same && (frame->size[1] < MSG_BUFSIZ)) {
+                        memcpy(clnt->name_last_msg, name, len);
+                        clnt->name_last_msg[len] = '\0';
+                }
+                break;
+
+        case MSG_CODE_HELLO:
+                recv_hello(&(clnt->hello), frame);
+                break;
+
+        case MSG_CODE_PING:
+                memcpy(&id, frame->field[0], sizeof(uint32_t));
+
+                if (send_heartbeat(clnt->srvr, clnt->hello.version,
+                                   MSG_CODE_PONG, ntohl(id)) < 0)
+                        log_error("[clnt] send_heartbeat(): %s",
                                   strerror(errno));
-                } else {
-                        printf("\r \x1b[2K");
+                break;
 
-                        if (strcmp(name, clnt->name_last_msg) == 0) {
-                                printf("\t%s\n", msg);
-                        } else {
-                                printf("\e\[1m%s:\e\[0m\n\t%s\n", name, msg);
-                                strcpy(clnt->name_last_msg, name);
-                        }
+        case MSG_CODE_PONG:
+                clnt_rtt(clnt, frame);
+                break;
 
-                        fflush(stdout);
-                        cmd_prompt(&(clnt->cmd));
+        case MSG_CODE_RECV_AUTH:
+                clnt_auth(clnt, *frame->field[0]);
+                break;
+
+        case MSG_CODE_SENDER:
+                clnt_sender(clnt, frame);
+                break;
+
+        case MSG_CODE_RECV_SENDER:
+                memcpy(&id, frame->field[1], sizeof(uint32_t));
+                id = ntohl(id);
+
+                name = clnt_sender_name(clnt, id);
+
+                if (name == NULL) {
+                        log_warn("[clnt] Unknown sender %u, ignored", id);
+                        break;
                 }
+
+                clnt_print(clnt, name, (int) strlen(name), frame,
+                           clnt->last_sender == (long) id);
+                clnt->last_sender = id;
+                break;
+
+        case MSG_CODE_ROOM_STATUS:
+                clnt_room_status(clnt, frame);
+                break;
+
+        case MSG_CODE_PUBLIC_STATUS:
+                clnt_public_status(clnt, frame);
+                break;
+
+        case MSG_CODE_RECV_ROOM:
+                clnt_print_room(clnt, frame);
+                break;
+
+        case MSG_CODE_DM:
+                clnt_print_dm(clnt, frame->field[0], (int) frame->size[0],
+                              frame);
+                break;
+
+        case MSG_CODE_DM_REQUEST:
+                clnt_peer_accept(clnt, frame);
+                break;
+
+        case MSG_CODE_DM_CONNECT:
+                clnt_peer_connect(clnt, frame);
                 break;
 
         case MSG_CODE_DM_STATUS:
+                clnt_dm_status(clnt, frame);
                 break;
 
-        case -1:
-                log_fatal("[clnt] Connection to server lost");
-                exit(EXIT_FAILURE);
+        case MSG_CODE_FILE_ACK:
+                clnt_file_ack(clnt, frame);
+                break;
+
+        case MSG_CODE_FILE_STATUS:
+                clnt_file_status(clnt, frame);
                 break;
 
         default:
-                log_warn("[clnt] Unknown message code %hhd, ignored", code);
+                log_warn("[clnt] Unknown message code %hhd, ignored",
+                         frame->code);
                 break;
         }
 }
 
 /*
- * New client connection processing
+ * Process the messages buffered from the server
+ */
+static void clnt_parse(struct clnt *const clnt)
+{
+        struct msg_frame frame, inner;
+        size_t pos;
+        int rc;
+
+        while ((rc = msg_parse(&(clnt->rd), &frame)) > 0) {
+                if (frame.code != MSG_CODE_BATCH) {
+                        clnt_dispatch(clnt, &frame);
+                        continue;
+                }
+
+                pos = 0;
+
+                while ((rc = msg_unbatch(&frame, &pos, &inner)) > 0)
+                        clnt_dispatch(clnt, &inner);
+
+                if (rc < 0)
+                        break;
+        }
+
+        if (rc < 0) {
+                log_fatal("[clnt] Malformed message from server");
+                exit(EXIT_FAILURE);
+        }
+}
+
+/*
+ * Server message processing
+ */
+static void clnt_recv(struct clnt *const clnt, const int sfd)
+{
+        ssize_t nread = msg_fill(&(clnt->rd), sfd);
+
+        log_debug("[clnt] Incoming message");
+
+        if ((nread < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK)
+                            || (errno == EINTR)))
+                return;
+
+        if (nread <= 0) {
+                log_fatal("[clnt] Connection to server lost");
+                exit(EXIT_FAILURE);
+        }
+
+        clnt->last = tw_now(&(clnt->tw));
+        clnt_parse(clnt);
+}
+
+/*
+ * Peer message processing
+ */
+static void clnt_peer_recv(struct clnt *const clnt, const int sfd)
+{
+        struct peer *peer = clnt_peer_fd(clnt, sfd);
+        struct msg_frame frame;
+        ssize_t nread;
+        int rc;
+
+        if (peer->state == PEER_CONNECTING) {
+                clnt_peer_connected(clnt, peer);
+
+                return;
+        }
+
+        nread = msg_fill(&(peer->rd), sfd);
+
+        if ((nread < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK)
+                            || (errno == EINTR)))
+                return;
+
+        if (nread <= 0) {
+                log_info("[clnt] Connection with '%s' closed",
+                         (peer->name != NULL) ? peer->name : "unknown peer");
+                clnt_peer_close(clnt, peer);
+
+                return;
+        }
+
+        while ((rc = msg_parse(&(peer->rd), &frame)) > 0) {
+                if (peer->state == PEER_INCOMING) {
+                        peer = clnt_peer_identify(clnt, peer, &frame);
+
+                        if (peer == NULL)
+                                return;
+                } else if (frame.code == MSG_CODE_DM) {
+                        /* Named by the connection, whatever it claims */
+                        clnt_print_dm(clnt, peer->name,
+                                      (int) strlen(peer->name), &frame);
+                } else {
+                        log_warn("[clnt] Unknown peer message code %hhd, "
+                                 "ignored", frame.code);
+                }
+        }
+
+        if (rc < 0) {
+                log_warn("[clnt] Malformed message from '%s'",
+                         (peer->name != NULL) ? peer->name : "unknown peer");
+                clnt_peer_close(clnt, peer);
+        }
+}
+
+/*
+ * New peer connection processing
  */
-static void clnt_connect(void)
+static void clnt_connect(struct clnt *const clnt)
 {
-        log_debug("[clnt] Inocming connection");
-        log_fatal("[clnt] Function not supported");
-        abort();
+        struct peer *peer;
+        int sfd;
+
+        log_debug("[clnt] Incoming connection");
+
+        sfd = net_accept_clnt(clnt->listener);
+
+        if (sfd == -1)
+                return;
+
+        /* Named once it sends the token of its request */
+        peer = clnt_peer_new(clnt, NULL, PEER_INCOMING);
+
+        if ((peer == NULL) || (fdl_add(&(clnt->fdl), sfd, POLLIN) != 0)) {
+                log_warn("[clnt] Peer connection refused");
+                close(sfd);
+
+                if (peer != NULL)
+                        clnt_peer_close(clnt, peer);
+
+                return;
+        }
+
+        peer->fd = sfd;
 }
 
 /*
@@ -228,12 +1607,31 @@ static void clnt_connect(void)
  */
 void clnt_run(struct clnt *const clnt)
 {
-        struct pollfd *ifd;
+        uint32_t caps = SOCK_CAPS;
+        short revents;
         int ready;
+        int i, fd;
 
-        while (auth_request(clnt->srvr, clnt->uname, MSG_BUFSIZ) != 0) {
-                fprintf(stderr, "\nSorry, try again\n");
-                clearerr(stdin);
+        if (tw_init(&(clnt->tw), TW_TICK) != 0) {
+                log_fatal("[clnt] tw_init(): %s", strerror(errno));
+                exit(EXIT_FAILURE);
+        }
+
+        /* Compressed messages are only asked for with a codec */
+        if (msg_codec_init(&(clnt->codec), NULL) == 0)
+                clnt->rd.codec = &(clnt->codec);
+        else
+                caps &= ~MSG_CAP_DEFLATE;
+
+        if (send_hello(clnt->srvr, caps) < 0) {
+                log_fatal("[clnt] send_hello(): %s", strerror(errno));
+                exit(EXIT_FAILURE);
+        }
+
+        /* Messages typed meanwhile are pipelined after the request */
+        if (auth_request(clnt->srvr, clnt->uname, MSG_BUFSIZ) != 0) {
+                log_fatal("[clnt] auth_request(): %s", strerror(errno));
+                exit(EXIT_FAILURE);
         }
 
         if (cmd_init(&(clnt->cmd), STDIN_FILENO, clnt->uname) == -1) {
@@ -241,8 +1639,20 @@ void clnt_run(struct clnt *const clnt)
                 exit(EXIT_FAILURE);
         }
 
+        clnt->last = tw_now(&(clnt->tw));
+        tw_timer(&(clnt->idle), &clnt_idle, clnt);
+        tw_add(&(clnt->tw), &(clnt->idle), CLNT_IDLE * 1000L);
+
+        /* Peers are then added without reallocating the list */
+        if (fdl_reserve(&(clnt->fdl), 0) != 0) {
+                log_fatal("[clnt] fdl_reserve(): %s", strerror(errno));
+                exit(EXIT_FAILURE);
+        }
+
+        /* The listener is only opened for direct messages */
         if ((fdl_add(&(clnt->fdl), STDIN_FILENO, POLLIN) != 0)
-            || (fdl_add(&(clnt->fdl), clnt->listener, POLLIN) != 0)
+            || ((clnt->listener > -1)
+                && (fdl_add(&(clnt->fdl), clnt->listener, POLLIN) != 0))
             || (fdl_add(&(clnt->fdl), clnt->srvr, POLLIN) != 0)) {
                 log_fatal("[clnt] fdl_add(): %s", strerror(errno));
                 exit(EXIT_FAILURE);
@@ -252,27 +1662,49 @@ void clnt_run(struct clnt *const clnt)
         cmd_prompt(&(clnt->cmd));
 
         for (;;) {
-                ready = poll(clnt->fdl.fds, clnt->fdl.nfds, -1);
+                ready = poll(clnt->fdl.fds, clnt->fdl.nfds,
+                             tw_timeout(&(clnt->tw)));
 
                 if (ready < 0) {
                         log_fatal("[clnt] poll(): %s", strerror(errno));
                         exit(EXIT_FAILURE);
                 }
 
-                for (ifd = clnt->fdl.fds; ready > 0; ++ifd) {
-                        if (ifd->revents == POLLIN) {
-                                if (ifd->fd == STDIN_FILENO) {
-                                        if (cmd_read(&(clnt->cmd)) == '\n')
-                                                clnt_cmd(clnt);
-                                } else if (ifd->fd == clnt->listener) {
-                                        clnt_connect();
-                                } else {
-                                        clnt_recv(clnt, ifd->fd);
-                                }
-
-                                --ready;
+                /* Peers come and go, the last ones first */
+                for (i = (int) clnt->fdl.nfds - 1; i >= 0; --i) {
+                        if (i >= (int) clnt->fdl.nfds)
+                                continue;
+
+                        fd = clnt->fdl.fds[i].fd;
+                        revents = clnt->fdl.fds[i].revents;
+                        clnt->fdl.fds[i].revents = 0;
+
+                        /* Files are sent between the other messages */
+                        if ((fd == clnt->srvr) && (revents & POLLOUT)) {
+                                clnt_upload(clnt);
+                                revents &= ~POLLOUT;
+                        }
+
+                        /* Otherwise, only peers being connected wait for it */
+                        if (!(revents & (POLLIN | POLLOUT | POLLHUP | POLLERR)))
+                                continue;
+
+                        if (fd == STDIN_FILENO) {
+                                /* Pasted lines are read at once */
+                                while (cmd_read(&(clnt->cmd)) == '\n')
+                                        clnt_cmd(clnt);
+
+                                clnt_flush(clnt);
+                        } else if (fd == clnt->listener) {
+                                clnt_connect(clnt);
+                        } else if (fd == clnt->srvr) {
+                                clnt_recv(clnt, fd);
+                        } else {
+                                clnt_peer_recv(clnt, fd);
                         }
                 }
+
+                tw_run(&(clnt->tw));
         }
 }
 
@@ -282,17 +1714,43 @@ void clnt_run(struct clnt *const clnt)
 void clnt_cleanup(__attribute__((unused)) int status, void *arg)
 {
         struct clnt *clnt = (struct clnt *) arg;
+        long i;
 
         log_info("[clnt] Clean up and exit");
 
         cmd_restore(&(clnt->cmd));
 
+        /* Messages still waiting for a peer are relayed by the server */
+        while (clnt->npeers > 0)
+                clnt_peer_close(clnt, clnt->peers[0]);
+
+        while (clnt->nxfers > 0)
+                clnt_xfer_close(clnt, clnt->nxfers - 1);
+
+        for (i = 0; i < clnt->nallowed; ++i)
+                free(clnt->allowed[i]);
+
+        fdm_destroy(&(clnt->fdm));
+
         if (clnt->log_file != NULL)
                 fclose(clnt->log_file);
 
         if (clnt->fdl.fds != NULL)
                 fdl_destroy(&(clnt->fdl));
 
+        msg_reader_destroy(&(clnt->rd));
+        msg_codec_destroy(&(clnt->codec));
+
+        for (i = 0; i < clnt->nsenders; ++i)
+                free(clnt->senders[i].name);
+
+        free(clnt->senders);
+
+        for (i = 0; i < clnt->npending; ++i)
+                free(clnt->pending[i]);
+
+        free(clnt->pending);
+
         if (clnt->srvr > -1)
                 close(clnt->srvr);
 
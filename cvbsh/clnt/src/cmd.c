@@ -130,9 +130,12 @@ void cmd_help(void)
         printf("\nList of commands:\n");
         printf("\n");
         printf(">MESSAGE           Send public MESSAGE to all users\n");
+        printf(">#ROOM MESSAGE     Send MESSAGE to the members of ROOM\n");
         printf(">/dm USER MESSAGE  Send direct MESSAGE to USER\n");
-        /* printf(">/ft PATHNAME      Transfer file PATHNAME to server\n"); */
+        printf(">/ft PATHNAME      Transfer file PATHNAME to server\n");
         printf(">/help             Display this help\n");
+        printf(">/join ROOM        Join ROOM\n");
+        printf(">/leave ROOM       Leave ROOM\n");
         printf(">/quit             Exit chat app\n");
 }
 
@@ -185,7 +188,15 @@ char **cmd_parse(struct cmd *cmd)
 
         args[0] = strtok(cmd->buf, CMD_LINE_DELIM);
         args[1] = strtok(NULL, CMD_LINE_DELIM);
-        args[2] = strtok(NULL, CMD_LINE_DELIM);
+
+        /* The last argument is the rest of the line, spaces included */
+        args[2] = strtok(NULL, "\r\n");
+
+        if (args[2] != NULL)
+                args[2] += strspn(args[2], CMD_LINE_DELIM);
+
+        if ((args[2] != NULL) && (*args[2] == '\0'))
+                args[2] = NULL;
 
         return args;
 }
@@ -215,7 +226,7 @@ void cmd_prompt(struct cmd *const cmd)
 /*
  * Restore input parameters
  */
-void cmd_restore(const struct cmd *const cmd)
+void cmd_restore(struct cmd *const cmd)
 {
         assert(cmd != NULL);
 
@@ -223,5 +234,6 @@ void cmd_restore(const struct cmd *const cmd)
                 fcntl(cmd->fd, F_SETFL, cmd->flags);
                 tcsetattr(cmd->fd, TCSAFLUSH, cmd->tattr);
                 free(cmd->tattr);
+                cmd->tattr = NULL;
         }
 }
@@ -26,112 +26,358 @@
 #include <stdio.h>
 #include <string.h>
 
+#include <arpa/inet.h>
+
 #include <cvb/logger.h>
 #include <cvb/msg.h>
 
 #include "sock.h"
 
 /*
- * Send authentification request
+ * Send handshake, answered along with the authentification
+ */
+int send_hello(const int srvr, const uint32_t caps)
+{
+        struct msg_field fields[2];
+        uint32_t net_caps = htonl(caps);
+        int8_t version = MSG_NVERSIONS;
+
+        fields[0].data = &version;
+        fields[0].size = sizeof(int8_t);
+        fields[1].data = &net_caps;
+        fields[1].size = sizeof(uint32_t);
+
+        /* Version 1 framing, ignored by servers without handshake */
+        return msg_send_frame(srvr, MSG_V1, MSG_CODE_HELLO, fields, 2);
+}
+
+/*
+ * Send authentification request, answered later
  */
 int send_auth_request(const int srvr, const char *const uname,
                       const char *const psswd)
 {
-        int rc;
+        struct msg_field fields[2];
 
         assert(uname != NULL);
 
-        if (psswd == NULL)
-                rc = msg_send_code(srvr, MSG_CODE_SEND_NO_AUTH);
-        else
-                rc = msg_send_code(srvr, MSG_CODE_SEND_AUTH);
+        fields[0].data = uname;
+        fields[0].size = strlen(uname);
 
-        if (rc <= 0)
-                return rc;
+        if (psswd == NULL)
+                return msg_send_frame(srvr, MSG_V1, MSG_CODE_SEND_NO_AUTH,
+                                      fields, 1);
 
-        rc = msg_send_text(srvr, uname, strlen(uname));
+        fields[1].data = psswd;
+        fields[1].size = strlen(psswd);
 
-        if (rc <= 0)
-                return rc;
+        return msg_send_frame(srvr, MSG_V1, MSG_CODE_SEND_AUTH, fields, 2);
+}
 
-        if (psswd != NULL)
-                msg_send_text(srvr, psswd, strlen(psswd));
+/*
+ * Receive handshake reply
+ */
+void recv_hello(struct sock_hello *const hello,
+                const struct msg_frame *const frame)
+{
+        uint32_t caps;
 
-        if (msg_recv_code(srvr) != MSG_CODE_RECV_AUTH)
-                return -1;
+        assert(frame->code == MSG_CODE_HELLO);
 
-        return msg_recv_code(srvr);
+        memcpy(&caps, frame->field[1], sizeof(uint32_t));
+        hello->version = *frame->field[0];
+        hello->caps = ntohl(caps) & SOCK_CAPS;
 }
 
 /*
- * Send connection request
+ * Send connection request, to bypass the server
  */
-int8_t send_connect_request(int srvr, const char *name)
+int send_connect_request(const int srvr, const int version,
+                         const char *const name)
 {
-        char buf[MSG_BUFSIZ];
-        int rc;
+        struct msg_field field;
 
         assert(name != NULL);
 
-        rc = msg_send_code(srvr, MSG_CODE_DM_REQUEST);
+        field.data = name;
+        field.size = strlen(name);
 
-        if (rc <= 0)
-                return rc;
+        return msg_send_frame(srvr, version, MSG_CODE_DM_REQUEST, &field, 1);
+}
 
-        rc = msg_send_text(srvr, name, strlen(name));
+/*
+ * Send connection token, with the port listened to for the peer
+ */
+int send_connect(const int sfd, const int version, const char *const name,
+                 const uint16_t port, const uint32_t token)
+{
+        struct msg_field fields[4];
+        uint32_t net_port = htonl(port);
+        uint32_t net_token = htonl(token);
 
-        if (rc <= 0)
-                return rc;
+        assert(name != NULL);
 
-        if (msg_recv_code(srvr) != MSG_CODE_DM_STATUS)
-                return -1;
+        /* The address is filled by the server */
+        fields[0].data = name;
+        fields[0].size = strlen(name);
+        fields[1].data = "";
+        fields[1].size = 0;
+        fields[2].data = &net_port;
+        fields[2].size = sizeof(uint32_t);
+        fields[3].data = &net_token;
+        fields[3].size = sizeof(uint32_t);
+
+        return msg_send_frame(sfd, version, MSG_CODE_DM_CONNECT, fields, 4);
+}
 
-        rc = msg_recv_text(srvr, buf);
+/*
+ * Send direct message status
+ */
+int send_dm_status(const int srvr, const int version, const char *const name,
+                   int8_t status)
+{
+        struct msg_field fields[2];
 
-        if (rc <= 0)
-                return rc;
+        assert(name != NULL);
 
-        if (strcmp(buf, name) != 0)
-                return -1;
+        fields[0].data = name;
+        fields[0].size = strlen(name);
+        fields[1].data = &status;
+        fields[1].size = sizeof(int8_t);
 
-        return msg_recv_code(srvr);
+        return msg_send_frame(srvr, version, MSG_CODE_DM_STATUS, fields, 2);
 }
 
 /*
  * Send a message
  */
-static int send_msg(const int sfd, const int8_t code, const char *const msg)
+static int send_msg(const int sfd, const int version, const int8_t code,
+                    const char *const msg)
 {
-        short size = (short) strlen(msg);
-        int rc;
+        struct msg_field field;
 
-        if (size == 0)
+        field.data = msg;
+        field.size = strlen(msg);
+
+        if (field.size == 0)
                 return 0;
 
-        rc = msg_send_code(sfd, code);
+        return msg_send_frame(sfd, version, code, &field, 1);
+}
+
+/*
+ * Send public message
+ */
+int send_public_message(const int srvr, const int version,
+                        const char *const msg)
+{
+        assert(msg != NULL);
+
+        return send_msg(srvr, version, MSG_CODE_SEND_PUBLIC, msg);
+}
 
-        if (rc <= 0)
-                return rc;
+/*
+ * Send room request, to join or leave it
+ */
+int send_room_request(const int srvr, const int version, const int8_t code,
+                      const char *const room)
+{
+        assert(room != NULL);
 
-        return msg_send_text(sfd, msg, size);
+        return send_msg(srvr, version, code, room);
 }
 
 /*
- * Send public message
+ * Send room message
  */
-int send_public_message(const int srvr, const char *const msg)
+int send_room_message(const int srvr, const int version,
+                      const char *const room, const char *const msg)
 {
+        struct msg_field fields[2];
+
+        assert(room != NULL);
         assert(msg != NULL);
 
-        return send_msg(srvr, MSG_CODE_SEND_PUBLIC, msg);
+        fields[0].data = room;
+        fields[0].size = strlen(room);
+        fields[1].data = msg;
+        fields[1].size = strlen(msg);
+
+        if ((fields[0].size == 0) || (fields[1].size == 0))
+                return 0;
+
+        return msg_send_frame(srvr, version, MSG_CODE_SEND_ROOM, fields, 2);
+}
+
+/*
+ * Send heartbeat, or the answer to one
+ */
+int send_heartbeat(const int srvr, const int version, const int8_t code,
+                   const uint32_t word)
+{
+        struct msg_field field;
+        uint32_t net_word = htonl(word);
+
+        field.data = &net_word;
+        field.size = sizeof(uint32_t);
+
+        return msg_send_frame(srvr, version, code, &field, 1);
+}
+
+/*
+ * Send file offer, with version 2
+ */
+int send_file_offer(const int srvr, const uint32_t id, const uint32_t size,
+                    const char *const name)
+{
+        struct msg_field fields[3];
+        uint32_t net_id = htonl(id);
+        uint32_t net_size = htonl(size);
+
+        assert(name != NULL);
+
+        fields[0].data = &net_id;
+        fields[0].size = sizeof(uint32_t);
+        fields[1].data = &net_size;
+        fields[1].size = sizeof(uint32_t);
+        fields[2].data = name;
+        fields[2].size = strlen(name);
+
+        return msg_send_frame(srvr, MSG_V2, MSG_CODE_FILE_OFFER, fields, 3);
+}
+
+/*
+ * Send file chunk, copied by the kernel from the file to the server
+ */
+int send_file_chunk(const int srvr, const uint32_t id, const int fd,
+                    off_t *const offset, const size_t count)
+{
+        struct msg_field field;
+        uint32_t net_id = htonl(id);
+
+        field.data = &net_id;
+        field.size = sizeof(uint32_t);
+
+        return msg_send_file(srvr, MSG_CODE_FILE_DATA, &field, 1, fd, offset,
+                             count);
+}
+
+/*
+ * Send file status, giving up a transfer, with version 2
+ */
+int send_file_status(const int srvr, const uint32_t id, const int8_t status)
+{
+        struct msg_field fields[2];
+        uint32_t net_id = htonl(id);
+
+        fields[0].data = &net_id;
+        fields[0].size = sizeof(uint32_t);
+        fields[1].data = &status;
+        fields[1].size = sizeof(int8_t);
+
+        return msg_send_frame(srvr, MSG_V2, MSG_CODE_FILE_STATUS, fields, 2);
+}
+
+/*
+ * Send public messages in a single batch
+ */
+int send_public_batch(const int srvr, char *const *const msgs,
+                      const int nmsgs)
+{
+        struct msg_buf *bufs[SOCK_MAXBATCH];
+        struct msg_buf *batch;
+        struct msg_field field;
+        int i, n = 0, rc = -1;
+
+        assert(nmsgs <= SOCK_MAXBATCH);
+
+        for (i = 0; i < nmsgs; ++i) {
+                field.data = msgs[i];
+                field.size = strlen(msgs[i]);
+
+                if (field.size == 0)
+                        continue;
+
+                bufs[n] = msg_buf_encode(NULL, MSG_V2, MSG_CODE_SEND_PUBLIC,
+                                         &field, 1);
+
+                if (bufs[n] == NULL)
+                        break;
+
+                ++n;
+        }
+
+        if ((i == nmsgs) && (n == 0)) {
+                rc = 0;
+        } else if (i == nmsgs) {
+                /* A single message needs no batch */
+                if (n == 1)
+                        batch = msg_buf_ref(bufs[0]);
+                else
+                        batch = msg_buf_batch(NULL, bufs, n);
+
+                if (batch != NULL) {
+                        rc = msg_send_buf(srvr, batch);
+                        msg_buf_free(batch);
+                }
+        }
+
+        for (i = 0; i < n; ++i)
+                msg_buf_free(bufs[i]);
+
+        return rc;
 }
 
 /*
- * Send private message
+ * Send private message, relayed by the server or sent to the peer
  */
-int send_private_message(const int clnt, const char *const msg)
+int send_private_message(const int srvr, const int version,
+                         const char *const name, const char *const msg)
 {
+        struct msg_field fields[2];
+
+        assert(name != NULL);
         assert(msg != NULL);
 
-        return send_msg(clnt, MSG_CODE_DM, msg);
+        fields[0].data = name;
+        fields[0].size = strlen(name);
+        fields[1].data = msg;
+        fields[1].size = strlen(msg);
+
+        if ((fields[0].size == 0) || (fields[1].size == 0))
+                return 0;
+
+        return msg_send_frame(srvr, version, MSG_CODE_DM, fields, 2);
+}
+
+/*
+ * Receive peer address, IPv4 or IPv6
+ */
+int recv_peer_addr(const struct msg_frame *const frame, char *const host,
+                   char *const service)
+{
+        uint32_t port;
+        int af;
+
+        assert(frame->code == MSG_CODE_DM_CONNECT);
+
+        if (frame->size[1] == sizeof(struct in_addr))
+                af = AF_INET;
+        else if (frame->size[1] == sizeof(struct in6_addr))
+                af = AF_INET6;
+        else
+                return -1;
+
+        if (inet_ntop(af, frame->field[1], host, INET6_ADDRSTRLEN) == NULL)
+                return -1;
+
+        memcpy(&port, frame->field[2], sizeof(uint32_t));
+        port = ntohl(port);
+
+        if ((port == 0) || (port > UINT16_MAX))
+                return -1;
+
+        sprintf(service, "%u", port);
+
+        return 0;
 }
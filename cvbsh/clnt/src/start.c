@@ -52,16 +52,7 @@ _Noreturn static void usage(const char *const progname, const int status)
  */
 int main(const int argc, const char *const argv[])
 {
-        struct clnt clnt = {
-                CMD_INIT,
-                "",
-                "",
-                FDLIST_INIT,
-                FDMAP_INIT,
-                NULL,
-                -1,
-                -1
-        };
+        struct clnt clnt = CLNT_INIT;
 
         if (argc != 3)
                 usage(argv[0], EXIT_FAILURE);
@@ -81,21 +72,14 @@ int main(const int argc, const char *const argv[])
                 exit(EXIT_FAILURE);
         }
 
-        clnt.srvr = net_fetch_socket(argv[1], argv[2]);
+        clnt.srvr = net_fetch_socket(argv[1], argv[2], 0);
 
         if (clnt.srvr == -1) {
                 log_fatal("[start] Failed to connect to the server");
                 exit(EXIT_FAILURE);
         }
 
-        /* Can be performed later (when incomming request) */
-        /* clnt.listener = net_fetch_next();
-
-        if (clnt.listener == -1) {
-                log_fatal("[start] Failed to fetch a socket");
-                exit(EXIT_FAILURE);
-        } */
-
+        /* The listener is opened for the first peer */
         clnt_run(&clnt);
 
         return EXIT_SUCCESS;
@@ -0,0 +1,85 @@
+/*
+ * CVB server rooms
+ *
+ * Copyright (c) 2025 Antoni Blanche
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the “Software”), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#ifndef ROOM_H
+#define ROOM_H
+
+#include <cvb/intern.h>
+
+/*
+ * Room table initializer
+ */
+#define ROOMTAB_INIT {NULL, 0, 0, NULL}
+
+/*
+ * Chat room, its members stored contiguously by file descriptor
+ */
+struct room {
+        struct istr *name;
+        int *fds;
+        int nfds;
+        int size;
+};
+
+/*
+ * Room membership of a session
+ */
+struct member {
+        struct istr *room;
+        int pos;
+};
+
+/*
+ * Room table
+ *
+ * Rooms are found from their interned name by open addressing, and removed
+ * once empty. Pointers to rooms are only valid until the next join or leave.
+ */
+struct roomtab {
+        struct room *rooms;
+        int nslots;
+        int count;
+        struct itab *names;
+};
+
+/*
+ * Get a room
+ */
+struct room *room_get(const struct roomtab *rt, const struct istr *name);
+
+/*
+ * Add a member to a room, created if needed, and get its position
+ */
+int room_join(struct roomtab *rt, struct istr *name, int fd);
+
+/*
+ * Remove a member from a room, and get the member moved in its place
+ */
+int room_leave(struct roomtab *rt, const struct istr *name, int pos);
+
+/*
+ * Room table destroyer
+ */
+void room_destroy(struct roomtab *rt);
+
+#endif /* room.h */
@@ -0,0 +1,152 @@
+/*
+ * CVB server sessions
+ *
+ * Copyright (c) 2025 Antoni Blanche
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the “Software”), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#ifndef SESS_H
+#define SESS_H
+
+#include <stdint.h>
+
+#include <sys/socket.h>
+
+#include <cvb/intern.h>
+#include <cvb/msg.h>
+#include <cvb/msgq.h>
+
+#include "room.h"
+
+/*
+ * Session table initializer
+ */
+#define SESSTAB_INIT {NULL, NULL, NULL, 0, 0, 0, NULL}
+
+/*
+ * Maximum number of sessions reserved ahead, the table grows beyond
+ */
+#define SESS_MAXRESERVE 4096
+
+/*
+ * Session states
+ */
+#define SESS_CONNECTED 0
+#define SESS_AUTHED    1
+#define SESS_CLOSING   2
+
+/*
+ * Session flags
+ */
+#define SESS_HELLO 1
+
+/*
+ * File uploaded by a client
+ */
+struct upload {
+        char *path;
+        uint32_t id;
+        uint32_t size;
+        uint32_t done;
+        uint32_t granted;
+        int fd;
+};
+
+/*
+ * Client session, data used on every message
+ */
+struct sess {
+        int fd;
+        int state;
+        int flags;
+        int version;
+        uint32_t caps;
+        long last;
+        struct msgq outq;
+        struct msg_reader rd;
+};
+
+/*
+ * Client session, data rarely used
+ */
+struct sess_info {
+        struct istr *name;
+        uint32_t id;
+        struct sockaddr_storage addr;
+        socklen_t addrlen;
+        struct msg_codec *codec;
+        struct idle *idle;
+        struct member *rooms;
+        int nrooms;
+        int roomsize;
+        struct upload *uploads;
+        int nuploads;
+        long srtt;
+        long rttvar;
+};
+
+/*
+ * Session table
+ *
+ * Sessions are stored contiguously, hot and cold data in two parallel arrays,
+ * and found from their file descriptor through an index. Closing a session
+ * moves the last one in its place, so pointers to sessions are only valid
+ * until the next open or close.
+ */
+struct sesstab {
+        struct sess *sess;
+        struct sess_info *info;
+        int *index;
+        int nsess;
+        int size;
+        int nindex;
+        struct itab *names;
+};
+
+/*
+ * Reserve room for sessions
+ */
+int sess_reserve(struct sesstab *st, int size);
+
+/*
+ * Open a session
+ */
+struct sess *sess_open(struct sesstab *st, int fd);
+
+/*
+ * Get a session
+ */
+struct sess *sess_get(const struct sesstab *st, int fd);
+
+/*
+ * Get the cold data of a session
+ */
+struct sess_info *sess_info(const struct sesstab *st, const struct sess *sess);
+
+/*
+ * Close a session
+ */
+void sess_close(struct sesstab *st, int fd);
+
+/*
+ * Session table destroyer
+ */
+void sess_destroy(struct sesstab *st);
+
+#endif /* sess.h */
@@ -24,20 +24,159 @@
 #ifndef SRVR_H
 #define SRVR_H
 
+#include <pthread.h>
 #include <stdio.h>
 
-#include <cvb/fdlist.h>
+#include <cvb/evloop.h>
 #include <cvb/fdmap.h>
+#include <cvb/intern.h>
+#include <cvb/msg.h>
+#include <cvb/slab.h>
+#include <cvb/timer.h>
+
+#include "room.h"
+#include "sess.h"
+
+/*
+ * Slow consumer policies
+ */
+#define SRVR_POLICY_DROP       0
+#define SRVR_POLICY_COALESCE   1
+#define SRVR_POLICY_DISCONNECT 2
+
+/*
+ * Default output queue limits
+ */
+#define SRVR_QBYTES  (1 << 20)
+#define SRVR_QFRAMES 4096
+
+/*
+ * Features supported by the server
+ */
+#define SRVR_CAPS (MSG_CAP_BATCH | MSG_CAP_DEFLATE | MSG_CAP_SENDERID \
+                   | MSG_CAP_PING | MSG_CAP_FILE)
+
+/*
+ * Default silence before pinging and before closing a client, in seconds
+ */
+#define SRVR_IDLE    30
+#define SRVR_TIMEOUT 90
+
+/*
+ * Period of the slow and silent clients counters report, in seconds
+ */
+#define SRVR_STATS 60
+
+/*
+ * Maximum number of rooms joined by a client
+ */
+#define SRVR_MAXROOMS 256
+
+/*
+ * Default directory of uploaded files, with a directory per client, only used
+ * if owned by the server user and not writable by others
+ */
+#define SRVR_FILES "/tmp/cvb_files"
+
+/*
+ * Maximum number of files uploaded at once by a client, and bytes granted to
+ * each of them ahead of their writing
+ */
+#define SRVR_MAXFILES 8
+#define SRVR_WINDOW   (256 * 1024)
+
+/*
+ * Broadcast slots, one per protocol version, then one for batching clients,
+ * for clients knowing senders by identifier, and for both
+ */
+#define SRVR_NSLOTS        (MSG_NVERSIONS + 3)
+#define SRVR_SLOT_BATCH    MSG_NVERSIONS
+#define SRVR_SLOT_ID       (MSG_NVERSIONS + 1)
+#define SRVR_SLOT_BATCH_ID (MSG_NVERSIONS + 2)
+
+/*
+ * Server structure initializer
+ */
+#define SRVR_INIT {NULL, 0, PTHREAD_MUTEX_INITIALIZER, FDMAP_INIT, ITAB_INIT, \
+                   NULL, NULL, 0, 0, SRVR_QBYTES, SRVR_QFRAMES, \
+                   SRVR_POLICY_DROP, SRVR_IDLE * 1000L, SRVR_TIMEOUT * 1000L, \
+                   SRVR_FILES, 0, 0, 0, 0, 0, TIMER_INIT, 0, NULL}
+
+/*
+ * Message forwarded between reactors, to all clients, to the members of a
+ * room, or to a single client
+ */
+struct fwd {
+        struct fwd *next;
+        struct msg_buf *bufs[SRVR_NSLOTS];
+        struct istr *room;
+        struct istr *to;
+        int fd;
+        struct slab *slab;
+};
+
+/*
+ * Client silence timer
+ */
+struct idle {
+        struct timer timer;
+        struct reactor *rct;
+        int fd;
+};
+
+/*
+ * Reactor structure (one per thread)
+ */
+struct reactor {
+        struct evloop evl;
+        struct sesstab sess;
+        struct roomtab rooms;
+        struct msg_pool pool;
+        struct slab fwds;
+        struct slab idles;
+        struct timerwheel tw;
+        long now;
+        pthread_mutex_t lock;
+        struct fwd *inbox;
+        struct fwd **inbox_tail;
+        struct msg_buf **batch;
+        struct msg_buf **batchid;
+        int nbatch;
+        int batchsize;
+        struct srvr *srvr;
+        pthread_t thread;
+        int listener;
+        int efd;
+        int stop;
+};
 
 /*
  * Server structure
  */
 struct srvr {
-        struct fdlist fdl;
+        struct reactor *rct;
+        int nrct;
+        pthread_mutex_t lock;
         struct fdmap fdm;
+        struct itab names;
+        struct reactor **owner;
+        uint32_t *ids;
+        int nowner;
+        uint32_t nextid;
+        size_t qbytes;
+        size_t qframes;
+        int policy;
+        long idle;
+        long timeout;
+        const char *files;
+        unsigned long ndrop;
+        unsigned long ncoalesce;
+        unsigned long nkick;
+        unsigned long nidle;
+        unsigned long nreported;
+        struct timer stats;
+        int nbatching;
         FILE *log;
-        /* struct db_connect *dbc; */
-        int listener;
 };
 
 /*
@@ -45,11 +184,42 @@ struct srvr {
  */
 void srvr_set_logger(struct srvr *srvr, const char *pathname);
 
+/*
+ * Initialize server reactors
+ */
+int srvr_set_reactors(struct srvr *srvr, int nrct, int backend, int flags);
+
+/*
+ * Get a slow consumer policy from its name
+ */
+int srvr_policy(const char *name);
+
+/*
+ * Initialize client output queue limits
+ */
+void srvr_set_limits(struct srvr *srvr, size_t qbytes, size_t qframes,
+                     int policy);
+
+/*
+ * Initialize client silence timeouts
+ */
+void srvr_set_idle(struct srvr *srvr, long idle, long timeout);
+
+/*
+ * Initialize the directory of uploaded files
+ */
+int srvr_set_files(struct srvr *srvr, const char *dir);
+
 /*
  * Update server signal handler
  */
 int srvr_set_handler(void);
 
+/*
+ * Open a listening socket for each reactor
+ */
+int srvr_listen(struct srvr *srvr, const char *service);
+
 /*
  * Server loop
  */
@@ -0,0 +1,229 @@
+/*
+ * CVB server rooms
+ *
+ * Copyright (c) 2025 Antoni Blanche
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the “Software”), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include <assert.h>
+#include <stdlib.h>
+
+#include "room.h"
+
+/*
+ * Initial number of slots and members
+ */
+#define ROOM_NSLOTS 16
+#define ROOM_NFDS   4
+
+/*
+ * Find the slot of a room, or the free slot where it would be
+ */
+static int room_slot(const struct roomtab *const rt,
+                     const struct istr *const name)
+{
+        int mask = rt->nslots - 1;
+        int i = name->hash & mask;
+
+        /* Names are interned, compared by address */
+        while ((rt->rooms[i].name != NULL) && (rt->rooms[i].name != name))
+                i = (i + 1) & mask;
+
+        return i;
+}
+
+/*
+ * Grow the room table
+ */
+static int room_grow(struct roomtab *const rt)
+{
+        struct room *rooms = rt->rooms;
+        int nslots = rt->nslots;
+        int i;
+
+        rt->nslots = (nslots > 0) ? 2 * nslots : ROOM_NSLOTS;
+        rt->rooms = (struct room *) calloc(rt->nslots, sizeof(struct room));
+
+        if (rt->rooms == NULL) {
+                rt->rooms = rooms;
+                rt->nslots = nslots;
+
+                return -1;
+        }
+
+        for (i = 0; i < nslots; ++i) {
+                if (rooms[i].name != NULL)
+                        rt->rooms[room_slot(rt, rooms[i].name)] = rooms[i];
+        }
+
+        free(rooms);
+
+        return 0;
+}
+
+/*
+ * Free a slot, moving back the rooms probed past it
+ */
+static void room_remove(struct roomtab *const rt, int i)
+{
+        int mask = rt->nslots - 1;
+        int j = i;
+        int k;
+
+        for (;;) {
+                j = (j + 1) & mask;
+
+                if (rt->rooms[j].name == NULL)
+                        break;
+
+                k = rt->rooms[j].name->hash & mask;
+
+                /* Moved back unless its home slot lies between i and j */
+                if ((i <= j) ? ((i < k) && (k <= j)) : ((i < k) || (k <= j)))
+                        continue;
+
+                rt->rooms[i] = rt->rooms[j];
+                i = j;
+        }
+
+        rt->rooms[i].name = NULL;
+        rt->rooms[i].fds = NULL;
+        rt->rooms[i].nfds = 0;
+        rt->rooms[i].size = 0;
+        --rt->count;
+}
+
+/*
+ * Get a room
+ */
+struct room *room_get(const struct roomtab *const rt,
+                      const struct istr *const name)
+{
+        int i;
+
+        assert(rt != NULL);
+        assert(name != NULL);
+
+        if (rt->count == 0)
+                return NULL;
+
+        i = room_slot(rt, name);
+
+        return (rt->rooms[i].name != NULL) ? rt->rooms + i : NULL;
+}
+
+/*
+ * Add a member to a room, created if needed, and get its position
+ */
+int room_join(struct roomtab *const rt, struct istr *const name, const int fd)
+{
+        struct room *room;
+        int *fds;
+        int size;
+
+        assert(rt != NULL);
+        assert(name != NULL);
+
+        room = room_get(rt, name);
+
+        if (room == NULL) {
+                /* Kept at most three quarters full */
+                if ((4 * (rt->count + 1) > 3 * rt->nslots)
+                    && (room_grow(rt) != 0))
+                        return -1;
+
+                fds = (int *) malloc(ROOM_NFDS * sizeof(int));
+
+                if (fds == NULL)
+                        return -1;
+
+                room = rt->rooms + room_slot(rt, name);
+                room->name = istr_ref(name);
+                room->fds = fds;
+                room->nfds = 0;
+                room->size = ROOM_NFDS;
+                ++rt->count;
+        }
+
+        if (room->nfds == room->size) {
+                size = 2 * room->size;
+                fds = (int *) realloc(room->fds, size * sizeof(int));
+
+                if (fds == NULL)
+                        return -1;
+
+                room->fds = fds;
+                room->size = size;
+        }
+
+        room->fds[room->nfds] = fd;
+
+        return room->nfds++;
+}
+
+/*
+ * Remove a member from a room, and get the member moved in its place
+ */
+int room_leave(struct roomtab *const rt, const struct istr *const name,
+               const int pos)
+{
+        struct room *room = room_get(rt, name);
+        int moved = -1;
+
+        assert(room != NULL);
+        assert((pos >= 0) && (pos < room->nfds));
+
+        --room->nfds;
+
+        if (pos != room->nfds) {
+                room->fds[pos] = room->fds[room->nfds];
+                moved = room->fds[pos];
+        }
+
+        if (room->nfds == 0) {
+                free(room->fds);
+                itab_release(rt->names, room->name);
+                room_remove(rt, room - rt->rooms);
+        }
+
+        return moved;
+}
+
+/*
+ * Room table destroyer
+ */
+void room_destroy(struct roomtab *const rt)
+{
+        int i;
+
+        assert(rt != NULL);
+
+        for (i = 0; i < rt->nslots; ++i) {
+                if (rt->rooms[i].name != NULL) {
+                        free(rt->rooms[i].fds);
+                        itab_release(rt->names, rt->rooms[i].name);
+                }
+        }
+
+        free(rt->rooms);
+
+        rt->rooms = NULL;
+        rt->nslots = 0;
+        rt->count = 0;
+}
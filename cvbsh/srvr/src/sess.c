@@ -0,0 +1,236 @@
+/*
+ * CVB server sessions
+ *
+ * Copyright (c) 2025 Antoni Blanche
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the “Software”), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include <assert.h>
+#include <stdlib.h>
+
+
+#include "sess.h"
+
+/*
+ * Session table padding
+ */
+#define PADDING 16
+
+/*
+ * Grow the file descriptor index
+ */
+static int sess_grow_index(struct sesstab *const st, int nindex)
+{
+        int *index;
+        int i;
+
+        if (nindex <= st->nindex)
+                return 0;
+
+        if (nindex < 2 * st->nindex)
+                nindex = 2 * st->nindex;
+
+        index = (int *) realloc(st->index, nindex * sizeof(int));
+
+        if (index == NULL)
+                return -1;
+
+        for (i = st->nindex; i < nindex; ++i)
+                index[i] = -1;
+
+        st->index = index;
+        st->nindex = nindex;
+
+        return 0;
+}
+
+/*
+ * Grow the session arrays
+ */
+static int sess_grow(struct sesstab *const st, int size)
+{
+        struct sess *sess;
+        struct sess_info *info;
+
+        if (size <= st->size)
+                return 0;
+
+        if (size < 2 * st->size)
+                size = 2 * st->size;
+
+        sess = (struct sess *) realloc(st->sess, size * sizeof(struct sess));
+
+        if (sess == NULL)
+                return -1;
+
+        st->sess = sess;
+
+        info = (struct sess_info *) realloc(st->info,
+                                            size * sizeof(struct sess_info));
+
+        if (info == NULL)
+                return -1;
+
+        st->info = info;
+        st->size = size;
+
+        return 0;
+}
+
+/*
+ * Reserve room for sessions
+ */
+int sess_reserve(struct sesstab *const st, const int size)
+{
+        assert(st != NULL);
+        assert(size > 0);
+
+        if ((sess_grow(st, size) != 0) || (sess_grow_index(st, size) != 0))
+                return -1;
+
+        return 0;
+}
+
+/*
+ * Open a session
+ */
+struct sess *sess_open(struct sesstab *const st, const int fd)
+{
+        struct sess *sess;
+        struct sess_info *info;
+
+        assert(st != NULL);
+        assert(fd >= 0);
+
+        if ((sess_grow_index(st, fd + PADDING) != 0)
+            || (sess_grow(st, st->nsess + 1) != 0))
+                return NULL;
+
+        assert(st->index[fd] == -1);
+
+        sess = st->sess + st->nsess;
+        sess->fd = fd;
+        sess->state = SESS_CONNECTED;
+        sess->flags = 0;
+        sess->version = MSG_V1;
+        sess->caps = MSG_CAP_NONE;
+        sess->last = 0;
+        sess->outq = (struct msgq) MSGQ_INIT;
+        sess->rd = (struct msg_reader) MSG_READER_INIT;
+
+        info = st->info + st->nsess;
+        info->name = NULL;
+        info->id = 0;
+        info->addrlen = 0;
+        info->codec = NULL;
+        info->idle = NULL;
+        info->rooms = NULL;
+        info->nrooms = 0;
+        info->roomsize = 0;
+        info->uploads = NULL;
+        info->nuploads = 0;
+        info->srtt = -1;
+        info->rttvar = 0;
+
+        st->index[fd] = st->nsess;
+        ++st->nsess;
+
+        return sess;
+}
+
+/*
+ * Get a session
+ */
+struct sess *sess_get(const struct sesstab *const st, const int fd)
+{
+        assert(st != NULL);
+
+        if ((fd < 0) || (fd >= st->nindex) || (st->index[fd] == -1))
+                return NULL;
+
+        return st->sess + st->index[fd];
+}
+
+/*
+ * Get the cold data of a session
+ */
+struct sess_info *sess_info(const struct sesstab *const st,
+                            const struct sess *const sess)
+{
+        assert(st != NULL);
+        assert(sess != NULL);
+
+        return st->info + (sess - st->sess);
+}
+
+/*
+ * Close a session
+ */
+void sess_close(struct sesstab *const st, const int fd)
+{
+        struct sess *sess = sess_get(st, fd);
+        int i, last;
+
+        if (sess == NULL)
+                return;
+
+        i = sess - st->sess;
+        last = st->nsess - 1;
+
+        msg_reader_destroy(&(sess->rd));
+        mq_destroy(&(sess->outq));
+        itab_release(st->names, st->info[i].name);
+
+        if (st->info[i].codec != NULL) {
+                msg_codec_destroy(st->info[i].codec);
+                free(st->info[i].codec);
+        }
+
+        /* Rooms are left before, by the owner of the room table */
+        free(st->info[i].rooms);
+
+        /* Uploads are closed before, by the reactor */
+        free(st->info[i].uploads);
+
+        if (i != last) {
+                st->sess[i] = st->sess[last];
+                st->info[i] = st->info[last];
+                st->index[st->sess[i].fd] = i;
+        }
+
+        st->index[fd] = -1;
+        --st->nsess;
+}
+
+/*
+ * Session table destroyer
+ */
+void sess_destroy(struct sesstab *const st)
+{
+        assert(st != NULL);
+
+        while (st->nsess > 0)
+                sess_close(st, st->sess[st->nsess - 1].fd);
+
+        free(st->sess);
+        free(st->info);
+        free(st->index);
+
+        *st = (struct sesstab) SESSTAB_INIT;
+}
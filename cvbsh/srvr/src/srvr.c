@@ -22,26 +22,35 @@
  * SOFTWARE.
  */
 #include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
 #include <netdb.h>
 #include <signal.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
+#include <arpa/inet.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+
 #include <cvb/logger.h>
 #include <cvb/msg.h>
+#include <cvb/msgq.h>
 #include <cvb/net.h>
 
 #include "srvr.h"
-#include "cvb/fdmap.h"
 
 /*
  * Initialize server logger
  */
 void srvr_set_logger(struct srvr *const srvr, const char *const pathname)
 {
-       srvr->log = fopen(pathname, "w");
+        srvr->log = fopen(pathname, "w");
 
         if (srvr->log != NULL)
                 log_callback(&file_callback, srvr->log, LOG_DEBUG);
@@ -51,12 +60,221 @@ void srvr_set_logger(struct srvr *const srvr, const char *const pathname)
         log_debug("[srvr] Logging level set to %s", log_level(LOG_INFO));
 }
 
+/*
+ * Initialize a reactor
+ */
+static int srvr_init_reactor(struct srvr *const srvr,
+                             struct reactor *const rct, const int backend,
+                             const int flags, const int reserve)
+{
+        rct->evl = (struct evloop) EVLOOP_INIT;
+        rct->sess = (struct sesstab) SESSTAB_INIT;
+        rct->sess.names = &(srvr->names);
+        rct->rooms = (struct roomtab) ROOMTAB_INIT;
+        rct->rooms.names = &(srvr->names);
+        rct->tw = (struct timerwheel) TIMERWHEEL_INIT;
+        rct->now = 0;
+        rct->inbox = NULL;
+        rct->inbox_tail = &(rct->inbox);
+        rct->batch = NULL;
+        rct->batchid = NULL;
+        rct->nbatch = 0;
+        rct->batchsize = 0;
+        rct->srvr = srvr;
+        rct->listener = -1;
+        rct->stop = 0;
+
+        if ((pthread_mutex_init(&(rct->lock), NULL) != 0)
+            || (tw_init(&(rct->tw), TW_TICK) != 0))
+                return -1;
+
+        /* Messages and forwards are recycled, not allocated per message */
+        if ((msg_pool_init(&(rct->pool), flags) != 0)
+            || (slab_init(&(rct->fwds), sizeof(struct fwd), flags) != 0)
+            || (slab_init(&(rct->idles), sizeof(struct idle), 0) != 0))
+                return -1;
+
+        /* Most connections never reallocate the session table */
+        if (sess_reserve(&(rct->sess), reserve) != 0)
+                log_warn("[srvr] sess_reserve(): %s", strerror(errno));
+
+        rct->efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+        if (rct->efd < 0) {
+                log_error("[srvr] eventfd(): %s", strerror(errno));
+
+                return -1;
+        }
+
+        if (evl_init(&(rct->evl), backend) != 0) {
+                log_warn("[srvr] evl_init(): %s, falling back to epoll",
+                         strerror(errno));
+
+                if (evl_init(&(rct->evl), EVL_BACKEND_EPOLL) != 0)
+                        return -1;
+        }
+
+        if (evl_add(&(rct->evl), rct->efd, POLLIN) != 0) {
+                log_error("[srvr] evl_add(): %s", strerror(errno));
+
+                return -1;
+        }
+
+        return 0;
+}
+
+/*
+ * Get the number of sessions reserved by each reactor
+ */
+static int srvr_reserve(const int nrct)
+{
+        struct rlimit rlim;
+        rlim_t size = SESS_MAXRESERVE;
+
+        /* Connections are spread over the reactors by the kernel */
+        if ((getrlimit(RLIMIT_NOFILE, &rlim) == 0)
+            && (rlim.rlim_cur != RLIM_INFINITY)
+            && (rlim.rlim_cur / nrct < size))
+                size = rlim.rlim_cur / nrct;
+
+        return (size > 0) ? (int) size : 1;
+}
+
+/*
+ * Initialize server reactors
+ */
+int srvr_set_reactors(struct srvr *const srvr, const int nrct,
+                      const int backend, const int flags)
+{
+        int reserve = srvr_reserve(nrct);
+
+        srvr->rct = (struct reactor *) calloc(nrct, sizeof(struct reactor));
+
+        if (srvr->rct == NULL) {
+                log_error("[srvr] calloc(): %s", strerror(errno));
+
+                return -1;
+        }
+
+        for (srvr->nrct = 0; srvr->nrct < nrct; ++srvr->nrct) {
+                if (srvr_init_reactor(srvr, srvr->rct + srvr->nrct,
+                                      backend, flags, reserve) != 0)
+                        return -1;
+        }
+
+        log_debug("[srvr] Reserved %d sessions per reactor", reserve);
+
+        log_info("[srvr] Using %d reactor(s) with %s event backend",
+                 srvr->nrct, evl_name(&(srvr->rct->evl)));
+
+        return 0;
+}
+
+/*
+ * Get a slow consumer policy from its name
+ */
+int srvr_policy(const char *const name)
+{
+        if (strcmp(name, "drop") == 0)
+                return SRVR_POLICY_DROP;
+
+        if (strcmp(name, "coalesce") == 0)
+                return SRVR_POLICY_COALESCE;
+
+        if (strcmp(name, "disconnect") == 0)
+                return SRVR_POLICY_DISCONNECT;
+
+        return -1;
+}
+
+/*
+ * Initialize client output queue limits
+ */
+void srvr_set_limits(struct srvr *const srvr, const size_t qbytes,
+                     const size_t qframes, const int policy)
+{
+        srvr->qbytes = qbytes;
+        srvr->qframes = qframes;
+        srvr->policy = policy;
+
+        log_debug("[srvr] Output queues limited to %lu bytes and %lu frames",
+                  (unsigned long) qbytes, (unsigned long) qframes);
+}
+
+/*
+ * Initialize client silence timeouts
+ */
+void srvr_set_idle(struct srvr *const srvr, const long idle,
+                   const long timeout)
+{
+        srvr->idle = idle;
+        srvr->timeout = timeout;
+
+        log_debug("[srvr] Silent clients pinged after %ld ms, closed after "
+                  "%ld ms", idle, timeout);
+}
+
+/*
+ * Initialize the directory of uploaded files
+ *
+ * The directory may have been created beforehand, by another user in /tmp for
+ * instance. It is only used if no one else can write to it.
+ */
+int srvr_set_files(struct srvr *const srvr, const char *const dir)
+{
+        struct stat st;
+
+        if ((mkdir(dir, 0755) != 0) && (errno != EEXIST)) {
+                log_error("[srvr] mkdir(): %s", strerror(errno));
+
+                return -1;
+        }
+
+        if (lstat(dir, &st) != 0) {
+                log_error("[srvr] lstat(): %s", strerror(errno));
+
+                return -1;
+        }
+
+        if (!S_ISDIR(st.st_mode) || (st.st_uid != geteuid())
+            || (st.st_mode & (S_IWGRP | S_IWOTH))) {
+                log_error("[srvr] '%s' is not a directory writable by the "
+                          "server only", dir);
+                errno = EPERM;
+
+                return -1;
+        }
+
+        srvr->files = dir;
+
+        log_debug("[srvr] Uploaded files stored in '%s'", dir);
+
+        return 0;
+}
+
+/*
+ * Set by SIGINT, polled by the first reactor
+ */
+static volatile sig_atomic_t srvr_quit = 0;
+
+/*
+ * Event file descriptor of the first reactor, written by SIGINT
+ */
+static volatile sig_atomic_t srvr_quitfd = -1;
+
 /*
  * Server SIGINT handler
  */
-_Noreturn static void srvr_handler(__attribute__((unused)) int signal)
+static void srvr_handler(__attribute__((unused)) int signal)
 {
-        exit(EXIT_SUCCESS);
+        uint64_t one = 1;
+        int err = errno;
+
+        srvr_quit = 1;
+
+        /* Wakes the first reactor up, the loop exits on its own */
+        if ((srvr_quitfd > -1) && (write(srvr_quitfd, &one, sizeof(one)) < 0))
+                errno = err;
 }
 
 /*
@@ -75,183 +293,2055 @@ int srvr_set_handler(void)
         return sigaction(SIGINT, &act, NULL);
 }
 
+/*
+ * Open a listening socket for each reactor
+ */
+int srvr_listen(struct srvr *const srvr, const char *const service)
+{
+        int flags = 0;
+        int i;
+
+        /* A single listener keeps the port to itself */
+        if (srvr->nrct > 1)
+                flags = NET_REUSEPORT;
+
+        for (i = 0; i < srvr->nrct; ++i) {
+                srvr->rct[i].listener = net_fetch_socket(NULL, service, flags);
+
+                if (srvr->rct[i].listener == -1)
+                        return -1;
+
+                if (evl_add(&(srvr->rct[i].evl), srvr->rct[i].listener,
+                            POLLIN) != 0) {
+                        log_error("[srvr] evl_add(): %s", strerror(errno));
+
+                        return -1;
+                }
+        }
+
+        return 0;
+}
+
+/*
+ * Wake up a reactor
+ */
+static void srvr_wakeup(struct reactor *const rct)
+{
+        uint64_t one = 1;
+
+        if (write(rct->efd, &one, sizeof(uint64_t)) < 0)
+                log_warn("[srvr] write(): %s", strerror(errno));
+}
+
+/*
+ * Check a client for silence, then ping or close it
+ */
+static void srvr_idle(void *arg);
+
 /*
  * Accept a new connection from a client
  */
-static void srvr_connect(struct srvr *const srvr, const int sfd)
+static void srvr_connect(struct reactor *const rct, const int sfd)
 {
+        struct sess *sess;
+        struct sess_info *info;
+        struct idle *idle;
         int clnt;
 
         log_debug("[srvr] Incoming connection request");
 
         clnt = net_accept_clnt(sfd);
 
-        if (clnt != -1) {
-                if (fdl_add(&(srvr->fdl), clnt, POLLIN) != 0)
-                        log_error("[srvr] fdl_add(): %s", strerror(errno));
-                else
-                        log_debug("[srvr] New client connected");
+        if (clnt == -1)
+                return;
+
+        sess = sess_open(&(rct->sess), clnt);
+
+        if (sess == NULL) {
+                log_error("[srvr] sess_open(): %s", strerror(errno));
+                close(clnt);
+        } else if (evl_add(&(rct->evl), clnt, POLLIN) != 0) {
+                log_error("[srvr] evl_add(): %s", strerror(errno));
+                sess_close(&(rct->sess), clnt);
+                close(clnt);
+        } else {
+                info = sess_info(&(rct->sess), sess);
+                info->addrlen = sizeof(struct sockaddr_storage);
+
+                if (getpeername(clnt, (struct sockaddr *) &(info->addr),
+                                &(info->addrlen)) != 0)
+                        info->addrlen = 0;
+
+                /* Clients without heartbeats are left to the system */
+                net_keepalive(clnt, rct->srvr->idle / 1000);
+
+                sess->last = rct->now;
+                idle = (struct idle *) slab_alloc(&(rct->idles));
+
+                if (idle != NULL) {
+                        idle->rct = rct;
+                        idle->fd = clnt;
+                        tw_timer(&(idle->timer), &srvr_idle, idle);
+                        tw_add(&(rct->tw), &(idle->timer), rct->srvr->idle);
+                        info->idle = idle;
+                } else {
+                        log_warn("[srvr] slab_alloc(): %s", strerror(errno));
+                }
+
+                log_debug("[srvr] New client connected");
         }
 }
 
 /*
- * Send a message to all clients
+ * Apply the slow consumer policy to a client output queue
  */
-static void srvr_broadcast(struct srvr *const srvr, const char *const msg,
-                           const char *const name)
+static void srvr_limit(struct reactor *const rct, struct sess *const sess)
 {
-        nfds_t i;
+        struct srvr *srvr = rct->srvr;
+        struct msgq *mq = &(sess->outq);
 
-        for (i = 0; i < srvr->fdl.nfds; ++i) {
-                if (srvr->fdl.fds[i].fd != srvr->listener) {
-                        msg_send_code(srvr->fdl.fds[i].fd, MSG_CODE_RECV_PUBLIC);
-                        msg_send_text(srvr->fdl.fds[i].fd, msg, strlen(msg));
-                        msg_send_text(srvr->fdl.fds[i].fd, name, strlen(name));
+        while ((mq->bytes > srvr->qbytes) || (mq->count > srvr->qframes)) {
+                if ((srvr->policy == SRVR_POLICY_COALESCE)
+                    && ((mq_coalesce(mq, MSG_CODE_RECV_PUBLIC) == 0)
+                        || (mq_coalesce(mq, MSG_CODE_RECV_SENDER) == 0))) {
+                        __atomic_add_fetch(&(srvr->ncoalesce), 1,
+                                           __ATOMIC_RELAXED);
+                } else if ((srvr->policy != SRVR_POLICY_DISCONNECT)
+                           && ((mq_drop(mq, MSG_CODE_RECV_PUBLIC) == 0)
+                               || (mq_drop(mq, MSG_CODE_RECV_SENDER) == 0)
+                               || (mq_drop(mq, MSG_CODE_RECV_ROOM) == 0)
+                               || (mq_drop(mq, MSG_CODE_BATCH) == 0))) {
+                        __atomic_add_fetch(&(srvr->ndrop), 1,
+                                           __ATOMIC_RELAXED);
+                } else {
+                        log_warn("[srvr] Slow client, closing connection");
+                        __atomic_add_fetch(&(srvr->nkick), 1,
+                                           __ATOMIC_RELAXED);
+
+                        /* Closed on the next event, out of any client loop */
+                        mq_destroy(mq);
+                        sess->state = SESS_CLOSING;
+                        shutdown(sess->fd, SHUT_RDWR);
+
+                        return;
                 }
         }
+}
+
+/*
+ * Queue an encoded message for a client
+ */
+static int srvr_send(struct reactor *const rct, struct sess *const sess,
+                     struct msg_buf *const buf)
+{
+        if ((sess->state == SESS_CLOSING)
+            || (mq_push(&(sess->outq), buf) != 0)) {
+                msg_buf_free(buf);
+
+                return -1;
+        }
+
+        srvr_limit(rct, sess);
+
+        /* Watch for POLLOUT as long as the queue is not empty */
+        if ((sess->outq.count == 1) && (sess->state != SESS_CLOSING)
+            && (evl_mod(&(rct->evl), sess->fd, POLLIN | POLLOUT) != 0)) {
+                log_error("[srvr] evl_mod(): %s", strerror(errno));
+
+                return -1;
+        }
 
-        log_debug("[srvr] Message '%s' sent to all clients", msg);
+        return 0;
 }
 
 /*
- * Client request processing
+ * Get the broadcast slot of a client
  */
-static void srvr_recv(struct srvr *const srvr, int sfd)
+static int srvr_slot(const struct sess *const sess)
 {
-        char buf[MSG_BUFSIZ];
-        char *fdname;
-        /* int clnt_fd; */
-        int8_t code = msg_recv_code(sfd);
+        if (sess->caps & MSG_CAP_SENDERID)
+                return (sess->caps & MSG_CAP_BATCH) ? SRVR_SLOT_BATCH_ID
+                       : SRVR_SLOT_ID;
 
-        log_debug("[srvr] Incoming client request");
+        if (sess->caps & MSG_CAP_BATCH)
+                return SRVR_SLOT_BATCH;
 
-        switch (code) {
-        case MSG_CODE_SEND_NO_AUTH:
-        case MSG_CODE_SEND_AUTH: /* TODO (requires db) */
-                msg_recv_text(sfd, buf);
-                log_info("[srvr] Authentification request from '%s'", buf);
-                msg_send_code(sfd, MSG_CODE_RECV_AUTH);
+        return sess->version - 1;
+}
 
-                if (fdm_contains(&(srvr->fdm), buf) != -1) {
-                        msg_send_code(sfd, 2);
-                        log_debug("[srvr] Authentification failed");
-                } else {
-                        fdm_put(&(srvr->fdm), sfd, strdup(buf));
-                        msg_send_code(sfd, 0);
-                        log_debug("[srvr] Client authentified");
+/*
+ * Send a message encoded for each broadcast slot to the clients of a reactor,
+ * or only to the members of a room
+ */
+static void srvr_broadcast_local(struct reactor *const rct,
+                                 struct msg_buf *const *const bufs,
+                                 const struct istr *const name)
+{
+        struct room *room;
+        struct sess *sess;
+        struct msg_buf *buf;
+        int i;
+
+        if (name == NULL) {
+                for (i = 0; i < rct->sess.nsess; ++i) {
+                        buf = bufs[srvr_slot(rct->sess.sess + i)];
+
+                        /* Too large for the client, or sent later in a batch */
+                        if (buf != NULL)
+                                srvr_send(rct, rct->sess.sess + i,
+                                          msg_buf_ref(buf));
                 }
-                break;
 
-        case MSG_CODE_SEND_PUBLIC:
-                msg_recv_text(sfd, buf);
-                srvr_broadcast(srvr, buf, fdm_get(&(srvr->fdm), sfd));
-                break;
+                return;
+        }
 
-        /* case MSG_CODE_DM_REQUEST:
-                msg_recv_text(sfd, buf);
+        room = room_get(&(rct->rooms), name);
 
-                clnt_fd = fdm_contains(&(srvr->fdm), buf);
+        for (i = 0; (room != NULL) && (i < room->nfds); ++i) {
+                sess = sess_get(&(rct->sess), room->fds[i]);
+                buf = bufs[srvr_slot(sess)];
 
-                if (clnt_fd == -1) {
-                        msg_send_code(sfd, MSG_CODE_DM_STATUS);
-                        msg_send_text(sfd, buf, strlen(buf));
-                        msg_send_code(sfd, 0);
-                } else {
-                        fdname = fdm_get(&(srvr->fdm), sfd);
+                if (buf != NULL)
+                        srvr_send(rct, sess, msg_buf_ref(buf));
+        }
+}
 
-                        msg_send_code(sfd, MSG_CODE_DM_REQUEST);
-                        msg_send_text(sfd, fdname, strlen(fdname));
-                }
-                break;
+/*
+ * Send a message encoded for each broadcast slot to a single client of a
+ * reactor, unless its descriptor was given to another client meanwhile
+ */
+static int srvr_deliver(struct reactor *const rct,
+                        struct msg_buf *const *const bufs, const int fd,
+                        const struct istr *const to)
+{
+        struct sess *sess = sess_get(&(rct->sess), fd);
+        struct msg_buf *buf;
 
-        case MSG_CODE_DM_STATUS:
-                msg_recv_text(sfd, buf);
+        if ((sess == NULL) || (sess->state != SESS_AUTHED)
+            || (sess_info(&(rct->sess), sess)->name != to))
+                return -1;
 
-                clnt_fd = fdm_contains(&(srvr->fdm), buf);
+        buf = bufs[srvr_slot(sess)];
 
-                if (clnt_fd == -1) {
-                        msg_send_code(sfd, MSG_CODE_DM_STATUS);
-                        msg_send_text(sfd, buf, strlen(buf));
-                        msg_send_code(sfd, 0);
-                } else {
-                        fdname = fdm_get(&(srvr->fdm), sfd);
+        if (buf == NULL)
+                return -1;
 
-                        msg_send_code(sfd, MSG_CODE_DM_REQUEST);
-                        msg_send_text(sfd, fdname, strlen(fdname));
-                }
-                break; */
+        return srvr_send(rct, sess, msg_buf_ref(buf));
+}
+
+/*
+ * Forward an encoded message to another reactor
+ */
+static void srvr_forward(struct reactor *const from, struct reactor *const rct,
+                         struct msg_buf *const *const bufs,
+                         struct istr *const room, struct istr *const to,
+                         const int fd)
+{
+        struct fwd *fwd;
+        int i;
+
+        fwd = (struct fwd *) slab_alloc(&(from->fwds));
+
+        if (fwd == NULL) {
+                log_error("[srvr] slab_alloc(): %s", strerror(errno));
+
+                return;
+        }
+
+        fwd->next = NULL;
+        fwd->room = (room != NULL) ? istr_ref(room) : NULL;
+        fwd->to = (to != NULL) ? istr_ref(to) : NULL;
+        fwd->fd = fd;
+        fwd->slab = &(from->fwds);
+
+        for (i = 0; i < SRVR_NSLOTS; ++i)
+                fwd->bufs[i] = (bufs[i] != NULL) ? msg_buf_ref(bufs[i]) : NULL;
+
+        /* Appended in constant time, whatever the backlog */
+        pthread_mutex_lock(&(rct->lock));
+        *(rct->inbox_tail) = fwd;
+        rct->inbox_tail = &(fwd->next);
+        pthread_mutex_unlock(&(rct->lock));
+
+        srvr_wakeup(rct);
+}
 
-        case -1:
-                fdname = fdm_remove(&(srvr->fdm), sfd);
+/*
+ * Process messages forwarded by other reactors
+ */
+static void srvr_drain(struct reactor *const rct)
+{
+        struct fwd *fwd, *next;
+        uint64_t count;
+        int i;
+
+        if (read(rct->efd, &count, sizeof(uint64_t)) < 0)
+                return;
 
-                if (fdname != NULL)
-                        log_info("[srvr] Client '%s' disconnected", fdname);
+        pthread_mutex_lock(&(rct->lock));
+        fwd = rct->inbox;
+        rct->inbox = NULL;
+        rct->inbox_tail = &(rct->inbox);
+        pthread_mutex_unlock(&(rct->lock));
+
+        for (; fwd != NULL; fwd = next) {
+                next = fwd->next;
+
+                if (fwd->to != NULL)
+                        srvr_deliver(rct, fwd->bufs, fwd->fd, fwd->to);
                 else
-                        log_info("[srvr] Client disconnected");
+                        srvr_broadcast_local(rct, fwd->bufs, fwd->room);
 
-                fdl_remove(&(srvr->fdl), sfd);
-                free(fdname);
-                close(sfd);
-                break;
+                for (i = 0; i < SRVR_NSLOTS; ++i)
+                        msg_buf_free(fwd->bufs[i]);
 
-        default:
-                log_warn("[srvr] Unknown message code %hhd, ignored", code);
-                break;
+                itab_release(&(rct->srvr->names), fwd->room);
+                itab_release(&(rct->srvr->names), fwd->to);
+
+                slab_free(fwd->slab, fwd);
         }
 }
 
 /*
- * Server loop
+ * Send a message encoded for each broadcast slot to all clients, or only to
+ * the members of a room
+ *
+ * Each reactor knows the members of a room among its own clients only.
  */
-void srvr_run(struct srvr *const srvr)
+static void srvr_fanout(struct reactor *const rct,
+                        struct msg_buf *const *const bufs,
+                        struct istr *const room)
+{
+        struct srvr *srvr = rct->srvr;
+        int i;
+
+        srvr_broadcast_local(rct, bufs, room);
+
+        for (i = 0; i < srvr->nrct; ++i) {
+                if (srvr->rct + i != rct)
+                        srvr_forward(rct, srvr->rct + i, bufs, room, NULL,
+                                     -1);
+        }
+}
+
+/*
+ * Keep a message, named and identified, for the batches sent at the end of the
+ * loop iteration
+ */
+static int srvr_batch(struct reactor *const rct, struct msg_buf *const buf,
+                      struct msg_buf *const idbuf)
 {
-        struct pollfd *ifd;
-        int ready;
+        struct msg_buf **batch;
+        int size;
+
+        if (rct->nbatch == rct->batchsize) {
+                size = (rct->batchsize > 0) ? 2 * rct->batchsize : 64;
+                batch = (struct msg_buf **) realloc(rct->batch, size
+                                                    * sizeof(struct msg_buf *));
+
+                if (batch == NULL)
+                        return -1;
+
+                rct->batch = batch;
+                batch = (struct msg_buf **) realloc(rct->batchid, size
+                                                    * sizeof(struct msg_buf *));
 
-        if (fdl_add(&(srvr->fdl), srvr->listener, POLLIN) != 0) {
-                log_fatal("[srvr] fdl_add(): %s", strerror(errno));
-                exit(EXIT_FAILURE);
+                if (batch == NULL)
+                        return -1;
+
+                rct->batchid = batch;
+                rct->batchsize = size;
         }
 
-        for (;;) {
-                ready = poll(srvr->fdl.fds, srvr->fdl.nfds, -1);
+        rct->batch[rct->nbatch] = msg_buf_ref(buf);
+        rct->batchid[rct->nbatch] = msg_buf_ref(idbuf);
+        ++rct->nbatch;
 
-                if (ready < 0) {
-                        log_fatal("[srvr] poll(): %s", strerror(errno));
-                        exit(EXIT_FAILURE);
-                }
+        return 0;
+}
+
+/*
+ * Encode a batch of messages, or take the only one
+ */
+static struct msg_buf *srvr_pack(struct reactor *const rct,
+                                 struct msg_buf *const *const bufs,
+                                 const int nbufs)
+{
+        struct msg_buf *buf;
 
-                for (ifd = srvr->fdl.fds; ready > 0; ++ifd) {
-                        if (ifd->revents == POLLIN) {
-                                if (ifd->fd == srvr->listener)
-                                        srvr_connect(srvr, ifd->fd);
-                                else
-                                        srvr_recv(srvr, ifd->fd);
+        if (nbufs == 1)
+                return msg_buf_ref(bufs[0]);
 
-                                --ready;
-                        }
-                }
+        buf = msg_buf_batch(&(rct->pool), bufs, nbufs);
+
+        if (buf == NULL)
+                log_error("[srvr] msg_buf_batch(): %s", strerror(errno));
+
+        return buf;
+}
+
+/*
+ * Get the end of a batch starting at a message, holding at least this one
+ */
+static int srvr_span(struct msg_buf *const *const bufs, const int i,
+                     const int nbufs)
+{
+        size_t size = 0;
+        int j;
+
+        for (j = i; j < nbufs; ++j) {
+                size = size + bufs[j]->size;
+
+                if ((j > i) && (size > MSG_MAXSIZE - sizeof(uint32_t)))
+                        break;
         }
+
+        return j;
 }
 
 /*
- * Server destroyer
+ * Send the messages kept during the loop iteration to batching clients
  */
-void srvr_cleanup(__attribute__((unused)) int status, void *arg)
+static void srvr_publish(struct reactor *const rct)
 {
-        struct srvr *srvr = (struct srvr *) arg;
+        struct msg_buf *bufs[SRVR_NSLOTS] = {NULL};
+        int i, j;
 
-        log_info("[srvr] Clean up and exit");
+        for (i = 0; i < rct->nbatch; i = j) {
+                /* Identified messages are never larger than named ones */
+                j = srvr_span(rct->batch, i, rct->nbatch);
+                bufs[SRVR_SLOT_BATCH] = srvr_pack(rct, rct->batch + i, j - i);
+                bufs[SRVR_SLOT_BATCH_ID] = srvr_pack(rct, rct->batchid + i,
+                                                     j - i);
 
-        if (srvr->log != NULL)
-                fclose(srvr->log);
+                if ((bufs[SRVR_SLOT_BATCH] != NULL)
+                    || (bufs[SRVR_SLOT_BATCH_ID] != NULL))
+                        srvr_fanout(rct, bufs, NULL);
+
+                msg_buf_free(bufs[SRVR_SLOT_BATCH]);
+                msg_buf_free(bufs[SRVR_SLOT_BATCH_ID]);
+        }
+
+        for (i = 0; i < rct->nbatch; ++i) {
+                msg_buf_free(rct->batch[i]);
+                msg_buf_free(rct->batchid[i]);
+        }
+
+        rct->nbatch = 0;
+}
+
+/*
+ * Send a message to all clients
+ */
+static void srvr_broadcast(struct reactor *const rct, const char *const msg,
+                           const size_t len, const uint32_t id,
+                           const struct istr *const name)
+{
+        struct srvr *srvr = rct->srvr;
+        struct msg_field fields[2];
+        struct msg_buf *bufs[SRVR_NSLOTS];
+        uint32_t net_id = htonl(id);
+        int i;
+
+        fields[0].data = msg;
+        fields[0].size = len;
+        fields[1].data = name->str;
+        fields[1].size = name->len;
+
+        /* Encoded once per version, shared by every output queue */
+        for (i = 0; i < MSG_NVERSIONS; ++i)
+                bufs[i] = msg_buf_encode(&(rct->pool), i + 1,
+                                         MSG_CODE_RECV_PUBLIC, fields, 2);
+
+        fields[1].data = &net_id;
+        fields[1].size = sizeof(uint32_t);
+
+        bufs[SRVR_SLOT_ID] = msg_buf_encode(&(rct->pool), MSG_V2,
+                                            MSG_CODE_RECV_SENDER, fields, 2);
+
+        if ((bufs[MSG_V1 - 1] == NULL) && (bufs[MSG_V2 - 1] == NULL)) {
+                log_error("[srvr] msg_buf_encode(): %s", strerror(errno));
+                msg_buf_free(bufs[SRVR_SLOT_ID]);
+
+                return;
+        }
+
+        /* Batching clients get it at the end of the loop iteration */
+        if ((bufs[MSG_V2 - 1] != NULL) && (bufs[SRVR_SLOT_ID] != NULL)
+            && (__atomic_load_n(&(srvr->nbatching), __ATOMIC_RELAXED) > 0)
+            && (srvr_batch(rct, bufs[MSG_V2 - 1], bufs[SRVR_SLOT_ID]) == 0)) {
+                bufs[SRVR_SLOT_BATCH] = NULL;
+                bufs[SRVR_SLOT_BATCH_ID] = NULL;
+        } else {
+                bufs[SRVR_SLOT_BATCH] = bufs[MSG_V2 - 1];
+                bufs[SRVR_SLOT_BATCH_ID] = bufs[SRVR_SLOT_ID];
+        }
+
+        srvr_fanout(rct, bufs, NULL);
+
+        for (i = 0; i < MSG_NVERSIONS; ++i)
+                msg_buf_free(bufs[i]);
+
+        msg_buf_free(bufs[SRVR_SLOT_ID]);
+
+        log_debug("[srvr] Message '%.*s' sent to all clients", (int) len, msg);
+}
+
+/*
+ * Send a message to the members of a room
+ */
+static void srvr_roomcast(struct reactor *const rct, struct istr *const room,
+                          const struct msg_frame *const frame,
+                          const struct istr *const name)
+{
+        struct msg_field fields[3];
+        struct msg_buf *bufs[SRVR_NSLOTS];
+        int i;
+
+        fields[0].data = room->str;
+        fields[0].size = room->len;
+        fields[1].data = frame->field[1];
+        fields[1].size = frame->size[1];
+        fields[2].data = name->str;
+        fields[2].size = name->len;
 
-        /* if (srvr->dbc != NULL)
-                db_close(&(srvr->dbc)); */
+        for (i = 0; i < MSG_NVERSIONS; ++i)
+                bufs[i] = msg_buf_encode(&(rct->pool), i + 1,
+                                         MSG_CODE_RECV_ROOM, fields, 3);
 
-        if (srvr->fdl.fds != NULL)
-                fdl_destroy(&(srvr->fdl));
+        if ((bufs[MSG_V1 - 1] == NULL) && (bufs[MSG_V2 - 1] == NULL)) {
+                log_error("[srvr] msg_buf_encode(): %s", strerror(errno));
 
-        if (srvr->listener > -1)
-                close(srvr->listener);
+                return;
+        }
+
+        /* Named whatever the features, and never batched */
+        for (i = MSG_NVERSIONS; i < SRVR_NSLOTS; ++i)
+                bufs[i] = bufs[MSG_V2 - 1];
+
+        srvr_fanout(rct, bufs, room);
+
+        for (i = 0; i < MSG_NVERSIONS; ++i)
+                msg_buf_free(bufs[i]);
+
+        log_debug("[srvr] Message '%.*s' sent to room '%s'",
+                  (int) frame->size[1], frame->field[1], room->str);
+}
+
+/*
+ * Encode the binding of a sender identifier to its name
+ */
+static struct msg_buf *srvr_sender(struct reactor *const rct,
+                                   const uint32_t id, const char *const name)
+{
+        struct msg_field fields[2];
+        uint32_t net_id = htonl(id);
+
+        fields[0].data = &net_id;
+        fields[0].size = sizeof(uint32_t);
+        fields[1].data = name;
+        fields[1].size = strlen(name);
+
+        return msg_buf_encode(&(rct->pool), MSG_V2, MSG_CODE_SENDER, fields,
+                              2);
+}
+
+/*
+ * Announce a new sender to the clients knowing senders by identifier, or its
+ * departure with an empty name
+ */
+static void srvr_announce(struct reactor *const rct, const uint32_t id,
+                          const char *const name)
+{
+        struct msg_buf *bufs[SRVR_NSLOTS] = {NULL};
+        struct msg_buf *buf;
+
+        buf = srvr_sender(rct, id, name);
+
+        if (buf == NULL) {
+                log_error("[srvr] msg_buf_encode(): %s", strerror(errno));
+
+                return;
+        }
+
+        /* Sent before any message of the sender, batched or not */
+        bufs[SRVR_SLOT_ID] = buf;
+        bufs[SRVR_SLOT_BATCH_ID] = buf;
+
+        srvr_fanout(rct, bufs, NULL);
+        msg_buf_free(buf);
+}
+
+/*
+ * Answer a room, direct or public message request of a client, about the name
+ * or text it holds first
+ */
+static void srvr_status(struct reactor *const rct, struct sess *const sess,
+                        const int8_t code, const struct msg_frame *const frame,
+                        int8_t status)
+{
+        struct msg_field fields[2];
+        struct msg_buf *reply;
+
+        fields[0].data = frame->field[0];
+        fields[0].size = frame->size[0];
+        fields[1].data = &status;
+        fields[1].size = sizeof(int8_t);
+
+        reply = msg_buf_encode(&(rct->pool), sess->version, code, fields, 2);
+
+        if (reply != NULL)
+                srvr_send(rct, sess, reply);
+}
+
+/*
+ * Find a room joined by a client
+ */
+static int srvr_member(const struct sess_info *const info,
+                       const struct istr *const room)
+{
+        int i;
+
+        for (i = 0; i < info->nrooms; ++i) {
+                if (info->rooms[i].room == room)
+                        return i;
+        }
+
+        return -1;
+}
+
+/*
+ * Find a room joined by a client from its name
+ *
+ * The few rooms of the client are compared, so that the shared interning
+ * table is not locked for each room message.
+ */
+static int srvr_member_name(const struct sess_info *const info,
+                            const char *const name, const size_t len)
+{
+        int i;
+
+        for (i = 0; i < info->nrooms; ++i) {
+                if ((info->rooms[i].room->len == len)
+                    && (memcmp(info->rooms[i].room->str, name, len) == 0))
+                        return i;
+        }
+
+        return -1;
+}
+
+/*
+ * Add a client to a room it is not a member of
+ */
+static int srvr_join(struct reactor *const rct, struct sess *const sess,
+                     const char *const name, const size_t len)
+{
+        struct sess_info *info = sess_info(&(rct->sess), sess);
+        struct member *rooms;
+        struct istr *room;
+        int size, pos;
+
+        if (info->nrooms == info->roomsize) {
+                if (info->roomsize == SRVR_MAXROOMS)
+                        return -1;
+
+                size = (info->roomsize > 0) ? 2 * info->roomsize : 4;
+                rooms = (struct member *) realloc(info->rooms, size
+                                                  * sizeof(struct member));
+
+                if (rooms == NULL)
+                        return -1;
+
+                info->rooms = rooms;
+                info->roomsize = size;
+        }
+
+        room = itab_intern(&(rct->srvr->names), name, len);
+
+        if (room == NULL) {
+                log_error("[srvr] itab_intern(): %s", strerror(errno));
+
+                return -1;
+        }
+
+        pos = room_join(&(rct->rooms), room, sess->fd);
+
+        /* The name is held by the room as long as the client is a member */
+        if (pos >= 0) {
+                info->rooms[info->nrooms].room = room;
+                info->rooms[info->nrooms].pos = pos;
+                ++info->nrooms;
+        }
+
+        itab_release(&(rct->srvr->names), room);
+
+        return (pos >= 0) ? 0 : -1;
+}
+
+/*
+ * Remove a client from one of its rooms
+ */
+static void srvr_leave(struct reactor *const rct, struct sess_info *const info,
+                       const int i)
+{
+        struct member *member = info->rooms + i;
+        struct sess_info *other;
+        int moved, j;
+
+        moved = room_leave(&(rct->rooms), member->room, member->pos);
+
+        /* Another member took the place of the client in the room */
+        if (moved != -1) {
+                other = sess_info(&(rct->sess), sess_get(&(rct->sess), moved));
+                j = srvr_member(other, member->room);
+                other->rooms[j].pos = member->pos;
+        }
+
+        info->rooms[i] = info->rooms[--info->nrooms];
+}
+
+/*
+ * Client room request processing
+ */
+static void srvr_room(struct reactor *const rct, struct sess *const sess,
+                      const struct msg_frame *const frame)
+{
+        struct sess_info *info = sess_info(&(rct->sess), sess);
+        int8_t status = MSG_ROOM_REFUSED;
+        int i;
+
+        if ((sess->state != SESS_AUTHED) || (frame->size[0] == 0)
+            || (frame->size[0] >= MSG_BUFSIZ)) {
+                srvr_status(rct, sess, MSG_CODE_ROOM_STATUS, frame, status);
+
+                return;
+        }
+
+        /* Only joining a room interns its name */
+        i = srvr_member_name(info, frame->field[0], frame->size[0]);
+
+        switch (frame->code) {
+        case MSG_CODE_JOIN:
+                if ((i != -1) || (srvr_join(rct, sess, frame->field[0],
+                                            frame->size[0]) == 0))
+                        status = MSG_ROOM_JOINED;
+                break;
+
+        case MSG_CODE_LEAVE:
+                if (i != -1) {
+                        srvr_leave(rct, info, i);
+                        status = MSG_ROOM_LEFT;
+                }
+                break;
+
+        case MSG_CODE_SEND_ROOM:
+                /* Only refusals are answered */
+                if (i != -1) {
+                        srvr_roomcast(rct, info->rooms[i].room, frame,
+                                      info->name);
+
+                        return;
+                }
+                break;
+        }
+
+        log_debug("[srvr] Room '%.*s' request %hhd: status %hhd",
+                  (int) frame->size[0], frame->field[0], frame->code, status);
+
+        srvr_status(rct, sess, MSG_CODE_ROOM_STATUS, frame, status);
+}
+
+/*
+ * Send a message to a single client, known by name among all reactors
+ *
+ * The recipient is found in the name index of the server map, and only the
+ * reactor holding it is woken up.
+ */
+static int srvr_unicast(struct reactor *const rct, struct istr *const to,
+                        const int8_t code,
+                        const struct msg_field *const fields,
+                        const int nfields)
+{
+        struct srvr *srvr = rct->srvr;
+        struct reactor *owner = NULL;
+        struct msg_buf *bufs[SRVR_NSLOTS];
+        int fd, i;
+        int rc = 0;
+
+        pthread_mutex_lock(&(srvr->lock));
+
+        /* Interned, the recipient name is neither hashed nor compared */
+        fd = fdm_find(&(srvr->fdm), to->str, to->hash);
+
+        if (fd != -1)
+                owner = srvr->owner[fd];
+
+        pthread_mutex_unlock(&(srvr->lock));
+
+        if (owner == NULL)
+                return -1;
+
+        for (i = 0; i < MSG_NVERSIONS; ++i)
+                bufs[i] = msg_buf_encode(&(rct->pool), i + 1, code, fields,
+                                         nfields);
+
+        if ((bufs[MSG_V1 - 1] == NULL) && (bufs[MSG_V2 - 1] == NULL)) {
+                log_error("[srvr] msg_buf_encode(): %s", strerror(errno));
+
+                return -1;
+        }
+
+        /* Named whatever the features, and never batched */
+        for (i = MSG_NVERSIONS; i < SRVR_NSLOTS; ++i)
+                bufs[i] = bufs[MSG_V2 - 1];
+
+        /* A recipient closed meanwhile is only known by its own reactor */
+        if (owner != rct)
+                srvr_forward(rct, owner, bufs, NULL, to, fd);
+        else
+                rc = srvr_deliver(rct, bufs, fd, to);
+
+        for (i = 0; i < MSG_NVERSIONS; ++i)
+                msg_buf_free(bufs[i]);
+
+        return rc;
+}
+
+/*
+ * Get the address of a client, as raw bytes in network order
+ */
+static int srvr_addr(const int sfd, struct sockaddr_storage *const addr,
+                     struct msg_field *const field)
+{
+        struct sockaddr_in6 *in6 = (struct sockaddr_in6 *) addr;
+        socklen_t addrlen = sizeof(struct sockaddr_storage);
+
+        if (getpeername(sfd, (struct sockaddr *) addr, &addrlen) != 0) {
+                log_error("[srvr] getpeername(): %s", strerror(errno));
+
+                return -1;
+        }
+
+        if (addr->ss_family == AF_INET) {
+                field->data = &(((struct sockaddr_in *) addr)->sin_addr);
+                field->size = sizeof(struct in_addr);
+        } else if (IN6_IS_ADDR_V4MAPPED(&(in6->sin6_addr))) {
+                field->data = in6->sin6_addr.s6_addr + 12;
+                field->size = sizeof(struct in_addr);
+        } else {
+                field->data = &(in6->sin6_addr);
+                field->size = sizeof(struct in6_addr);
+        }
+
+        return 0;
+}
+
+/*
+ * Relay a direct message, or a request to bypass the server, from a client to
+ * another one
+ *
+ * The recipient gets the sender name instead of its own, and the address of
+ * the sender when it accepts a connection.
+ */
+static void srvr_dm(struct reactor *const rct, struct sess *const sess,
+                    const struct msg_frame *const frame)
+{
+        struct srvr *srvr = rct->srvr;
+        struct istr *name = sess_info(&(rct->sess), sess)->name;
+        struct msg_field fields[MSG_MAXFIELDS];
+        struct sockaddr_storage addr;
+        struct istr *to;
+        int i;
+
+        if ((sess->state != SESS_AUTHED) || (frame->size[0] == 0)
+            || (frame->size[0] >= MSG_BUFSIZ)) {
+                /* Statuses are never answered */
+                if (frame->code != MSG_CODE_DM_STATUS)
+                        srvr_status(rct, sess, MSG_CODE_DM_STATUS, frame,
+                                    MSG_DM_REFUSED);
+
+                return;
+        }
+
+        to = itab_intern(&(srvr->names), frame->field[0], frame->size[0]);
+
+        if (to == NULL) {
+                log_error("[srvr] itab_intern(): %s", strerror(errno));
+
+                if (frame->code != MSG_CODE_DM_STATUS)
+                        srvr_status(rct, sess, MSG_CODE_DM_STATUS, frame,
+                                    MSG_DM_REFUSED);
+
+                return;
+        }
+
+        fields[0].data = name->str;
+        fields[0].size = name->len;
+
+        for (i = 1; i < frame->nfields; ++i) {
+                fields[i].data = frame->field[i];
+                fields[i].size = frame->size[i];
+        }
+
+        if (((frame->code == MSG_CODE_DM_CONNECT)
+             && (srvr_addr(sess->fd, &addr, fields + 1) != 0))
+            || (srvr_unicast(rct, to, frame->code, fields, frame->nfields)
+                != 0)) {
+                log_debug("[srvr] Direct message %hhd to '%s' refused",
+                          frame->code, to->str);
+
+                if (frame->code != MSG_CODE_DM_STATUS)
+                        srvr_status(rct, sess, MSG_CODE_DM_STATUS, frame,
+                                    MSG_DM_REFUSED);
+        } else {
+                log_debug("[srvr] Direct message %hhd sent to '%s'",
+                          frame->code, to->str);
+        }
+
+        itab_release(&(srvr->names), to);
+}
+
+/*
+ * Answer a file transfer of a client, granting bytes or ending it
+ */
+static void srvr_file_reply(struct reactor *const rct, struct sess *const sess,
+                            const int8_t code, const uint32_t id,
+                            const void *const arg, const size_t size)
+{
+        struct msg_field fields[2];
+        struct msg_buf *reply;
+        uint32_t word = htonl(id);
+
+        fields[0].data = &word;
+        fields[0].size = sizeof(uint32_t);
+        fields[1].data = arg;
+        fields[1].size = size;
+
+        reply = msg_buf_encode(&(rct->pool), sess->version, code, fields, 2);
+
+        if (reply != NULL)
+                srvr_send(rct, sess, reply);
+}
+
+/*
+ * Grant bytes of a file to a client
+ */
+static void srvr_grant(struct reactor *const rct, struct sess *const sess,
+                       struct upload *const up, const uint32_t count)
+{
+        uint32_t word = htonl(count);
+
+        up->granted += count;
+        srvr_file_reply(rct, sess, MSG_CODE_FILE_ACK, up->id, &word,
+                        sizeof(uint32_t));
+}
+
+/*
+ * End a file transfer of a client
+ */
+static void srvr_file_status(struct reactor *const rct,
+                             struct sess *const sess, const uint32_t id,
+                             int8_t status)
+{
+        srvr_file_reply(rct, sess, MSG_CODE_FILE_STATUS, id, &status,
+                        sizeof(int8_t));
+}
+
+/*
+ * Find a file uploaded by a client
+ */
+static int srvr_upload(const struct sess_info *const info, const uint32_t id)
+{
+        int i;
+
+        for (i = 0; i < info->nuploads; ++i) {
+                if (info->uploads[i].id == id)
+                        return i;
+        }
+
+        return -1;
+}
+
+/*
+ * Close a file uploaded by a client, removed unless complete
+ */
+static void srvr_unload(struct sess_info *const info, const int i)
+{
+        struct upload *up = info->uploads + i;
+
+        close(up->fd);
+
+        if (up->done < up->size)
+                unlink(up->path);
+
+        free(up->path);
+        info->uploads[i] = info->uploads[--info->nuploads];
+}
+
+/*
+ * Check that a name stays in its directory
+ */
+static int srvr_entry(const char *const name, const size_t len)
+{
+        return (len > 0) && (len <= NAME_MAX)
+               && (memchr(name, '/', len) == NULL)
+               && (memchr(name, '\0', len) == NULL)
+               && ((name[0] != '.') || ((len > 1)
+                                        && ((name[1] != '.') || (len > 2))));
+}
+
+/*
+ * Get the path of a file uploaded by a client, in the directory of the client
+ * among the uploaded files
+ *
+ * The directory of the client is created if needed. Names of clients and files
+ * cannot be confused, whatever their characters.
+ */
+static char *srvr_path(const struct srvr *const srvr,
+                       const struct istr *const user,
+                       const char *const name, const size_t len)
+{
+        size_t size;
+        char *path;
+
+        if (!srvr_entry(user->str, user->len) || !srvr_entry(name, len)) {
+                errno = EINVAL;
+
+                return NULL;
+        }
+
+        size = strlen(srvr->files) + user->len + len + 3;
+        path = (char *) malloc(size);
+
+        if (path == NULL)
+                return NULL;
+
+        snprintf(path, size, "%s/%s", srvr->files, user->str);
+
+        if ((mkdir(path, 0755) != 0) && (errno != EEXIST)) {
+                free(path);
+
+                return NULL;
+        }
+
+        snprintf(path, size, "%s/%s/%.*s", srvr->files, user->str, (int) len,
+                 name);
+
+        return path;
+}
+
+/*
+ * Client file offer processing
+ *
+ * The file is accepted by granting its first bytes, and written as they come.
+ */
+static void srvr_offer(struct reactor *const rct, struct sess *const sess,
+                       const struct msg_frame *const frame)
+{
+        struct sess_info *info = sess_info(&(rct->sess), sess);
+        struct upload *up;
+        uint32_t id, size;
+        char *path;
+
+        memcpy(&id, frame->field[0], sizeof(uint32_t));
+        memcpy(&size, frame->field[1], sizeof(uint32_t));
+        id = ntohl(id);
+        size = ntohl(size);
+
+        if ((sess->state != SESS_AUTHED) || !(sess->caps & MSG_CAP_FILE)
+            || (srvr_upload(info, id) != -1)
+            || (info->nuploads == SRVR_MAXFILES)) {
+                srvr_file_status(rct, sess, id, MSG_FILE_REFUSED);
+
+                return;
+        }
+
+        if (info->uploads == NULL) {
+                info->uploads = (struct upload *)
+                                malloc(SRVR_MAXFILES * sizeof(struct upload));
+
+                if (info->uploads == NULL) {
+                        log_error("[srvr] malloc(): %s", strerror(errno));
+                        srvr_file_status(rct, sess, id, MSG_FILE_REFUSED);
+
+                        return;
+                }
+        }
+
+        path = srvr_path(rct->srvr, info->name, frame->field[2],
+                         frame->size[2]);
+
+        if (path == NULL) {
+                log_debug("[srvr] File '%.*s' refused: %s",
+                          (int) frame->size[2], frame->field[2],
+                          strerror(errno));
+                srvr_file_status(rct, sess, id, MSG_FILE_REFUSED);
+
+                return;
+        }
+
+        /* Files are never overwritten, nor written twice at once */
+        up = info->uploads + info->nuploads;
+        up->fd = open(path, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC
+                      | O_NOFOLLOW, 0644);
+
+        if (up->fd == -1) {
+                log_warn("[srvr] open(): %s: %s", path, strerror(errno));
+                free(path);
+                srvr_file_status(rct, sess, id, MSG_FILE_REFUSED);
+
+                return;
+        }
+
+        up->path = path;
+        up->id = id;
+        up->size = size;
+        up->done = 0;
+        up->granted = 0;
+        ++info->nuploads;
+
+        log_info("[srvr] Client '%s' uploads %lu bytes to '%s'",
+                 info->name->str, (unsigned long) size, path);
+
+        if (size == 0) {
+                srvr_unload(info, info->nuploads - 1);
+                srvr_file_status(rct, sess, id, MSG_FILE_DONE);
+        } else {
+                srvr_grant(rct, sess, up, (size < SRVR_WINDOW) ? size
+                           : SRVR_WINDOW);
+        }
+}
+
+/*
+ * Write a whole buffer to a file
+ */
+static int srvr_write(const int fd, const char *data, size_t size)
+{
+        ssize_t nwrite;
+
+        while (size > 0) {
+                nwrite = write(fd, data, size);
+
+                if (nwrite < 0) {
+                        if (errno == EINTR)
+                                continue;
+
+                        return -1;
+                }
+
+                data += nwrite;
+                size -= nwrite;
+        }
+
+        return 0;
+}
+
+/*
+ * Client file chunk processing
+ *
+ * Every chunk written is granted again, so that a client never sends more
+ * than a window ahead of the writes.
+ */
+static void srvr_file_data(struct reactor *const rct, struct sess *const sess,
+                           const struct msg_frame *const frame)
+{
+        struct sess_info *info = sess_info(&(rct->sess), sess);
+        struct upload *up;
+        uint32_t id, left;
+        size_t size = frame->size[1];
+        int i;
+
+        memcpy(&id, frame->field[0], sizeof(uint32_t));
+        id = ntohl(id);
+
+        i = srvr_upload(info, id);
+
+        /* Chunks sent before a failure are dropped silently */
+        if (i == -1) {
+                log_debug("[srvr] Chunk of unknown file %lu, ignored",
+                          (unsigned long) id);
+
+                return;
+        }
+
+        up = info->uploads + i;
+
+        if ((size > up->granted - up->done)
+            || (srvr_write(up->fd, frame->field[1], size) != 0)) {
+                log_warn("[srvr] Upload to '%s' failed: %s", up->path,
+                         (size > up->granted - up->done) ? "overflow"
+                         : strerror(errno));
+
+                srvr_unload(info, i);
+                srvr_file_status(rct, sess, id, MSG_FILE_FAILED);
+
+                return;
+        }
+
+        up->done += size;
+
+        if (up->done == up->size) {
+                log_info("[srvr] Upload to '%s' complete", up->path);
+
+                srvr_unload(info, i);
+                srvr_file_status(rct, sess, id, MSG_FILE_DONE);
+
+                return;
+        }
+
+        left = up->size - up->granted;
+
+        if ((size > 0) && (left > 0))
+                srvr_grant(rct, sess, up, (size < left) ? size : left);
+}
+
+/*
+ * Client file transfer abort processing
+ */
+static void srvr_file_abort(struct reactor *const rct, struct sess *const sess,
+                            const struct msg_frame *const frame)
+{
+        struct sess_info *info = sess_info(&(rct->sess), sess);
+        uint32_t id;
+        int i;
+
+        memcpy(&id, frame->field[0], sizeof(uint32_t));
+
+        i = srvr_upload(info, ntohl(id));
+
+        if (i == -1)
+                return;
+
+        log_info("[srvr] Upload to '%s' given up by the client",
+                 info->uploads[i].path);
+
+        srvr_unload(info, i);
+}
+
+/*
+ * Record the reactor and identifier of a client, under the server lock
+ */
+static int srvr_own(struct srvr *const srvr, const int fd,
+                    struct reactor *const rct, const uint32_t id)
+{
+        struct reactor **owner;
+        uint32_t *ids;
+        int size;
+
+        if (fd >= srvr->nowner) {
+                size = (srvr->nowner > 0) ? srvr->nowner : 64;
+
+                while (size <= fd)
+                        size *= 2;
+
+                owner = (struct reactor **) realloc(srvr->owner, size
+                                                    * sizeof(struct reactor *));
+
+                if (owner == NULL)
+                        return -1;
+
+                memset(owner + srvr->nowner, 0, (size - srvr->nowner)
+                       * sizeof(struct reactor *));
+
+                srvr->owner = owner;
+                ids = (uint32_t *) realloc(srvr->ids, size * sizeof(uint32_t));
+
+                if (ids == NULL)
+                        return -1;
+
+                srvr->ids = ids;
+                srvr->nowner = size;
+        }
+
+        srvr->owner[fd] = rct;
+        srvr->ids[fd] = id;
+
+        return 0;
+}
+
+/*
+ * Register a client name, unique among all reactors
+ */
+static int srvr_auth(struct reactor *const rct, struct sess *const sess,
+                     const char *const name, const size_t len)
+{
+        struct srvr *srvr = rct->srvr;
+        struct sess_info *info = sess_info(&(rct->sess), sess);
+        struct istr *is;
+        int rc = -1;
+
+        is = itab_intern(&(srvr->names), name, len);
+
+        if (is == NULL)
+                return -1;
+
+        pthread_mutex_lock(&(srvr->lock));
+
+        /* Identifiers are never given twice, unlike file descriptors */
+        if (++srvr->nextid == 0)
+                ++srvr->nextid;
+
+        /*
+         * The map refers to the interned name held by the session. Interned
+         * names compare by address, with the hash kept by the table.
+         */
+        if ((fdm_find(&(srvr->fdm), is->str, is->hash) == -1)
+            && (srvr_own(srvr, sess->fd, rct, srvr->nextid) == 0)
+            && (fdm_put(&(srvr->fdm), sess->fd, (char *) is->str)
+                != (char *) -1)) {
+                itab_release(&(srvr->names), info->name);
+                info->name = istr_ref(is);
+                info->id = srvr->nextid;
+                sess->state = SESS_AUTHED;
+                rc = 0;
+        }
+
+        pthread_mutex_unlock(&(srvr->lock));
+
+        itab_release(&(srvr->names), is);
+
+        return rc;
+}
+
+/*
+ * Close a client connection
+ */
+static void srvr_disconnect(struct reactor *const rct, struct sess *const sess)
+{
+        struct srvr *srvr = rct->srvr;
+        struct sess_info *info = sess_info(&(rct->sess), sess);
+        struct istr *name = info->name;
+        uint32_t id = info->id;
+        int sfd = sess->fd;
+
+        if (sess->caps & MSG_CAP_BATCH)
+                __atomic_sub_fetch(&(srvr->nbatching), 1, __ATOMIC_RELAXED);
+
+        if (info->codec != NULL)
+                log_debug("[srvr] Compressed %lu bytes into %lu",
+                          info->codec->nraw, info->codec->nzip);
+
+        if (info->srtt > -1)
+                log_debug("[srvr] Smoothed RTT %ld ms, variation %ld ms",
+                          info->srtt, info->rttvar);
+
+        while (info->nrooms > 0)
+                srvr_leave(rct, info, info->nrooms - 1);
+
+        while (info->nuploads > 0)
+                srvr_unload(info, info->nuploads - 1);
+
+        if (info->idle != NULL) {
+                tw_cancel(&(rct->tw), &(info->idle->timer));
+                slab_free(&(rct->idles), info->idle);
+        }
+
+        if (name != NULL) {
+                pthread_mutex_lock(&(srvr->lock));
+                fdm_remove(&(srvr->fdm), sfd);
+                srvr->owner[sfd] = NULL;
+                pthread_mutex_unlock(&(srvr->lock));
+
+                log_info("[srvr] Client '%s' disconnected", name->str);
+        } else {
+                log_info("[srvr] Client disconnected");
+        }
+
+        /* Its last messages are sent before its identifier is released */
+        if (name != NULL) {
+                srvr_publish(rct);
+                srvr_announce(rct, id, "");
+        }
+
+        evl_remove(&(rct->evl), sfd);
+        sess_close(&(rct->sess), sfd);
+        close(sfd);
+}
+
+/*
+ * Send a heartbeat, or the answer to one, to a client
+ */
+static void srvr_ping(struct reactor *const rct, struct sess *const sess,
+                      const int8_t code, const char *const word)
+{
+        struct msg_field field;
+        struct msg_buf *buf;
+
+        field.data = word;
+        field.size = sizeof(uint32_t);
+
+        buf = msg_buf_encode(&(rct->pool), sess->version, code, &field, 1);
+
+        if (buf != NULL)
+                srvr_send(rct, sess, buf);
+}
+
+/*
+ * Update the smoothed round-trip time of a client from a heartbeat answer
+ */
+static void srvr_rtt(struct reactor *const rct, struct sess *const sess,
+                     const struct msg_frame *const frame)
+{
+        struct sess_info *info = sess_info(&(rct->sess), sess);
+        uint32_t word;
+        long rtt;
+
+        memcpy(&word, frame->field[0], sizeof(uint32_t));
+        rtt = (long) ((uint32_t) rct->now - ntohl(word));
+
+        /* Answers to nothing we sent */
+        if (rtt > rct->srvr->timeout)
+                return;
+
+        /* As TCP does (RFC 6298) */
+        if (info->srtt < 0) {
+                info->srtt = rtt;
+                info->rttvar = rtt / 2;
+        } else {
+                info->rttvar = (3 * info->rttvar + labs(info->srtt - rtt)) / 4;
+                info->srtt = (7 * info->srtt + rtt) / 8;
+        }
+
+        log_debug("[srvr] RTT %ld ms, smoothed %ld ms", rtt, info->srtt);
+}
+
+static void srvr_idle(void *const arg)
+{
+        struct idle *idle = (struct idle *) arg;
+        struct reactor *rct = idle->rct;
+        struct srvr *srvr = rct->srvr;
+        struct sess *sess = sess_get(&(rct->sess), idle->fd);
+        uint32_t word;
+        long silent, delay;
+        int evict;
+
+        if (sess == NULL)
+                return;
+
+        silent = rct->now - sess->last;
+
+        /* Authentified clients may only be silent without heartbeats */
+        evict = (sess->caps & MSG_CAP_PING) || (sess->state != SESS_AUTHED);
+
+        if (evict && (silent >= srvr->timeout)) {
+                log_info("[srvr] Client silent for %ld ms, closing connection",
+                         silent);
+                __atomic_add_fetch(&(srvr->nidle), 1, __ATOMIC_RELAXED);
+                srvr_disconnect(rct, sess);
+
+                return;
+        }
+
+        if (silent < srvr->idle) {
+                delay = srvr->idle - silent;
+        } else {
+                delay = srvr->idle;
+
+                if (sess->caps & MSG_CAP_PING) {
+                        word = htonl((uint32_t) rct->now);
+                        srvr_ping(rct, sess, MSG_CODE_PING, (char *) &word);
+                }
+        }
+
+        if (evict && (srvr->timeout - silent < delay))
+                delay = srvr->timeout - silent;
+
+        tw_add(&(rct->tw), &(idle->timer), delay);
+}
+
+/*
+ * Write pending messages of a client
+ */
+static void srvr_flush(struct reactor *const rct, struct sess *const sess)
+{
+        if (mq_flush(&(sess->outq), sess->fd) < 0) {
+                log_warn("[srvr] sendmsg(): %s", strerror(errno));
+                srvr_disconnect(rct, sess);
+        } else if ((sess->outq.count == 0)
+                   && (evl_mod(&(rct->evl), sess->fd, POLLIN) != 0)) {
+                log_error("[srvr] evl_mod(): %s", strerror(errno));
+        }
+}
+
+/*
+ * Set up the compression streams of a client
+ */
+static int srvr_codec(struct reactor *const rct, struct sess *const sess)
+{
+        struct msg_codec *codec;
+
+        codec = (struct msg_codec *) malloc(sizeof(struct msg_codec));
+
+        if ((codec == NULL) || (msg_codec_init(codec, &(rct->pool)) != 0)) {
+                log_debug("[srvr] msg_codec_init(): %s", strerror(errno));
+                free(codec);
+
+                return -1;
+        }
+
+        sess_info(&(rct->sess), sess)->codec = codec;
+
+        return 0;
+}
+
+/*
+ * Send the names of the connected senders to a client knowing senders by
+ * identifier
+ */
+static void srvr_senders(struct reactor *const rct, struct sess *const sess)
+{
+        struct srvr *srvr = rct->srvr;
+        struct msg_buf **bufs, *buf;
+        int fd, i, j, n = 0, pos = 0;
+
+        pthread_mutex_lock(&(srvr->lock));
+
+        bufs = (struct msg_buf **) malloc((srvr->fdm.count + 1)
+                                          * sizeof(struct msg_buf *));
+
+        /* Only the named descriptors are visited, whatever their values */
+        while ((bufs != NULL) && ((fd = fdm_next(&(srvr->fdm), &pos)) != -1)) {
+                bufs[n] = srvr_sender(rct, srvr->ids[fd],
+                                      fdm_get(&(srvr->fdm), fd));
+
+                if (bufs[n] != NULL)
+                        ++n;
+        }
+
+        pthread_mutex_unlock(&(srvr->lock));
+
+        if (bufs == NULL) {
+                log_error("[srvr] malloc(): %s", strerror(errno));
+
+                return;
+        }
+
+        /*
+         * Batching clients get them all at once. Without its bindings, a
+         * client ignores every message of the senders, so the batches are
+         * never dropped by the slow consumer policy.
+         */
+        for (i = 0; i < n; i = j) {
+                j = (sess->caps & MSG_CAP_BATCH) ? srvr_span(bufs, i, n)
+                    : i + 1;
+                buf = srvr_pack(rct, bufs + i, j - i);
+
+                if (buf != NULL) {
+                        buf->flags |= MSG_BUF_KEEP;
+                        srvr_send(rct, sess, buf);
+                }
+        }
+
+        for (i = 0; i < n; ++i)
+                msg_buf_free(bufs[i]);
+
+        free(bufs);
+}
+
+/*
+ * Negotiate the protocol version and features of a client
+ */
+static void srvr_hello(struct reactor *const rct, struct sess *const sess,
+                       const struct msg_frame *const frame)
+{
+        struct msg_field fields[2];
+        struct msg_codec *codec;
+        struct msg_buf *reply;
+        uint32_t caps;
+        int8_t version;
+
+        if ((sess->state != SESS_CONNECTED) || (sess->flags & SESS_HELLO)) {
+                log_warn("[srvr] Unexpected handshake, ignored");
+
+                return;
+        }
+
+        version = *frame->field[0];
+        memcpy(&caps, frame->field[1], sizeof(uint32_t));
+
+        sess->version = (version < MSG_V1) ? MSG_V1
+                        : (version > MSG_NVERSIONS) ? MSG_NVERSIONS : version;
+        sess->caps = ntohl(caps) & SRVR_CAPS;
+        sess->flags |= SESS_HELLO;
+
+        /* Batches, compressed, identified messages and files need version 2 */
+        if (sess->version < MSG_V2)
+                sess->caps &= ~(MSG_CAP_BATCH | MSG_CAP_DEFLATE
+                                | MSG_CAP_SENDERID | MSG_CAP_FILE);
+
+        if ((sess->caps & MSG_CAP_DEFLATE) && (srvr_codec(rct, sess) != 0))
+                sess->caps &= ~MSG_CAP_DEFLATE;
+
+        if (sess->caps & MSG_CAP_BATCH)
+                __atomic_add_fetch(&(rct->srvr->nbatching), 1,
+                                   __ATOMIC_RELAXED);
+
+        log_debug("[srvr] Client speaks version %d with features %#x",
+                  sess->version, sess->caps);
+
+        version = sess->version;
+        caps = htonl(sess->caps);
+        fields[0].data = &version;
+        fields[0].size = sizeof(int8_t);
+        fields[1].data = &caps;
+        fields[1].size = sizeof(uint32_t);
+
+        reply = msg_buf_encode(&(rct->pool), sess->version, MSG_CODE_HELLO,
+                               fields, 2);
+
+        if (reply != NULL)
+                srvr_send(rct, sess, reply);
+
+        /* Everything after the reply is compressed */
+        if (sess->caps & MSG_CAP_DEFLATE) {
+                codec = sess_info(&(rct->sess), sess)->codec;
+                mq_set_codec(&(sess->outq), codec);
+                sess->rd.codec = codec;
+        }
+}
+
+/*
+ * Client message processing
+ */
+static void srvr_dispatch(struct reactor *const rct, struct sess *const sess,
+                          const struct msg_frame *const frame)
+{
+        struct msg_field status;
+        struct msg_buf *reply;
+        int8_t rc;
+
+        /* Without handshake, replies use the version of the last request */
+        if (!(sess->flags & SESS_HELLO))
+                sess->version = frame->version;
+
+        switch (frame->code) {
+        case MSG_CODE_HELLO:
+                srvr_hello(rct, sess, frame);
+                break;
+
+        case MSG_CODE_SEND_NO_AUTH:
+        case MSG_CODE_SEND_AUTH: /* TODO (requires db) */
+                log_info("[srvr] Authentification request from '%.*s'",
+                         (int) frame->size[0], frame->field[0]);
+
+                /* Names are sent to clients of every protocol version */
+                if (frame->size[0] >= MSG_BUFSIZ) {
+                        rc = 1;
+                        log_debug("[srvr] Name too long");
+                } else if (srvr_auth(rct, sess, frame->field[0],
+                                     frame->size[0]) != 0) {
+                        rc = 2;
+                        log_debug("[srvr] Authentification failed");
+                } else {
+                        rc = 0;
+                        log_debug("[srvr] Client authentified");
+                }
+
+                status.data = &rc;
+                status.size = sizeof(int8_t);
+                reply = msg_buf_encode(&(rct->pool), sess->version,
+                                       MSG_CODE_RECV_AUTH, &status, 1);
+
+                if (reply != NULL)
+                        srvr_send(rct, sess, reply);
+
+                /* Later senders are announced after the reply */
+                if ((rc == 0) && (sess->caps & MSG_CAP_SENDERID))
+                        srvr_senders(rct, sess);
+
+                if (rc == 0)
+                        srvr_announce(rct, sess_info(&(rct->sess), sess)->id,
+                                      sess_info(&(rct->sess), sess)->name->str);
+                break;
+
+        case MSG_CODE_PING:
+                srvr_ping(rct, sess, MSG_CODE_PONG, frame->field[0]);
+                break;
+
+        case MSG_CODE_PONG:
+                srvr_rtt(rct, sess, frame);
+                break;
+
+        case MSG_CODE_JOIN:
+        case MSG_CODE_LEAVE:
+        case MSG_CODE_SEND_ROOM:
+                srvr_room(rct, sess, frame);
+                break;
+
+        case MSG_CODE_DM_REQUEST:
+        case MSG_CODE_DM_STATUS:
+        case MSG_CODE_DM_CONNECT:
+        case MSG_CODE_DM:
+                srvr_dm(rct, sess, frame);
+                break;
+
+        case MSG_CODE_FILE_OFFER:
+                srvr_offer(rct, sess, frame);
+                break;
+
+        case MSG_CODE_FILE_DATA:
+                srvr_file_data(rct, sess, frame);
+                break;
+
+        case MSG_CODE_FILE_STATUS:
+                srvr_file_abort(rct, sess, frame);
+                break;
+
+        case MSG_CODE_SEND_PUBLIC:
+                if (sess->state == SESS_AUTHED)
+                        srvr_broadcast(rct, frame->field[0], frame->size[0],
+                                       sess_info(&(rct->sess), sess)->id,
+                                       sess_info(&(rct->sess), sess)->name);
+                else
+                        srvr_status(rct, sess, MSG_CODE_PUBLIC_STATUS, frame,
+                                    MSG_PUBLIC_REFUSED);
+                break;
+
+        default:
+                log_warn("[srvr] Unknown message code %hhd, ignored",
+                         frame->code);
+                break;
+        }
+}
+
+/*
+ * Client batch processing
+ */
+static int srvr_unbatch(struct reactor *const rct, struct sess *const sess,
+                        const struct msg_frame *const batch)
+{
+        struct msg_frame frame;
+        size_t pos = 0;
+        int rc = 0;
+
+        while ((sess->state != SESS_CLOSING)
+               && ((rc = msg_unbatch(batch, &pos, &frame)) > 0)) {
+                if (frame.code == MSG_CODE_BATCH)
+                        log_warn("[srvr] Nested batch, ignored");
+                else
+                        srvr_dispatch(rct, sess, &frame);
+        }
+
+        return rc;
+}
+
+/*
+ * Client request processing
+ */
+static void srvr_recv(struct reactor *const rct, struct sess *const sess)
+{
+        struct msg_frame frame;
+        ssize_t nread;
+        int rc = 0;
+
+        log_debug("[srvr] Incoming client request");
+
+        if (sess->state == SESS_CLOSING) {
+                srvr_disconnect(rct, sess);
+
+                return;
+        }
+
+        nread = msg_fill(&(sess->rd), sess->fd);
+
+        if ((nread < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK)
+                            || (errno == EINTR)))
+                return;
+
+        if (nread <= 0) {
+                srvr_disconnect(rct, sess);
+
+                return;
+        }
+
+        sess->last = rct->now;
+
+        /* Sessions are neither opened nor closed while dispatching */
+        while ((sess->state != SESS_CLOSING)
+               && ((rc = msg_parse(&(sess->rd), &frame)) > 0)) {
+                if (frame.code != MSG_CODE_BATCH)
+                        srvr_dispatch(rct, sess, &frame);
+                else if ((rc = srvr_unbatch(rct, sess, &frame)) < 0)
+                        break;
+        }
+
+        if (rc < 0) {
+                log_warn("[srvr] Malformed message, closing connection");
+                srvr_disconnect(rct, sess);
+        }
+}
+
+/*
+ * Client event processing
+ */
+static void srvr_event(struct reactor *const rct, const int sfd,
+                       const short events)
+{
+        struct sess *sess = sess_get(&(rct->sess), sfd);
+
+        /* Writing first frees queue space before reading new requests */
+        if ((sess != NULL) && (events & POLLOUT))
+                srvr_flush(rct, sess);
+
+        /* The session may have been closed by the flush */
+        sess = sess_get(&(rct->sess), sfd);
+
+        if ((sess != NULL) && (events & (POLLIN | POLLHUP | POLLERR)))
+                srvr_recv(rct, sess);
+}
+
+/*
+ * Reactor loop
+ */
+static void *srvr_loop(void *const arg)
+{
+        struct reactor *rct = (struct reactor *) arg;
+        struct evl_event evs[EVL_MAXEVENTS];
+        int i, ready;
+
+        while (!__atomic_load_n(&(rct->stop), __ATOMIC_ACQUIRE)) {
+                /* Only the first reactor gets SIGINT */
+                if (srvr_quit && (rct == rct->srvr->rct))
+                        break;
+
+                /* Woken up for the next timer at the latest */
+                ready = evl_wait(&(rct->evl), evs, EVL_MAXEVENTS,
+                                 tw_timeout(&(rct->tw)));
+
+                if (ready < 0) {
+                        if (errno == EINTR)
+                                continue;
+
+                        log_fatal("[srvr] evl_wait(): %s", strerror(errno));
+                        exit(EXIT_FAILURE);
+                }
+
+                rct->now = tw_now(&(rct->tw));
+
+                for (i = 0; i < ready; ++i) {
+                        if (evs[i].fd == rct->listener)
+                                srvr_connect(rct, evs[i].fd);
+                        else if (evs[i].fd == rct->efd)
+                                srvr_drain(rct);
+                        else
+                                srvr_event(rct, evs[i].fd, evs[i].events);
+                }
+
+                tw_run(&(rct->tw));
+                srvr_publish(rct);
+        }
+
+        return NULL;
+}
+
+/*
+ * Log the slow and silent clients counters
+ */
+static void srvr_log_stats(struct srvr *const srvr)
+{
+        log_info("[srvr] Slow clients: %lu dropped, %lu coalesced, "
+                 "%lu disconnected",
+                 __atomic_load_n(&(srvr->ndrop), __ATOMIC_RELAXED),
+                 __atomic_load_n(&(srvr->ncoalesce), __ATOMIC_RELAXED),
+                 __atomic_load_n(&(srvr->nkick), __ATOMIC_RELAXED));
+        log_info("[srvr] Silent clients: %lu disconnected",
+                 __atomic_load_n(&(srvr->nidle), __ATOMIC_RELAXED));
+}
+
+/*
+ * Report the counters periodically, when they changed
+ */
+static void srvr_stats(void *const arg)
+{
+        struct reactor *rct = (struct reactor *) arg;
+        struct srvr *srvr = rct->srvr;
+        unsigned long n;
+
+        /* Counters only grow, their sum tells whether any of them changed */
+        n = __atomic_load_n(&(srvr->ndrop), __ATOMIC_RELAXED)
+            + __atomic_load_n(&(srvr->ncoalesce), __ATOMIC_RELAXED)
+            + __atomic_load_n(&(srvr->nkick), __ATOMIC_RELAXED)
+            + __atomic_load_n(&(srvr->nidle), __ATOMIC_RELAXED);
+
+        if (n != srvr->nreported) {
+                srvr_log_stats(srvr);
+                srvr->nreported = n;
+        }
+
+        tw_add(&(rct->tw), &(srvr->stats), SRVR_STATS * 1000L);
+}
+
+/*
+ * Stop and join the reactor threads
+ */
+static void srvr_stop(struct srvr *const srvr)
+{
+        int i;
+
+        for (i = 1; i < srvr->nrct; ++i) {
+                if (srvr->rct[i].thread == 0)
+                        continue;
+
+                __atomic_store_n(&(srvr->rct[i].stop), 1, __ATOMIC_RELEASE);
+                srvr_wakeup(srvr->rct + i);
+                pthread_join(srvr->rct[i].thread, NULL);
+                srvr->rct[i].thread = 0;
+        }
+}
+
+/*
+ * Server loop
+ */
+void srvr_run(struct srvr *const srvr)
+{
+        sigset_t set, old;
+        int i, rc;
+
+        /* Only the main thread handles SIGINT */
+        sigemptyset(&set);
+        sigaddset(&set, SIGINT);
+        pthread_sigmask(SIG_BLOCK, &set, &old);
+
+        for (i = 1; i < srvr->nrct; ++i) {
+                rc = pthread_create(&(srvr->rct[i].thread), NULL, &srvr_loop,
+                                    srvr->rct + i);
+
+                if (rc != 0) {
+                        log_fatal("[srvr] pthread_create(): %s", strerror(rc));
+                        exit(EXIT_FAILURE);
+                }
+        }
+
+        /* Reported by the first reactor, on the main thread */
+        tw_timer(&(srvr->stats), &srvr_stats, srvr->rct);
+        tw_add(&(srvr->rct->tw), &(srvr->stats), SRVR_STATS * 1000L);
+
+        srvr->rct->thread = pthread_self();
+        srvr_quitfd = srvr->rct->efd;
+        pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+        srvr_loop(srvr->rct);
+
+        /* Torn down from a single thread, out of any handler */
+        log_info("[srvr] Interrupted, stopping reactors");
+        srvr_quitfd = -1;
+        srvr_stop(srvr);
+}
+
+/*
+ * Count the messages allocated from a pool
+ */
+static unsigned long srvr_pool_allocs(const struct msg_pool *const pool)
+{
+        unsigned long n = 0;
+        int i;
+
+        for (i = 0; i < MSG_POOL_NCLASSES; ++i)
+                n = n + pool->slabs[i].nalloc;
+
+        return n;
+}
+
+/*
+ * Count the chunks allocated by a pool
+ */
+static unsigned long srvr_pool_chunks(const struct msg_pool *const pool)
+{
+        unsigned long n = 0;
+        int i;
+
+        for (i = 0; i < MSG_POOL_NCLASSES; ++i)
+                n = n + pool->slabs[i].nchunks;
+
+        return n;
+}
+
+/*
+ * Reactor destroyer
+ */
+static void srvr_cleanup_reactor(struct reactor *const rct)
+{
+        struct sess_info *info;
+        struct fwd *fwd, *next;
+        int i;
+
+        for (i = 0; i < rct->sess.nsess; ++i) {
+                info = rct->sess.info + i;
+
+                while (info->nuploads > 0)
+                        srvr_unload(info, info->nuploads - 1);
+
+                close(rct->sess.sess[i].fd);
+        }
+
+        for (fwd = rct->inbox; fwd != NULL; fwd = next) {
+                next = fwd->next;
+
+                for (i = 0; i < SRVR_NSLOTS; ++i)
+                        msg_buf_free(fwd->bufs[i]);
+
+                itab_release(&(rct->srvr->names), fwd->room);
+                itab_release(&(rct->srvr->names), fwd->to);
+                slab_free(fwd->slab, fwd);
+        }
+
+        for (i = 0; i < rct->nbatch; ++i) {
+                msg_buf_free(rct->batch[i]);
+                msg_buf_free(rct->batchid[i]);
+        }
+
+        free(rct->batch);
+        free(rct->batchid);
+
+        evl_destroy(&(rct->evl));
+
+        room_destroy(&(rct->rooms));
+        sess_destroy(&(rct->sess));
+        pthread_mutex_destroy(&(rct->lock));
+
+        log_info("[srvr] Messages: %lu allocated in %lu chunks, %lu from heap",
+                 srvr_pool_allocs(&(rct->pool)), srvr_pool_chunks(&(rct->pool)),
+                 rct->pool.nmalloc);
+
+        if (rct->listener > -1)
+                close(rct->listener);
+
+        if (rct->efd > -1)
+                close(rct->efd);
+}
+
+/*
+ * Server destroyer
+ */
+void srvr_cleanup(__attribute__((unused)) int status, void *arg)
+{
+        struct srvr *srvr = (struct srvr *) arg;
+        int i;
+
+        log_info("[srvr] Clean up and exit");
+        srvr_log_stats(srvr);
+
+        /* Still running when exiting on a fatal error */
+        srvr_stop(srvr);
+
+        for (i = 0; i < srvr->nrct; ++i)
+                srvr_cleanup_reactor(srvr->rct + i);
+
+        /* Messages may be shared by reactors, pools are freed last */
+        for (i = 0; i < srvr->nrct; ++i) {
+                msg_pool_destroy(&(srvr->rct[i].pool));
+                slab_destroy(&(srvr->rct[i].fwds));
+                slab_destroy(&(srvr->rct[i].idles));
+        }
+
+        free(srvr->rct);
+
+        /* Names are interned, and released by the sessions */
+        fdm_destroy(&(srvr->fdm));
+        itab_destroy(&(srvr->names));
+        free(srvr->owner);
+        free(srvr->ids);
+
+        if (srvr->log != NULL)
+                fclose(srvr->log);
 }
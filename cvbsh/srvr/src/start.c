@@ -25,9 +25,12 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
+#include <cvb/evloop.h>
 #include <cvb/logger.h>
 #include <cvb/net.h>
+#include <cvb/slab.h>
 
 #include "srvr.h"
 
@@ -42,6 +45,23 @@ _Noreturn static void usage(const char *const progname, const int status)
                         progname);
         } else {
                 printf("Usage: %s [OPTIONS]... PORT\n", progname);
+                printf("\nOptions:\n");
+                printf("  -b BACKEND  Event backend: epoll (default), poll\n");
+                printf("  -d DIR      Store uploaded files in DIR "
+                       "(default %s)\n", SRVR_FILES);
+                printf("  -h          Display this help\n");
+                printf("  -H          Back message pools with huge pages\n");
+                printf("  -i SECONDS  Ping clients silent for SECONDS "
+                       "(default %d)\n", SRVR_IDLE);
+                printf("  -p POLICY   Slow client policy: drop (default), "
+                       "coalesce, disconnect\n");
+                printf("  -q BYTES    Output queue limit in bytes "
+                       "(default %d)\n", SRVR_QBYTES);
+                printf("  -Q FRAMES   Output queue limit in frames "
+                       "(default %d)\n", SRVR_QFRAMES);
+                printf("  -t SECONDS  Close clients silent for SECONDS "
+                       "(default %d)\n", SRVR_TIMEOUT);
+                printf("  -w WORKERS  Number of reactor threads (default 1)\n");
         }
 
         exit(status);
@@ -52,14 +72,88 @@ _Noreturn static void usage(const char *const progname, const int status)
  */
 int main(const int argc, const char *const argv[])
 {
-        struct srvr srvr = {
-                FDLIST_INIT,
-                FDMAP_INIT,
-                NULL,
-                -1
-        };
-
-        if (argc != 2)
+        /* Cleaned up by on_exit(), once main() has returned */
+        static struct srvr srvr = SRVR_INIT;
+        int backend = EVL_BACKEND_EPOLL;
+        int policy = SRVR_POLICY_DROP;
+        int flags = 0;
+        long qbytes = SRVR_QBYTES;
+        long qframes = SRVR_QFRAMES;
+        long idle = SRVR_IDLE;
+        long timeout = SRVR_TIMEOUT;
+        const char *files = SRVR_FILES;
+        int nrct = 1;
+        int opt;
+
+        while ((opt = getopt(argc, (char *const *) argv, "b:d:hHi:p:q:Q:t:w:"))
+               != -1) {
+                switch (opt) {
+                case 'b':
+                        backend = evl_backend(optarg);
+
+                        if (backend == -1)
+                                usage(argv[0], EXIT_FAILURE);
+                        break;
+
+                case 'd':
+                        files = optarg;
+                        break;
+
+                case 'h':
+                        usage(argv[0], EXIT_SUCCESS);
+
+                case 'H':
+                        flags = SLAB_HUGEPAGE;
+                        break;
+
+                case 'i':
+                        idle = atol(optarg);
+
+                        if (idle < 1)
+                                usage(argv[0], EXIT_FAILURE);
+                        break;
+
+                case 'p':
+                        policy = srvr_policy(optarg);
+
+                        if (policy == -1)
+                                usage(argv[0], EXIT_FAILURE);
+                        break;
+
+                case 'q':
+                        qbytes = atol(optarg);
+
+                        if (qbytes < 1)
+                                usage(argv[0], EXIT_FAILURE);
+                        break;
+
+                case 'Q':
+                        qframes = atol(optarg);
+
+                        if (qframes < 1)
+                                usage(argv[0], EXIT_FAILURE);
+                        break;
+
+                case 't':
+                        timeout = atol(optarg);
+
+                        if (timeout < 1)
+                                usage(argv[0], EXIT_FAILURE);
+                        break;
+
+                case 'w':
+                        nrct = atoi(optarg);
+
+                        if (nrct < 1)
+                                usage(argv[0], EXIT_FAILURE);
+                        break;
+
+                default:
+                        usage(argv[0], EXIT_FAILURE);
+                }
+        }
+
+        if (argc - optind != 1)
                 usage(argv[0], EXIT_FAILURE);
 
         srvr_set_logger(&srvr, "/tmp/cvb_srvr.log");
@@ -81,9 +175,20 @@ int main(const int argc, const char *const argv[])
                 exit(EXIT_FAILURE);
         } */
 
-        srvr.listener = net_fetch_socket(NULL, argv[1]);
+        srvr_set_limits(&srvr, qbytes, qframes, policy);
+        srvr_set_idle(&srvr, idle * 1000, timeout * 1000);
+
+        if (srvr_set_files(&srvr, files) != 0) {
+                log_fatal("[srvr] Failed to create directory '%s'", files);
+                exit(EXIT_FAILURE);
+        }
+
+        if (srvr_set_reactors(&srvr, nrct, backend, flags) != 0) {
+                log_fatal("[srvr] Failed to initialize reactors");
+                exit(EXIT_FAILURE);
+        }
 
-        if (srvr.listener == -1) {
+        if (srvr_listen(&srvr, argv[optind]) != 0) {
                 log_fatal("[srvr] Failed to fetch a socket");
                 exit(EXIT_FAILURE);
         }
@@ -0,0 +1,179 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "room.h"
+
+#define NROOMS   1000
+#define NMEMBERS 100
+
+/*
+ * Every room is reachable from its home slot without crossing a free slot
+ */
+static void check(const struct roomtab *const rt)
+{
+        int mask = rt->nslots - 1;
+        int i, j, count = 0;
+
+        for (i = 0; i < rt->nslots; ++i) {
+                if (rt->rooms[i].name == NULL)
+                        continue;
+
+                for (j = rt->rooms[i].name->hash & mask; j != i;
+                     j = (j + 1) & mask)
+                        assert(rt->rooms[j].name != NULL);
+
+                assert(room_get(rt, rt->rooms[i].name) == rt->rooms + i);
+                ++count;
+        }
+
+        assert(count == rt->count);
+}
+
+static void test_table(void)
+{
+        struct itab names = ITAB_INIT;
+        struct roomtab rt = ROOMTAB_INIT;
+        struct istr *is[NROOMS];
+        char name[16];
+        int i;
+
+        rt.names = &names;
+
+        for (i = 0; i < NROOMS; ++i) {
+                sprintf(name, "room%d", i);
+                is[i] = itab_intern(&names, name, strlen(name));
+                assert(is[i] != NULL);
+                assert(room_get(&rt, is[i]) == NULL);
+                assert(room_join(&rt, is[i], i) == 0);
+        }
+
+        assert(rt.count == NROOMS);
+        assert(4 * rt.count <= 3 * rt.nslots);
+        check(&rt);
+
+        /* Emptied rooms go, the others are moved back along their probes */
+        for (i = 0; i < NROOMS; i += 3) {
+                assert(room_leave(&rt, is[i], 0) == -1);
+                assert(room_get(&rt, is[i]) == NULL);
+        }
+
+        check(&rt);
+
+        for (i = 0; i < NROOMS; ++i) {
+                if (i % 3)
+                        assert(room_get(&rt, is[i])->fds[0] == i);
+                else
+                        assert(room_get(&rt, is[i]) == NULL);
+        }
+
+        for (i = NROOMS - 1; i >= 0; --i) {
+                if (i % 3)
+                        room_leave(&rt, is[i], 0);
+        }
+
+        assert(rt.count == 0);
+        check(&rt);
+
+        /* The rooms held the names */
+        for (i = 0; i < NROOMS; ++i)
+                itab_release(&names, is[i]);
+
+        assert(names.count == 0);
+
+        room_destroy(&rt);
+        itab_destroy(&names);
+}
+
+static void test_members(void)
+{
+        struct itab names = ITAB_INIT;
+        struct roomtab rt = ROOMTAB_INIT;
+        struct istr *is;
+        struct room *room;
+        int pos[NMEMBERS];
+        int fd, moved, n, i;
+
+        rt.names = &names;
+        is = itab_intern(&names, "lobby", 5);
+        assert(is != NULL);
+
+        for (fd = 0; fd < NMEMBERS; ++fd) {
+                pos[fd] = room_join(&rt, is, fd);
+                assert(pos[fd] == fd);
+        }
+
+        room = room_get(&rt, is);
+        assert(room->nfds == NMEMBERS);
+        assert(rt.count == 1);
+
+        /* The last member takes the place left, and its position follows */
+        for (n = NMEMBERS, fd = 0; fd < NMEMBERS - 1; fd += 2, --n) {
+                moved = room_leave(&rt, is, pos[fd]);
+                room = room_get(&rt, is);
+
+                if (pos[fd] == n - 1) {
+                        assert(moved == -1);
+                } else {
+                        assert(moved == room->fds[pos[fd]]);
+                        pos[moved] = pos[fd];
+                }
+
+                pos[fd] = -1;
+
+                for (i = 0; i < room->nfds; ++i)
+                        assert(pos[room->fds[i]] == i);
+
+                assert(room->nfds == n - 1);
+        }
+
+        /* The room goes with its last member */
+        for (fd = 1; fd < NMEMBERS; fd += 2) {
+                moved = room_leave(&rt, is, pos[fd]);
+
+                if (moved != -1)
+                        pos[moved] = pos[fd];
+        }
+
+        assert(room_get(&rt, is) == NULL);
+        assert(rt.count == 0);
+
+        itab_release(&names, is);
+        assert(names.count == 0);
+
+        room_destroy(&rt);
+        itab_destroy(&names);
+}
+
+static void test_destroy(void)
+{
+        struct itab names = ITAB_INIT;
+        struct roomtab rt = ROOMTAB_INIT;
+        struct istr *is;
+
+        rt.names = &names;
+        is = itab_intern(&names, "lobby", 5);
+        assert(is != NULL);
+
+        assert(room_join(&rt, is, 3) == 0);
+        assert(room_join(&rt, is, 4) == 1);
+        itab_release(&names, is);
+        assert(names.count == 1);
+
+        room_destroy(&rt);
+        assert(rt.rooms == NULL);
+        assert(rt.count == 0);
+        assert(names.count == 0);
+
+        itab_destroy(&names);
+}
+
+int main(void)
+{
+        test_table();
+        test_members();
+        test_destroy();
+
+        return EXIT_SUCCESS;
+}
@@ -0,0 +1,111 @@
+#include <assert.h>
+#include <stdlib.h>
+
+#include "sess.h"
+
+#define NSESS 1000
+
+static void check(const struct sesstab *const st)
+{
+        struct sess *sess;
+        int i;
+
+        for (i = 0; i < st->nsess; ++i) {
+                sess = sess_get(st, st->sess[i].fd);
+                assert(sess == st->sess + i);
+                assert(sess_info(st, sess) == st->info + i);
+        }
+}
+
+static void test_open(void)
+{
+        struct sesstab st = SESSTAB_INIT;
+        struct itab names = ITAB_INIT;
+        struct sess *sess;
+
+        st.names = &names;
+
+        assert(sess_reserve(&st, 8) == 0);
+        assert((st.size >= 8) && (st.nindex >= 8));
+
+        sess = sess_open(&st, 3);
+        assert((sess != NULL) && (sess->fd == 3));
+        assert(sess->state == SESS_CONNECTED);
+
+        /* The index grows with the descriptors */
+        assert(sess_open(&st, 10) != NULL);
+        assert(sess_open(&st, 100) != NULL);
+        assert(st.nsess == 3);
+        assert(st.nindex > 100);
+        check(&st);
+
+        assert(sess_get(&st, 4) == NULL);
+        assert(sess_get(&st, -1) == NULL);
+        assert(sess_get(&st, 1000) == NULL);
+
+        /* Names are held by their session */
+        sess = sess_get(&st, 10);
+        sess_info(&st, sess)->name = itab_intern(&names, "bob", 3);
+        assert(names.count == 1);
+
+        /* The last session takes the place of a closed one */
+        sess_close(&st, 10);
+        assert(names.count == 0);
+        assert(st.nsess == 2);
+        assert(sess_get(&st, 10) == NULL);
+        assert(sess_get(&st, 100) == st.sess + 1);
+        check(&st);
+
+        /* Closing an unknown descriptor does nothing */
+        sess_close(&st, 10);
+        sess_close(&st, 5000);
+        assert(st.nsess == 2);
+
+        /* Descriptors are reused */
+        assert(sess_open(&st, 10) == st.sess + 2);
+        check(&st);
+
+        sess_destroy(&st);
+        assert((st.sess == NULL) && (st.index == NULL) && (st.nsess == 0));
+
+        itab_destroy(&names);
+}
+
+static void test_churn(void)
+{
+        struct sesstab st = SESSTAB_INIT;
+        struct itab names = ITAB_INIT;
+        int i;
+
+        st.names = &names;
+
+        for (i = 0; i < NSESS; ++i)
+                assert(sess_open(&st, i) != NULL);
+
+        /* Every other session, from both ends */
+        for (i = 0; i < NSESS / 2; i += 2) {
+                sess_close(&st, i);
+                sess_close(&st, NSESS - 1 - i);
+        }
+
+        assert(st.nsess == NSESS / 2);
+        check(&st);
+
+        for (i = 0; i < NSESS; ++i) {
+                if ((i < NSESS / 2) ? (i % 2 == 0) : ((NSESS - 1 - i) % 2 == 0))
+                        assert(sess_get(&st, i) == NULL);
+                else
+                        assert(sess_get(&st, i)->fd == i);
+        }
+
+        sess_destroy(&st);
+        itab_destroy(&names);
+}
+
+int main(void)
+{
+        test_open();
+        test_churn();
+
+        return EXIT_SUCCESS;
+}
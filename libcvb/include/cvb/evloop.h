@@ -0,0 +1,179 @@
+/**
+ * \file       evloop.h
+ * \brief      Functions dealing with event loops.
+ *
+ * Copyright (c) 2025 Antoni Blanche
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the “Software”), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#ifndef CVB_EVLOOP_H
+#define CVB_EVLOOP_H
+
+#include <cvb/fdlist.h>
+
+/**
+ * \brief      Event loop initializer.
+ */
+#define EVLOOP_INIT {NULL, FDLIST_INIT, NULL, -1}
+
+/**
+ * \brief      Event loop backends.
+ *
+ * \see        evl_init()
+ */
+#define EVL_BACKEND_POLL  0
+#define EVL_BACKEND_EPOLL 1
+
+/**
+ * \brief      Maximum number of events reported by a single wait.
+ */
+#define EVL_MAXEVENTS 256
+
+/**
+ * \brief      Ready event.
+ *
+ * Events are expressed with the \c poll() flags (\c POLLIN, \c POLLOUT, ...)
+ * whatever the backend in use.
+ */
+struct evl_event {
+        int fd;       /**< The ready file descriptor */
+        short events; /**< The returned events       */
+};
+
+/**
+ * \brief      Backend operations.
+ */
+struct evl_ops;
+
+/**
+ * \brief      Event loop.
+ *
+ * A structure to wait for events on a set of file descriptors, whatever the
+ * underlying mechanism.
+ */
+struct evloop {
+        const struct evl_ops *ops; /**< The backend operations   */
+        struct fdlist fdl;         /**< The poll backend list    */
+        void *evs;                 /**< The backend event buffer */
+        int fd;                    /**< The backend descriptor   */
+};
+
+/**
+ * \brief      Returns a backend identifier.
+ *
+ * The \c evl_backend() function returns the backend identifier named \a name.
+ *
+ * \param[in]  name  The backend name
+ *
+ * \return     The backend identifier on success, -1 otherwise.
+ */
+int evl_backend(const char *name);
+
+/**
+ * \brief      Returns a backend name.
+ *
+ * The \c evl_name() function returns the name of the backend used by \a evl.
+ *
+ * \param[in]  evl   The event loop
+ *
+ * \return     The backend name.
+ */
+const char *evl_name(const struct evloop *evl);
+
+/**
+ * \brief      Initializes an event loop.
+ *
+ * The \c evl_init() function initializes \a evl with the backend \a backend.
+ * If \a backend is not available on the running system, then \c evl_init()
+ * returns -1 and \a evl is left untouched.
+ *
+ * \param      evl      The event loop
+ * \param[in]  backend  The backend identifier
+ *
+ * \return     0 on success, -1 otherwise.
+ */
+int evl_init(struct evloop *evl, int backend);
+
+/**
+ * \brief      Adds a file descriptor.
+ *
+ * The \c evl_add() function starts watching \a events on \a fd.
+ *
+ * \param      evl     The event loop
+ * \param[in]  fd      The file descriptor to add
+ * \param[in]  events  The requested events
+ *
+ * \return     0 on success, -1 otherwise.
+ */
+int evl_add(struct evloop *evl, int fd, short events);
+
+/**
+ * \brief      Modifies a file descriptor.
+ *
+ * The \c evl_mod() function replaces the events watched on \a fd by
+ * \a events.
+ *
+ * \param      evl     The event loop
+ * \param[in]  fd      The file descriptor to modify
+ * \param[in]  events  The requested events
+ *
+ * \return     0 on success, -1 otherwise.
+ */
+int evl_mod(struct evloop *evl, int fd, short events);
+
+/**
+ * \brief      Removes a file descriptor.
+ *
+ * The \c evl_remove() function stops watching \a fd. It must be called before
+ * \a fd is closed.
+ *
+ * \param      evl   The event loop
+ * \param[in]  fd    The file descriptor to remove
+ *
+ * \return     0 on success, -1 otherwise.
+ */
+int evl_remove(struct evloop *evl, int fd);
+
+/**
+ * \brief      Waits for events.
+ *
+ * The \c evl_wait() function waits at most \a timeout milliseconds for events
+ * and stores at most \a maxevents of them in \a evs. A negative \a timeout
+ * means an infinite timeout.
+ *
+ * \param      evl        The event loop
+ * \param[out] evs        The ready events
+ * \param[in]  maxevents  The maximum number of events
+ * \param[in]  timeout    The timeout
+ *
+ * \return     The number of ready events on success, -1 otherwise.
+ */
+int evl_wait(struct evloop *evl, struct evl_event *evs, int maxevents,
+             int timeout);
+
+/**
+ * \brief      Destroys an event loop.
+ *
+ * The \c evl_destroy() function releases all the resources held by \a evl.
+ *
+ * \param      evl   The event loop
+ */
+void evl_destroy(struct evloop *evl);
+
+#endif /* cvb/evloop.h */
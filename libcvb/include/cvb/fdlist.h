@@ -30,24 +30,48 @@
 /**
  * \brief      List initializer.
  */
-#define FDLIST_INIT {NULL, 0, 0}
+#define FDLIST_INIT {NULL, 0, 0, NULL, 0}
+
+/**
+ * \brief      Maximum size reserved from the file descriptors limit.
+ */
+#define FDL_MAXRESERVE (1 << 20)
 
 /**
  * \brief      File descriptors list.
  *
- * A structure for a list of <tt>struct pollfd<tt> with a dynamic size.
+ * A structure for a list of <tt>struct pollfd<tt> with a dynamic size. The
+ * list is kept dense, without holes, and a side table gives the position of
+ * each file descriptor so that no operation has to scan the list.
  */
 struct fdlist {
-        struct pollfd *fds;
-        nfds_t nfds;
-        nfds_t size;
+        struct pollfd *fds; /**< The file descriptors                 */
+        nfds_t nfds;        /**< The number of file descriptors       */
+        nfds_t size;        /**< The list size                        */
+        int *index;         /**< The positions, by file descriptor    */
+        int nindex;         /**< The side table size                  */
 };
 
+/**
+ * \brief      Reserves memory for a file descriptors list.
+ *
+ * The \c fdl_reserve() function makes room in \a fdl for the file descriptors
+ * from 0 to \a size - 1, so that adding them never reallocates memory. If
+ * \a size is 0, the soft \c RLIMIT_NOFILE limit is used instead, up to
+ * \c FDL_MAXRESERVE.
+ *
+ * \param      fdl   The file descriptors list
+ * \param[in]  size  The number of file descriptors
+ *
+ * \return     0 on success, -1 otherwise.
+ */
+int fdl_reserve(struct fdlist *fdl, nfds_t size);
+
 /**
  * \brief      Adds a file descriptor.
  *
  * The \c fdl_add() function adds the file descriptor \a fd at the end of the
- * file descriptor list \a fdl.
+ * file descriptor list \a fdl. A file descriptor can only be added once.
  *
  * \param      fdl     The file descriptiors list
  * \param[in]  fd      The file descriptor to add
@@ -60,10 +84,9 @@ int fdl_add(struct fdlist *fdl, int fd, short events);
 /**
  * \brief      Gets a file descriptor.
  *
- * The \c dl_get() function returns the first occurence of \a fd in the file
- * descriptors list \a fdl as a <tt>struct pollfd<tt>. If \a fd is not found in
- * \a fdl, then \c fdl_get() returns NULL.If there are other occurrences of
- * \a fd left in \a fdl, they are ignored.
+ * The \c fdl_get() function returns \a fd in the file descriptors list \a fdl
+ * as a <tt>struct pollfd<tt>. If \a fd is not found in \a fdl, then
+ * \c fdl_get() returns NULL.
  *
  * \param[in]  fdl   The file descriptors list
  * \param[in]  fd    The file descriptor wanted
@@ -75,11 +98,10 @@ struct pollfd *fdl_get(const struct fdlist *fdl, int fd);
 /**
  * \brief      Removes a file descriptor.
  *
- * The \c fdl_remove() function removes the first occurence of \a fd in the file
- * descriptors list \a fdl. After removing an element, \c fdl_remove() moves to
- * the left all the file descriptors that are after \a fd in the list. If \a fd
- * is not found in \a fdl, then \c fdl_remove() does nothing and returns -1. If
- * there are other occurrences of \a fd left in \a fdl, they are ignored.
+ * The \c fdl_remove() function removes \a fd from the file descriptors list
+ * \a fdl. The last file descriptor of the list takes its place, so the order
+ * of the list is not preserved. If \a fd is not found in \a fdl, then
+ * \c fdl_remove() does nothing and returns -1.
  *
  * \param      fdl   The file descriptors list
  * \param[in]  fd    The file descriptor to remove
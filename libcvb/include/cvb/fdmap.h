@@ -33,17 +33,22 @@
 /**
  * \brief      Map initializer.
  */
-#define FDMAP_INIT {NULL, 0, 0}
+#define FDMAP_INIT {NULL, 0, 0, NULL, 0, 0}
 
 /**
  * \brief      File descriptors map.
  *
- * A structure to name file descriptors.
+ * A structure to name file descriptors. Names are also indexed in an open
+ * addressing hash table of file descriptors, so a file descriptor is found
+ * from its name in constant time.
  */
 struct fdmap {
-        char **fdname;
-        int back;
-        int size;
+        char **fdname; /**< The names, indexed by file descriptor */
+        int back;      /**< The greatest file descriptor          */
+        int size;      /**< The names array size                  */
+        int *index;    /**< The hash table of file descriptors    */
+        int nslots;    /**< The hash table size, a power of 2     */
+        int count;     /**< The number of indexed names           */
 };
 
 /**
@@ -97,6 +102,39 @@ char *fdm_get(const struct fdmap *fdm, int fd);
  */
 int fdm_contains(const struct fdmap *fdm, const char *fdname);
 
+/**
+ * \brief      Returns the file descriptor of an interned name.
+ *
+ * The \c fdm_find() function returns the file descriptor named \a fdname,
+ * like \c fdm_contains(), for maps whose names are all interned in the same
+ * table. Names are compared by address only, and \a hash must be the 32-bit
+ * FNV-1a hash of \a fdname, as kept by its interned string, so the name is
+ * never read.
+ *
+ * \param[in]  fdm     The file descriptors map
+ * \param[in]  fdname  The interned file descriptor name
+ * \param[in]  hash    The name hash
+ *
+ * \return     The file descriptor on success, -1 otherwise.
+ */
+int fdm_find(const struct fdmap *fdm, const char *fdname,
+             unsigned int hash);
+
+/**
+ * \brief      Returns the next named file descriptor.
+ *
+ * The \c fdm_next() function iterates over the named file descriptors of
+ * \a fdm, in no particular order. The cursor \a pos must be 0 on the first
+ * call. The iteration takes time proportional to the number of names, not to
+ * the greatest file descriptor.
+ *
+ * \param[in]  fdm   The file descriptors map
+ * \param      pos   The iteration cursor
+ *
+ * \return     The next file descriptor, -1 once all have been returned.
+ */
+int fdm_next(const struct fdmap *fdm, int *pos);
+
 /**
  * \brief      Destroys a file descriptors map.
  *
@@ -0,0 +1,107 @@
+/**
+ * \file       intern.h
+ * \brief      Functions dealing with interned strings.
+ *
+ * Copyright (c) 2025 Antoni Blanche
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the “Software”), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#ifndef CVB_INTERN_H
+#define CVB_INTERN_H
+
+#include <pthread.h>
+#include <stddef.h>
+
+/**
+ * \brief      Table initializer.
+ */
+#define ITAB_INIT {NULL, 0, 0, PTHREAD_MUTEX_INITIALIZER}
+
+/**
+ * \brief      Interned string.
+ *
+ * A string stored once in a table, with its length and hash. Two interned
+ * strings of the same table are equal if and only if they are the same
+ * pointer.
+ */
+struct istr {
+        const char *str;   /**< The string, null-terminated */
+        size_t len;        /**< The string length           */
+        unsigned int hash; /**< The string hash             */
+        int refs;          /**< The reference counter       */
+};
+
+/**
+ * \brief      Interning table.
+ *
+ * An open addressing hash table of interned strings. The table is thread-safe.
+ */
+struct itab {
+        struct istr **slots;  /**< The hash table        */
+        int nslots;           /**< The table size        */
+        int count;            /**< The number of strings */
+        pthread_mutex_t lock; /**< The table lock        */
+};
+
+/**
+ * \brief      Interns a string.
+ *
+ * The \c itab_intern() function returns the interned string equal to the
+ * \a len first bytes of \a str, adding it to \a tab if needed. The caller
+ * holds a reference on the returned string.
+ *
+ * \param      tab   The interning table
+ * \param[in]  str   The string
+ * \param[in]  len   The string length
+ *
+ * \return     The interned string on success, NULL otherwise.
+ */
+struct istr *itab_intern(struct itab *tab, const char *str, size_t len);
+
+/**
+ * \brief      Takes a reference on an interned string.
+ *
+ * \param      is    The interned string
+ *
+ * \return     The interned string.
+ */
+struct istr *istr_ref(struct istr *is);
+
+/**
+ * \brief      Releases an interned string.
+ *
+ * The \c itab_release() function drops a reference on \a is, and removes it
+ * from \a tab when no reference is left. The table is only locked to drop
+ * what may be the last reference.
+ *
+ * \param      tab   The interning table
+ * \param      is    The interned string
+ */
+void itab_release(struct itab *tab, struct istr *is);
+
+/**
+ * \brief      Destroys an interning table.
+ *
+ * The \c itab_destroy() function frees all the strings still in \a tab.
+ *
+ * \param      tab   The interning table
+ */
+void itab_destroy(struct itab *tab);
+
+#endif /* cvb/intern.h */
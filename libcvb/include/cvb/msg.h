@@ -25,16 +25,79 @@
 #ifndef CVB_MSG_H
 #define CVB_MSG_H
 
+#include <stddef.h>
 #include <stdint.h>
 
+#include <sys/types.h>
+
+#include <cvb/slab.h>
+
 /**
  * \brief      Maximum message buffer size.
+ *
+ * Fields of version 1 messages are shorter than this size.
  */
 #define MSG_BUFSIZ 1024
 
+/**
+ * \brief      Protocol versions.
+ *
+ * Version 1 messages start with their code, followed by each field with a
+ * 16-bit size. Version 2 messages start with a fixed header holding the
+ * version, the code, 16 bits of flags and the 32-bit size of the payload,
+ * followed by each field with a 32-bit size. All sizes are big-endian.
+ */
+#define MSG_V1 1
+#define MSG_V2 2
+
+/**
+ * \brief      Number of protocol versions.
+ */
+#define MSG_NVERSIONS 2
+
+/**
+ * \brief      First byte of version 2 messages.
+ *
+ * The high bit is never set in a version 1 message code.
+ */
+#define MSG_V2_MAGIC 0x82
+
+/**
+ * \brief      Version 2 message header size.
+ */
+#define MSG_HDRSIZ 8
+
+/**
+ * \brief      Maximum version 2 message payload size.
+ */
+#define MSG_MAXSIZE (1 << 20)
+
+/**
+ * \brief      Message reader buffer size.
+ *
+ * Large enough to hold at least one complete version 1 message. The buffer
+ * grows as needed to hold larger version 2 messages.
+ */
+#define MSG_RDBUFSIZ (4 * MSG_BUFSIZ)
+
+/**
+ * \brief      Maximum number of fields in a message.
+ */
+#define MSG_MAXFIELDS 4
+
+/**
+ * \brief      Message reader initializer.
+ */
+#define MSG_READER_INIT {NULL, 0, 0, 0, NULL}
+
 /**
  * \brief      Message codes (from client POV)
  *
+ * Messages may follow an authentification request without waiting for its
+ * \c MSG_CODE_RECV_AUTH reply: they are processed once it succeeds, or
+ * rejected along with it up to the next request. Each rejected message gets
+ * its own status answer.
+ *
  * \see        RFC for details
  */
 #define MSG_CODE_SEND_NO_AUTH  1
@@ -50,6 +113,243 @@
 
 #define MSG_CODE_DM            9
 
+#define MSG_CODE_HELLO        10
+
+#define MSG_CODE_BATCH        11
+
+#define MSG_CODE_SENDER       12
+#define MSG_CODE_RECV_SENDER  13
+
+#define MSG_CODE_PING         14
+#define MSG_CODE_PONG         15
+
+#define MSG_CODE_JOIN         16
+#define MSG_CODE_LEAVE        17
+#define MSG_CODE_ROOM_STATUS  18
+#define MSG_CODE_SEND_ROOM    19
+#define MSG_CODE_RECV_ROOM    20
+
+#define MSG_CODE_FILE_OFFER   21
+#define MSG_CODE_FILE_ACK     22
+#define MSG_CODE_FILE_DATA    23
+#define MSG_CODE_FILE_STATUS  24
+
+#define MSG_CODE_PUBLIC_STATUS 25
+
+/**
+ * \brief      Room status, answering \c MSG_CODE_JOIN, \c MSG_CODE_LEAVE and
+ *             \c MSG_CODE_SEND_ROOM messages.
+ *
+ * A client may be a member of many rooms at once, and only receives the
+ * messages sent to its rooms.
+ */
+#define MSG_ROOM_JOINED  0
+#define MSG_ROOM_LEFT    1
+#define MSG_ROOM_REFUSED 2
+
+/**
+ * \brief      Direct message status, answering \c MSG_CODE_DM and
+ *             \c MSG_CODE_DM_REQUEST messages.
+ *
+ * A \c MSG_CODE_DM message holds the recipient name and the text, and is
+ * relayed to the recipient with the sender name instead. Only refusals are
+ * answered, when the recipient is not connected.
+ *
+ * Direct messages may also bypass the server. A \c MSG_CODE_DM_REQUEST
+ * message is relayed the same way, and answered by the recipient with a
+ * \c MSG_CODE_DM_STATUS refusal or a \c MSG_CODE_DM_CONNECT message holding
+ * the port it listens to and a token. The server relays the latter with the
+ * address of the recipient, raw bytes in network order. The requester then
+ * connects to it and sends the same \c MSG_CODE_DM_CONNECT message, with its
+ * own name and no address, before its \c MSG_CODE_DM messages. Peers use
+ * protocol version 2 without any feature, and name the sender of their
+ * messages. Clients only accept the requests of the users they have sent
+ * direct messages to, since their address is disclosed.
+ */
+#define MSG_DM_REFUSED  0
+#define MSG_DM_ACCEPTED 1
+
+/**
+ * \brief      File transfer status, ending a transfer.
+ *
+ * A \c MSG_CODE_FILE_OFFER message announces a file by identifier, size and
+ * name. The receiver accepts it with a \c MSG_CODE_FILE_ACK message granting
+ * a number of bytes, sent in \c MSG_CODE_FILE_DATA messages, and grants as
+ * many again once they are written. A transfer thus never holds more than its
+ * window on the connection, ahead of the other messages. The receiver ends it
+ * with a \c MSG_CODE_FILE_STATUS message, and so may the sender to give it
+ * up. The server stores files by client, and refuses those it already has.
+ */
+#define MSG_FILE_DONE    0
+#define MSG_FILE_REFUSED 1
+#define MSG_FILE_FAILED  2
+
+/**
+ * \brief      Public message status, answering \c MSG_CODE_SEND_PUBLIC
+ *             messages.
+ *
+ * Only refusals are answered, with the text of the message, to clients not
+ * authentified yet.
+ */
+#define MSG_PUBLIC_REFUSED 0
+
+/**
+ * \brief      Optional features, negotiated by \c MSG_CODE_HELLO messages.
+ *
+ * A client may start with a \c MSG_CODE_HELLO message holding the highest
+ * protocol version it speaks and the features it supports. The server answers
+ * with the version and the features both of them support. Servers ignoring
+ * this message never answer, and the client keeps speaking version 1 without
+ * any feature.
+ */
+#define MSG_CAP_NONE 0
+
+/**
+ * \brief      Peer accepts \c MSG_CODE_BATCH messages, with protocol version 2.
+ */
+#define MSG_CAP_BATCH (1 << 0)
+
+/**
+ * \brief      Peer accepts compressed messages, with protocol version 2.
+ */
+#define MSG_CAP_DEFLATE (1 << 1)
+
+/**
+ * \brief      Peer accepts public messages naming their sender by identifier.
+ *
+ * A \c MSG_CODE_SENDER message binds an identifier to a sender name, until
+ * another one with an empty name releases it. \c MSG_CODE_RECV_SENDER
+ * messages then carry the identifier instead of the name. Requires protocol
+ * version 2.
+ */
+#define MSG_CAP_SENDERID (1 << 2)
+
+/**
+ * \brief      Peer answers heartbeats.
+ *
+ * Either peer may send a \c MSG_CODE_PING message holding an opaque word,
+ * answered by a \c MSG_CODE_PONG message holding the same word. Peers silent
+ * for too long may be disconnected.
+ */
+#define MSG_CAP_PING (1 << 3)
+
+/**
+ * \brief      Peer accepts file transfers, with protocol version 2.
+ */
+#define MSG_CAP_FILE (1 << 4)
+
+/**
+ * \brief      Version 2 message flags.
+ *
+ * The payload of a compressed message is a raw deflate block, produced by the
+ * compression stream of the connection and shared by all its messages.
+ */
+#define MSG_FLAG_DEFLATE (1 << 0)
+
+/**
+ * \brief      Message codec initializer.
+ */
+#define MSG_CODEC_INIT {NULL, NULL, NULL, 0, NULL, 0, 0}
+
+/**
+ * \brief      Message codec.
+ *
+ * A structure holding the compression state of a connection, one stream per
+ * direction. Both streams start from the same preset dictionary and keep the
+ * history of the previous messages, so that the names and words repeated in a
+ * conversation cost a few bits each.
+ */
+struct msg_codec {
+        void *zout;             /**< The compression stream       */
+        void *zin;              /**< The decompression stream     */
+        char *buf;              /**< The decompressed payload     */
+        size_t size;            /**< The payload buffer size      */
+        struct msg_pool *pool;  /**< The compressed messages pool */
+        unsigned long nraw;     /**< The bytes before compression */
+        unsigned long nzip;     /**< The bytes after compression  */
+};
+
+/**
+ * \brief      Message reader.
+ *
+ * A structure buffering the bytes received on a socket until they form
+ * complete messages.
+ */
+struct msg_reader {
+        char *buf;               /**< The buffer              */
+        size_t size;             /**< The buffer size         */
+        size_t head;             /**< The first unparsed byte */
+        size_t tail;             /**< The first free byte     */
+        struct msg_codec *codec; /**< The codec, if any       */
+};
+
+/**
+ * \brief      Parsed message.
+ *
+ * The fields point into the reader buffer and are not null-terminated. They
+ * stay valid until the next call to \c msg_fill(). The fields of a compressed
+ * message point into the reader codec and stay valid until the next call to
+ * \c msg_parse().
+ */
+struct msg_frame {
+        const char *field[MSG_MAXFIELDS]; /**< The fields           */
+        size_t size[MSG_MAXFIELDS];       /**< The fields size      */
+        int nfields;                      /**< Number of fields     */
+        uint16_t flags;                   /**< The message flags    */
+        int8_t code;                      /**< The message code     */
+        int8_t version;                   /**< The protocol version */
+};
+
+/**
+ * \brief      Message field.
+ *
+ * A field to encode, either a text or a single byte depending on the message
+ * layout.
+ */
+struct msg_field {
+        const void *data; /**< The field data */
+        size_t size;      /**< The field size */
+};
+
+/**
+ * \brief      Encoded message flag: never dropped nor merged by a queue.
+ */
+#define MSG_BUF_KEEP 0x01
+
+/**
+ * \brief      Encoded message.
+ *
+ * A structure holding a message ready to be written on a socket. An encoded
+ * message is immutable and may be shared by several output queues, it is freed
+ * when its last reference is released. Its flags are set, if any, before it is
+ * queued.
+ */
+struct msg_buf {
+        char *data;        /**< The encoded bytes            */
+        size_t size;       /**< The encoded size             */
+        int refs;          /**< The reference counter        */
+        int8_t code;       /**< The message code             */
+        int8_t version;    /**< The protocol version         */
+        int8_t flags;      /**< The buffer flags             */
+        struct slab *slab; /**< The slab holding it, if any  */
+};
+
+/**
+ * \brief      Number of message pool size classes.
+ */
+#define MSG_POOL_NCLASSES 4
+
+/**
+ * \brief      Message pool.
+ *
+ * A structure to allocate encoded messages from slabs, one per size class.
+ * Messages too large for every class are allocated from the heap and counted.
+ */
+struct msg_pool {
+        struct slab slabs[MSG_POOL_NCLASSES]; /**< The slabs, by size class */
+        unsigned long nmalloc;                /**< The heap allocations     */
+};
+
 /**
  * \brief      Receives a message code.
  *
@@ -127,4 +427,283 @@ int msg_send_bytes(int sfd, const void *buf, short size);
  */
 int msg_send_text(int sfd, const char *text, short size);
 
+/**
+ * \brief      Sends a message frame.
+ *
+ * The \c msg_send_frame() function writes the message \a code followed by the
+ * \a nfields fields \a fields to \a sfd with a single vectored write, retried
+ * only if the socket accepts part of the frame.
+ *
+ * \param[in]  sfd      The socket
+ * \param[in]  version  The protocol version
+ * \param[in]  code     The message code
+ * \param[in]  fields   The message fields
+ * \param[in]  nfields  The number of fields
+ *
+ * \return     The number of bytes sent on success, -1 otherwise.
+ */
+ssize_t msg_send_frame(int sfd, int version, int8_t code,
+                       const struct msg_field *fields, int nfields);
+
+/**
+ * \brief      Sends an encoded message.
+ *
+ * The \c msg_send_buf() function writes \a buf to \a sfd, retried only if the
+ * socket accepts part of the message.
+ *
+ * \param[in]  sfd   The socket
+ * \param[in]  buf   The encoded message
+ *
+ * \return     The number of bytes sent on success, -1 otherwise.
+ */
+ssize_t msg_send_buf(int sfd, const struct msg_buf *buf);
+
+/**
+ * \brief      Sends a message frame ending with file contents.
+ *
+ * The \c msg_send_file() function writes the version 2 message \a code
+ * followed by the \a nfields fields \a fields, and by a last text field
+ * holding \a count bytes of \a fd from \a offset. These bytes are copied by
+ * \c sendfile(), without crossing user space. Unlike the other functions, a
+ * closed socket raises \c SIGPIPE. A file shorter than expected is padded
+ * with null bytes, so that the frame is still complete, and fails with
+ * \c EIO.
+ *
+ * \param[in]  sfd      The socket
+ * \param[in]  code     The message code
+ * \param[in]  fields   The message fields, but the last one
+ * \param[in]  nfields  The number of fields, but the last one
+ * \param[in]  fd       The file
+ * \param      offset   The file offset, moved past the bytes sent
+ * \param[in]  count    The number of bytes to send from the file
+ *
+ * \return     The number of bytes sent on success, -1 otherwise.
+ */
+ssize_t msg_send_file(int sfd, int8_t code, const struct msg_field *fields,
+                      int nfields, int fd, off_t *offset, size_t count);
+
+/**
+ * \brief      Fills a message reader.
+ *
+ * The \c msg_fill() function performs a single non-blocking read from \a sfd
+ * into the buffer of \a rd.
+ *
+ * \param      rd    The message reader
+ * \param[in]  sfd   The socket
+ *
+ * \return     The number of bytes received on success, 0 if the peer closed
+ *             the connection, -1 otherwise.
+ */
+ssize_t msg_fill(struct msg_reader *rd, int sfd);
+
+/**
+ * \brief      Parses a message.
+ *
+ * The \c msg_parse() function extracts the next complete message buffered in
+ * \a rd and stores it in \a frame. It must be called until it returns 0 to
+ * consume all the messages received by \c msg_fill(). The protocol version is
+ * detected from the first byte of each message. The fields of unknown version
+ * 2 messages are skipped. Compressed messages are inflated with the codec of
+ * \a rd, and are not valid if it has none.
+ *
+ * \param      rd     The message reader
+ * \param[out] frame  The parsed message
+ *
+ * \return     1 if a message was parsed, 0 if more bytes are needed, -1 if
+ *             the buffered bytes are not a valid message.
+ */
+int msg_parse(struct msg_reader *rd, struct msg_frame *frame);
+
+/**
+ * \brief      Parses a message from a batch.
+ *
+ * The \c msg_unbatch() function extracts the message at offset \a pos of the
+ * \c MSG_CODE_BATCH message \a batch, stores it in \a frame and moves \a pos
+ * to the next message. The fields of \a frame point into \a batch.
+ *
+ * \param[in]  batch  The batch message
+ * \param      pos    The offset of the message, 0 for the first one
+ * \param[out] frame  The parsed message
+ *
+ * \return     1 if a message was parsed, 0 at the end of the batch, -1 if the
+ *             batch is not valid.
+ */
+int msg_unbatch(const struct msg_frame *batch, size_t *pos,
+                struct msg_frame *frame);
+
+/**
+ * \brief      Receives a message frame.
+ *
+ * The \c msg_recv_frame() function waits until a complete message is buffered
+ * in \a rd, filling it from \a sfd, and stores it in \a frame.
+ *
+ * \param      rd     The message reader
+ * \param[in]  sfd    The socket
+ * \param[out] frame  The parsed message
+ *
+ * \return     1 if a message was received, -1 otherwise.
+ */
+int msg_recv_frame(struct msg_reader *rd, int sfd, struct msg_frame *frame);
+
+/**
+ * \brief      Encodes a message.
+ *
+ * The \c msg_buf_new() function encodes a message with code \a code and the
+ * \a nfields fields \a fields in a newly allocated buffer. The returned message
+ * holds one reference.
+ *
+ * \param[in]  code     The message code
+ * \param[in]  fields   The message fields
+ * \param[in]  nfields  The number of fields
+ *
+ * \return     The encoded message on success, NULL otherwise.
+ */
+struct msg_buf *msg_buf_new(int8_t code, const struct msg_field *fields,
+                            int nfields);
+
+/**
+ * \brief      Encodes a message in a pool.
+ *
+ * The \c msg_buf_alloc() function works as \c msg_buf_new(), but takes the
+ * buffer from \a pool. It must always be called from the same thread for a
+ * given pool, while the message may be released from any thread.
+ *
+ * \param      pool     The message pool, or NULL for the heap
+ * \param[in]  code     The message code
+ * \param[in]  fields   The message fields
+ * \param[in]  nfields  The number of fields
+ *
+ * \return     The encoded message on success, NULL otherwise.
+ */
+struct msg_buf *msg_buf_alloc(struct msg_pool *pool, int8_t code,
+                              const struct msg_field *fields, int nfields);
+
+/**
+ * \brief      Encodes a message for a protocol version.
+ *
+ * The \c msg_buf_encode() function works as \c msg_buf_alloc(), but encodes
+ * the message with the protocol \a version. \c msg_buf_alloc() encodes version
+ * 1 messages.
+ *
+ * \param      pool     The message pool, or NULL for the heap
+ * \param[in]  version  The protocol version
+ * \param[in]  code     The message code
+ * \param[in]  fields   The message fields
+ * \param[in]  nfields  The number of fields
+ *
+ * \return     The encoded message on success, NULL otherwise. In particular,
+ *             errno is set to EMSGSIZE if the message is too large for
+ *             \a version.
+ */
+struct msg_buf *msg_buf_encode(struct msg_pool *pool, int version, int8_t code,
+                               const struct msg_field *fields, int nfields);
+
+/**
+ * \brief      Encodes a batch of messages.
+ *
+ * The \c msg_buf_batch() function encodes a \c MSG_CODE_BATCH message holding
+ * a copy of the \a nbufs version 2 messages \a bufs, in order.
+ *
+ * \param      pool   The message pool, or NULL for the heap
+ * \param[in]  bufs   The encoded messages
+ * \param[in]  nbufs  The number of messages
+ *
+ * \return     The encoded batch on success, NULL otherwise. In particular,
+ *             errno is set to EMSGSIZE if the messages do not fit in a single
+ *             message.
+ */
+struct msg_buf *msg_buf_batch(struct msg_pool *pool,
+                              struct msg_buf *const *bufs, int nbufs);
+
+/**
+ * \brief      Compresses an encoded message.
+ *
+ * The \c msg_buf_deflate() function compresses the payload of the version 2
+ * message \a buf with the output stream of \a codec. The compressed messages
+ * must be sent in the order of their compression.
+ *
+ * \param      codec  The message codec
+ * \param[in]  buf    The encoded message
+ *
+ * \return     The compressed message on success, NULL otherwise. In particular,
+ *             errno is set to EMSGSIZE if the compressed payload might not fit
+ *             in a single message, in which case the stream is left untouched
+ *             and \a buf may be sent as is.
+ */
+struct msg_buf *msg_buf_deflate(struct msg_codec *codec,
+                                const struct msg_buf *buf);
+
+/**
+ * \brief      Takes a reference on an encoded message.
+ *
+ * The \c msg_buf_ref() function increments the reference counter of \a buf.
+ * References may be taken and released from different threads.
+ *
+ * \param      buf   The encoded message
+ *
+ * \return     The encoded message.
+ */
+struct msg_buf *msg_buf_ref(struct msg_buf *buf);
+
+/**
+ * \brief      Releases an encoded message.
+ *
+ * The \c msg_buf_free() function decrements the reference counter of \a buf
+ * and frees it when no reference is left.
+ *
+ * \param      buf   The encoded message
+ */
+void msg_buf_free(struct msg_buf *buf);
+
+/**
+ * \brief      Initializes a message pool.
+ *
+ * \param      pool   The message pool
+ * \param[in]  flags  The slab flags
+ *
+ * \return     0 on success, -1 otherwise.
+ */
+int msg_pool_init(struct msg_pool *pool, int flags);
+
+/**
+ * \brief      Destroys a message pool.
+ *
+ * The \c msg_pool_destroy() function frees the memory of \a pool. Messages
+ * still referenced become invalid.
+ *
+ * \param      pool  The message pool
+ */
+void msg_pool_destroy(struct msg_pool *pool);
+
+/**
+ * \brief      Initializes a message codec.
+ *
+ * The \c msg_codec_init() function sets up both compression streams of
+ * \a codec. Compressed messages are taken from \a pool, which must only be
+ * used from the thread compressing them.
+ *
+ * \param      codec  The message codec
+ * \param      pool   The message pool, or NULL for the heap
+ *
+ * \return     0 on success, -1 otherwise. In particular, errno is set to
+ *             ENOTSUP if the library is built without compression.
+ */
+int msg_codec_init(struct msg_codec *codec, struct msg_pool *pool);
+
+/**
+ * \brief      Destroys a message codec.
+ *
+ * \param      codec  The message codec
+ */
+void msg_codec_destroy(struct msg_codec *codec);
+
+/**
+ * \brief      Destroys a message reader.
+ *
+ * The \c msg_reader_destroy() function frees the buffer of \a rd.
+ *
+ * \param      rd    The message reader
+ */
+void msg_reader_destroy(struct msg_reader *rd);
+
 #endif /* cvb/msg.h */
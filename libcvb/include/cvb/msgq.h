@@ -0,0 +1,135 @@
+/**
+ * \file       msgq.h
+ * \brief      Functions dealing with outgoing message queues.
+ *
+ * Copyright (c) 2025 Antoni Blanche
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the “Software”), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#ifndef CVB_MSGQ_H
+#define CVB_MSGQ_H
+
+#include <stddef.h>
+
+#include <sys/types.h>
+
+#include <cvb/msg.h>
+
+/**
+ * \brief      Queue initializer.
+ */
+#define MSGQ_INIT {NULL, 0, 0, 0, 0, 0, NULL, 0}
+
+/**
+ * \brief      Outgoing message queue.
+ *
+ * A circular buffer of encoded messages waiting to be written on a socket.
+ * With a codec, version 2 messages are compressed right before their first
+ * write. Compressed messages are sealed: they are neither dropped nor merged,
+ * since the peer needs all of them to follow the compression stream.
+ */
+struct msgq {
+        struct msg_buf **bufs;   /**< The queued messages            */
+        size_t size;             /**< The queue capacity             */
+        size_t head;             /**< The first queued message       */
+        size_t count;            /**< The number of queued messages  */
+        size_t off;              /**< The bytes of head already sent */
+        size_t bytes;            /**< The number of pending bytes    */
+        struct msg_codec *codec; /**< The codec, if any              */
+        size_t sealed;           /**< The number of sealed messages  */
+};
+
+/**
+ * \brief      Appends a message.
+ *
+ * The \c mq_push() function appends \a buf at the end of \a mq. On success,
+ * \a mq takes the ownership of \a buf.
+ *
+ * \param      mq    The message queue
+ * \param      buf   The encoded message
+ *
+ * \return     0 on success, -1 otherwise.
+ */
+int mq_push(struct msgq *mq, struct msg_buf *buf);
+
+/**
+ * \brief      Drops a message.
+ *
+ * The \c mq_drop() function removes the oldest message with code \a code not
+ * partially written nor sealed yet from \a mq. Messages flagged with
+ * \c MSG_BUF_KEEP are never dropped.
+ *
+ * \param      mq    The message queue
+ * \param[in]  code  The message code
+ *
+ * \return     0 if a message has been dropped, -1 otherwise.
+ */
+int mq_drop(struct msgq *mq, int8_t code);
+
+/**
+ * \brief      Merges two messages.
+ *
+ * The \c mq_coalesce() function replaces the two oldest consecutive messages
+ * with code \a code not partially written nor sealed yet, and whose fields
+ * are identical except the first one, by a single message. The first text
+ * fields are joined by a newline. Messages flagged with \c MSG_BUF_KEEP are
+ * never merged.
+ *
+ * \param      mq    The message queue
+ * \param[in]  code  The message code
+ *
+ * \return     0 if two messages have been merged, -1 otherwise.
+ */
+int mq_coalesce(struct msgq *mq, int8_t code);
+
+/**
+ * \brief      Sets the codec of a message queue.
+ *
+ * The \c mq_set_codec() function compresses the messages appended to \a mq
+ * from now on with \a codec. The messages already queued are sent as is.
+ *
+ * \param      mq     The message queue
+ * \param      codec  The message codec
+ */
+void mq_set_codec(struct msgq *mq, struct msg_codec *codec);
+
+/**
+ * \brief      Writes queued messages.
+ *
+ * The \c mq_flush() function writes as many queued messages as possible on
+ * \a sfd, several messages per system call, without blocking. Messages fully
+ * written are removed from \a mq.
+ *
+ * \param      mq    The message queue
+ * \param[in]  sfd   The socket
+ *
+ * \return     The number of bytes written on success, -1 otherwise.
+ */
+ssize_t mq_flush(struct msgq *mq, int sfd);
+
+/**
+ * \brief      Destroys a message queue.
+ *
+ * The \c mq_destroy() function frees all the messages left in \a mq.
+ *
+ * \param      mq    The message queue
+ */
+void mq_destroy(struct msgq *mq);
+
+#endif /* cvb/msgq.h */
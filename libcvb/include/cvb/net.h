@@ -25,6 +25,16 @@
 #ifndef CVB_NET_H
 #define CVB_NET_H
 
+/**
+ * \brief      Lets several listening sockets share a service.
+ */
+#define NET_REUSEPORT 1
+
+/**
+ * \brief      Returns connecting sockets without waiting for the connection.
+ */
+#define NET_NONBLOCK 2
+
 /**
  * \brief      Fetches a socket.
  *
@@ -32,13 +42,20 @@
  * parameters \a host and \a service. If the \a host is NULL, then
  * \c net_fetch_socket() will return a socket suitable for \c net_accept_clnt().
  * Otherwise, the socket will be \c connect()ed directly to the \a host.
+ * Listening sockets fetched with \c NET_REUSEPORT are bound with
+ * \c SO_REUSEPORT, so that several of them can share the same \a service.
+ * Connecting sockets fetched with \c NET_NONBLOCK are non-blocking, and
+ * returned while the connection is still in progress: it is complete once
+ * the socket is writable, and \c SO_ERROR then gives its result.
  *
  * \param[in]  host     The host
  * \param[in]  service  The service
+ * \param[in]  flags    The socket flags: 0, \c NET_REUSEPORT or
+ *                      \c NET_NONBLOCK
  *
  * \return     The fetched socket.
  */
-int net_fetch_socket(const char *host, const char *service);
+int net_fetch_socket(const char *host, const char *service, int flags);
 
 /**
  * \brief      Fetches next socket.
@@ -68,4 +85,18 @@ int net_fetch_next(void);
  */
 int net_accept_clnt(int listener);
 
+/**
+ * \brief      Enables TCP keepalive.
+ *
+ * The \c net_keepalive() function makes the system probe the peer of \a sfd
+ * after \a idle seconds of silence, so that a dead peer makes the socket
+ * fail instead of hanging forever.
+ *
+ * \param[in]  sfd   The connected socket
+ * \param[in]  idle  The idle time before probing, in seconds
+ *
+ * \return     0 on success, -1 otherwise.
+ */
+int net_keepalive(int sfd, int idle);
+
 #endif /* cvb/net.h */
@@ -0,0 +1,116 @@
+/**
+ * \file       slab.h
+ * \brief      Functions dealing with fixed-size object allocation.
+ *
+ * Copyright (c) 2025 Antoni Blanche
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the “Software”), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#ifndef CVB_SLAB_H
+#define CVB_SLAB_H
+
+#include <stddef.h>
+
+/**
+ * \brief      Slab initializer.
+ */
+#define SLAB_INIT {0, 0, 0, NULL, NULL, NULL, 0, 0, 0}
+
+/**
+ * \brief      Backs a slab with huge pages when possible.
+ */
+#define SLAB_HUGEPAGE 1
+
+/**
+ * \brief      Chunk sizes.
+ */
+#define SLAB_CHUNK     (64 * 1024)
+#define SLAB_HUGECHUNK (2 * 1024 * 1024)
+
+/**
+ * \brief      Slab allocator.
+ *
+ * A structure to allocate objects of a single size from large chunks of
+ * memory, which are only given back to the system when the slab is destroyed.
+ * Freed objects are kept in a free list and reused by the next allocations.
+ *
+ * Objects must be allocated by a single thread, but may be freed by any
+ * thread: frees are pushed on a lock-free list that the allocating thread
+ * reclaims when its own free list is empty.
+ */
+struct slab {
+        size_t objsize;        /**< The object size, aligned           */
+        size_t chunksize;      /**< The chunk size                     */
+        int flags;             /**< The slab flags                     */
+        void *chunks;          /**< The allocated chunks               */
+        void *free;            /**< The free objects                   */
+        void *remote;          /**< The objects freed, to be reclaimed */
+        unsigned long nalloc;  /**< The number of allocations          */
+        unsigned long nfree;   /**< The number of frees                */
+        unsigned long nchunks; /**< The number of allocated chunks     */
+};
+
+/**
+ * \brief      Initializes a slab.
+ *
+ * The \c slab_init() function initializes \a slab for objects of \a objsize
+ * bytes.
+ *
+ * \param      slab     The slab
+ * \param[in]  objsize  The object size
+ * \param[in]  flags    The slab flags: 0 or \c SLAB_HUGEPAGE
+ *
+ * \return     0 on success, -1 otherwise.
+ */
+int slab_init(struct slab *slab, size_t objsize, int flags);
+
+/**
+ * \brief      Allocates an object.
+ *
+ * The \c slab_alloc() function returns a free object of \a slab, allocating
+ * a new chunk only when no object is left.
+ *
+ * \param      slab  The slab
+ *
+ * \return     The object on success, NULL otherwise.
+ */
+void *slab_alloc(struct slab *slab);
+
+/**
+ * \brief      Frees an object.
+ *
+ * The \c slab_free() function gives \a obj back to \a slab. It may be called
+ * from any thread.
+ *
+ * \param      slab  The slab
+ * \param      obj   The object
+ */
+void slab_free(struct slab *slab, void *obj);
+
+/**
+ * \brief      Destroys a slab.
+ *
+ * The \c slab_destroy() function gives all the chunks of \a slab back to the
+ * system. Objects still allocated become invalid.
+ *
+ * \param      slab  The slab
+ */
+void slab_destroy(struct slab *slab);
+
+#endif /* cvb/slab.h */
@@ -0,0 +1,186 @@
+/**
+ * \file       timer.h
+ * \brief      Functions dealing with timers.
+ *
+ * Copyright (c) 2025 Antoni Blanche
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the “Software”), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#ifndef CVB_TIMER_H
+#define CVB_TIMER_H
+
+#include <stdint.h>
+
+/**
+ * \brief      Timer initializer.
+ */
+#define TIMER_INIT {NULL, NULL, 0, 0, NULL, NULL}
+
+/**
+ * \brief      Timer wheel initializer.
+ */
+#define TIMERWHEEL_INIT {{{NULL}}, {0}, 0, 0, 0, 0}
+
+/**
+ * \brief      Default tick, in milliseconds.
+ */
+#define TW_TICK 10
+
+/**
+ * \brief      Wheel geometry.
+ *
+ * Each level has \c TW_SIZE slots, a slot of a level spanning a whole turn
+ * of the level below. Longer delays are clamped to \c TW_MAXTICKS ticks.
+ */
+#define TW_BITS     6
+#define TW_SIZE     (1 << TW_BITS)
+#define TW_LEVELS   4
+#define TW_MAXTICKS ((1UL << (TW_BITS * TW_LEVELS)) - 1)
+
+/**
+ * \brief      Timer.
+ *
+ * Timers are embedded in the structures they work for, so that arming and
+ * cancelling them never allocates.
+ */
+struct timer {
+        struct timer *next;    /**< The next timer of the slot       */
+        struct timer **pprev;  /**< The link pointing to this timer  */
+        unsigned long expires; /**< The expiration tick              */
+        int slot;              /**< The slot, as level * TW_SIZE + i */
+        void (*fn)(void *);    /**< The expiration callback          */
+        void *arg;             /**< The callback argument            */
+};
+
+/**
+ * \brief      Hierarchical timer wheel.
+ *
+ * A structure to expire timers with a coarse granularity. Timers are hashed
+ * by expiration tick into the slots of the first level, or of an upper level
+ * when they expire later, and moved down a level each time the level below
+ * completes a turn. Adding and cancelling a timer are O(1) whatever the
+ * number of timers.
+ *
+ * A timer wheel is meant to be driven by a single thread, through the
+ * timeout of its event loop.
+ */
+struct timerwheel {
+        struct timer *slots[TW_LEVELS][TW_SIZE]; /**< The timer slots        */
+        uint64_t used[TW_LEVELS];                /**< The non-empty slots    */
+        unsigned long now;                       /**< The next tick to run   */
+        unsigned long count;                     /**< The number of timers   */
+        long tick;                               /**< The tick length, in ms */
+        long start;                              /**< The start time, in s   */
+};
+
+/**
+ * \brief      Initializes a timer wheel.
+ *
+ * The \c tw_init() function initializes \a tw with ticks of \a tick
+ * milliseconds.
+ *
+ * \param      tw    The timer wheel
+ * \param[in]  tick  The tick length, in milliseconds
+ *
+ * \return     0 on success, -1 otherwise.
+ */
+int tw_init(struct timerwheel *tw, long tick);
+
+/**
+ * \brief      Returns the elapsed time.
+ *
+ * The \c tw_now() function returns the clock of \a tw, on which timers are
+ * armed.
+ *
+ * \param[in]  tw    The timer wheel
+ *
+ * \return     The milliseconds elapsed since \a tw was initialized.
+ */
+long tw_now(const struct timerwheel *tw);
+
+/**
+ * \brief      Initializes a timer.
+ *
+ * The \c tw_timer() function initializes \a timer to call \a fn with \a arg
+ * on expiration.
+ *
+ * \param      timer  The timer
+ * \param[in]  fn     The expiration callback
+ * \param      arg    The callback argument
+ */
+void tw_timer(struct timer *timer, void (*fn)(void *), void *arg);
+
+/**
+ * \brief      Arms a timer.
+ *
+ * The \c tw_add() function arms \a timer to expire in \a delay milliseconds,
+ * or later by at most a tick. A pending timer is armed again.
+ *
+ * \param      tw     The timer wheel
+ * \param      timer  The timer
+ * \param[in]  delay  The delay, in milliseconds
+ */
+void tw_add(struct timerwheel *tw, struct timer *timer, long delay);
+
+/**
+ * \brief      Cancels a timer.
+ *
+ * The \c tw_cancel() function disarms \a timer. Cancelling a timer which is
+ * not pending does nothing.
+ *
+ * \param      tw     The timer wheel
+ * \param      timer  The timer
+ */
+void tw_cancel(struct timerwheel *tw, struct timer *timer);
+
+/**
+ * \brief      Checks whether a timer is pending.
+ *
+ * \param[in]  timer  The timer
+ *
+ * \return     1 if \a timer is armed, 0 otherwise.
+ */
+int tw_pending(const struct timer *timer);
+
+/**
+ * \brief      Returns the event loop timeout.
+ *
+ * The \c tw_timeout() function returns the number of milliseconds until
+ * \a tw has work to do, to be used as an event loop timeout.
+ *
+ * \param[in]  tw    The timer wheel
+ *
+ * \return     The timeout in milliseconds, -1 if no timer is pending.
+ */
+int tw_timeout(const struct timerwheel *tw);
+
+/**
+ * \brief      Runs expired timers.
+ *
+ * The \c tw_run() function calls the callback of every timer of \a tw
+ * expired by now. Callbacks may add or cancel any timer, including their
+ * own.
+ *
+ * \param      tw    The timer wheel
+ *
+ * \return     The number of expired timers.
+ */
+int tw_run(struct timerwheel *tw);
+
+#endif /* cvb/timer.h */
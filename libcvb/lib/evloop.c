@@ -0,0 +1,225 @@
+/**
+ * \file       evloop.c
+ * \brief      Functions dealing with event loops.
+ *
+ * Copyright (c) 2025 Antoni Blanche
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the “Software”), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include <assert.h>
+#include <errno.h>
+#include <stddef.h>
+#include <string.h>
+
+#include <cvb/evloop.h>
+
+#include "evloop_ops.h"
+
+/**
+ * \brief      Available backends, indexed by identifier.
+ */
+static const struct evl_ops *const backends[] = {
+        &evl_poll_ops,
+        &evl_epoll_ops
+};
+
+/**
+ * \brief      Number of available backends.
+ */
+#define NBACKENDS ((int) (sizeof(backends) / sizeof(backends[0])))
+
+/**
+ * \brief      Returns a backend identifier.
+ *
+ * The \c evl_backend() function returns the backend identifier named \a name.
+ *
+ * \param[in]  name  The backend name
+ *
+ * \return     The backend identifier on success, -1 otherwise.
+ */
+int evl_backend(const char *const name)
+{
+        int i;
+
+        assert(name != NULL);
+
+        for (i = 0; i < NBACKENDS; ++i) {
+                if ((backends[i] != NULL)
+                    && (strcmp(backends[i]->name, name) == 0))
+                        return i;
+        }
+
+        return -1;
+}
+
+/**
+ * \brief      Returns a backend name.
+ *
+ * The \c evl_name() function returns the name of the backend used by \a evl.
+ *
+ * \param[in]  evl   The event loop
+ *
+ * \return     The backend name.
+ */
+const char *evl_name(const struct evloop *const evl)
+{
+        assert(evl != NULL);
+
+        if (evl->ops == NULL)
+                return "none";
+
+        return evl->ops->name;
+}
+
+/**
+ * \brief      Initializes an event loop.
+ *
+ * The \c evl_init() function initializes \a evl with the backend \a backend.
+ * If \a backend is not available on the running system, then \c evl_init()
+ * returns -1 and \a evl is left untouched.
+ *
+ * \param      evl      The event loop
+ * \param[in]  backend  The backend identifier
+ *
+ * \return     0 on success, -1 otherwise.
+ */
+int evl_init(struct evloop *const evl, const int backend)
+{
+        assert(evl != NULL);
+        assert(evl->ops == NULL);
+
+        if ((backend < 0) || (backend >= NBACKENDS)
+            || (backends[backend] == NULL)) {
+                errno = ENOSYS;
+
+                return -1;
+        }
+
+        if (backends[backend]->init(evl) != 0)
+                return -1;
+
+        evl->ops = backends[backend];
+
+        return 0;
+}
+
+/**
+ * \brief      Adds a file descriptor.
+ *
+ * The \c evl_add() function starts watching \a events on \a fd.
+ *
+ * \param      evl     The event loop
+ * \param[in]  fd      The file descriptor to add
+ * \param[in]  events  The requested events
+ *
+ * \return     0 on success, -1 otherwise.
+ */
+int evl_add(struct evloop *const evl, const int fd, const short events)
+{
+        assert(evl != NULL);
+        assert(evl->ops != NULL);
+        assert(fd >= 0);
+
+        return evl->ops->add(evl, fd, events);
+}
+
+/**
+ * \brief      Modifies a file descriptor.
+ *
+ * The \c evl_mod() function replaces the events watched on \a fd by
+ * \a events.
+ *
+ * \param      evl     The event loop
+ * \param[in]  fd      The file descriptor to modify
+ * \param[in]  events  The requested events
+ *
+ * \return     0 on success, -1 otherwise.
+ */
+int evl_mod(struct evloop *const evl, const int fd, const short events)
+{
+        assert(evl != NULL);
+        assert(evl->ops != NULL);
+        assert(fd >= 0);
+
+        return evl->ops->mod(evl, fd, events);
+}
+
+/**
+ * \brief      Removes a file descriptor.
+ *
+ * The \c evl_remove() function stops watching \a fd. It must be called before
+ * \a fd is closed.
+ *
+ * \param      evl   The event loop
+ * \param[in]  fd    The file descriptor to remove
+ *
+ * \return     0 on success, -1 otherwise.
+ */
+int evl_remove(struct evloop *const evl, const int fd)
+{
+        assert(evl != NULL);
+        assert(evl->ops != NULL);
+
+        if (fd < 0)
+                return -1;
+
+        return evl->ops->remove(evl, fd);
+}
+
+/**
+ * \brief      Waits for events.
+ *
+ * The \c evl_wait() function waits at most \a timeout milliseconds for events
+ * and stores at most \a maxevents of them in \a evs. A negative \a timeout
+ * means an infinite timeout.
+ *
+ * \param      evl        The event loop
+ * \param[out] evs        The ready events
+ * \param[in]  maxevents  The maximum number of events
+ * \param[in]  timeout    The timeout
+ *
+ * \return     The number of ready events on success, -1 otherwise.
+ */
+int evl_wait(struct evloop *const evl, struct evl_event *const evs,
+             const int maxevents, const int timeout)
+{
+        assert(evl != NULL);
+        assert(evl->ops != NULL);
+        assert(evs != NULL);
+        assert(maxevents > 0);
+
+        return evl->ops->wait(evl, evs, maxevents, timeout);
+}
+
+/**
+ * \brief      Destroys an event loop.
+ *
+ * The \c evl_destroy() function releases all the resources held by \a evl.
+ *
+ * \param      evl   The event loop
+ */
+void evl_destroy(struct evloop *const evl)
+{
+        assert(evl != NULL);
+
+        if (evl->ops != NULL)
+                evl->ops->destroy(evl);
+
+        evl->ops = NULL;
+}
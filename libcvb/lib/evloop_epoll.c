@@ -0,0 +1,231 @@
+/**
+ * \file       evloop_epoll.c
+ * \brief      Event loop backend based on epoll().
+ *
+ * Copyright (c) 2025 Antoni Blanche
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the “Software”), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include <assert.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <sys/epoll.h>
+
+#include <cvb/evloop.h>
+
+#include "evloop_ops.h"
+
+/**
+ * \brief      Converts \c poll() flags to \c epoll() flags.
+ *
+ * \param[in]  events  The \c poll() flags
+ *
+ * \return     The \c epoll() flags.
+ */
+static uint32_t evl_to_epoll(const short events)
+{
+        uint32_t ev = 0;
+
+        if (events & POLLIN)
+                ev = ev | EPOLLIN;
+
+        if (events & POLLOUT)
+                ev = ev | EPOLLOUT;
+
+        return ev;
+}
+
+/**
+ * \brief      Converts \c epoll() flags to \c poll() flags.
+ *
+ * \param[in]  ev    The \c epoll() flags
+ *
+ * \return     The \c poll() flags.
+ */
+static short evl_from_epoll(const uint32_t ev)
+{
+        short events = 0;
+
+        if (ev & EPOLLIN)
+                events = events | POLLIN;
+
+        if (ev & EPOLLOUT)
+                events = events | POLLOUT;
+
+        if (ev & EPOLLERR)
+                events = events | POLLERR;
+
+        if (ev & EPOLLHUP)
+                events = events | POLLHUP;
+
+        return events;
+}
+
+/**
+ * \brief      Initializes the backend.
+ *
+ * \param      evl   The event loop
+ *
+ * \return     0 on success, -1 otherwise.
+ */
+static int evl_epoll_init(struct evloop *const evl)
+{
+        evl->evs = malloc(EVL_MAXEVENTS * sizeof(struct epoll_event));
+
+        if (evl->evs == NULL)
+                return -1;
+
+        evl->fd = epoll_create1(EPOLL_CLOEXEC);
+
+        if (evl->fd < 0) {
+                free(evl->evs);
+                evl->evs = NULL;
+
+                return -1;
+        }
+
+        return 0;
+}
+
+/**
+ * \brief      Updates a file descriptor.
+ *
+ * \param      evl     The event loop
+ * \param[in]  op      The \c epoll_ctl() operation
+ * \param[in]  fd      The file descriptor
+ * \param[in]  events  The requested events
+ *
+ * \return     0 on success, -1 otherwise.
+ */
+static int evl_epoll_ctl(struct evloop *const evl, const int op, const int fd,
+                         const short events)
+{
+        struct epoll_event ev;
+
+        ev.events = evl_to_epoll(events);
+        ev.data.fd = fd;
+
+        return epoll_ctl(evl->fd, op, fd, &ev);
+}
+
+/**
+ * \brief      Adds a file descriptor.
+ *
+ * \param      evl     The event loop
+ * \param[in]  fd      The file descriptor to add
+ * \param[in]  events  The requested events
+ *
+ * \return     0 on success, -1 otherwise.
+ */
+static int evl_epoll_add(struct evloop *const evl, const int fd,
+                         const short events)
+{
+        return evl_epoll_ctl(evl, EPOLL_CTL_ADD, fd, events);
+}
+
+/**
+ * \brief      Modifies a file descriptor.
+ *
+ * \param      evl     The event loop
+ * \param[in]  fd      The file descriptor to modify
+ * \param[in]  events  The requested events
+ *
+ * \return     0 on success, -1 otherwise.
+ */
+static int evl_epoll_mod(struct evloop *const evl, const int fd,
+                         const short events)
+{
+        return evl_epoll_ctl(evl, EPOLL_CTL_MOD, fd, events);
+}
+
+/**
+ * \brief      Removes a file descriptor.
+ *
+ * \param      evl   The event loop
+ * \param[in]  fd    The file descriptor to remove
+ *
+ * \return     0 on success, -1 otherwise.
+ */
+static int evl_epoll_remove(struct evloop *const evl, const int fd)
+{
+        return epoll_ctl(evl->fd, EPOLL_CTL_DEL, fd, NULL);
+}
+
+/**
+ * \brief      Waits for events.
+ *
+ * Only the ready file descriptors are returned by the kernel, so each wakeup
+ * costs the number of events rather than the number of watched descriptors.
+ *
+ * \param      evl        The event loop
+ * \param[out] evs        The ready events
+ * \param[in]  maxevents  The maximum number of events
+ * \param[in]  timeout    The timeout
+ *
+ * \return     The number of ready events on success, -1 otherwise.
+ */
+static int evl_epoll_wait(struct evloop *const evl, struct evl_event *const evs,
+                          const int maxevents, const int timeout)
+{
+        struct epoll_event *epevs = (struct epoll_event *) evl->evs;
+        int i, ready;
+
+        ready = epoll_wait(evl->fd, epevs,
+                           maxevents < EVL_MAXEVENTS ? maxevents : EVL_MAXEVENTS,
+                           timeout);
+
+        for (i = 0; i < ready; ++i) {
+                evs[i].fd = epevs[i].data.fd;
+                evs[i].events = evl_from_epoll(epevs[i].events);
+        }
+
+        return ready;
+}
+
+/**
+ * \brief      Destroys the backend.
+ *
+ * \param      evl   The event loop
+ */
+static void evl_epoll_destroy(struct evloop *const evl)
+{
+        if (evl->fd > -1)
+                close(evl->fd);
+
+        free(evl->evs);
+
+        evl->evs = NULL;
+        evl->fd = -1;
+}
+
+/**
+ * \brief      \c epoll() backend.
+ */
+const struct evl_ops evl_epoll_ops = {
+        "epoll",
+        &evl_epoll_init,
+        &evl_epoll_add,
+        &evl_epoll_mod,
+        &evl_epoll_remove,
+        &evl_epoll_wait,
+        &evl_epoll_destroy
+};
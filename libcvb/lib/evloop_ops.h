@@ -0,0 +1,57 @@
+/**
+ * \file       evloop_ops.h
+ * \brief      Event loop backends interface.
+ *
+ * Copyright (c) 2025 Antoni Blanche
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the “Software”), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#ifndef CVB_EVLOOP_OPS_H
+#define CVB_EVLOOP_OPS_H
+
+#include <cvb/evloop.h>
+
+/**
+ * \brief      Backend operations.
+ *
+ * Each backend fills this table with its own implementation of the event
+ * loop functions.
+ */
+struct evl_ops {
+        const char *name;
+        int (*init)(struct evloop *evl);
+        int (*add)(struct evloop *evl, int fd, short events);
+        int (*mod)(struct evloop *evl, int fd, short events);
+        int (*remove)(struct evloop *evl, int fd);
+        int (*wait)(struct evloop *evl, struct evl_event *evs, int maxevents,
+                    int timeout);
+        void (*destroy)(struct evloop *evl);
+};
+
+/**
+ * \brief      \c poll() backend.
+ */
+extern const struct evl_ops evl_poll_ops;
+
+/**
+ * \brief      \c epoll() backend.
+ */
+extern const struct evl_ops evl_epoll_ops;
+
+#endif /* evloop_ops.h */
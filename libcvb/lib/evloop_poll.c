@@ -0,0 +1,169 @@
+/**
+ * \file       evloop_poll.c
+ * \brief      Event loop backend based on poll().
+ *
+ * Copyright (c) 2025 Antoni Blanche
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the “Software”), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include <assert.h>
+#include <errno.h>
+#include <stdlib.h>
+
+#include <cvb/evloop.h>
+#include <cvb/fdlist.h>
+
+#include "evloop_ops.h"
+
+/**
+ * \brief      Initializes the backend.
+ *
+ * \param      evl   The event loop
+ *
+ * \return     0 on success, -1 otherwise.
+ */
+static int evl_poll_init(struct evloop *const evl)
+{
+        evl->fdl = (struct fdlist) FDLIST_INIT;
+        evl->evs = NULL;
+        evl->fd = -1;
+
+        /* Adding the accepted connections never reallocates the list */
+        if (fdl_reserve(&(evl->fdl), 0) != 0) {
+                fdl_destroy(&(evl->fdl));
+
+                return -1;
+        }
+
+        return 0;
+}
+
+/**
+ * \brief      Adds a file descriptor.
+ *
+ * \param      evl     The event loop
+ * \param[in]  fd      The file descriptor to add
+ * \param[in]  events  The requested events
+ *
+ * \return     0 on success, -1 otherwise.
+ */
+static int evl_poll_add(struct evloop *const evl, const int fd,
+                        const short events)
+{
+        return fdl_add(&(evl->fdl), fd, events);
+}
+
+/**
+ * \brief      Modifies a file descriptor.
+ *
+ * \param      evl     The event loop
+ * \param[in]  fd      The file descriptor to modify
+ * \param[in]  events  The requested events
+ *
+ * \return     0 on success, -1 otherwise.
+ */
+static int evl_poll_mod(struct evloop *const evl, const int fd,
+                        const short events)
+{
+        struct pollfd *pfd = fdl_get(&(evl->fdl), fd);
+
+        if (pfd == NULL) {
+                errno = ENOENT;
+
+                return -1;
+        }
+
+        pfd->events = events;
+
+        return 0;
+}
+
+/**
+ * \brief      Removes a file descriptor.
+ *
+ * \param      evl   The event loop
+ * \param[in]  fd    The file descriptor to remove
+ *
+ * \return     0 on success, -1 otherwise.
+ */
+static int evl_poll_remove(struct evloop *const evl, const int fd)
+{
+        return fdl_remove(&(evl->fdl), fd);
+}
+
+/**
+ * \brief      Waits for events.
+ *
+ * The whole list is handed to \c poll() and then scanned for returned events,
+ * so each wakeup costs the number of watched file descriptors.
+ *
+ * \param      evl        The event loop
+ * \param[out] evs        The ready events
+ * \param[in]  maxevents  The maximum number of events
+ * \param[in]  timeout    The timeout
+ *
+ * \return     The number of ready events on success, -1 otherwise.
+ */
+static int evl_poll_wait(struct evloop *const evl, struct evl_event *const evs,
+                         const int maxevents, const int timeout)
+{
+        nfds_t i;
+        int ready, n = 0;
+
+        ready = poll(evl->fdl.fds, evl->fdl.nfds, timeout);
+
+        if (ready < 0)
+                return -1;
+
+        for (i = 0; (i < evl->fdl.nfds) && (n < ready); ++i) {
+                if (n >= maxevents)
+                        break;
+
+                if ((evl->fdl.fds[i].fd >= 0) && (evl->fdl.fds[i].revents)) {
+                        evs[n].fd = evl->fdl.fds[i].fd;
+                        evs[n].events = evl->fdl.fds[i].revents;
+                        ++n;
+                }
+        }
+
+        return n;
+}
+
+/**
+ * \brief      Destroys the backend.
+ *
+ * \param      evl   The event loop
+ */
+static void evl_poll_destroy(struct evloop *const evl)
+{
+        fdl_destroy(&(evl->fdl));
+}
+
+/**
+ * \brief      \c poll() backend.
+ */
+const struct evl_ops evl_poll_ops = {
+        "poll",
+        &evl_poll_init,
+        &evl_poll_add,
+        &evl_poll_mod,
+        &evl_poll_remove,
+        &evl_poll_wait,
+        &evl_poll_destroy
+};
@@ -23,8 +23,11 @@
  * SOFTWARE.
  */
 #include <assert.h>
+#include <errno.h>
 #include <stdlib.h>
 
+#include <sys/resource.h>
+
 #include <cvb/fdlist.h>
 
 /**
@@ -33,27 +36,113 @@
 #define DEFAULT_SIZE 16
 
 /**
- * \brief      Performs a left shift.
+ * \brief      Grows the side table.
+ *
+ * \param      fdl     The file descriptors list
+ * \param[in]  nindex  The minimum side table size
+ *
+ * \return     0 on success, -1 otherwise.
+ */
+static int fdl_grow_index(struct fdlist *const fdl, int nindex)
+{
+        int *index;
+        int i;
+
+        if (nindex <= fdl->nindex)
+                return 0;
+
+        if (nindex < 2 * fdl->nindex)
+                nindex = 2 * fdl->nindex;
+
+        index = (int *) realloc(fdl->index, nindex * sizeof(int));
+
+        if (index == NULL)
+                return -1;
+
+        for (i = fdl->nindex; i < nindex; ++i)
+                index[i] = -1;
+
+        fdl->index = index;
+        fdl->nindex = nindex;
+
+        return 0;
+}
+
+/**
+ * \brief      Grows the list.
+ *
+ * \param      fdl   The file descriptors list
+ * \param[in]  size  The minimum list size
+ *
+ * \return     0 on success, -1 otherwise.
+ */
+static int fdl_grow(struct fdlist *const fdl, nfds_t size)
+{
+        struct pollfd *fds;
+
+        if (size <= fdl->size)
+                return 0;
+
+        if (size < 2 * fdl->size)
+                size = 2 * fdl->size;
+
+        fds = (struct pollfd *) realloc(fdl->fds, size * sizeof(struct pollfd));
+
+        if (fds == NULL)
+                return -1;
+
+        fdl->fds = fds;
+        fdl->size = size;
+
+        return 0;
+}
+
+/**
+ * \brief      Reserves memory for a file descriptors list.
  *
- * The \c _fdl_shift_left() function moves to the left each elements of the
- * file descriptors list \a fdl from \a start.
+ * The \c fdl_reserve() function makes room in \a fdl for the file descriptors
+ * from 0 to \a size - 1, so that adding them never reallocates memory. If
+ * \a size is 0, the soft \c RLIMIT_NOFILE limit is used instead, up to
+ * \c FDL_MAXRESERVE.
  *
- * \param      fdl    The file descriptors list
- * \param[in]  start  The first element to move
+ * \param      fdl   The file descriptors list
+ * \param[in]  size  The number of file descriptors
+ *
+ * \return     0 on success, -1 otherwise.
  */
-/* static void _fdl_shift_left(struct fdlist *const fdl, const nfds_t start)
+int fdl_reserve(struct fdlist *const fdl, nfds_t size)
 {
-        nfds_t i;
+        struct rlimit rlim;
+
+        assert(fdl != NULL);
+
+        if (size == 0) {
+                if (getrlimit(RLIMIT_NOFILE, &rlim) != 0)
+                        return -1;
 
-        for (i = start; i < fdl->nfds - 1; ++i)
-                fdl->fds[i] = fdl->fds[i + 1];
-} */
+                size = FDL_MAXRESERVE;
+
+                if (rlim.rlim_cur < size)
+                        size = rlim.rlim_cur;
+        }
+
+        if (size > FDL_MAXRESERVE) {
+                errno = EINVAL;
+
+                return -1;
+        }
+
+        if ((fdl_grow(fdl, size) != 0) || (fdl_grow_index(fdl, size) != 0))
+                return -1;
+
+        return 0;
+}
 
 /**
  * \brief      Adds a file descriptor.
  *
  * The \c fdl_add() function adds the file descriptor \a fd at the end of the
- * file descriptor list \a fdl.
+ * file descriptor list \a fdl. A file descriptor can only be added once.
  *
  * \param      fdl     The file descriptiors list
  * \param[in]  fd      The file descriptor to add
@@ -63,30 +152,32 @@
  */
 int fdl_add(struct fdlist *const fdl, const int fd, const short events)
 {
-        nfds_t i;
-
         assert(fdl != NULL);
 
-        for (i = 0; i < fdl->nfds; ++i) {
-                if (fdl->fds[i].fd == -1) {
-                        fdl->fds[i].fd = fd;
-                        fdl->fds[i].events = events;
+        if (fd < 0) {
+                errno = EBADF;
 
-                        return 0;
-                }
+                return -1;
         }
 
-        if (i >= fdl->size) {
-                fdl->size = fdl->size + DEFAULT_SIZE;
-                fdl->fds = (struct pollfd *) realloc(fdl->fds, (fdl->size)
-                                                     * sizeof(struct pollfd));
+        /* Reserved file descriptors already fit in the side table */
+        if ((fd >= fdl->nindex)
+            && (fdl_grow_index(fdl, fd + DEFAULT_SIZE) != 0))
+                return -1;
+
+        if (fdl->index[fd] != -1) {
+                errno = EEXIST;
 
-                if (fdl->fds == NULL)
-                        return -1;
+                return -1;
         }
 
+        if (fdl_grow(fdl, fdl->nfds + 1) != 0)
+                return -1;
+
         fdl->fds[fdl->nfds].fd = fd;
         fdl->fds[fdl->nfds].events = events;
+        fdl->fds[fdl->nfds].revents = 0;
+        fdl->index[fd] = fdl->nfds;
         ++fdl->nfds;
 
         return 0;
@@ -95,10 +186,9 @@ int fdl_add(struct fdlist *const fdl, const int fd, const short events)
 /**
  * \brief      Gets a file descriptor.
  *
- * The \c dl_get() function returns the first occurence of \a fd in the file
- * descriptors list \a fdl as a <tt>struct pollfd<tt>. If \a fd is not found in
- * \a fdl, or if \a fd is negative, then \c fdl_get() returns NULL.If there are
- * other occurrences of \a fd left in \a fdl, they are ignored.
+ * The \c fdl_get() function returns \a fd in the file descriptors list \a fdl
+ * as a <tt>struct pollfd<tt>. If \a fd is not found in \a fdl, or if \a fd is
+ * negative, then \c fdl_get() returns NULL.
  *
  * \param[in]  fdl   The file descriptors list
  * \param[in]  fd    The file descriptor wanted
@@ -107,28 +197,21 @@ int fdl_add(struct fdlist *const fdl, const int fd, const short events)
  */
 struct pollfd *fdl_get(const struct fdlist *const fdl, const int fd)
 {
-        nfds_t i;
-
         assert(fdl != NULL);
 
-        if (fd < 0)
+        if ((fd < 0) || (fd >= fdl->nindex) || (fdl->index[fd] == -1))
                 return NULL;
 
-        for (i = 0; i < fdl->nfds; ++i) {
-                if (fdl->fds[i].fd == fd)
-                        return fdl->fds + i;
-        }
-
-        return NULL;
+        return fdl->fds + fdl->index[fd];
 }
 
 /**
  * \brief      Removes a file descriptor.
  *
- * The \c fdl_remove() function removes the first occurence of \a fd in the file
- * descriptors list \a fdl. If \a fd is not found in \a fdl, then
- * \c fdl_remove() does nothing and returns -1. If there are other occurrences
- * of \a fd left in \a fdl, they are ignored.
+ * The \c fdl_remove() function removes \a fd from the file descriptors list
+ * \a fdl. The last file descriptor of the list takes its place, so the order
+ * of the list is not preserved. If \a fd is not found in \a fdl, then
+ * \c fdl_remove() does nothing and returns -1.
  *
  * \param      fdl   The file descriptors list
  * \param[in]  fd    The file descriptor to remove
@@ -137,22 +220,21 @@ struct pollfd *fdl_get(const struct fdlist *const fdl, const int fd)
  */
 int fdl_remove(struct fdlist *const fdl, const int fd)
 {
-        nfds_t i;
+        int i;
 
         assert(fdl != NULL);
 
-        if (fd < 0)
+        if ((fd < 0) || (fd >= fdl->nindex) || (fdl->index[fd] == -1))
                 return -1;
 
-        for (i = 0; i < fdl->nfds; ++i) {
-                if (fdl->fds[i].fd == fd) {
-                        fdl->fds[i].fd = -1;
+        i = fdl->index[fd];
+        --fdl->nfds;
 
-                        return 0;
-                }
-        }
+        fdl->fds[i] = fdl->fds[fdl->nfds];
+        fdl->index[fdl->fds[i].fd] = i;
+        fdl->index[fd] = -1;
 
-        return -1;
+        return 0;
 }
 
 /**
@@ -168,8 +250,11 @@ void fdl_destroy(struct fdlist *const fdl)
         assert(fdl != NULL);
 
         free(fdl->fds);
+        free(fdl->index);
 
         fdl->fds = NULL;
         fdl->nfds = 0;
         fdl->size = 0;
+        fdl->index = NULL;
+        fdl->nindex = 0;
 }
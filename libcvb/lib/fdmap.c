@@ -32,9 +32,149 @@
 #include <cvb/fdmap.h>
 
 /**
- * \brief      File descriptors map padding.
+ * \brief      Minimum names array size.
  */
-#define PADDING 10
+#define MIN_SIZE 16
+
+/**
+ * \brief      Minimum hash table size.
+ */
+#define MIN_SLOTS 16
+
+/**
+ * \brief      Hashes a name.
+ *
+ * The \c fdm_hash() function computes the 32-bit FNV-1a hash of \a fdname.
+ *
+ * \param[in]  fdname  The file descriptor name
+ *
+ * \return     The hash value.
+ */
+static unsigned int fdm_hash(const char *fdname)
+{
+        unsigned int h = 2166136261U;
+
+        while (*fdname != '\0') {
+                h = h ^ (unsigned char) *fdname++;
+                h = h * 16777619U;
+        }
+
+        return h;
+}
+
+/**
+ * \brief      Returns the home slot of a name.
+ *
+ * \param[in]  fdm     The file descriptors map
+ * \param[in]  fdname  The file descriptor name
+ *
+ * \return     The first slot to probe.
+ */
+static int fdm_slot(const struct fdmap *const fdm, const char *const fdname)
+{
+        return (int) (fdm_hash(fdname) & (fdm->nslots - 1));
+}
+
+/**
+ * \brief      Indexes a file descriptor.
+ *
+ * The \c fdm_link() function inserts \a fd in the hash table of \a fdm, which
+ * must have a free slot.
+ *
+ * \param      fdm   The file descriptors map
+ * \param[in]  fd    The file descriptor, already named
+ */
+static void fdm_link(struct fdmap *const fdm, const int fd)
+{
+        int i = fdm_slot(fdm, fdm->fdname[fd]);
+
+        while (fdm->index[i] != -1)
+                i = (i + 1) & (fdm->nslots - 1);
+
+        fdm->index[i] = fd;
+        ++fdm->count;
+}
+
+/**
+ * \brief      Grows the hash table.
+ *
+ * The \c fdm_rehash() function makes sure the hash table of \a fdm stays at
+ * most half full after one more insertion.
+ *
+ * \param      fdm   The file descriptors map
+ *
+ * \return     0 on success, -1 otherwise.
+ */
+static int fdm_rehash(struct fdmap *const fdm)
+{
+        int *index = fdm->index;
+        int nslots = fdm->nslots;
+        int i;
+
+        if (2 * (fdm->count + 1) <= fdm->nslots)
+                return 0;
+
+        fdm->nslots = (nslots > 0) ? 2 * nslots : MIN_SLOTS;
+        fdm->index = (int *) malloc(fdm->nslots * sizeof(int));
+
+        if (fdm->index == NULL) {
+                fdm->index = index;
+                fdm->nslots = nslots;
+
+                return -1;
+        }
+
+        for (i = 0; i < fdm->nslots; ++i)
+                fdm->index[i] = -1;
+
+        fdm->count = 0;
+
+        for (i = 0; i < nslots; ++i) {
+                if (index[i] != -1)
+                        fdm_link(fdm, index[i]);
+        }
+
+        free(index);
+
+        return 0;
+}
+
+/**
+ * \brief      Unindexes a file descriptor.
+ *
+ * The \c fdm_unlink() function removes \a fd from the hash table of \a fdm.
+ * The following entries of the probe sequence are shifted back, so the table
+ * never holds tombstones.
+ *
+ * \param      fdm   The file descriptors map
+ * \param[in]  fd    The file descriptor, still named
+ */
+static void fdm_unlink(struct fdmap *const fdm, const int fd)
+{
+        int mask = fdm->nslots - 1;
+        int i, j, k;
+
+        i = fdm_slot(fdm, fdm->fdname[fd]);
+
+        while (fdm->index[i] != fd) {
+                assert(fdm->index[i] != -1);
+                i = (i + 1) & mask;
+        }
+
+        for (j = (i + 1) & mask; fdm->index[j] != -1; j = (j + 1) & mask) {
+                k = fdm_slot(fdm, fdm->fdname[fdm->index[j]]);
+
+                /* Keep entries whose home slot lies in (i, j] */
+                if ((i <= j) ? ((i < k) && (k <= j)) : ((i < k) || (k <= j)))
+                        continue;
+
+                fdm->index[i] = fdm->index[j];
+                i = j;
+        }
+
+        fdm->index[i] = -1;
+        --fdm->count;
+}
 
 /**
  * \brief      Updates a file descriptors map.
@@ -51,8 +191,14 @@ static char *fdm_set(struct fdmap *const fdm, const int fd, char *const fdname)
 {
         char *s = fdm->fdname[fd];
 
+        if (s != NULL)
+                fdm_unlink(fdm, fd);
+
         fdm->fdname[fd] = fdname;
 
+        if (fdname != NULL)
+                fdm_link(fdm, fd);
+
         return s;
 }
 
@@ -70,23 +216,35 @@ static char *fdm_set(struct fdmap *const fdm, const int fd, char *const fdname)
  */
 char *fdm_put(struct fdmap *const fdm, int const fd, char *const fdname)
 {
-        int i;
+        char **fdname_p;
+        int i, size;
 
         assert(fdm != NULL);
         assert(fd >= 0);
 
+        /* Doubled, so increasing file descriptors cost amortized O(1) */
         if (fd >= fdm->size) {
-                fdm->size = fd + PADDING;
-                fdm->fdname = (char **) realloc(fdm->fdname,
-                                                fdm->size * sizeof(char *));
+                size = (fdm->size > 0) ? fdm->size : MIN_SIZE;
+
+                while (size <= fd)
+                        size *= 2;
+
+                fdname_p = (char **) realloc(fdm->fdname,
+                                             size * sizeof(char *));
 
-                if (fdm->fdname == NULL)
+                if (fdname_p == NULL)
                         return (char *) -1;
 
-                for (i = fdm->back; i <= fd; ++i)
-                        fdm->fdname[i] = NULL;
+                for (i = fdm->size; i < size; ++i)
+                        fdname_p[i] = NULL;
+
+                fdm->fdname = fdname_p;
+                fdm->size = size;
         }
 
+        if ((fdname != NULL) && (fdm_rehash(fdm) != 0))
+                return (char *) -1;
+
         if (fd > fdm->back)
                 fdm->back = fd;
 
@@ -159,14 +317,80 @@ int fdm_contains(const struct fdmap *const fdm, const char *const fdname)
         assert(fdm != NULL);
         assert(fdname != NULL);
 
-        if (fdm->fdname == NULL)
+        if (fdm->index == NULL)
+                return -1;
+
+        for (i = fdm_slot(fdm, fdname); fdm->index[i] != -1;
+             i = (i + 1) & (fdm->nslots - 1)) {
+                if ((fdm->fdname[fdm->index[i]] == fdname)
+                    || (strcmp(fdname, fdm->fdname[fdm->index[i]]) == 0))
+                        return fdm->index[i];
+        }
+
+        return -1;
+}
+
+/**
+ * \brief      Returns the file descriptor of an interned name.
+ *
+ * The \c fdm_find() function returns the file descriptor named \a fdname,
+ * like \c fdm_contains(), for maps whose names are all interned in the same
+ * table. Names are compared by address only, and \a hash must be the 32-bit
+ * FNV-1a hash of \a fdname, as kept by its interned string, so the name is
+ * never read.
+ *
+ * \param[in]  fdm     The file descriptors map
+ * \param[in]  fdname  The interned file descriptor name
+ * \param[in]  hash    The name hash
+ *
+ * \return     The file descriptor on success, -1 otherwise.
+ */
+int fdm_find(const struct fdmap *const fdm, const char *const fdname,
+             const unsigned int hash)
+{
+        int i;
+
+        assert(fdm != NULL);
+        assert(fdname != NULL);
+
+        if (fdm->index == NULL)
                 return -1;
 
-        for (i = 0; i <= fdm->back; ++i) {
-                if (fdm->fdname[i] != NULL) {
-                        if (strcmp(fdname, fdm->fdname[i]) == 0)
-                                return i;
-                }
+        for (i = (int) (hash & (fdm->nslots - 1)); fdm->index[i] != -1;
+             i = (i + 1) & (fdm->nslots - 1)) {
+                if (fdm->fdname[fdm->index[i]] == fdname)
+                        return fdm->index[i];
+        }
+
+        return -1;
+}
+
+/**
+ * \brief      Returns the next named file descriptor.
+ *
+ * The \c fdm_next() function iterates over the named file descriptors of
+ * \a fdm, in no particular order. The cursor \a pos must be 0 on the first
+ * call. The iteration takes time proportional to the number of names, not to
+ * the greatest file descriptor.
+ *
+ * \param[in]  fdm   The file descriptors map
+ * \param      pos   The iteration cursor
+ *
+ * \return     The next file descriptor, -1 once all have been returned.
+ */
+int fdm_next(const struct fdmap *const fdm, int *const pos)
+{
+        int fd;
+
+        assert(fdm != NULL);
+        assert(pos != NULL);
+
+        /* The hash table is at most half full */
+        while (*pos < fdm->nslots) {
+                fd = fdm->index[(*pos)++];
+
+                if (fd != -1)
+                        return fd;
         }
 
         return -1;
@@ -184,8 +408,12 @@ void fdm_destroy(struct fdmap *const fdm)
         assert(fdm != NULL);
 
         free(fdm->fdname);
+        free(fdm->index);
 
         fdm->fdname = NULL;
         fdm->back = 0;
         fdm->size = 0;
+        fdm->index = NULL;
+        fdm->nslots = 0;
+        fdm->count = 0;
 }
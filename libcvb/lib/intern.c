@@ -0,0 +1,310 @@
+/**
+ * \file       intern.c
+ * \brief      Functions dealing with interned strings.
+ *
+ * Copyright (c) 2025 Antoni Blanche
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the “Software”), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <cvb/intern.h>
+
+/**
+ * \brief      Minimum hash table size.
+ */
+#define MIN_SLOTS 64
+
+/**
+ * \brief      Hashes a string.
+ *
+ * The \c itab_hash() function computes the 32-bit FNV-1a hash of the \a len
+ * first bytes of \a str.
+ *
+ * \param[in]  str   The string
+ * \param[in]  len   The string length
+ *
+ * \return     The hash value.
+ */
+static unsigned int itab_hash(const char *const str, const size_t len)
+{
+        unsigned int h = 2166136261U;
+        size_t i;
+
+        for (i = 0; i < len; ++i) {
+                h = h ^ (unsigned char) str[i];
+                h = h * 16777619U;
+        }
+
+        return h;
+}
+
+/**
+ * \brief      Inserts a string in the hash table.
+ *
+ * \param      tab   The interning table, with a free slot
+ * \param      is    The interned string
+ */
+static void itab_link(struct itab *const tab, struct istr *const is)
+{
+        int i = is->hash & (tab->nslots - 1);
+
+        while (tab->slots[i] != NULL)
+                i = (i + 1) & (tab->nslots - 1);
+
+        tab->slots[i] = is;
+        ++tab->count;
+}
+
+/**
+ * \brief      Grows the hash table.
+ *
+ * The \c itab_rehash() function makes sure the hash table of \a tab stays at
+ * most half full after one more insertion.
+ *
+ * \param      tab   The interning table
+ *
+ * \return     0 on success, -1 otherwise.
+ */
+static int itab_rehash(struct itab *const tab)
+{
+        struct istr **slots = tab->slots;
+        int nslots = tab->nslots;
+        int i;
+
+        if (2 * (tab->count + 1) <= tab->nslots)
+                return 0;
+
+        tab->nslots = (nslots > 0) ? 2 * nslots : MIN_SLOTS;
+        tab->slots = (struct istr **) calloc(tab->nslots,
+                                             sizeof(struct istr *));
+
+        if (tab->slots == NULL) {
+                tab->slots = slots;
+                tab->nslots = nslots;
+
+                return -1;
+        }
+
+        tab->count = 0;
+
+        for (i = 0; i < nslots; ++i) {
+                if (slots[i] != NULL)
+                        itab_link(tab, slots[i]);
+        }
+
+        free(slots);
+
+        return 0;
+}
+
+/**
+ * \brief      Finds a string in the hash table.
+ *
+ * \param[in]  tab   The interning table
+ * \param[in]  str   The string
+ * \param[in]  len   The string length
+ * \param[in]  hash  The string hash
+ *
+ * \return     The interned string if any, NULL otherwise.
+ */
+static struct istr *itab_find(const struct itab *const tab,
+                              const char *const str, const size_t len,
+                              const unsigned int hash)
+{
+        int mask = tab->nslots - 1;
+        int i;
+
+        if (tab->nslots == 0)
+                return NULL;
+
+        for (i = hash & mask; tab->slots[i] != NULL; i = (i + 1) & mask) {
+                if ((tab->slots[i]->hash == hash) && (tab->slots[i]->len == len)
+                    && (memcmp(tab->slots[i]->str, str, len) == 0))
+                        return tab->slots[i];
+        }
+
+        return NULL;
+}
+
+/**
+ * \brief      Removes a string from the hash table.
+ *
+ * The following entries of the probe sequence are shifted back, so the table
+ * never holds tombstones.
+ *
+ * \param      tab   The interning table
+ * \param      is    The interned string
+ */
+static void itab_unlink(struct itab *const tab, const struct istr *const is)
+{
+        int mask = tab->nslots - 1;
+        int i, j, k;
+
+        i = is->hash & mask;
+
+        while (tab->slots[i] != is)
+                i = (i + 1) & mask;
+
+        for (j = (i + 1) & mask; tab->slots[j] != NULL; j = (j + 1) & mask) {
+                k = tab->slots[j]->hash & mask;
+
+                /* Keep entries whose home slot lies in (i, j] */
+                if ((i <= j) ? ((i < k) && (k <= j)) : ((i < k) || (k <= j)))
+                        continue;
+
+                tab->slots[i] = tab->slots[j];
+                i = j;
+        }
+
+        tab->slots[i] = NULL;
+        --tab->count;
+}
+
+/**
+ * \brief      Interns a string.
+ *
+ * The \c itab_intern() function returns the interned string equal to the
+ * \a len first bytes of \a str, adding it to \a tab if needed. The caller
+ * holds a reference on the returned string.
+ *
+ * \param      tab   The interning table
+ * \param[in]  str   The string
+ * \param[in]  len   The string length
+ *
+ * \return     The interned string on success, NULL otherwise.
+ */
+struct istr *itab_intern(struct itab *const tab, const char *const str,
+                         const size_t len)
+{
+        unsigned int hash = itab_hash(str, len);
+        struct istr *is;
+        char *s;
+
+        assert(tab != NULL);
+        assert(str != NULL);
+
+        pthread_mutex_lock(&(tab->lock));
+
+        is = itab_find(tab, str, len, hash);
+
+        if (is != NULL) {
+                __atomic_add_fetch(&(is->refs), 1, __ATOMIC_RELAXED);
+        } else if (itab_rehash(tab) == 0) {
+                is = (struct istr *) malloc(sizeof(struct istr) + len + 1);
+
+                if (is != NULL) {
+                        s = (char *) (is + 1);
+                        memcpy(s, str, len);
+                        s[len] = '\0';
+
+                        is->str = s;
+                        is->len = len;
+                        is->hash = hash;
+                        is->refs = 1;
+
+                        itab_link(tab, is);
+                }
+        }
+
+        pthread_mutex_unlock(&(tab->lock));
+
+        return is;
+}
+
+/**
+ * \brief      Takes a reference on an interned string.
+ *
+ * \param      is    The interned string
+ *
+ * \return     The interned string.
+ */
+struct istr *istr_ref(struct istr *const is)
+{
+        assert(is != NULL);
+
+        __atomic_add_fetch(&(is->refs), 1, __ATOMIC_RELAXED);
+
+        return is;
+}
+
+/**
+ * \brief      Releases an interned string.
+ *
+ * The \c itab_release() function drops a reference on \a is, and removes it
+ * from \a tab when no reference is left. The table is only locked to drop
+ * what may be the last reference.
+ *
+ * \param      tab   The interning table
+ * \param      is    The interned string
+ */
+void itab_release(struct itab *const tab, struct istr *const is)
+{
+        int refs;
+
+        assert(tab != NULL);
+
+        if (is == NULL)
+                return;
+
+        refs = __atomic_load_n(&(is->refs), __ATOMIC_RELAXED);
+
+        /* Without the lock as long as another reference is left */
+        while (refs > 1) {
+                if (__atomic_compare_exchange_n(&(is->refs), &refs, refs - 1,
+                                                1, __ATOMIC_RELEASE,
+                                                __ATOMIC_RELAXED))
+                        return;
+        }
+
+        /* Under the lock, so that no lookup revives a dying string */
+        pthread_mutex_lock(&(tab->lock));
+
+        if (__atomic_sub_fetch(&(is->refs), 1, __ATOMIC_ACQ_REL) == 0) {
+                itab_unlink(tab, is);
+                free(is);
+        }
+
+        pthread_mutex_unlock(&(tab->lock));
+}
+
+/**
+ * \brief      Destroys an interning table.
+ *
+ * The \c itab_destroy() function frees all the strings still in \a tab.
+ *
+ * \param      tab   The interning table
+ */
+void itab_destroy(struct itab *const tab)
+{
+        int i;
+
+        assert(tab != NULL);
+
+        for (i = 0; i < tab->nslots; ++i)
+                free(tab->slots[i]);
+
+        free(tab->slots);
+
+        tab->slots = NULL;
+        tab->nslots = 0;
+        tab->count = 0;
+}
@@ -26,6 +26,7 @@
  * SOFTWARE.
  */
 #include <assert.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <time.h>
 
@@ -51,6 +52,20 @@ static struct {
         struct callback cb; /**< The callback      */
 } logger;
 
+/**
+ * \brief      Serializes logging between threads.
+ *
+ * The lock is recursive since the client SIGINT handler calls exit(), whose
+ * handlers log, and may interrupt a logging call. The server handler only
+ * wakes its loop up.
+ */
+static pthread_mutex_t lock;
+
+/**
+ * \brief      Lock initialization control.
+ */
+static pthread_once_t lock_once = PTHREAD_ONCE_INIT;
+
 /**
  * \brief      Logging level strings.
  */
@@ -78,14 +93,28 @@ static const char *const level_colors[] = {
  */
 static void set_log_event(struct log_event *const ev, void *const udata)
 {
+        static struct tm tm;
         time_t t = time(NULL);
 
         if (!ev->time)
-                ev->time = localtime(&t);
+                ev->time = localtime_r(&t, &tm);
 
         ev->udata = udata;
 }
 
+/**
+ * \brief      Initializes the logger lock.
+ */
+static void init_lock(void)
+{
+        pthread_mutexattr_t attr;
+
+        pthread_mutexattr_init(&attr);
+        pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+        pthread_mutex_init(&lock, &attr);
+        pthread_mutexattr_destroy(&attr);
+}
+
 /**
  * \brief      Enables quiet mode.
  *
@@ -207,6 +236,9 @@ void log_log(const int level, const char *const file,
                 .fmt = fmt, .file = file, .line = line, .level = level
         };
 
+        pthread_once(&lock_once, &init_lock);
+        pthread_mutex_lock(&lock);
+
         if ((!logger.quiet) && (level >= logger.level)) {
                 set_log_event(&ev, stderr);
                 va_start(ev.ap, fmt);
@@ -220,4 +252,6 @@ void log_log(const int level, const char *const file,
                 logger.cb.fn(&ev);
                 va_end(ev.ap);
         }
+
+        pthread_mutex_unlock(&lock);
 }
@@ -23,12 +23,325 @@
  * SOFTWARE.
  */
 #include <assert.h>
+#include <errno.h>
 #include <stdlib.h>
+#include <string.h>
+
+#include <poll.h>
 
 #include <arpa/inet.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
 
 #include <cvb/msg.h>
 
+#ifdef CVB_HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+/**
+ * \brief      Message pool size classes, including the \c msg_buf header.
+ */
+static const size_t classes[MSG_POOL_NCLASSES] = {64, 256, 1024, 8448};
+
+#ifdef CVB_HAVE_ZLIB
+/**
+ * \brief      Compression window size, in bits.
+ *
+ * A small window keeps the codec of each connection around 40 KiB, while
+ * still covering the last few dozen messages.
+ */
+#define MSG_ZWBITS 12
+
+/**
+ * \brief      Compression memory level.
+ */
+#define MSG_ZMEMLEVEL 5
+
+/**
+ * \brief      Compression preset dictionary.
+ *
+ * Strings likely to appear in the first messages of a connection, the most
+ * frequent ones last. Changing it breaks the compatibility with older peers.
+ */
+static const char dictionary[] =
+        "https://www.http://.com/.org/.net/.html.png.jpg.gif"
+        "I don't know, I think that it is not what you want to do here, "
+        "does anyone have any idea why this is not working for me? "
+        "Good morning everyone, how are you doing today? "
+        "Thank you, thanks, see you later, bye, good night, "
+        "yes, no, ok, okay, sure, maybe, sorry, please, what, why, who, "
+        "lol :) :( :D ;) ^^ xD <3 haha hahaha "
+        "the and for you that this with have are was not but what all "
+        "hi hello hey ";
+
+/**
+ * \brief      Bytes appended by a sync flush, left out of the messages.
+ */
+static const unsigned char sync_tail[] = {0x00, 0x00, 0xff, 0xff};
+#endif
+
+/**
+ * \brief      Message layouts, indexed by message code.
+ *
+ * Each character describes a field: 't' for a text prefixed by its size, 'b'
+ * for a single byte and 'w' for a big-endian 32-bit word.
+ */
+static const char *const layouts[] = {
+        "",     /* Unused                */
+        "t",    /* MSG_CODE_SEND_NO_AUTH */
+        "tt",   /* MSG_CODE_SEND_AUTH    */
+        "b",    /* MSG_CODE_RECV_AUTH    */
+        "t",    /* MSG_CODE_SEND_PUBLIC  */
+        "tt",   /* MSG_CODE_RECV_PUBLIC  */
+        "t",    /* MSG_CODE_DM_REQUEST   */
+        "tb",   /* MSG_CODE_DM_STATUS    */
+        "ttww", /* MSG_CODE_DM_CONNECT   */
+        "tt",   /* MSG_CODE_DM           */
+        "bw",   /* MSG_CODE_HELLO        */
+        "t",    /* MSG_CODE_BATCH        */
+        "wt",   /* MSG_CODE_SENDER       */
+        "tw",   /* MSG_CODE_RECV_SENDER  */
+        "w",    /* MSG_CODE_PING         */
+        "w",    /* MSG_CODE_PONG         */
+        "t",    /* MSG_CODE_JOIN         */
+        "t",    /* MSG_CODE_LEAVE        */
+        "tb",   /* MSG_CODE_ROOM_STATUS  */
+        "tt",   /* MSG_CODE_SEND_ROOM    */
+        "ttt",  /* MSG_CODE_RECV_ROOM    */
+        "wwt",  /* MSG_CODE_FILE_OFFER   */
+        "ww",   /* MSG_CODE_FILE_ACK     */
+        "wt",   /* MSG_CODE_FILE_DATA    */
+        "wb",   /* MSG_CODE_FILE_STATUS  */
+        "tb"    /* MSG_CODE_PUBLIC_STATUS */
+};
+
+/**
+ * \brief      Returns a message layout.
+ *
+ * The \c msg_layout() function returns the fields layout of the messages
+ * with code \a code. Unknown messages have no field.
+ *
+ * \param[in]  code  The message code
+ *
+ * \return     The message layout.
+ */
+static const char *msg_layout(const int8_t code)
+{
+        if ((code < 0) || ((size_t) code >= sizeof(layouts) / sizeof(char *)))
+                return "";
+
+        return layouts[code];
+}
+
+/**
+ * \brief      Returns a message payload size.
+ *
+ * The \c msg_payload() function returns the size of the fields \a fields once
+ * encoded with the protocol \a version, including their size prefixes.
+ *
+ * \param[in]  version  The protocol version
+ * \param[in]  layout   The message layout
+ * \param[in]  fields   The message fields
+ * \param[in]  nfields  The number of fields
+ *
+ * \return     The payload size on success, -1 if a field or the payload is too
+ *             large for \a version.
+ */
+static ssize_t msg_payload(const int version, const char *const layout,
+                           const struct msg_field *const fields,
+                           const int nfields)
+{
+        size_t size = 0;
+        int i;
+
+        for (i = 0; i < nfields; ++i) {
+                if ((version == MSG_V1) && (fields[i].size >= MSG_BUFSIZ))
+                        return -1;
+
+                if (layout[i] == 't')
+                        size = size + ((version == MSG_V1) ? sizeof(uint16_t)
+                                       : sizeof(uint32_t));
+
+                size = size + fields[i].size;
+        }
+
+        if ((version == MSG_V2) && (size > MSG_MAXSIZE))
+                return -1;
+
+        return size;
+}
+
+/**
+ * \brief      Writes a message header.
+ *
+ * The \c msg_put_header() function writes the header of a message with code
+ * \a code and a payload of \a size bytes at \a p. Version 1 messages have no
+ * flags.
+ *
+ * \param      p        The destination
+ * \param[in]  version  The protocol version
+ * \param[in]  code     The message code
+ * \param[in]  flags    The message flags
+ * \param[in]  size     The payload size
+ *
+ * \return     The header size.
+ */
+static size_t msg_put_header(char *const p, const int version,
+                             const int8_t code, const uint16_t flags,
+                             const size_t size)
+{
+        uint16_t net_flags = htons(flags);
+        uint32_t net_size = htonl(size);
+
+        if (version == MSG_V1) {
+                *p = code;
+
+                return sizeof(int8_t);
+        }
+
+        p[0] = (char) MSG_V2_MAGIC;
+        p[1] = code;
+        memcpy(p + 2, &net_flags, sizeof(uint16_t));
+        memcpy(p + 4, &net_size, sizeof(uint32_t));
+
+        return MSG_HDRSIZ;
+}
+
+/**
+ * \brief      Writes a text field size.
+ *
+ * \param      p        The destination
+ * \param[in]  version  The protocol version
+ * \param[in]  size     The field size
+ *
+ * \return     The size prefix size.
+ */
+static size_t msg_put_size(char *const p, const int version, const size_t size)
+{
+        uint16_t size16 = htons(size);
+        uint32_t size32 = htonl(size);
+
+        if (version == MSG_V1) {
+                memcpy(p, &size16, sizeof(uint16_t));
+
+                return sizeof(uint16_t);
+        }
+
+        memcpy(p, &size32, sizeof(uint32_t));
+
+        return sizeof(uint32_t);
+}
+
+/**
+ * \brief      Allocates an encoded message.
+ *
+ * The \c msg_buf_get() function allocates a message of \a size bytes from
+ * \a pool, or from the heap if \a pool is NULL or \a size too large for every
+ * size class. The returned message holds one reference.
+ *
+ * \param      pool  The message pool, or NULL for the heap
+ * \param[in]  size  The encoded size
+ *
+ * \return     The message on success, NULL otherwise.
+ */
+static struct msg_buf *msg_buf_get(struct msg_pool *const pool,
+                                   const size_t size)
+{
+        struct msg_buf *buf;
+        struct slab *slab = NULL;
+        int i;
+
+        for (i = 0; (pool != NULL) && (i < MSG_POOL_NCLASSES); ++i) {
+                if (sizeof(struct msg_buf) + size <= classes[i]) {
+                        slab = pool->slabs + i;
+                        break;
+                }
+        }
+
+        if (slab != NULL) {
+                buf = (struct msg_buf *) slab_alloc(slab);
+        } else {
+                buf = (struct msg_buf *) malloc(sizeof(struct msg_buf) + size);
+
+                if (pool != NULL)
+                        ++pool->nmalloc;
+        }
+
+        if (buf == NULL)
+                return NULL;
+
+        buf->data = (char *) (buf + 1);
+        buf->size = size;
+        buf->refs = 1;
+        buf->flags = 0;
+        buf->slab = slab;
+
+        return buf;
+}
+
+/**
+ * \brief      Writes a vector.
+ *
+ * The \c msg_sendv() function writes the \a n buffers \a iov to \a sfd,
+ * retrying as long as the socket accepts only part of them.
+ *
+ * \param[in]  sfd    The socket
+ * \param      iov    The buffers, updated as they are written
+ * \param[in]  n      The number of buffers
+ * \param[in]  flags  The \c sendmsg() flags, besides \c MSG_NOSIGNAL
+ *
+ * \return     The number of bytes sent on success, -1 otherwise.
+ */
+static ssize_t msg_sendv(const int sfd, struct iovec *const iov, const int n,
+                         const int flags)
+{
+        struct msghdr mh;
+        ssize_t nwrite, total = 0;
+        size_t len;
+
+        memset(&mh, 0, sizeof(struct msghdr));
+        mh.msg_iov = iov;
+        mh.msg_iovlen = n;
+
+        while (mh.msg_iovlen > 0) {
+                nwrite = sendmsg(sfd, &mh, MSG_NOSIGNAL | flags);
+
+                if (nwrite < 0) {
+                        if (errno == EINTR)
+                                continue;
+
+                        return -1;
+                }
+
+                total = total + nwrite;
+
+                /* Skip what has been written */
+                while ((mh.msg_iovlen > 0) && (nwrite > 0)) {
+                        len = mh.msg_iov->iov_len;
+
+                        if ((size_t) nwrite < len) {
+                                mh.msg_iov->iov_base = (char *)
+                                        mh.msg_iov->iov_base + nwrite;
+                                mh.msg_iov->iov_len = len - nwrite;
+                                nwrite = 0;
+                        } else {
+                                nwrite = nwrite - len;
+                                ++mh.msg_iov;
+                                --mh.msg_iovlen;
+                        }
+                }
+
+                while ((mh.msg_iovlen > 0) && (mh.msg_iov->iov_len == 0)) {
+                        ++mh.msg_iov;
+                        --mh.msg_iovlen;
+                }
+        }
+
+        return total;
+}
+
 /**
  * \brief      Receives a message code.
  *
@@ -166,3 +479,1065 @@ int msg_send_text(const int sfd, const char *const text, const short size)
 {
         return msg_send_bytes(sfd, text, size);
 }
+
+/**
+ * \brief      Sends a message frame.
+ *
+ * The \c msg_send_frame() function writes the message \a code followed by the
+ * \a nfields fields \a fields to \a sfd with a single vectored write, retried
+ * only if the socket accepts part of the frame.
+ *
+ * \param[in]  sfd      The socket
+ * \param[in]  version  The protocol version
+ * \param[in]  code     The message code
+ * \param[in]  fields   The message fields
+ * \param[in]  nfields  The number of fields
+ *
+ * \return     The number of bytes sent on success, -1 otherwise.
+ */
+ssize_t msg_send_frame(const int sfd, const int version, const int8_t code,
+                       const struct msg_field *const fields, const int nfields)
+{
+        struct iovec iov[1 + 2 * MSG_MAXFIELDS];
+        char hdr[MSG_HDRSIZ];
+        char prefix[MSG_MAXFIELDS][sizeof(uint32_t)];
+        const char *layout = msg_layout(code);
+        ssize_t payload;
+        int i, n = 0;
+
+        assert((fields != NULL) || (nfields == 0));
+        assert(strlen(layout) == (size_t) nfields);
+
+        payload = msg_payload(version, layout, fields, nfields);
+
+        if (payload < 0) {
+                errno = EMSGSIZE;
+
+                return -1;
+        }
+
+        iov[n].iov_base = hdr;
+        iov[n++].iov_len = msg_put_header(hdr, version, code, 0,
+                                          payload);
+
+        for (i = 0; i < nfields; ++i) {
+                if (layout[i] == 't') {
+                        iov[n].iov_base = prefix[i];
+                        iov[n++].iov_len = msg_put_size(prefix[i], version,
+                                                        fields[i].size);
+                }
+
+                iov[n].iov_base = (void *) fields[i].data;
+                iov[n++].iov_len = fields[i].size;
+        }
+
+        return msg_sendv(sfd, iov, n, 0);
+}
+
+/**
+ * \brief      Sends an encoded message.
+ *
+ * The \c msg_send_buf() function writes \a buf to \a sfd, retried only if the
+ * socket accepts part of the message.
+ *
+ * \param[in]  sfd   The socket
+ * \param[in]  buf   The encoded message
+ *
+ * \return     The number of bytes sent on success, -1 otherwise.
+ */
+ssize_t msg_send_buf(const int sfd, const struct msg_buf *const buf)
+{
+        struct iovec iov;
+
+        assert(buf != NULL);
+
+        iov.iov_base = buf->data;
+        iov.iov_len = buf->size;
+
+        return msg_sendv(sfd, &iov, 1, 0);
+}
+
+/*
+ * Send null bytes, padding a message frame
+ */
+static int msg_send_zeros(const int sfd, size_t left)
+{
+        static const char zeros[4096];
+        struct iovec iov;
+
+        while (left > 0) {
+                iov.iov_base = (void *) zeros;
+                iov.iov_len = (left < sizeof(zeros)) ? left : sizeof(zeros);
+
+                if (msg_sendv(sfd, &iov, 1, 0) < 0)
+                        return -1;
+
+                left = left - iov.iov_len;
+        }
+
+        return 0;
+}
+
+/**
+ * \brief      Sends a message frame ending with file contents.
+ *
+ * The \c msg_send_file() function writes the version 2 message \a code
+ * followed by the \a nfields fields \a fields, and by a last text field
+ * holding \a count bytes of \a fd from \a offset. These bytes are copied by
+ * \c sendfile(), without crossing user space. Unlike the other functions, a
+ * closed socket raises \c SIGPIPE. A file shorter than expected is padded
+ * with null bytes, so that the frame is still complete, and fails with
+ * \c EIO.
+ *
+ * \param[in]  sfd      The socket
+ * \param[in]  code     The message code
+ * \param[in]  fields   The message fields, but the last one
+ * \param[in]  nfields  The number of fields, but the last one
+ * \param[in]  fd       The file
+ * \param      offset   The file offset, moved past the bytes sent
+ * \param[in]  count    The number of bytes to send from the file
+ *
+ * \return     The number of bytes sent on success, -1 otherwise.
+ */
+ssize_t msg_send_file(const int sfd, const int8_t code,
+                      const struct msg_field *const fields, const int nfields,
+                      const int fd, off_t *const offset, const size_t count)
+{
+        struct iovec iov[1 + 2 * MSG_MAXFIELDS];
+        char hdr[MSG_HDRSIZ];
+        char prefix[MSG_MAXFIELDS][sizeof(uint32_t)];
+        const char *layout = msg_layout(code);
+        ssize_t payload, total, nwrite;
+        size_t left = count;
+        int i, n = 0;
+
+        assert((fields != NULL) || (nfields == 0));
+        assert(strlen(layout) == (size_t) nfields + 1);
+        assert(layout[nfields] == 't');
+
+        payload = msg_payload(MSG_V2, layout, fields, nfields);
+
+        if ((payload < 0) || (count > MSG_MAXSIZE)
+            || ((size_t) payload + sizeof(uint32_t) + count > MSG_MAXSIZE)) {
+                errno = EMSGSIZE;
+
+                return -1;
+        }
+
+        payload = payload + sizeof(uint32_t) + count;
+
+        iov[n].iov_base = hdr;
+        iov[n++].iov_len = msg_put_header(hdr, MSG_V2, code, 0, payload);
+
+        for (i = 0; i <= nfields; ++i) {
+                if (layout[i] == 't') {
+                        iov[n].iov_base = prefix[i];
+                        iov[n++].iov_len = msg_put_size(prefix[i], MSG_V2,
+                                                        (i < nfields)
+                                                        ? fields[i].size
+                                                        : count);
+                }
+
+                if (i < nfields) {
+                        iov[n].iov_base = (void *) fields[i].data;
+                        iov[n++].iov_len = fields[i].size;
+                }
+        }
+
+        /* Sent along with the first file bytes */
+        total = msg_sendv(sfd, iov, n, MSG_MORE);
+
+        if (total < 0)
+                return -1;
+
+        while (left > 0) {
+                nwrite = sendfile(sfd, fd, offset, left);
+
+                if (nwrite < 0) {
+                        if (errno == EINTR)
+                                continue;
+
+                        return -1;
+                }
+
+                /* The file is shorter than expected, the frame is completed */
+                if (nwrite == 0) {
+                        if (msg_send_zeros(sfd, left) == 0)
+                                errno = EIO;
+
+                        return -1;
+                }
+
+                left = left - nwrite;
+                total = total + nwrite;
+        }
+
+        return total;
+}
+
+/**
+ * \brief      Fills a message reader.
+ *
+ * The \c msg_fill() function performs a single non-blocking read from \a sfd
+ * into the buffer of \a rd.
+ *
+ * \param      rd    The message reader
+ * \param[in]  sfd   The socket
+ *
+ * \return     The number of bytes received on success, 0 if the peer closed
+ *             the connection, -1 otherwise.
+ */
+ssize_t msg_fill(struct msg_reader *const rd, const int sfd)
+{
+        ssize_t nread;
+        size_t size;
+        char *buf;
+
+        assert(rd != NULL);
+
+        if (rd->buf == NULL) {
+                rd->buf = (char *) malloc(MSG_RDBUFSIZ);
+
+                if (rd->buf == NULL)
+                        return -1;
+
+                rd->size = MSG_RDBUFSIZ;
+        }
+
+        if (rd->head > 0) {
+                memmove(rd->buf, rd->buf + rd->head, rd->tail - rd->head);
+                rd->tail = rd->tail - rd->head;
+                rd->head = 0;
+        }
+
+        /* A full buffer holds the beginning of a large message */
+        if (rd->tail == rd->size) {
+                if (rd->size >= MSG_HDRSIZ + MSG_MAXSIZE) {
+                        errno = ENOBUFS;
+
+                        return -1;
+                }
+
+                size = 2 * rd->size;
+
+                if (size > MSG_HDRSIZ + MSG_MAXSIZE)
+                        size = MSG_HDRSIZ + MSG_MAXSIZE;
+
+                buf = (char *) realloc(rd->buf, size);
+
+                if (buf == NULL)
+                        return -1;
+
+                rd->buf = buf;
+                rd->size = size;
+        } else if ((rd->tail == 0) && (rd->size > MSG_RDBUFSIZ)) {
+                /* Give back the memory once the large message is consumed */
+                buf = (char *) realloc(rd->buf, MSG_RDBUFSIZ);
+
+                if (buf != NULL) {
+                        rd->buf = buf;
+                        rd->size = MSG_RDBUFSIZ;
+                }
+        }
+
+        nread = recv(sfd, rd->buf + rd->tail, rd->size - rd->tail,
+                     MSG_DONTWAIT);
+
+        if (nread > 0)
+                rd->tail = rd->tail + nread;
+
+        return nread;
+}
+
+/**
+ * \brief      Parses message fields.
+ *
+ * The \c msg_fields() function parses the fields of \a frame from the bytes
+ * of \a buf between \a pos and \a end, and moves \a pos after the last one.
+ *
+ * \param      frame  The message, with its code and version
+ * \param[in]  buf    The buffer
+ * \param      pos    The offset of the first field
+ * \param[in]  end    The end of the message, or of the buffered bytes
+ *
+ * \return     1 if the fields were parsed, 0 if more bytes are needed, -1 if
+ *             they are not valid.
+ */
+static int msg_fields(struct msg_frame *const frame, const char *const buf,
+                      size_t *const pos, const size_t end)
+{
+        const char *layout = msg_layout(frame->code);
+        uint32_t size32;
+        uint16_t size16;
+        size_t size;
+        int i;
+
+        for (i = 0; layout[i] != '\0'; ++i) {
+                if (layout[i] == 'b') {
+                        size = 1;
+                } else if (layout[i] == 'w') {
+                        size = sizeof(uint32_t);
+                } else if (frame->version == MSG_V1) {
+                        if (end - *pos < sizeof(uint16_t))
+                                return 0;
+
+                        memcpy(&size16, buf + *pos, sizeof(uint16_t));
+                        size = ntohs(size16);
+                        *pos = *pos + sizeof(uint16_t);
+
+                        if (size >= MSG_BUFSIZ)
+                                return -1;
+                } else {
+                        if (end - *pos < sizeof(uint32_t))
+                                return -1;
+
+                        memcpy(&size32, buf + *pos, sizeof(uint32_t));
+                        size = ntohl(size32);
+                        *pos = *pos + sizeof(uint32_t);
+                }
+
+                if (end - *pos < size)
+                        return (frame->version == MSG_V1) ? 0 : -1;
+
+                frame->field[i] = buf + *pos;
+                frame->size[i] = size;
+                ++frame->nfields;
+                *pos = *pos + size;
+        }
+
+        return 1;
+}
+
+#ifdef CVB_HAVE_ZLIB
+/**
+ * \brief      Runs a decompression stream.
+ *
+ * The \c msg_inflate_run() function decompresses the \a size bytes \a data
+ * with the input stream of \a codec, growing the payload buffer as needed.
+ *
+ * \param      codec  The message codec
+ * \param[in]  data   The compressed bytes
+ * \param[in]  size   The number of bytes
+ *
+ * \return     0 on success, -1 otherwise.
+ */
+static int msg_inflate_run(struct msg_codec *const codec,
+                           const void *const data, const size_t size)
+{
+        z_stream *z = (z_stream *) codec->zin;
+        size_t used, len;
+        char *buf;
+        int rc;
+
+        z->next_in = (Bytef *) data;
+        z->avail_in = size;
+
+        for (;;) {
+                if (z->avail_out == 0) {
+                        if (codec->size >= MSG_MAXSIZE) {
+                                errno = EMSGSIZE;
+
+                                return -1;
+                        }
+
+                        used = codec->size;
+                        len = 2 * codec->size;
+
+                        if (len > MSG_MAXSIZE)
+                                len = MSG_MAXSIZE;
+
+                        buf = (char *) realloc(codec->buf, len);
+
+                        if (buf == NULL)
+                                return -1;
+
+                        codec->buf = buf;
+                        codec->size = len;
+                        z->next_out = (Bytef *) buf + used;
+                        z->avail_out = len - used;
+                }
+
+                rc = inflate(z, Z_SYNC_FLUSH);
+
+                /* No progress is possible once the input is consumed */
+                if ((rc == Z_BUF_ERROR) && (z->avail_in == 0))
+                        return 0;
+
+                if (rc != Z_OK) {
+                        errno = EBADMSG;
+
+                        return -1;
+                }
+
+                if ((z->avail_in == 0) && (z->avail_out > 0))
+                        return 0;
+        }
+}
+#endif
+
+/**
+ * \brief      Decompresses a message payload.
+ *
+ * The \c msg_inflate() function decompresses the \a size bytes \a data in
+ * the payload buffer of \a codec.
+ *
+ * \param      codec  The message codec
+ * \param[in]  data   The compressed payload
+ * \param[in]  size   The compressed payload size
+ *
+ * \return     The payload size on success, -1 otherwise.
+ */
+static ssize_t msg_inflate(struct msg_codec *const codec,
+                           const char *const data, const size_t size)
+{
+#ifdef CVB_HAVE_ZLIB
+        z_stream *z = (z_stream *) codec->zin;
+        char *buf;
+
+        /* Give back the memory of a previous large message */
+        if ((codec->buf == NULL) || (codec->size > MSG_RDBUFSIZ)) {
+                buf = (char *) realloc(codec->buf, MSG_RDBUFSIZ);
+
+                if (buf == NULL)
+                        return -1;
+
+                codec->buf = buf;
+                codec->size = MSG_RDBUFSIZ;
+        }
+
+        z->next_out = (Bytef *) codec->buf;
+        z->avail_out = codec->size;
+
+        if ((msg_inflate_run(codec, data, size) != 0)
+            || (msg_inflate_run(codec, sync_tail, sizeof(sync_tail)) != 0))
+                return -1;
+
+        codec->nraw = codec->nraw + (codec->size - z->avail_out);
+        codec->nzip = codec->nzip + size;
+
+        return codec->size - z->avail_out;
+#else
+        (void) codec;
+        (void) data;
+        (void) size;
+
+        errno = ENOTSUP;
+
+        return -1;
+#endif
+}
+
+/**
+ * \brief      Parses a message.
+ *
+ * The \c msg_parse() function extracts the next complete message buffered in
+ * \a rd and stores it in \a frame. It must be called until it returns 0 to
+ * consume all the messages received by \c msg_fill().
+ *
+ * \param      rd     The message reader
+ * \param[out] frame  The parsed message
+ *
+ * \return     1 if a message was parsed, 0 if more bytes are needed, -1 if
+ *             the buffered bytes are not a valid message.
+ */
+int msg_parse(struct msg_reader *const rd, struct msg_frame *const frame)
+{
+        uint32_t size32;
+        uint16_t size16;
+        size_t pos, end, size;
+        ssize_t len;
+        int rc;
+
+        assert(rd != NULL);
+        assert(frame != NULL);
+
+        pos = rd->head;
+
+        if (pos >= rd->tail)
+                return 0;
+
+        frame->nfields = 0;
+        frame->flags = 0;
+
+        if ((rd->buf[pos] & 0x80) == 0) {
+                /* Version 1 messages end with their last field */
+                frame->code = (int8_t) rd->buf[pos];
+                frame->version = MSG_V1;
+                end = rd->tail;
+                ++pos;
+        } else {
+                if ((uint8_t) rd->buf[pos] != MSG_V2_MAGIC)
+                        return -1;
+
+                if (rd->tail - pos < MSG_HDRSIZ)
+                        return 0;
+
+                frame->code = (int8_t) rd->buf[pos + 1];
+                frame->version = MSG_V2;
+                memcpy(&size16, rd->buf + pos + 2, sizeof(uint16_t));
+                frame->flags = ntohs(size16);
+                memcpy(&size32, rd->buf + pos + 4, sizeof(uint32_t));
+                size = ntohl(size32);
+
+                if (size > MSG_MAXSIZE)
+                        return -1;
+
+                pos = pos + MSG_HDRSIZ;
+
+                if (rd->tail - pos < size)
+                        return 0;
+
+                end = pos + size;
+        }
+
+        if (frame->flags & MSG_FLAG_DEFLATE) {
+                if (rd->codec == NULL)
+                        return -1;
+
+                /* The stream moves on even if the payload is not valid */
+                rd->head = end;
+                len = msg_inflate(rd->codec, rd->buf + pos, end - pos);
+                pos = 0;
+
+                if ((len < 0) || (msg_fields(frame, rd->codec->buf, &pos,
+                                             len) != 1))
+                        return -1;
+
+                return 1;
+        }
+
+        rc = msg_fields(frame, rd->buf, &pos, end);
+
+        /* The rest of a version 2 payload is left to later revisions */
+        if (rc == 1)
+                rd->head = (frame->version == MSG_V1) ? pos : end;
+
+        return rc;
+}
+
+/**
+ * \brief      Parses a message from a batch.
+ *
+ * The \c msg_unbatch() function extracts the message at offset \a pos of the
+ * \c MSG_CODE_BATCH message \a batch, stores it in \a frame and moves \a pos
+ * to the next message. The fields of \a frame point into \a batch.
+ *
+ * \param[in]  batch  The batch message
+ * \param      pos    The offset of the message, 0 for the first one
+ * \param[out] frame  The parsed message
+ *
+ * \return     1 if a message was parsed, 0 at the end of the batch, -1 if the
+ *             batch is not valid.
+ */
+int msg_unbatch(const struct msg_frame *const batch, size_t *const pos,
+                struct msg_frame *const frame)
+{
+        struct msg_reader rd;
+        int rc;
+
+        assert(batch != NULL);
+        assert(pos != NULL);
+        assert(batch->code == MSG_CODE_BATCH);
+
+        rd.buf = (char *) batch->field[0];
+        rd.size = batch->size[0];
+        rd.head = *pos;
+        rd.tail = batch->size[0];
+        rd.codec = NULL;
+
+        rc = msg_parse(&rd, frame);
+
+        /* Messages never span several batches */
+        if ((rc == 0) && (rd.head < rd.tail))
+                return -1;
+
+        *pos = rd.head;
+
+        return rc;
+}
+
+/**
+ * \brief      Receives a message frame.
+ *
+ * The \c msg_recv_frame() function waits until a complete message is buffered
+ * in \a rd, filling it from \a sfd, and stores it in \a frame.
+ *
+ * \param      rd     The message reader
+ * \param[in]  sfd    The socket
+ * \param[out] frame  The parsed message
+ *
+ * \return     1 if a message was received, -1 otherwise.
+ */
+int msg_recv_frame(struct msg_reader *const rd, const int sfd,
+                   struct msg_frame *const frame)
+{
+        struct pollfd pfd;
+        ssize_t nread;
+        int rc;
+
+        pfd.fd = sfd;
+        pfd.events = POLLIN;
+
+        while ((rc = msg_parse(rd, frame)) == 0) {
+                nread = msg_fill(rd, sfd);
+
+                if (nread == 0)
+                        return -1;
+
+                if ((nread < 0) && (errno != EAGAIN) && (errno != EWOULDBLOCK)
+                    && (errno != EINTR))
+                        return -1;
+
+                if ((nread < 0) && (poll(&pfd, 1, -1) < 0) && (errno != EINTR))
+                        return -1;
+        }
+
+        return rc;
+}
+
+/**
+ * \brief      Encodes a message in a pool.
+ *
+ * The \c msg_buf_alloc() function works as \c msg_buf_new(), but takes the
+ * buffer from \a pool. It must always be called from the same thread for a
+ * given pool, while the message may be released from any thread.
+ *
+ * \param      pool     The message pool, or NULL for the heap
+ * \param[in]  code     The message code
+ * \param[in]  fields   The message fields
+ * \param[in]  nfields  The number of fields
+ *
+ * \return     The encoded message on success, NULL otherwise.
+ */
+struct msg_buf *msg_buf_alloc(struct msg_pool *const pool, const int8_t code,
+                              const struct msg_field *const fields,
+                              const int nfields)
+{
+        return msg_buf_encode(pool, MSG_V1, code, fields, nfields);
+}
+
+/**
+ * \brief      Encodes a message for a protocol version.
+ *
+ * The \c msg_buf_encode() function works as \c msg_buf_alloc(), but encodes
+ * the message with the protocol \a version. \c msg_buf_alloc() encodes version
+ * 1 messages.
+ *
+ * \param      pool     The message pool, or NULL for the heap
+ * \param[in]  version  The protocol version
+ * \param[in]  code     The message code
+ * \param[in]  fields   The message fields
+ * \param[in]  nfields  The number of fields
+ *
+ * \return     The encoded message on success, NULL otherwise. In particular,
+ *             errno is set to EMSGSIZE if the message is too large for
+ *             \a version.
+ */
+struct msg_buf *msg_buf_encode(struct msg_pool *const pool, const int version,
+                               const int8_t code,
+                               const struct msg_field *const fields,
+                               const int nfields)
+{
+        const char *layout = msg_layout(code);
+        struct msg_buf *buf;
+        ssize_t payload;
+        size_t size;
+        char *p;
+        int i;
+
+        assert((fields != NULL) || (nfields == 0));
+        assert(strlen(layout) == (size_t) nfields);
+        assert((version == MSG_V1) || (version == MSG_V2));
+
+        payload = msg_payload(version, layout, fields, nfields);
+
+        if (payload < 0) {
+                errno = EMSGSIZE;
+
+                return NULL;
+        }
+
+        size = ((version == MSG_V1) ? sizeof(int8_t) : MSG_HDRSIZ) + payload;
+        buf = msg_buf_get(pool, size);
+
+        if (buf == NULL)
+                return NULL;
+
+        buf->code = code;
+        buf->version = version;
+
+        p = buf->data + msg_put_header(buf->data, version, code, 0,
+                                       payload);
+
+        for (i = 0; i < nfields; ++i) {
+                if (layout[i] == 't')
+                        p = p + msg_put_size(p, version, fields[i].size);
+
+                memcpy(p, fields[i].data, fields[i].size);
+                p = p + fields[i].size;
+        }
+
+        return buf;
+}
+
+/**
+ * \brief      Encodes a batch of messages.
+ *
+ * The \c msg_buf_batch() function encodes a \c MSG_CODE_BATCH message holding
+ * a copy of the \a nbufs version 2 messages \a bufs, in order.
+ *
+ * \param      pool   The message pool, or NULL for the heap
+ * \param[in]  bufs   The encoded messages
+ * \param[in]  nbufs  The number of messages
+ *
+ * \return     The encoded batch on success, NULL otherwise. In particular,
+ *             errno is set to EMSGSIZE if the messages do not fit in a single
+ *             message.
+ */
+struct msg_buf *msg_buf_batch(struct msg_pool *const pool,
+                              struct msg_buf *const *const bufs,
+                              const int nbufs)
+{
+        struct msg_buf *buf;
+        size_t size = 0;
+        char *p;
+        int i;
+
+        assert((bufs != NULL) || (nbufs == 0));
+
+        for (i = 0; i < nbufs; ++i) {
+                assert(bufs[i]->version == MSG_V2);
+                size = size + bufs[i]->size;
+        }
+
+        if (size > MSG_MAXSIZE - sizeof(uint32_t)) {
+                errno = EMSGSIZE;
+
+                return NULL;
+        }
+
+        buf = msg_buf_get(pool, MSG_HDRSIZ + sizeof(uint32_t) + size);
+
+        if (buf == NULL)
+                return NULL;
+
+        buf->code = MSG_CODE_BATCH;
+        buf->version = MSG_V2;
+
+        p = buf->data + msg_put_header(buf->data, MSG_V2, MSG_CODE_BATCH, 0,
+                                       sizeof(uint32_t) + size);
+        p = p + msg_put_size(p, MSG_V2, size);
+
+        for (i = 0; i < nbufs; ++i) {
+                memcpy(p, bufs[i]->data, bufs[i]->size);
+                p = p + bufs[i]->size;
+        }
+
+        return buf;
+}
+
+/**
+ * \brief      Encodes a message.
+ *
+ * The \c msg_buf_new() function encodes a message with code \a code and the
+ * \a nfields fields \a fields in a newly allocated buffer. The returned message
+ * holds one reference.
+ *
+ * \param[in]  code     The message code
+ * \param[in]  fields   The message fields
+ * \param[in]  nfields  The number of fields
+ *
+ * \return     The encoded message on success, NULL otherwise.
+ */
+struct msg_buf *msg_buf_new(const int8_t code,
+                            const struct msg_field *const fields,
+                            const int nfields)
+{
+        return msg_buf_alloc(NULL, code, fields, nfields);
+}
+
+/**
+ * \brief      Compresses an encoded message.
+ *
+ * The \c msg_buf_deflate() function compresses the payload of the version 2
+ * message \a buf with the output stream of \a codec. The compressed messages
+ * must be sent in the order of their compression.
+ *
+ * \param      codec  The message codec
+ * \param[in]  buf    The encoded message
+ *
+ * \return     The compressed message on success, NULL otherwise. In particular,
+ *             errno is set to EMSGSIZE if the compressed payload might not fit
+ *             in a single message, in which case the stream is left untouched
+ *             and \a buf may be sent as is.
+ */
+struct msg_buf *msg_buf_deflate(struct msg_codec *const codec,
+                                const struct msg_buf *const buf)
+{
+#ifdef CVB_HAVE_ZLIB
+        z_stream *z;
+        struct msg_buf *zbuf;
+        size_t payload, bound, size;
+
+        assert(codec != NULL);
+        assert(buf != NULL);
+        assert(buf->version == MSG_V2);
+
+        z = (z_stream *) codec->zout;
+        payload = buf->size - MSG_HDRSIZ;
+        /* Room for the sync flush, whatever the state of the stream */
+        bound = deflateBound(z, payload) + 2 * sizeof(sync_tail);
+
+        if (bound > MSG_MAXSIZE) {
+                errno = EMSGSIZE;
+
+                return NULL;
+        }
+
+        zbuf = msg_buf_get(codec->pool, MSG_HDRSIZ + bound);
+
+        if (zbuf == NULL)
+                return NULL;
+
+        z->next_in = (Bytef *) buf->data + MSG_HDRSIZ;
+        z->avail_in = payload;
+        z->next_out = (Bytef *) zbuf->data + MSG_HDRSIZ;
+        z->avail_out = bound;
+
+        if ((deflate(z, Z_SYNC_FLUSH) != Z_OK) || (z->avail_in > 0)
+            || (z->avail_out == 0)) {
+                msg_buf_free(zbuf);
+                errno = ENOBUFS;
+
+                return NULL;
+        }
+
+        size = bound - z->avail_out;
+
+        /* The receiver adds the empty block ending each flush back */
+        assert(size >= sizeof(sync_tail));
+        assert(memcmp(zbuf->data + MSG_HDRSIZ + size - sizeof(sync_tail),
+                      sync_tail, sizeof(sync_tail)) == 0);
+
+        size = size - sizeof(sync_tail);
+
+        zbuf->code = buf->code;
+        zbuf->version = MSG_V2;
+        zbuf->flags = buf->flags;
+        zbuf->size = MSG_HDRSIZ + size;
+
+        msg_put_header(zbuf->data, MSG_V2, buf->code, MSG_FLAG_DEFLATE, size);
+
+        codec->nraw = codec->nraw + payload;
+        codec->nzip = codec->nzip + size;
+
+        return zbuf;
+#else
+        (void) codec;
+        (void) buf;
+
+        errno = ENOTSUP;
+
+        return NULL;
+#endif
+}
+
+/**
+ * \brief      Takes a reference on an encoded message.
+ *
+ * The \c msg_buf_ref() function increments the reference counter of \a buf.
+ * References may be taken and released from different threads.
+ *
+ * \param      buf   The encoded message
+ *
+ * \return     The encoded message.
+ */
+struct msg_buf *msg_buf_ref(struct msg_buf *const buf)
+{
+        assert(buf != NULL);
+
+        __atomic_add_fetch(&(buf->refs), 1, __ATOMIC_RELAXED);
+
+        return buf;
+}
+
+/**
+ * \brief      Releases an encoded message.
+ *
+ * The \c msg_buf_free() function decrements the reference counter of \a buf
+ * and frees it when no reference is left.
+ *
+ * \param      buf   The encoded message
+ */
+void msg_buf_free(struct msg_buf *const buf)
+{
+        if ((buf == NULL)
+            || (__atomic_sub_fetch(&(buf->refs), 1, __ATOMIC_ACQ_REL) != 0))
+                return;
+
+        if (buf->slab != NULL)
+                slab_free(buf->slab, buf);
+        else
+                free(buf);
+}
+
+/**
+ * \brief      Initializes a message pool.
+ *
+ * \param      pool   The message pool
+ * \param[in]  flags  The slab flags
+ *
+ * \return     0 on success, -1 otherwise.
+ */
+int msg_pool_init(struct msg_pool *const pool, const int flags)
+{
+        int i;
+
+        assert(pool != NULL);
+
+        pool->nmalloc = 0;
+
+        for (i = 0; i < MSG_POOL_NCLASSES; ++i) {
+                if (slab_init(pool->slabs + i, classes[i], flags) != 0)
+                        return -1;
+        }
+
+        return 0;
+}
+
+/**
+ * \brief      Destroys a message pool.
+ *
+ * The \c msg_pool_destroy() function frees the memory of \a pool. Messages
+ * still referenced become invalid.
+ *
+ * \param      pool  The message pool
+ */
+void msg_pool_destroy(struct msg_pool *const pool)
+{
+        int i;
+
+        assert(pool != NULL);
+
+        for (i = 0; i < MSG_POOL_NCLASSES; ++i)
+                slab_destroy(pool->slabs + i);
+}
+
+/**
+ * \brief      Initializes a message codec.
+ *
+ * The \c msg_codec_init() function sets up both compression streams of
+ * \a codec. Compressed messages are taken from \a pool, which must only be
+ * used from the thread compressing them.
+ *
+ * \param      codec  The message codec
+ * \param      pool   The message pool, or NULL for the heap
+ *
+ * \return     0 on success, -1 otherwise. In particular, errno is set to
+ *             ENOTSUP if the library is built without compression.
+ */
+int msg_codec_init(struct msg_codec *const codec, struct msg_pool *const pool)
+{
+#ifdef CVB_HAVE_ZLIB
+        z_stream *zout, *zin;
+
+        assert(codec != NULL);
+
+        zout = (z_stream *) calloc(1, sizeof(z_stream));
+        zin = (z_stream *) calloc(1, sizeof(z_stream));
+
+        if ((zout == NULL) || (zin == NULL)) {
+                free(zout);
+                free(zin);
+
+                return -1;
+        }
+
+        /* Raw streams, the messages carry their own framing */
+        if (deflateInit2(zout, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -MSG_ZWBITS,
+                         MSG_ZMEMLEVEL, Z_DEFAULT_STRATEGY) != Z_OK) {
+                free(zout);
+                free(zin);
+                errno = ENOMEM;
+
+                return -1;
+        }
+
+        if (inflateInit2(zin, -MSG_ZWBITS) != Z_OK) {
+                deflateEnd(zout);
+                free(zout);
+                free(zin);
+                errno = ENOMEM;
+
+                return -1;
+        }
+
+        deflateSetDictionary(zout, (const Bytef *) dictionary,
+                             sizeof(dictionary) - 1);
+        inflateSetDictionary(zin, (const Bytef *) dictionary,
+                             sizeof(dictionary) - 1);
+
+        codec->zout = zout;
+        codec->zin = zin;
+        codec->buf = NULL;
+        codec->size = 0;
+        codec->pool = pool;
+        codec->nraw = 0;
+        codec->nzip = 0;
+
+        return 0;
+#else
+        (void) codec;
+        (void) pool;
+
+        errno = ENOTSUP;
+
+        return -1;
+#endif
+}
+
+/**
+ * \brief      Destroys a message codec.
+ *
+ * \param      codec  The message codec
+ */
+void msg_codec_destroy(struct msg_codec *const codec)
+{
+        assert(codec != NULL);
+
+#ifdef CVB_HAVE_ZLIB
+        if (codec->zout != NULL)
+                deflateEnd((z_stream *) codec->zout);
+
+        if (codec->zin != NULL)
+                inflateEnd((z_stream *) codec->zin);
+#endif
+
+        free(codec->zout);
+        free(codec->zin);
+        free(codec->buf);
+
+        codec->zout = NULL;
+        codec->zin = NULL;
+        codec->buf = NULL;
+        codec->size = 0;
+}
+
+/**
+ * \brief      Destroys a message reader.
+ *
+ * The \c msg_reader_destroy() function frees the buffer of \a rd.
+ *
+ * \param      rd    The message reader
+ */
+void msg_reader_destroy(struct msg_reader *const rd)
+{
+        assert(rd != NULL);
+
+        free(rd->buf);
+
+        rd->buf = NULL;
+        rd->size = 0;
+        rd->head = 0;
+        rd->tail = 0;
+}
@@ -0,0 +1,469 @@
+/**
+ * \file       msgq.c
+ * \brief      Functions dealing with outgoing message queues.
+ *
+ * Copyright (c) 2025 Antoni Blanche
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the “Software”), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include <assert.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include <cvb/msgq.h>
+
+/**
+ * \brief      Default queue size.
+ */
+#define DEFAULT_SIZE 16
+
+/**
+ * \brief      Maximum number of messages written by a single system call.
+ */
+#define MQ_IOVMAX 64
+
+/**
+ * \brief      Returns a queued message.
+ *
+ * \param[in]  mq    The message queue
+ * \param[in]  i     The message position, from the head
+ *
+ * \return     The queued message.
+ */
+static struct msg_buf *mq_at(const struct msgq *const mq, const size_t i)
+{
+        return mq->bufs[(mq->head + i) % mq->size];
+}
+
+/**
+ * \brief      Grows a message queue.
+ *
+ * The messages are moved to the beginning of the new buffer.
+ *
+ * \param      mq    The message queue
+ *
+ * \return     0 on success, -1 otherwise.
+ */
+static int mq_grow(struct msgq *const mq)
+{
+        struct msg_buf **bufs;
+        size_t size = mq->size + DEFAULT_SIZE;
+        size_t i;
+
+        if (mq->size > DEFAULT_SIZE)
+                size = 2 * mq->size;
+
+        bufs = (struct msg_buf **) malloc(size * sizeof(struct msg_buf *));
+
+        if (bufs == NULL)
+                return -1;
+
+        for (i = 0; i < mq->count; ++i)
+                bufs[i] = mq_at(mq, i);
+
+        free(mq->bufs);
+
+        mq->bufs = bufs;
+        mq->size = size;
+        mq->head = 0;
+
+        return 0;
+}
+
+/**
+ * \brief      Removes the first message.
+ *
+ * \param      mq    The message queue
+ */
+static void mq_pop(struct msgq *const mq)
+{
+        struct msg_buf *buf = mq->bufs[mq->head];
+
+        mq->bytes = mq->bytes - (buf->size - mq->off);
+        mq->head = (mq->head + 1) % mq->size;
+        mq->off = 0;
+        --mq->count;
+
+        if (mq->sealed > 0)
+                --mq->sealed;
+
+        msg_buf_free(buf);
+}
+
+/**
+ * \brief      Returns the first message that may still be changed.
+ *
+ * Messages partially written or sealed are sent as they are.
+ *
+ * \param[in]  mq    The message queue
+ *
+ * \return     The message position, from the head.
+ */
+static size_t mq_first(const struct msgq *const mq)
+{
+        if (mq->sealed > 0)
+                return mq->sealed;
+
+        return (mq->off > 0);
+}
+
+/**
+ * \brief      Removes a message.
+ *
+ * \param      mq    The message queue
+ * \param[in]  i     The message position, from the head
+ */
+static void mq_erase(struct msgq *const mq, const size_t i)
+{
+        struct msg_buf *buf = mq_at(mq, i);
+        size_t j;
+
+        for (j = i; j + 1 < mq->count; ++j)
+                mq->bufs[(mq->head + j) % mq->size] = mq_at(mq, j + 1);
+
+        mq->bytes = mq->bytes - buf->size;
+        --mq->count;
+
+        msg_buf_free(buf);
+}
+
+/**
+ * \brief      Decodes a queued message.
+ *
+ * \param[in]  buf    The encoded message
+ * \param[out] frame  The decoded message
+ *
+ * \return     1 on success, 0 or -1 otherwise.
+ */
+static int mq_decode(const struct msg_buf *const buf,
+                     struct msg_frame *const frame)
+{
+        struct msg_reader rd;
+
+        rd.buf = buf->data;
+        rd.size = buf->size;
+        rd.head = 0;
+        rd.tail = buf->size;
+        rd.codec = NULL;
+
+        return msg_parse(&rd, frame);
+}
+
+/**
+ * \brief      Merges two decoded messages.
+ *
+ * \param[in]  a     The first message
+ * \param[in]  b     The second message
+ *
+ * \return     The merged message on success, NULL otherwise.
+ */
+static struct msg_buf *mq_merge(const struct msg_frame *const a,
+                                const struct msg_frame *const b)
+{
+        struct msg_field fields[MSG_MAXFIELDS];
+        char text[MSG_BUFSIZ];
+        int i;
+
+        if ((a->nfields < 1) || (a->nfields != b->nfields)
+            || (a->version != b->version)
+            || (a->size[0] + b->size[0] + 1 >= MSG_BUFSIZ))
+                return NULL;
+
+        for (i = 1; i < a->nfields; ++i) {
+                if ((a->size[i] != b->size[i])
+                    || (memcmp(a->field[i], b->field[i], a->size[i]) != 0))
+                        return NULL;
+
+                fields[i].data = a->field[i];
+                fields[i].size = a->size[i];
+        }
+
+        memcpy(text, a->field[0], a->size[0]);
+        text[a->size[0]] = '\n';
+        memcpy(text + a->size[0] + 1, b->field[0], b->size[0]);
+
+        fields[0].data = text;
+        fields[0].size = a->size[0] + b->size[0] + 1;
+
+        return msg_buf_encode(NULL, a->version, a->code, fields,
+                              a->nfields);
+}
+
+/**
+ * \brief      Seals the messages about to be written.
+ *
+ * The \c mq_seal() function compresses the version 2 messages among the next
+ * \c MQ_IOVMAX ones with the codec of \a mq. Messages too large to compress
+ * are sealed as they are.
+ *
+ * \param      mq    The message queue
+ *
+ * \return     0 on success, -1 otherwise.
+ */
+static int mq_seal(struct msgq *const mq)
+{
+        struct msg_buf *buf, *zbuf;
+
+        while ((mq->sealed < mq->count) && (mq->sealed < MQ_IOVMAX)) {
+                buf = mq_at(mq, mq->sealed);
+
+                if (buf->version == MSG_V2) {
+                        zbuf = msg_buf_deflate(mq->codec, buf);
+
+                        if ((zbuf == NULL) && (errno != EMSGSIZE))
+                                return -1;
+
+                        if (zbuf != NULL) {
+                                mq->bytes = mq->bytes - buf->size + zbuf->size;
+                                mq->bufs[(mq->head + mq->sealed) % mq->size] =
+                                        zbuf;
+                                msg_buf_free(buf);
+                        }
+                }
+
+                ++mq->sealed;
+        }
+
+        return 0;
+}
+
+/**
+ * \brief      Appends a message.
+ *
+ * The \c mq_push() function appends \a buf at the end of \a mq. On success,
+ * \a mq takes the ownership of \a buf.
+ *
+ * \param      mq    The message queue
+ * \param      buf   The encoded message
+ *
+ * \return     0 on success, -1 otherwise.
+ */
+int mq_push(struct msgq *const mq, struct msg_buf *const buf)
+{
+        assert(mq != NULL);
+        assert(buf != NULL);
+
+        if ((mq->count == mq->size) && (mq_grow(mq) != 0))
+                return -1;
+
+        mq->bufs[(mq->head + mq->count) % mq->size] = buf;
+        mq->bytes = mq->bytes + buf->size;
+        ++mq->count;
+
+        return 0;
+}
+
+/**
+ * \brief      Drops a message.
+ *
+ * The \c mq_drop() function removes the oldest message with code \a code not
+ * partially written nor sealed yet from \a mq. Messages flagged with
+ * \c MSG_BUF_KEEP are never dropped.
+ *
+ * \param      mq    The message queue
+ * \param[in]  code  The message code
+ *
+ * \return     0 if a message has been dropped, -1 otherwise.
+ */
+int mq_drop(struct msgq *const mq, const int8_t code)
+{
+        size_t i;
+
+        assert(mq != NULL);
+
+        for (i = mq_first(mq); i < mq->count; ++i) {
+                if ((mq_at(mq, i)->code == code)
+                    && !(mq_at(mq, i)->flags & MSG_BUF_KEEP)) {
+                        mq_erase(mq, i);
+
+                        return 0;
+                }
+        }
+
+        return -1;
+}
+
+/**
+ * \brief      Merges two messages.
+ *
+ * The \c mq_coalesce() function replaces the two oldest consecutive messages
+ * with code \a code not partially written nor sealed yet, and whose fields
+ * are identical except the first one, by a single message. The first text
+ * fields are joined by a newline. Messages flagged with \c MSG_BUF_KEEP are
+ * never merged.
+ *
+ * \param      mq    The message queue
+ * \param[in]  code  The message code
+ *
+ * \return     0 if two messages have been merged, -1 otherwise.
+ */
+int mq_coalesce(struct msgq *const mq, const int8_t code)
+{
+        struct msg_frame a, b;
+        struct msg_buf *buf;
+        size_t i;
+
+        assert(mq != NULL);
+
+        for (i = mq_first(mq); i + 1 < mq->count; ++i) {
+                if ((mq_at(mq, i)->code != code)
+                    || (mq_at(mq, i + 1)->code != code)
+                    || (mq_at(mq, i)->flags & MSG_BUF_KEEP)
+                    || (mq_at(mq, i + 1)->flags & MSG_BUF_KEEP)
+                    || (mq_decode(mq_at(mq, i), &a) != 1)
+                    || (mq_decode(mq_at(mq, i + 1), &b) != 1))
+                        continue;
+
+                buf = mq_merge(&a, &b);
+
+                if (buf != NULL) {
+                        mq->bytes = mq->bytes - mq_at(mq, i)->size + buf->size;
+                        msg_buf_free(mq_at(mq, i));
+                        mq->bufs[(mq->head + i) % mq->size] = buf;
+                        mq_erase(mq, i + 1);
+
+                        return 0;
+                }
+        }
+
+        return -1;
+}
+
+/**
+ * \brief      Sets the codec of a message queue.
+ *
+ * The \c mq_set_codec() function compresses the messages appended to \a mq
+ * from now on with \a codec. The messages already queued are sent as is.
+ *
+ * \param      mq     The message queue
+ * \param      codec  The message codec
+ */
+void mq_set_codec(struct msgq *const mq, struct msg_codec *const codec)
+{
+        assert(mq != NULL);
+        assert(codec != NULL);
+
+        mq->codec = codec;
+        mq->sealed = mq->count;
+}
+
+/**
+ * \brief      Writes queued messages.
+ *
+ * The \c mq_flush() function writes as many queued messages as possible on
+ * \a sfd, several messages per system call, without blocking. Messages fully
+ * written are removed from \a mq.
+ *
+ * \param      mq    The message queue
+ * \param[in]  sfd   The socket
+ *
+ * \return     The number of bytes written on success, -1 otherwise.
+ */
+ssize_t mq_flush(struct msgq *const mq, const int sfd)
+{
+        struct iovec iov[MQ_IOVMAX];
+        struct msghdr mh;
+        struct msg_buf *buf;
+        ssize_t nwrite, total = 0;
+        size_t i, len;
+
+        assert(mq != NULL);
+
+        while (mq->count > 0) {
+                if ((mq->codec != NULL) && (mq_seal(mq) != 0))
+                        return -1;
+
+                iov[0].iov_base = mq_at(mq, 0)->data + mq->off;
+                iov[0].iov_len = mq_at(mq, 0)->size - mq->off;
+                len = iov[0].iov_len;
+
+                for (i = 1; (i < mq->count) && (i < MQ_IOVMAX); ++i) {
+                        buf = mq_at(mq, i);
+                        iov[i].iov_base = buf->data;
+                        iov[i].iov_len = buf->size;
+                        len = len + buf->size;
+                }
+
+                memset(&mh, 0, sizeof(struct msghdr));
+                mh.msg_iov = iov;
+                mh.msg_iovlen = i;
+
+                /* Same as writev(), without SIGPIPE on a closed peer */
+                nwrite = sendmsg(sfd, &mh, MSG_DONTWAIT | MSG_NOSIGNAL);
+
+                if (nwrite < 0) {
+                        if ((errno == EAGAIN) || (errno == EWOULDBLOCK)
+                            || (errno == EINTR))
+                                break;
+
+                        return -1;
+                }
+
+                total = total + nwrite;
+                /* A short write means the socket buffer is full */
+                len = len - nwrite;
+
+                while ((nwrite > 0) && (mq->count > 0)) {
+                        buf = mq->bufs[mq->head];
+
+                        if ((size_t) nwrite < buf->size - mq->off) {
+                                mq->off = mq->off + nwrite;
+                                mq->bytes = mq->bytes - nwrite;
+                                nwrite = 0;
+                        } else {
+                                nwrite = nwrite - (buf->size - mq->off);
+                                mq_pop(mq);
+                        }
+                }
+
+                if (len > 0)
+                        break;
+        }
+
+        return total;
+}
+
+/**
+ * \brief      Destroys a message queue.
+ *
+ * The \c mq_destroy() function frees all the messages left in \a mq.
+ *
+ * \param      mq    The message queue
+ */
+void mq_destroy(struct msgq *const mq)
+{
+        assert(mq != NULL);
+
+        while (mq->count > 0)
+                mq_pop(mq);
+
+        free(mq->bufs);
+
+        mq->bufs = NULL;
+        mq->size = 0;
+        mq->head = 0;
+        mq->off = 0;
+        mq->bytes = 0;
+        mq->codec = NULL;
+        mq->sealed = 0;
+}
@@ -29,10 +29,14 @@
 #include <string.h>
 #include <unistd.h>
 
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
 #include <sys/socket.h>
 #include <sys/types.h>
 
 #include <cvb/logger.h>
+#include <cvb/net.h>
 
 /**
  * \brief      Internal getaddrinfo().
@@ -79,11 +83,12 @@ static struct addrinfo *net_getaddrinfo(const char *const host,
  * The \c net_bind_socket() function tries to \c bind() each socket provided by
  * the address list \a rp until success.
  *
- * \param[in]  rp    The address list
+ * \param[in]  rp     The address list
+ * \param[in]  flags  The socket flags
  *
  * \return     The binded socket.
  */
-static int net_bind_socket(const struct addrinfo *rp)
+static int net_bind_socket(const struct addrinfo *rp, const int flags)
 {
         int sfd, optval = 1;
 
@@ -94,6 +99,11 @@ static int net_bind_socket(const struct addrinfo *rp)
                         setsockopt(sfd, SOL_SOCKET, SO_REUSEADDR,
                                    &optval, sizeof(int));
 
+                        /* Lets several reactors listen on the same port */
+                        if (flags & NET_REUSEPORT)
+                                setsockopt(sfd, SOL_SOCKET, SO_REUSEPORT,
+                                           &optval, sizeof(int));
+
                         if (bind(sfd, rp->ai_addr, rp->ai_addrlen) == 0)
                                 return sfd;
 
@@ -108,21 +118,30 @@ static int net_bind_socket(const struct addrinfo *rp)
  * \brief      Connects a socket.
  *
  * The \c net_connect_socket() function tries to \c connect() each socket
- * provided by the address list \a rp until success.
+ * provided by the address list \a rp until success. With \c NET_NONBLOCK, the
+ * first connection started is kept, without waiting for it.
  *
- * \param[in]  rp    The address list
+ * \param[in]  rp     The address list
+ * \param[in]  flags  The socket flags
  *
  * \return     The Connected socket.
  */
-static int net_connect_socket(const struct addrinfo *rp)
+static int net_connect_socket(const struct addrinfo *rp, const int flags)
 {
-        int sfd;
+        int type, sfd;
 
         for (; rp != NULL; rp = rp->ai_next) {
-                sfd = socket(rp->ai_family, rp->ai_socktype, rp->ai_protocol);
+                type = rp->ai_socktype;
+
+                if (flags & NET_NONBLOCK)
+                        type = type | SOCK_NONBLOCK;
+
+                sfd = socket(rp->ai_family, type, rp->ai_protocol);
 
                 if (sfd >= 0) {
-                        if (connect(sfd, rp->ai_addr, rp->ai_addrlen) == 0)
+                        if ((connect(sfd, rp->ai_addr, rp->ai_addrlen) == 0)
+                            || ((flags & NET_NONBLOCK)
+                                && (errno == EINPROGRESS)))
                                 return sfd;
 
                         close(sfd);
@@ -139,13 +158,21 @@ static int net_connect_socket(const struct addrinfo *rp)
  * parameters \a host and \a service. If the \a host is NULL, then
  * \c net_fetch_socket() will return a socket suitable for \c net_accept_clnt().
  * Otherwise, the socket will be \c connect()ed directly to the \a host.
+ * Listening sockets fetched with \c NET_REUSEPORT are bound with
+ * \c SO_REUSEPORT, so that several of them can share the same \a service.
+ * Connecting sockets fetched with \c NET_NONBLOCK are non-blocking, and
+ * returned while the connection is still in progress: it is complete once
+ * the socket is writable, and \c SO_ERROR then gives its result.
  *
  * \param[in]  host     The host
  * \param[in]  service  The service
+ * \param[in]  flags    The socket flags: 0, \c NET_REUSEPORT or
+ *                      \c NET_NONBLOCK
  *
  * \return     The fetched socket.
  */
-int net_fetch_socket(const char *const host, const char *const service)
+int net_fetch_socket(const char *const host, const char *const service,
+                     const int flags)
 {
         struct addrinfo *res;
         int sfd;
@@ -156,7 +183,7 @@ int net_fetch_socket(const char *const host, const char *const service)
                 log_debug("[net] Trying to listen on port %s", service);
 
                 res = net_getaddrinfo(NULL, service, AI_PASSIVE);
-                sfd = net_bind_socket(res);
+                sfd = net_bind_socket(res, flags);
 
                 freeaddrinfo(res);
 
@@ -177,7 +204,7 @@ int net_fetch_socket(const char *const host, const char *const service)
                 log_debug("[net] Connecting to %s:%s", host, service);
 
                 res = net_getaddrinfo(host, service, 0);
-                sfd = net_connect_socket(res);
+                sfd = net_connect_socket(res, flags);
 
                 freeaddrinfo(res);
 
@@ -187,7 +214,10 @@ int net_fetch_socket(const char *const host, const char *const service)
                         return -1;
                 }
 
-                log_info("[net] Successfuly connected to %s:%s", host, service);
+                /* Possibly still connecting */
+                if (!(flags & NET_NONBLOCK))
+                        log_info("[net] Successfuly connected to %s:%s", host,
+                                 service);
         }
 
         return sfd;
@@ -213,7 +243,7 @@ int net_fetch_next(void)
         int rc;
 
         res = net_getaddrinfo(NULL, "0", AI_PASSIVE | AI_NUMERICHOST);
-        sfd = net_bind_socket(res);
+        sfd = net_bind_socket(res, 0);
 
         freeaddrinfo(res);
 
@@ -262,7 +292,7 @@ int net_accept_clnt(const int listener)
 {
         char host[NI_MAXHOST], service[NI_MAXSERV];
         struct sockaddr_storage addr;
-        socklen_t addrlen;
+        socklen_t addrlen = sizeof(addr);
         int sfd;
         int rc;
 
@@ -288,3 +318,37 @@ int net_accept_clnt(const int listener)
 
         return sfd;
 }
+
+/**
+ * \brief      Enables TCP keepalive.
+ *
+ * The \c net_keepalive() function makes the system probe the peer of \a sfd
+ * after \a idle seconds of silence, then every third of \a idle, and give up
+ * after 3 unanswered probes.
+ *
+ * \param[in]  sfd   The connected socket
+ * \param[in]  idle  The idle time before probing, in seconds
+ *
+ * \return     0 on success, -1 otherwise.
+ */
+int net_keepalive(const int sfd, const int idle)
+{
+        int optval = 1;
+        int intvl = (idle > 3) ? idle / 3 : 1;
+        int cnt = 3;
+
+        if ((setsockopt(sfd, SOL_SOCKET, SO_KEEPALIVE, &optval, sizeof(int))
+             != 0)
+            || (setsockopt(sfd, IPPROTO_TCP, TCP_KEEPIDLE, &idle, sizeof(int))
+                != 0)
+            || (setsockopt(sfd, IPPROTO_TCP, TCP_KEEPINTVL, &intvl,
+                           sizeof(int)) != 0)
+            || (setsockopt(sfd, IPPROTO_TCP, TCP_KEEPCNT, &cnt, sizeof(int))
+                != 0)) {
+                log_warn("[net] setsockopt(): %s", strerror(errno));
+
+                return -1;
+        }
+
+        return 0;
+}
@@ -0,0 +1,249 @@
+/**
+ * \file       slab.c
+ * \brief      Functions dealing with fixed-size object allocation.
+ *
+ * Copyright (c) 2025 Antoni Blanche
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the “Software”), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include <assert.h>
+#include <stdlib.h>
+
+#include <sys/mman.h>
+
+#include <cvb/slab.h>
+
+/**
+ * \brief      Object alignment.
+ */
+#define ALIGNMENT 16
+
+/**
+ * \brief      Chunk header.
+ *
+ * Each chunk starts with this header, the objects follow it.
+ */
+struct chunk {
+        struct chunk *next; /**< The next chunk */
+        size_t size;        /**< The chunk size */
+};
+
+/**
+ * \brief      Returns the next object of a list.
+ *
+ * Free objects are linked through their first bytes.
+ *
+ * \param[in]  obj   The object
+ *
+ * \return     A pointer to the next object.
+ */
+static void **slab_next(void *const obj)
+{
+        return (void **) obj;
+}
+
+/**
+ * \brief      Maps a chunk.
+ *
+ * The \c slab_map() function maps \a size bytes of anonymous memory, from the
+ * huge pages pool if \a flags asks for it and if the pool is not empty, or
+ * with a transparent huge pages hint otherwise.
+ *
+ * \param[in]  size   The chunk size
+ * \param[in]  flags  The slab flags
+ *
+ * \return     The chunk on success, NULL otherwise.
+ */
+static void *slab_map(const size_t size, const int flags)
+{
+        void *p = MAP_FAILED;
+
+#ifdef MAP_HUGETLB
+        if (flags & SLAB_HUGEPAGE)
+                p = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+#endif
+
+        if (p == MAP_FAILED) {
+                p = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+                if (p == MAP_FAILED)
+                        return NULL;
+
+#ifdef MADV_HUGEPAGE
+                if (flags & SLAB_HUGEPAGE)
+                        madvise(p, size, MADV_HUGEPAGE);
+#endif
+        }
+
+        return p;
+}
+
+/**
+ * \brief      Adds a chunk to a slab.
+ *
+ * \param      slab  The slab
+ *
+ * \return     0 on success, -1 otherwise.
+ */
+static int slab_grow(struct slab *const slab)
+{
+        struct chunk *chunk;
+        char *obj, *end;
+
+        chunk = (struct chunk *) slab_map(slab->chunksize, slab->flags);
+
+        if (chunk == NULL)
+                return -1;
+
+        chunk->next = (struct chunk *) slab->chunks;
+        chunk->size = slab->chunksize;
+        slab->chunks = chunk;
+        ++slab->nchunks;
+
+        obj = (char *) chunk + ALIGNMENT;
+        end = (char *) chunk + slab->chunksize;
+
+        for (; obj + slab->objsize <= end; obj = obj + slab->objsize) {
+                *slab_next(obj) = slab->free;
+                slab->free = obj;
+        }
+
+        return 0;
+}
+
+/**
+ * \brief      Initializes a slab.
+ *
+ * The \c slab_init() function initializes \a slab for objects of \a objsize
+ * bytes.
+ *
+ * \param      slab     The slab
+ * \param[in]  objsize  The object size
+ * \param[in]  flags    The slab flags: 0 or \c SLAB_HUGEPAGE
+ *
+ * \return     0 on success, -1 otherwise.
+ */
+int slab_init(struct slab *const slab, size_t objsize, const int flags)
+{
+        assert(slab != NULL);
+        assert(ALIGNMENT >= sizeof(struct chunk));
+
+        if (objsize < sizeof(void *))
+                objsize = sizeof(void *);
+
+        objsize = (objsize + ALIGNMENT - 1) & ~((size_t) ALIGNMENT - 1);
+
+        *slab = (struct slab) SLAB_INIT;
+        slab->objsize = objsize;
+        slab->flags = flags;
+        slab->chunksize = (flags & SLAB_HUGEPAGE) ? SLAB_HUGECHUNK : SLAB_CHUNK;
+
+        while (slab->chunksize < ALIGNMENT + objsize)
+                slab->chunksize = 2 * slab->chunksize;
+
+        return 0;
+}
+
+/**
+ * \brief      Allocates an object.
+ *
+ * The \c slab_alloc() function returns a free object of \a slab, allocating
+ * a new chunk only when no object is left.
+ *
+ * \param      slab  The slab
+ *
+ * \return     The object on success, NULL otherwise.
+ */
+void *slab_alloc(struct slab *const slab)
+{
+        void *obj;
+
+        assert(slab != NULL);
+
+        /* Reclaim the objects freed by other threads at once */
+        if (slab->free == NULL)
+                slab->free = __atomic_exchange_n(&(slab->remote), NULL,
+                                                 __ATOMIC_ACQUIRE);
+
+        if ((slab->free == NULL) && (slab_grow(slab) != 0))
+                return NULL;
+
+        obj = slab->free;
+        slab->free = *slab_next(obj);
+        ++slab->nalloc;
+
+        return obj;
+}
+
+/**
+ * \brief      Frees an object.
+ *
+ * The \c slab_free() function gives \a obj back to \a slab. It may be called
+ * from any thread.
+ *
+ * \param      slab  The slab
+ * \param      obj   The object
+ */
+void slab_free(struct slab *const slab, void *const obj)
+{
+        void *head;
+
+        assert(slab != NULL);
+
+        if (obj == NULL)
+                return;
+
+        head = __atomic_load_n(&(slab->remote), __ATOMIC_RELAXED);
+
+        do {
+                *slab_next(obj) = head;
+        } while (!__atomic_compare_exchange_n(&(slab->remote), &head, obj, 1,
+                                              __ATOMIC_RELEASE,
+                                              __ATOMIC_RELAXED));
+
+        __atomic_add_fetch(&(slab->nfree), 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * \brief      Destroys a slab.
+ *
+ * The \c slab_destroy() function gives all the chunks of \a slab back to the
+ * system. Objects still allocated become invalid.
+ *
+ * \param      slab  The slab
+ */
+void slab_destroy(struct slab *const slab)
+{
+        struct chunk *chunk, *next;
+
+        assert(slab != NULL);
+
+        for (chunk = (struct chunk *) slab->chunks; chunk != NULL;
+             chunk = next) {
+                next = chunk->next;
+                munmap(chunk, chunk->size);
+        }
+
+        slab->chunks = NULL;
+        slab->free = NULL;
+        slab->remote = NULL;
+        slab->nchunks = 0;
+}
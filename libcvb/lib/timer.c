@@ -0,0 +1,373 @@
+/**
+ * \file       timer.c
+ * \brief      Functions dealing with timers.
+ *
+ * Copyright (c) 2025 Antoni Blanche
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the “Software”), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include <assert.h>
+#include <limits.h>
+#include <stddef.h>
+#include <time.h>
+
+#include <cvb/timer.h>
+
+/**
+ * \brief      Slot index mask.
+ */
+#define TW_MASK (TW_SIZE - 1)
+
+/**
+ * \brief      Returns the first non-empty slot.
+ *
+ * \param[in]  used   The non-empty slots of a level
+ * \param[in]  first  The slot to start from
+ *
+ * \return     The distance from \a first to the first non-empty slot.
+ */
+static int tw_first(const uint64_t used, const int first)
+{
+        uint64_t rot;
+        int i;
+
+        rot = (first > 0) ? (used >> first) | (used << (TW_SIZE - first))
+                          : used;
+
+#ifdef __GNUC__
+        i = __builtin_ctzll(rot);
+#else
+        for (i = 0; !(rot & 1); ++i)
+                rot >>= 1;
+#endif
+
+        return i;
+}
+
+/**
+ * \brief      Links a timer into its slot.
+ *
+ * The slot is chosen from the distance between the timer expiration and the
+ * next tick to run.
+ *
+ * \param      tw     The timer wheel
+ * \param      timer  The timer
+ */
+static void tw_link(struct timerwheel *const tw, struct timer *const timer)
+{
+        unsigned long expires;
+        unsigned long ticks;
+        struct timer **head;
+        int level;
+        int i;
+
+        if (timer->expires < tw->now)
+                timer->expires = tw->now;
+
+        ticks = timer->expires - tw->now;
+        expires = timer->expires;
+
+        if (ticks > TW_MAXTICKS) {
+                ticks = TW_MAXTICKS;
+                expires = tw->now + ticks;
+        }
+
+        for (level = 0; level < TW_LEVELS - 1; ++level) {
+                if (ticks < (1UL << (TW_BITS * (level + 1))))
+                        break;
+        }
+
+        i = (expires >> (TW_BITS * level)) & TW_MASK;
+        head = &(tw->slots[level][i]);
+
+        timer->next = *head;
+        timer->pprev = head;
+        timer->slot = level * TW_SIZE + i;
+
+        if (*head != NULL)
+                (*head)->pprev = &(timer->next);
+
+        *head = timer;
+        tw->used[level] |= (uint64_t) 1 << i;
+}
+
+/**
+ * \brief      Unlinks a timer from its slot.
+ *
+ * \param      tw     The timer wheel
+ * \param      timer  The timer
+ */
+static void tw_unlink(struct timerwheel *const tw, struct timer *const timer)
+{
+        int level = timer->slot / TW_SIZE;
+        int i = timer->slot % TW_SIZE;
+
+        *(timer->pprev) = timer->next;
+
+        if (timer->next != NULL)
+                timer->next->pprev = timer->pprev;
+
+        if (tw->slots[level][i] == NULL)
+                tw->used[level] &= ~((uint64_t) 1 << i);
+
+        timer->next = NULL;
+        timer->pprev = NULL;
+}
+
+/**
+ * \brief      Returns the next tick with work to do.
+ *
+ * This is the first tick expiring a timer of the first level, or moving down
+ * the timers of an upper level slot.
+ *
+ * \param[in]  tw    The timer wheel
+ *
+ * \return     The next tick, ULONG_MAX if no timer is pending.
+ */
+static unsigned long tw_next(const struct timerwheel *const tw)
+{
+        unsigned long next = ULONG_MAX;
+        unsigned long block;
+        unsigned long tick;
+        int shift;
+        int level;
+
+        if (tw->used[0])
+                next = tw->now + tw_first(tw->used[0], tw->now & TW_MASK);
+
+        for (level = 1; level < TW_LEVELS; ++level) {
+                if (!tw->used[level])
+                        continue;
+
+                /* First slot boundary of this level not run yet */
+                shift = TW_BITS * level;
+                block = (tw->now + (1UL << shift) - 1) >> shift;
+                block += tw_first(tw->used[level], block & TW_MASK);
+                tick = block << shift;
+
+                if (tick < next)
+                        next = tick;
+        }
+
+        return next;
+}
+
+/**
+ * \brief      Moves the timers of a slot down.
+ *
+ * \param      tw     The timer wheel
+ * \param[in]  level  The slot level
+ * \param[in]  i      The slot index
+ */
+static void tw_cascade(struct timerwheel *const tw, const int level,
+                       const int i)
+{
+        struct timer *timer;
+
+        while ((timer = tw->slots[level][i]) != NULL) {
+                tw_unlink(tw, timer);
+                tw_link(tw, timer);
+        }
+}
+
+/**
+ * \brief      Runs a tick.
+ *
+ * \param      tw    The timer wheel
+ *
+ * \return     The number of expired timers.
+ */
+static int tw_tick(struct timerwheel *const tw)
+{
+        struct timer *list;
+        struct timer *timer;
+        unsigned long tick = tw->now;
+        int level;
+        int i;
+        int n = 0;
+
+        for (level = 1; level < TW_LEVELS; ++level) {
+                if (tick & ((1UL << (TW_BITS * level)) - 1))
+                        break;
+
+                tw_cascade(tw, level, (tick >> (TW_BITS * level)) & TW_MASK);
+        }
+
+        /* Callbacks may cancel any timer of the expired list */
+        i = tick & TW_MASK;
+        list = tw->slots[0][i];
+        tw->slots[0][i] = NULL;
+        tw->used[0] &= ~((uint64_t) 1 << i);
+
+        if (list != NULL)
+                list->pprev = &list;
+
+        ++tw->now;
+
+        while ((timer = list) != NULL) {
+                list = timer->next;
+
+                if (list != NULL)
+                        list->pprev = &list;
+
+                timer->next = NULL;
+                timer->pprev = NULL;
+                --tw->count;
+                ++n;
+
+                timer->fn(timer->arg);
+        }
+
+        return n;
+}
+
+int tw_init(struct timerwheel *const tw, const long tick)
+{
+        struct timespec ts;
+        int level;
+        int i;
+
+        assert(tw != NULL);
+
+        if ((tick < 1) || (clock_gettime(CLOCK_MONOTONIC, &ts) != 0))
+                return -1;
+
+        for (level = 0; level < TW_LEVELS; ++level) {
+                for (i = 0; i < TW_SIZE; ++i)
+                        tw->slots[level][i] = NULL;
+
+                tw->used[level] = 0;
+        }
+
+        tw->now = 0;
+        tw->count = 0;
+        tw->tick = tick;
+        tw->start = ts.tv_sec;
+
+        return 0;
+}
+
+long tw_now(const struct timerwheel *const tw)
+{
+        struct timespec ts;
+
+        assert(tw != NULL);
+
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+
+        return (ts.tv_sec - tw->start) * 1000 + ts.tv_nsec / 1000000;
+}
+
+void tw_timer(struct timer *const timer, void (*const fn)(void *),
+              void *const arg)
+{
+        assert(timer != NULL);
+        assert(fn != NULL);
+
+        timer->next = NULL;
+        timer->pprev = NULL;
+        timer->expires = 0;
+        timer->slot = 0;
+        timer->fn = fn;
+        timer->arg = arg;
+}
+
+void tw_add(struct timerwheel *const tw, struct timer *const timer,
+            const long delay)
+{
+        long when;
+
+        assert(tw != NULL);
+        assert(timer != NULL);
+        assert(timer->fn != NULL);
+
+        if (timer->pprev != NULL)
+                tw_unlink(tw, timer);
+        else
+                ++tw->count;
+
+        when = tw_now(tw) + ((delay > 0) ? delay : 0);
+
+        /* Rounded up, never early */
+        timer->expires = (when + tw->tick - 1) / tw->tick;
+        tw_link(tw, timer);
+}
+
+void tw_cancel(struct timerwheel *const tw, struct timer *const timer)
+{
+        assert(tw != NULL);
+        assert(timer != NULL);
+
+        if (timer->pprev != NULL) {
+                tw_unlink(tw, timer);
+                --tw->count;
+        }
+}
+
+int tw_pending(const struct timer *const timer)
+{
+        assert(timer != NULL);
+
+        return timer->pprev != NULL;
+}
+
+int tw_timeout(const struct timerwheel *const tw)
+{
+        unsigned long next;
+        long timeout;
+
+        assert(tw != NULL);
+
+        if (tw->count == 0)
+                return -1;
+
+        next = tw_next(tw);
+        timeout = (long) next * tw->tick - tw_now(tw);
+
+        if (timeout < 0)
+                return 0;
+
+        return (timeout < INT_MAX) ? (int) timeout : INT_MAX;
+}
+
+int tw_run(struct timerwheel *const tw)
+{
+        unsigned long now;
+        unsigned long next;
+        int n = 0;
+
+        assert(tw != NULL);
+
+        now = tw_now(tw) / tw->tick;
+
+        while (tw->now <= now) {
+                next = tw_next(tw);
+
+                /* Nothing to do up to now, skip the idle ticks */
+                if (next > now) {
+                        tw->now = now + 1;
+                        break;
+                }
+
+                tw->now = next;
+                n += tw_tick(tw);
+        }
+
+        return n;
+}
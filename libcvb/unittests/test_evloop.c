@@ -0,0 +1,68 @@
+#include <assert.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <cvb/evloop.h>
+
+static void test_backend(const int backend, const char *const name)
+{
+        struct evloop evl = EVLOOP_INIT;
+        struct evl_event evs[EVL_MAXEVENTS];
+        int fds[2];
+        char c;
+
+        assert(evl_backend(name) == backend);
+        assert(evl_init(&evl, backend) == 0);
+        assert(strcmp(evl_name(&evl), name) == 0);
+        assert(pipe(fds) == 0);
+
+        /* Nothing to read yet */
+        assert(evl_add(&evl, fds[0], POLLIN) == 0);
+        assert(evl_wait(&evl, evs, EVL_MAXEVENTS, 0) == 0);
+
+        assert(write(fds[1], "x", 1) == 1);
+        assert(evl_wait(&evl, evs, EVL_MAXEVENTS, -1) == 1);
+        assert(evs[0].fd == fds[0]);
+        assert(evs[0].events & POLLIN);
+
+        /* Level triggered, until read */
+        assert(evl_wait(&evl, evs, EVL_MAXEVENTS, 0) == 1);
+        assert(read(fds[0], &c, 1) == 1);
+        assert(evl_wait(&evl, evs, EVL_MAXEVENTS, 0) == 0);
+
+        /* Both ends, then the writing end only */
+        assert(evl_add(&evl, fds[1], POLLOUT) == 0);
+        assert(write(fds[1], "y", 1) == 1);
+        assert(evl_wait(&evl, evs, EVL_MAXEVENTS, 0) == 2);
+
+        assert(evl_mod(&evl, fds[0], 0) == 0);
+        assert(evl_wait(&evl, evs, EVL_MAXEVENTS, 0) == 1);
+        assert(evs[0].fd == fds[1]);
+        assert(evs[0].events & POLLOUT);
+
+        assert(evl_remove(&evl, fds[1]) == 0);
+        assert(evl_mod(&evl, fds[0], POLLIN) == 0);
+        assert(evl_wait(&evl, evs, EVL_MAXEVENTS, 0) == 1);
+        assert(evs[0].fd == fds[0]);
+
+        assert(evl_remove(&evl, fds[0]) == 0);
+        assert(evl_wait(&evl, evs, EVL_MAXEVENTS, 0) == 0);
+
+        close(fds[0]);
+        close(fds[1]);
+
+        evl_destroy(&evl);
+        assert(strcmp(evl_name(&evl), "none") == 0);
+}
+
+int main(void)
+{
+        test_backend(EVL_BACKEND_POLL, "poll");
+        test_backend(EVL_BACKEND_EPOLL, "epoll");
+
+        assert(evl_backend("select") == -1);
+
+        return EXIT_SUCCESS;
+}
@@ -3,9 +3,14 @@
 
 #include <cvb/fdlist.h>
 
+#define NFDS 50000
+
 int main(void)
 {
         struct fdlist fdl = FDLIST_INIT;
+        struct pollfd *fds;
+        int *index;
+        int i;
 
         assert(fdl_add(&fdl, 0, 0) == 0);
         assert(fdl.nfds == 1);
@@ -24,11 +29,51 @@ int main(void)
         assert(fdl_remove(&fdl, 1) == 0);
         assert(fdl_get(&fdl, 1) == NULL);
 
-        assert(fdl.fds[1].fd == -1);
+        /* The last file descriptor fills the hole */
+        assert(fdl.nfds == 2);
+        assert(fdl.fds[1].fd == 3);
+        assert(fdl_get(&fdl, 3) == fdl.fds + 1);
+
+        assert(fdl_add(&fdl, 0, 0) != 0);
+        assert(fdl_add(&fdl, -1, 0) != 0);
 
         fdl_destroy(&fdl);
         assert(fdl.fds == NULL);
         assert(fdl.nfds == 0);
 
+        assert(fdl_reserve(&fdl, NFDS) == 0);
+        fds = fdl.fds;
+        index = fdl.index;
+
+        for (i = 0; i < NFDS; ++i)
+                assert(fdl_add(&fdl, i, POLLIN) == 0);
+
+        assert(fdl.fds == fds);
+        assert(fdl.index == index);
+        assert(fdl.nindex == NFDS);
+        assert(fdl.nfds == NFDS);
+
+        for (i = 0; i < NFDS; i += 2)
+                assert(fdl_remove(&fdl, i) == 0);
+
+        assert(fdl.nfds == NFDS / 2);
+
+        for (i = 0; i < NFDS; ++i) {
+                if (i % 2)
+                        assert(fdl_get(&fdl, i)->fd == i);
+                else
+                        assert(fdl_get(&fdl, i) == NULL);
+        }
+
+        for (i = 0; i < (int) fdl.nfds; ++i)
+                assert(fdl.fds[i].fd % 2 == 1);
+
+        fdl_destroy(&fdl);
+
+        assert(fdl_reserve(&fdl, 0) == 0);
+        assert(fdl.size > 0);
+
+        fdl_destroy(&fdl);
+
         return EXIT_SUCCESS;
 }
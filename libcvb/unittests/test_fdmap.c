@@ -1,8 +1,132 @@
 #include <assert.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include <cvb/fdmap.h>
+#include <cvb/intern.h>
+
+#define NNAMES 50000
+
+static void test_large(void)
+{
+        struct fdmap fdm = FDMAP_INIT;
+        char **names;
+        int i;
+
+        names = (char **) malloc(NNAMES * sizeof(char *));
+        assert(names != NULL);
+
+        for (i = 0; i < NNAMES; ++i) {
+                names[i] = (char *) malloc(16);
+                assert(names[i] != NULL);
+                sprintf(names[i], "user%d", i);
+                assert(fdm_put(&fdm, i, names[i]) == NULL);
+        }
+
+        for (i = 0; i < NNAMES; ++i)
+                assert(fdm_contains(&fdm, names[i]) == i);
+
+        assert(fdm_contains(&fdm, "user-1") == -1);
+
+        for (i = 0; i < NNAMES; i += 2)
+                assert(fdm_remove(&fdm, i) == names[i]);
+
+        for (i = 0; i < NNAMES; ++i)
+                assert(fdm_contains(&fdm, names[i]) == ((i % 2) ? i : -1));
+
+        /* Names move to other file descriptors */
+        for (i = 0; i < NNAMES; i += 2)
+                assert(fdm_put(&fdm, i, names[i + 1]) == NULL);
+
+        for (i = 1; i < NNAMES; i += 2)
+                assert(fdm_put(&fdm, i, names[i - 1]) == names[i]);
+
+        for (i = 0; i < NNAMES; ++i)
+                assert(fdm_contains(&fdm, names[i]) == (i ^ 1));
+
+        for (i = 0; i < NNAMES; ++i)
+                assert(fdm_remove(&fdm, i) == names[i ^ 1]);
+
+        for (i = 0; i < NNAMES; ++i) {
+                assert(fdm_contains(&fdm, names[i]) == -1);
+                free(names[i]);
+        }
+
+        assert(fdm.count == 0);
+
+        fdm_destroy(&fdm);
+        free(names);
+}
+
+static void test_next(void)
+{
+        struct fdmap fdm = FDMAP_INIT;
+        char *fdnames[] = {"alice", "bob", "carl"};
+        int seen[3] = {0, 0, 0};
+        int fds[3] = {7, 1000, 3};
+        int pos = 0;
+        int fd, i, n = 0;
+
+        assert(fdm_next(&fdm, &pos) == -1);
+
+        for (i = 0; i < 3; ++i)
+                assert(fdm_put(&fdm, fds[i], fdnames[i]) == NULL);
+
+        assert(fdm_remove(&fdm, 1000) == fdnames[1]);
+
+        /* Only the named file descriptors, once each */
+        while ((fd = fdm_next(&fdm, &pos)) != -1) {
+                for (i = 0; i < 3; ++i) {
+                        if (fd == fds[i])
+                                ++seen[i];
+                }
+
+                ++n;
+        }
+
+        assert(n == 2);
+        assert((seen[0] == 1) && (seen[1] == 0) && (seen[2] == 1));
+        assert(fdm_next(&fdm, &pos) == -1);
+
+        fdm_destroy(&fdm);
+}
+
+static void test_find(void)
+{
+        struct fdmap fdm = FDMAP_INIT;
+        struct itab tab = ITAB_INIT;
+        struct istr *is[NNAMES / 10];
+        struct istr *other;
+        char name[16];
+        int i;
+
+        for (i = 0; i < NNAMES / 10; ++i) {
+                sprintf(name, "user%d", i);
+                is[i] = itab_intern(&tab, name, strlen(name));
+                assert(is[i] != NULL);
+                assert(fdm_put(&fdm, i, (char *) is[i]->str) == NULL);
+        }
+
+        /* The interned hashes probe the same slots as the names */
+        for (i = 0; i < NNAMES / 10; ++i)
+                assert(fdm_find(&fdm, is[i]->str, is[i]->hash) == i);
+
+        other = itab_intern(&tab, "user-1", 6);
+        assert(other != NULL);
+        assert(fdm_find(&fdm, other->str, other->hash) == -1);
+
+        assert(fdm_remove(&fdm, 0) == is[0]->str);
+        assert(fdm_find(&fdm, is[0]->str, is[0]->hash) == -1);
+
+        itab_release(&tab, other);
+
+        for (i = 0; i < NNAMES / 10; ++i)
+                itab_release(&tab, is[i]);
+
+        fdm_destroy(&fdm);
+        itab_destroy(&tab);
+}
 
 int main(void)
 {
@@ -45,5 +169,9 @@ int main(void)
 
         fdm_destroy(&fdm);
 
+        test_large();
+        test_next();
+        test_find();
+
         return EXIT_SUCCESS;
 }
@@ -0,0 +1,87 @@
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <cvb/intern.h>
+
+#define NSTRS 50000
+
+static struct istr *strs[NSTRS];
+
+static void test_large(void)
+{
+        struct itab tab = ITAB_INIT;
+        char name[16];
+        int len;
+        int i;
+
+        for (i = 0; i < NSTRS; ++i) {
+                len = sprintf(name, "user%d", i);
+                strs[i] = itab_intern(&tab, name, len);
+                assert(strs[i] != NULL);
+        }
+
+        assert(tab.count == NSTRS);
+
+        for (i = 0; i < NSTRS; i += 2)
+                itab_release(&tab, strs[i]);
+
+        assert(tab.count == NSTRS / 2);
+
+        for (i = 1; i < NSTRS; i += 2) {
+                len = sprintf(name, "user%d", i);
+                assert(itab_intern(&tab, name, len) == strs[i]);
+                itab_release(&tab, strs[i]);
+                itab_release(&tab, strs[i]);
+        }
+
+        assert(tab.count == 0);
+
+        itab_destroy(&tab);
+}
+
+int main(void)
+{
+        struct itab tab = ITAB_INIT;
+        struct istr *a;
+        struct istr *b;
+        struct istr *c;
+
+        a = itab_intern(&tab, "alice", 5);
+        assert(a != NULL);
+        assert(strcmp(a->str, "alice") == 0);
+        assert(a->len == 5);
+        assert(a->refs == 1);
+
+        b = itab_intern(&tab, "alice and bob", 5);
+        assert(b == a);
+        assert(a->refs == 2);
+
+        c = itab_intern(&tab, "bob", 3);
+        assert(c != a);
+        assert(tab.count == 2);
+
+        assert(istr_ref(c) == c);
+        assert(c->refs == 2);
+
+        itab_release(&tab, b);
+        itab_release(&tab, c);
+        assert(tab.count == 2);
+
+        itab_release(&tab, a);
+        assert(tab.count == 1);
+
+        a = itab_intern(&tab, "alice", 5);
+        assert(a->refs == 1);
+
+        itab_release(&tab, NULL);
+        itab_release(&tab, a);
+        itab_release(&tab, c);
+        assert(tab.count == 0);
+
+        itab_destroy(&tab);
+
+        test_large();
+
+        return 0;
+}
@@ -0,0 +1,639 @@
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+#include <cvb/msg.h>
+#include <cvb/msgq.h>
+
+#define LARGE (MSG_MAXSIZE / 2)
+
+static char large[LARGE];
+
+static int sv[2];
+
+/* A public message, then an authentification with a password */
+static const char stream[] = {
+        MSG_CODE_SEND_PUBLIC, 0, 5, 'h', 'e', 'l', 'l', 'o',
+        MSG_CODE_SEND_AUTH, 0, 3, 'b', 'o', 'b', 0, 2, 'p', 'w'
+};
+
+static void check_frame(const struct msg_frame *const frame, const int n)
+{
+        if (n == 0) {
+                assert(frame->code == MSG_CODE_SEND_PUBLIC);
+                assert(frame->nfields == 1);
+                assert(frame->size[0] == 5);
+                assert(memcmp(frame->field[0], "hello", 5) == 0);
+        } else {
+                assert(frame->code == MSG_CODE_SEND_AUTH);
+                assert(frame->nfields == 2);
+                assert(frame->size[0] == 3);
+                assert(memcmp(frame->field[0], "bob", 3) == 0);
+                assert(frame->size[1] == 2);
+                assert(memcmp(frame->field[1], "pw", 2) == 0);
+        }
+}
+
+static void test_fill(void)
+{
+        struct msg_reader rd = MSG_READER_INIT;
+        struct msg_frame frame;
+        size_t i;
+        int sv[2];
+        int n = 0;
+        int rc;
+
+        assert(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+
+        /* Nothing received yet, without blocking */
+        assert(msg_fill(&rd, sv[1]) == -1);
+        assert((errno == EAGAIN) || (errno == EWOULDBLOCK));
+
+        /* Messages received byte after byte */
+        for (i = 0; i < sizeof(stream); ++i) {
+                assert(write(sv[0], stream + i, 1) == 1);
+                assert(msg_fill(&rd, sv[1]) == 1);
+
+                while ((rc = msg_parse(&rd, &frame)) == 1)
+                        check_frame(&frame, n++);
+
+                assert(rc == 0);
+                assert(n == ((i < 7) ? 0 : (i < sizeof(stream) - 1) ? 1 : 2));
+        }
+
+        /* Both messages received at once */
+        assert(write(sv[0], stream, sizeof(stream)) == sizeof(stream));
+        assert(msg_fill(&rd, sv[1]) == sizeof(stream));
+
+        for (n = 0; msg_parse(&rd, &frame) == 1; ++n)
+                check_frame(&frame, n);
+
+        assert(n == 2);
+        assert(rd.head == rd.tail);
+
+        close(sv[0]);
+        assert(msg_fill(&rd, sv[1]) == 0);
+        close(sv[1]);
+
+        msg_reader_destroy(&rd);
+}
+
+static void test_invalid(void)
+{
+        struct msg_reader rd = MSG_READER_INIT;
+        struct msg_frame frame;
+        char bad[] = {MSG_CODE_SEND_PUBLIC, 0x7f, 0x7f};
+
+        /* Text fields are never larger than a buffer */
+        rd.buf = bad;
+        rd.size = sizeof(bad);
+        rd.tail = sizeof(bad);
+
+        assert(msg_parse(&rd, &frame) == -1);
+        assert(rd.head == 0);
+}
+
+static void *send_large(__attribute__((unused)) void *arg)
+{
+        struct msg_field field;
+
+        field.data = large;
+        field.size = LARGE;
+
+        assert(msg_send_frame(sv[0], MSG_V2, MSG_CODE_SEND_PUBLIC, &field, 1)
+               == MSG_HDRSIZ + 4 + LARGE);
+
+        return NULL;
+}
+
+static void test_parse(const int version)
+{
+        struct msg_reader rd = MSG_READER_INIT;
+        struct msg_field fields[2];
+        struct msg_field room[3];
+        struct msg_field peer[4];
+        struct msg_frame frame;
+        struct msg_buf *buf;
+        uint32_t caps;
+        uint32_t port = htonl(4242);
+        char addr[4] = {127, 0, 0, 1};
+        int8_t status = 2;
+
+        fields[0].data = "hello";
+        fields[0].size = 5;
+        fields[1].data = "alice";
+        fields[1].size = 5;
+
+        buf = msg_buf_encode(NULL, version, MSG_CODE_RECV_PUBLIC, fields, 2);
+        assert(buf != NULL);
+        assert(buf->code == MSG_CODE_RECV_PUBLIC);
+        assert(buf->version == version);
+
+        if (version == MSG_V1)
+                assert(buf->size == 1 + 2 + 5 + 2 + 5);
+        else
+                assert(buf->size == MSG_HDRSIZ + 4 + 5 + 4 + 5);
+
+        /* Every prefix of a message is incomplete */
+        rd.buf = buf->data;
+        rd.size = buf->size;
+
+        for (rd.tail = 0; rd.tail < buf->size; ++rd.tail)
+                assert(msg_parse(&rd, &frame) == 0);
+
+        assert(msg_parse(&rd, &frame) == 1);
+        assert(rd.head == buf->size);
+        assert(frame.code == MSG_CODE_RECV_PUBLIC);
+        assert(frame.version == version);
+        assert(frame.nfields == 2);
+        assert(frame.size[0] == 5);
+        assert(memcmp(frame.field[0], "hello", 5) == 0);
+        assert(frame.size[1] == 5);
+        assert(memcmp(frame.field[1], "alice", 5) == 0);
+
+        msg_buf_free(buf);
+
+        fields[0].data = &status;
+        fields[0].size = 1;
+
+        buf = msg_buf_encode(NULL, version, MSG_CODE_RECV_AUTH, fields, 1);
+        assert(buf != NULL);
+
+        rd.buf = buf->data;
+        rd.size = buf->size;
+        rd.head = 0;
+        rd.tail = buf->size;
+
+        assert(msg_parse(&rd, &frame) == 1);
+        assert((frame.nfields == 1) && (*frame.field[0] == 2));
+        assert(msg_parse(&rd, &frame) == 0);
+
+        msg_buf_free(buf);
+
+        caps = htonl(0x01020304);
+        fields[1].data = &caps;
+        fields[1].size = sizeof(uint32_t);
+
+        buf = msg_buf_encode(NULL, version, MSG_CODE_HELLO, fields, 2);
+        assert(buf != NULL);
+
+        rd.buf = buf->data;
+        rd.size = buf->size;
+        rd.head = 0;
+        rd.tail = buf->size;
+
+        assert(msg_parse(&rd, &frame) == 1);
+        assert((frame.code == MSG_CODE_HELLO) && (frame.nfields == 2));
+        assert(frame.size[1] == sizeof(uint32_t));
+        assert(memcmp(frame.field[1], &caps, sizeof(uint32_t)) == 0);
+        assert(rd.head == buf->size);
+
+        msg_buf_free(buf);
+
+        /* Sender identifiers, bound then referred to */
+        fields[0].data = &caps;
+        fields[0].size = sizeof(uint32_t);
+        fields[1].data = "alice";
+        fields[1].size = 5;
+
+        buf = msg_buf_encode(NULL, version, MSG_CODE_SENDER, fields, 2);
+        assert(buf != NULL);
+
+        rd.buf = buf->data;
+        rd.size = buf->size;
+        rd.head = 0;
+        rd.tail = buf->size;
+
+        assert(msg_parse(&rd, &frame) == 1);
+        assert((frame.code == MSG_CODE_SENDER) && (frame.nfields == 2));
+        assert(memcmp(frame.field[0], &caps, sizeof(uint32_t)) == 0);
+        assert(frame.size[1] == 5);
+        assert(memcmp(frame.field[1], "alice", 5) == 0);
+
+        msg_buf_free(buf);
+
+        fields[0].data = "hello";
+        fields[0].size = 5;
+        fields[1].data = &caps;
+        fields[1].size = sizeof(uint32_t);
+
+        buf = msg_buf_encode(NULL, version, MSG_CODE_RECV_SENDER, fields, 2);
+        assert(buf != NULL);
+        assert(buf->size < MSG_HDRSIZ + 4 + 5 + 4 + 5);
+
+        rd.buf = buf->data;
+        rd.size = buf->size;
+        rd.head = 0;
+        rd.tail = buf->size;
+
+        assert(msg_parse(&rd, &frame) == 1);
+        assert((frame.code == MSG_CODE_RECV_SENDER) && (frame.nfields == 2));
+        assert(frame.size[0] == 5);
+        assert(memcmp(frame.field[0], "hello", 5) == 0);
+        assert(memcmp(frame.field[1], &caps, sizeof(uint32_t)) == 0);
+        assert(rd.head == buf->size);
+
+        msg_buf_free(buf);
+
+        /* Heartbeats echo their word */
+        buf = msg_buf_encode(NULL, version, MSG_CODE_PING, fields + 1, 1);
+        assert(buf != NULL);
+
+        rd.buf = buf->data;
+        rd.size = buf->size;
+        rd.head = 0;
+        rd.tail = buf->size;
+
+        assert(msg_parse(&rd, &frame) == 1);
+        assert((frame.code == MSG_CODE_PING) && (frame.nfields == 1));
+        assert(frame.size[0] == sizeof(uint32_t));
+        assert(memcmp(frame.field[0], &caps, sizeof(uint32_t)) == 0);
+
+        msg_buf_free(buf);
+
+        /* Room messages carry the room, the text and the sender */
+        room[0].data = "dev";
+        room[0].size = 3;
+        room[1].data = "hello";
+        room[1].size = 5;
+        room[2].data = "alice";
+        room[2].size = 5;
+
+        buf = msg_buf_encode(NULL, version, MSG_CODE_RECV_ROOM, room, 3);
+        assert(buf != NULL);
+
+        rd.buf = buf->data;
+        rd.size = buf->size;
+        rd.head = 0;
+        rd.tail = buf->size;
+
+        assert(msg_parse(&rd, &frame) == 1);
+        assert((frame.code == MSG_CODE_RECV_ROOM) && (frame.nfields == 3));
+        assert((frame.size[0] == 3) && (memcmp(frame.field[0], "dev", 3) == 0));
+        assert(memcmp(frame.field[1], "hello", 5) == 0);
+        assert(memcmp(frame.field[2], "alice", 5) == 0);
+        assert(rd.head == buf->size);
+
+        msg_buf_free(buf);
+
+        /* Peer addresses are raw bytes, possibly empty */
+        peer[0].data = "bob";
+        peer[0].size = 3;
+        peer[1].data = addr;
+        peer[1].size = sizeof(addr);
+        peer[2].data = &port;
+        peer[2].size = sizeof(uint32_t);
+        peer[3].data = &caps;
+        peer[3].size = sizeof(uint32_t);
+
+        buf = msg_buf_encode(NULL, version, MSG_CODE_DM_CONNECT, peer, 4);
+        assert(buf != NULL);
+
+        rd.buf = buf->data;
+        rd.size = buf->size;
+        rd.head = 0;
+        rd.tail = buf->size;
+
+        assert(msg_parse(&rd, &frame) == 1);
+        assert((frame.code == MSG_CODE_DM_CONNECT) && (frame.nfields == 4));
+        assert(memcmp(frame.field[1], addr, sizeof(addr)) == 0);
+        assert(memcmp(frame.field[2], &port, sizeof(uint32_t)) == 0);
+        assert(memcmp(frame.field[3], &caps, sizeof(uint32_t)) == 0);
+
+        msg_buf_free(buf);
+
+        peer[1].size = 0;
+
+        buf = msg_buf_encode(NULL, version, MSG_CODE_DM_CONNECT, peer, 4);
+        assert(buf != NULL);
+
+        rd.buf = buf->data;
+        rd.size = buf->size;
+        rd.head = 0;
+        rd.tail = buf->size;
+
+        assert(msg_parse(&rd, &frame) == 1);
+        assert((frame.size[1] == 0) && (frame.size[3] == sizeof(uint32_t)));
+        assert(rd.head == buf->size);
+
+        msg_buf_free(buf);
+}
+
+static void test_v2(void)
+{
+        struct msg_reader rd = MSG_READER_INIT;
+        struct msg_field field;
+        struct msg_frame frame;
+        char data[2 * MSG_HDRSIZ + 7] = {
+                (char) MSG_V2_MAGIC, 100, 0, 0, 0, 0, 0, 3, 'a', 'b', 'c',
+                (char) MSG_V2_MAGIC, MSG_CODE_PING, 0, 2, 0, 0, 0, 4,
+                0, 0, 0, 7
+        };
+
+        /* Unknown codes are skipped, unknown flags are kept */
+        rd.buf = data;
+        rd.size = sizeof(data);
+        rd.tail = sizeof(data);
+
+        assert(msg_parse(&rd, &frame) == 1);
+        assert((frame.code == 100) && (frame.nfields == 0));
+        assert(msg_parse(&rd, &frame) == 1);
+        assert((frame.code == MSG_CODE_PING) && (frame.flags == 2));
+        assert(msg_parse(&rd, &frame) == 0);
+
+        /* Fields larger than the payload */
+        data[1] = MSG_CODE_DM;
+        data[7] = 6;
+        data[8] = 0;
+        data[9] = 0;
+        data[10] = 0;
+        data[11] = 3;
+        rd.head = 0;
+
+        assert(msg_parse(&rd, &frame) == -1);
+
+        /* Unknown version */
+        data[0] = (char) 0x83;
+
+        assert(msg_parse(&rd, &frame) == -1);
+
+        /* Too large for version 1 */
+        field.data = large;
+        field.size = MSG_BUFSIZ;
+
+        assert(msg_buf_encode(NULL, MSG_V1, MSG_CODE_SEND_PUBLIC, &field,
+                              1) == NULL);
+}
+
+static void test_batch(void)
+{
+        struct msg_reader rd = MSG_READER_INIT;
+        struct msg_buf *bufs[3];
+        struct msg_buf *batch;
+        struct msg_field field;
+        struct msg_frame frame, inner;
+        char text[2] = "a";
+        size_t pos = 0;
+        int i;
+
+        field.data = text;
+        field.size = 1;
+
+        for (i = 0; i < 3; ++i) {
+                text[0] = 'a' + i;
+                bufs[i] = msg_buf_encode(NULL, MSG_V2, MSG_CODE_SEND_PUBLIC,
+                                         &field, 1);
+                assert(bufs[i] != NULL);
+        }
+
+        batch = msg_buf_batch(NULL, bufs, 3);
+        assert(batch != NULL);
+        assert(batch->code == MSG_CODE_BATCH);
+        assert(batch->size == MSG_HDRSIZ + 4 + 3 * bufs[0]->size);
+
+        assert(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+        assert(msg_send_buf(sv[0], batch) == (ssize_t) batch->size);
+        assert(msg_recv_frame(&rd, sv[1], &frame) == 1);
+        assert(frame.code == MSG_CODE_BATCH);
+
+        for (i = 0; i < 3; ++i) {
+                assert(msg_unbatch(&frame, &pos, &inner) == 1);
+                assert(inner.code == MSG_CODE_SEND_PUBLIC);
+                assert((inner.size[0] == 1) && (*inner.field[0] == 'a' + i));
+        }
+
+        assert(msg_unbatch(&frame, &pos, &inner) == 0);
+
+        /* Truncated inner message */
+        frame.size[0] = frame.size[0] - 1;
+        pos = 2 * bufs[0]->size;
+
+        assert(msg_unbatch(&frame, &pos, &inner) == -1);
+
+        for (i = 0; i < 3; ++i)
+                msg_buf_free(bufs[i]);
+
+        msg_buf_free(batch);
+        msg_reader_destroy(&rd);
+        close(sv[0]);
+        close(sv[1]);
+}
+
+static void test_large(void)
+{
+        struct msg_reader rd = MSG_READER_INIT;
+        struct msg_field field;
+        struct msg_frame frame;
+        pthread_t thread;
+        size_t i;
+
+        for (i = 0; i < LARGE; ++i)
+                large[i] = 'a' + i % 26;
+
+        assert(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+        assert(pthread_create(&thread, NULL, &send_large, NULL) == 0);
+
+        assert(msg_recv_frame(&rd, sv[1], &frame) == 1);
+        assert(frame.code == MSG_CODE_SEND_PUBLIC);
+        assert(frame.size[0] == LARGE);
+        assert(memcmp(frame.field[0], large, LARGE) == 0);
+        assert(rd.size > MSG_RDBUFSIZ);
+
+        pthread_join(thread, NULL);
+
+        /* The buffer shrinks back once empty */
+        field.data = "hi";
+        field.size = 2;
+
+        assert(msg_send_frame(sv[0], MSG_V1, MSG_CODE_SEND_PUBLIC, &field, 1)
+               == 5);
+        assert(msg_recv_frame(&rd, sv[1], &frame) == 1);
+        assert(rd.size == MSG_RDBUFSIZ);
+        assert((frame.version == MSG_V1) && (frame.size[0] == 2));
+
+        close(sv[0]);
+        assert(msg_recv_frame(&rd, sv[1], &frame) == -1);
+
+        close(sv[1]);
+        msg_reader_destroy(&rd);
+}
+
+static void test_file(void)
+{
+        struct msg_reader rd = MSG_READER_INIT;
+        struct msg_field field;
+        struct msg_frame frame;
+        char path[] = "/tmp/test_msg_XXXXXX";
+        uint32_t id = htonl(7);
+        off_t offset = 0;
+        int fd, i;
+
+        for (i = 0; i < 3000; ++i)
+                large[i] = 'a' + i % 26;
+
+        fd = mkstemp(path);
+        assert(fd != -1);
+        assert(write(fd, large, 3000) == 3000);
+        unlink(path);
+
+        assert(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+
+        field.data = &id;
+        field.size = sizeof(uint32_t);
+
+        /* Chunks follow each other in the file */
+        for (i = 0; i < 3; ++i)
+                assert(msg_send_file(sv[0], MSG_CODE_FILE_DATA, &field, 1, fd,
+                                     &offset, 1000)
+                       == MSG_HDRSIZ + 8 + 1000);
+
+        assert(offset == 3000);
+
+        for (i = 0; i < 3; ++i) {
+                assert(msg_recv_frame(&rd, sv[1], &frame) == 1);
+                assert((frame.code == MSG_CODE_FILE_DATA)
+                       && (frame.nfields == 2));
+                assert(memcmp(frame.field[0], &id, sizeof(uint32_t)) == 0);
+                assert(frame.size[1] == 1000);
+                assert(memcmp(frame.field[1], large + i * 1000, 1000) == 0);
+        }
+
+        /* Too large, or past the end of the file */
+        assert(msg_send_file(sv[0], MSG_CODE_FILE_DATA, &field, 1, fd,
+                             &offset, MSG_MAXSIZE) == -1);
+        assert(errno == EMSGSIZE);
+        assert(msg_send_file(sv[0], MSG_CODE_FILE_DATA, &field, 1, fd,
+                             &offset, 10) == -1);
+        assert(errno == EIO);
+
+        /* Still a whole frame */
+        assert(msg_recv_frame(&rd, sv[1], &frame) == 1);
+        assert((frame.code == MSG_CODE_FILE_DATA) && (frame.size[1] == 10));
+        assert(memcmp(frame.field[1], "\0\0\0\0\0\0\0\0\0\0", 10) == 0);
+
+        close(fd);
+        close(sv[0]);
+        close(sv[1]);
+        msg_reader_destroy(&rd);
+}
+
+static void test_deflate(void)
+{
+        struct msg_codec out = MSG_CODEC_INIT, in = MSG_CODEC_INIT;
+        struct msg_reader rd = MSG_READER_INIT;
+        struct msgq mq = MSGQ_INIT;
+        struct msg_field fields[2];
+        struct msg_frame frame;
+        struct msg_buf *buf, *zbuf[2];
+        int i;
+
+        if (msg_codec_init(&out, NULL) != 0) {
+                assert(errno == ENOTSUP);
+
+                return;
+        }
+
+        assert(msg_codec_init(&in, NULL) == 0);
+
+        fields[0].data = "Hello everyone, how are you doing today?";
+        fields[0].size = strlen(fields[0].data);
+        fields[1].data = "alice";
+        fields[1].size = 5;
+
+        buf = msg_buf_encode(NULL, MSG_V2, MSG_CODE_RECV_PUBLIC, fields, 2);
+
+        /* The stream remembers the previous messages */
+        for (i = 0; i < 2; ++i) {
+                zbuf[i] = msg_buf_deflate(&out, buf);
+                assert(zbuf[i] != NULL);
+                assert(zbuf[i]->code == MSG_CODE_RECV_PUBLIC);
+                assert(zbuf[i]->size < buf->size);
+        }
+
+        assert(zbuf[1]->size < zbuf[0]->size);
+
+        rd.size = zbuf[0]->size + zbuf[1]->size;
+        rd.buf = (char *) malloc(rd.size);
+        memcpy(rd.buf, zbuf[0]->data, zbuf[0]->size);
+        memcpy(rd.buf + zbuf[0]->size, zbuf[1]->data, zbuf[1]->size);
+        rd.tail = rd.size;
+
+        /* Compressed messages need a codec */
+        assert(msg_parse(&rd, &frame) == -1);
+
+        rd.codec = &in;
+
+        for (i = 0; i < 2; ++i) {
+                assert(msg_parse(&rd, &frame) == 1);
+                assert(frame.code == MSG_CODE_RECV_PUBLIC);
+                assert(frame.flags == MSG_FLAG_DEFLATE);
+                assert(frame.nfields == 2);
+                assert(frame.size[0] == fields[0].size);
+                assert(memcmp(frame.field[0], fields[0].data,
+                              fields[0].size) == 0);
+                assert(frame.size[1] == 5);
+                assert(memcmp(frame.field[1], "alice", 5) == 0);
+        }
+
+        assert(msg_parse(&rd, &frame) == 0);
+
+        msg_reader_destroy(&rd);
+        msg_buf_free(zbuf[0]);
+        msg_buf_free(zbuf[1]);
+
+        /* Queued messages are compressed when written, except older ones */
+        assert(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+        assert(mq_push(&mq, msg_buf_ref(buf)) == 0);
+        mq_set_codec(&mq, &out);
+        assert(mq_push(&mq, buf) == 0);
+
+        fields[0].data = large;
+        fields[0].size = LARGE;
+        buf = msg_buf_encode(NULL, MSG_V2, MSG_CODE_SEND_PUBLIC, fields, 1);
+        assert(mq_push(&mq, buf) == 0);
+        assert(mq_flush(&mq, sv[0]) > 0);
+        assert(mq.count == 0);
+
+        rd.codec = &in;
+
+        assert(msg_recv_frame(&rd, sv[1], &frame) == 1);
+        assert((frame.code == MSG_CODE_RECV_PUBLIC) && (frame.flags == 0));
+        assert(msg_recv_frame(&rd, sv[1], &frame) == 1);
+        assert(frame.code == MSG_CODE_RECV_PUBLIC);
+        assert(frame.flags == MSG_FLAG_DEFLATE);
+        assert(memcmp(frame.field[1], "alice", 5) == 0);
+        assert(msg_recv_frame(&rd, sv[1], &frame) == 1);
+        assert(frame.code == MSG_CODE_SEND_PUBLIC);
+        assert(frame.flags == MSG_FLAG_DEFLATE);
+        assert(frame.size[0] == LARGE);
+        assert(memcmp(frame.field[0], large, LARGE) == 0);
+        assert(rd.head == rd.tail);
+
+        close(sv[0]);
+        close(sv[1]);
+        mq_destroy(&mq);
+        msg_reader_destroy(&rd);
+        msg_codec_destroy(&out);
+        msg_codec_destroy(&in);
+}
+
+int main(void)
+{
+        test_fill();
+        test_invalid();
+        test_parse(MSG_V1);
+        test_parse(MSG_V2);
+        test_v2();
+        test_batch();
+        test_large();
+        test_file();
+        test_deflate();
+
+        return 0;
+}
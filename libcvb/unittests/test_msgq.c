@@ -0,0 +1,445 @@
+#include <assert.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+#include <cvb/msg.h>
+#include <cvb/msgq.h>
+
+#define NMSGS 300
+#define TEXT  1000
+
+static char stream[NMSGS * (TEXT + 16)];
+
+static char text[TEXT];
+
+static struct msg_buf *encode(const int8_t code, const int i)
+{
+        struct msg_field fields[2];
+
+        memset(text, 'a' + i % 26, TEXT);
+        fields[0].data = text;
+        fields[0].size = TEXT;
+        fields[1].data = "bob";
+        fields[1].size = 3;
+
+        return msg_buf_new(code, fields, 2);
+}
+
+static struct msg_buf *encode_text(const int8_t code, const char *const msg,
+                                   const char *const name)
+{
+        struct msg_field fields[2];
+
+        fields[0].data = msg;
+        fields[0].size = strlen(msg);
+        fields[1].data = name;
+        fields[1].size = strlen(name);
+
+        return msg_buf_new(code, fields, 2);
+}
+
+static struct msg_buf *encode_v2(const char *const msg,
+                                  const char *const name)
+{
+        struct msg_field fields[2];
+
+        fields[0].data = msg;
+        fields[0].size = strlen(msg);
+        fields[1].data = name;
+        fields[1].size = strlen(name);
+
+        return msg_buf_encode(NULL, MSG_V2, MSG_CODE_RECV_PUBLIC, fields, 2);
+}
+
+/*
+ * Read everything sent so far, without blocking
+ */
+static size_t drain(const int sfd, size_t pos)
+{
+        ssize_t nread;
+
+        while ((nread = recv(sfd, stream + pos, sizeof(stream) - pos,
+                             MSG_DONTWAIT)) > 0)
+                pos = pos + nread;
+
+        return pos;
+}
+
+static void test_flush(void)
+{
+        struct msgq mq = MSGQ_INIT;
+        struct msg_buf *buf;
+        size_t size, total = 0, pos = 0, sent = 0;
+        ssize_t nwrite;
+        int partial = 0;
+        int sv[2];
+        int i;
+
+        assert(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+
+        for (i = 0; i < NMSGS; ++i) {
+                buf = encode(MSG_CODE_RECV_PUBLIC, i);
+                assert(buf != NULL);
+                total = total + buf->size;
+                assert(mq_push(&mq, buf) == 0);
+        }
+
+        size = total / NMSGS;
+        assert(mq.count == NMSGS);
+        assert(mq.bytes == total);
+
+        /* Written as the peer reads, a message cut anywhere */
+        while (mq.count > 0) {
+                nwrite = mq_flush(&mq, sv[0]);
+                assert(nwrite >= 0);
+
+                sent = sent + nwrite;
+                assert(mq.bytes == total - sent);
+                assert(mq.count == NMSGS - sent / size);
+                assert(mq.off == sent % size);
+
+                if (mq.off > 0)
+                        partial = 1;
+
+                pos = drain(sv[1], pos);
+        }
+
+        assert(partial);
+        assert(sent == total);
+        assert(pos == total);
+        assert(mq_flush(&mq, sv[0]) == 0);
+
+        /* Received in order and whole */
+        for (i = 0; i < NMSGS; ++i) {
+                buf = encode(MSG_CODE_RECV_PUBLIC, i);
+                assert(memcmp(stream + i * size, buf->data, size) == 0);
+                msg_buf_free(buf);
+        }
+
+        /* No SIGPIPE on a closed peer */
+        assert(mq_push(&mq, encode(MSG_CODE_RECV_PUBLIC, 0)) == 0);
+        close(sv[1]);
+        assert(mq_flush(&mq, sv[0]) == -1);
+        assert(errno == EPIPE);
+
+        mq_destroy(&mq);
+        assert((mq.count == 0) && (mq.bytes == 0) && (mq.bufs == NULL));
+
+        close(sv[0]);
+}
+
+static void test_wrap(void)
+{
+        struct msgq mq = MSGQ_INIT;
+        size_t size, pos = 0;
+        int sv[2];
+        int i, n = 0;
+
+        assert(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+
+        /* The head moves forward, then the queue grows around the end */
+        for (i = 0; i < 10; ++i)
+                assert(mq_push(&mq, encode(MSG_CODE_RECV_PUBLIC, n++)) == 0);
+
+        size = mq.bytes / mq.count;
+        assert(mq_flush(&mq, sv[0]) == (ssize_t) (10 * size));
+        pos = drain(sv[1], pos);
+
+        for (i = 0; i < 40; ++i)
+                assert(mq_push(&mq, encode(MSG_CODE_RECV_PUBLIC, n++)) == 0);
+
+        assert(mq.count == 40);
+
+        while (mq.count > 0) {
+                assert(mq_flush(&mq, sv[0]) >= 0);
+                pos = drain(sv[1], pos);
+        }
+
+        assert(pos == (size_t) n * size);
+
+        for (i = 0; i < n; ++i)
+                assert(stream[i * size + 3] == 'a' + i % 26);
+
+        mq_destroy(&mq);
+
+        close(sv[0]);
+        close(sv[1]);
+}
+
+static void test_drop(void)
+{
+        struct msgq mq = MSGQ_INIT;
+        struct msg_buf *bufs[4];
+        struct msg_field field;
+        int8_t status = 0;
+        int i;
+
+        field.data = &status;
+        field.size = 1;
+
+        bufs[0] = msg_buf_new(MSG_CODE_RECV_AUTH, &field, 1);
+        bufs[1] = encode_text(MSG_CODE_RECV_PUBLIC, "one", "alice");
+        bufs[2] = encode_text(MSG_CODE_RECV_PUBLIC, "two", "bob");
+        bufs[3] = encode_text(MSG_CODE_RECV_PUBLIC, "three", "carl");
+
+        for (i = 0; i < 4; ++i)
+                assert(mq_push(&mq, msg_buf_ref(bufs[i])) == 0);
+
+        /* The oldest message with the code, accounted for */
+        assert(mq_drop(&mq, MSG_CODE_RECV_PUBLIC) == 0);
+        assert(mq.count == 3);
+        assert(mq.bytes == bufs[0]->size + bufs[2]->size + bufs[3]->size);
+        assert(mq.bufs[(mq.head + 1) % mq.size] == bufs[2]);
+        assert(mq_drop(&mq, MSG_CODE_DM) == -1);
+
+        /* The head, partially written, is never dropped */
+        assert(mq_drop(&mq, MSG_CODE_RECV_AUTH) == 0);
+        mq.off = 1;
+        mq.bytes = mq.bytes - 1;
+
+        assert(mq_drop(&mq, MSG_CODE_RECV_PUBLIC) == 0);
+        assert(mq.count == 1);
+        assert(mq.bufs[mq.head] == bufs[2]);
+        assert(mq.bytes == bufs[2]->size - 1);
+        assert(mq_drop(&mq, MSG_CODE_RECV_PUBLIC) == -1);
+
+        mq_destroy(&mq);
+
+        for (i = 0; i < 4; ++i)
+                msg_buf_free(bufs[i]);
+}
+
+static void test_coalesce(void)
+{
+        struct msgq mq = MSGQ_INIT;
+        struct msg_reader rd = MSG_READER_INIT;
+        struct msg_frame frame;
+        struct msg_buf *buf;
+        size_t bytes;
+
+        assert(mq_push(&mq, encode_text(MSG_CODE_RECV_PUBLIC, "one", "alice"))
+               == 0);
+        assert(mq_push(&mq, encode_text(MSG_CODE_RECV_PUBLIC, "two", "bob"))
+               == 0);
+        assert(mq_push(&mq, encode_text(MSG_CODE_RECV_PUBLIC, "three", "bob"))
+               == 0);
+        assert(mq_push(&mq, encode_text(MSG_CODE_RECV_PUBLIC, "four", "bob"))
+               == 0);
+
+        /* Only messages of the same sender are merged */
+        assert(mq_coalesce(&mq, MSG_CODE_RECV_PUBLIC) == 0);
+        assert(mq.count == 3);
+
+        buf = mq.bufs[(mq.head + 1) % mq.size];
+        rd.buf = buf->data;
+        rd.size = buf->size;
+        rd.tail = buf->size;
+
+        assert(msg_parse(&rd, &frame) == 1);
+        assert(frame.size[0] == 9);
+        assert(memcmp(frame.field[0], "two\nthree", 9) == 0);
+        assert(frame.size[1] == 3);
+        assert(memcmp(frame.field[1], "bob", 3) == 0);
+
+        bytes = mq.bufs[mq.head]->size + buf->size
+                + mq.bufs[(mq.head + 2) % mq.size]->size;
+        assert(mq.bytes == bytes);
+
+        /* Merged again, until no neighbours share their sender */
+        assert(mq_coalesce(&mq, MSG_CODE_RECV_PUBLIC) == 0);
+        assert(mq.count == 2);
+        assert(mq_coalesce(&mq, MSG_CODE_RECV_PUBLIC) == -1);
+        assert(mq_coalesce(&mq, MSG_CODE_RECV_AUTH) == -1);
+
+        mq_destroy(&mq);
+
+        /* Never with the head once partially written */
+        assert(mq_push(&mq, encode_text(MSG_CODE_RECV_PUBLIC, "one", "bob"))
+               == 0);
+        assert(mq_push(&mq, encode_text(MSG_CODE_RECV_PUBLIC, "two", "bob"))
+               == 0);
+
+        mq.off = 1;
+        mq.bytes = mq.bytes - 1;
+        assert(mq_coalesce(&mq, MSG_CODE_RECV_PUBLIC) == -1);
+        assert(mq.count == 2);
+
+        mq_destroy(&mq);
+}
+
+static struct msg_buf *encode_sender(const uint32_t id,
+                                     const char *const name)
+{
+        struct msg_field fields[2];
+        uint32_t net_id = htonl(id);
+
+        fields[0].data = &net_id;
+        fields[0].size = sizeof(uint32_t);
+        fields[1].data = name;
+        fields[1].size = strlen(name);
+
+        return msg_buf_encode(NULL, MSG_V2, MSG_CODE_SENDER, fields, 2);
+}
+
+static void test_keep(void)
+{
+        struct msgq mq = MSGQ_INIT;
+        struct msg_buf *bufs[3];
+        struct msg_buf *table, *batch;
+        int i;
+
+        /* The sender table of a batching client, then public messages */
+        bufs[0] = encode_sender(1, "alice");
+        bufs[1] = encode_sender(2, "bob");
+        table = msg_buf_batch(NULL, bufs, 2);
+        assert(table != NULL);
+        table->flags |= MSG_BUF_KEEP;
+
+        bufs[2] = encode_v2("one", "alice");
+        batch = msg_buf_batch(NULL, bufs + 2, 1);
+        assert(batch != NULL);
+
+        assert(mq_push(&mq, msg_buf_ref(table)) == 0);
+        assert(mq_push(&mq, msg_buf_ref(batch)) == 0);
+
+        /* Only the public batch goes, the table stays */
+        assert(mq_drop(&mq, MSG_CODE_BATCH) == 0);
+        assert(mq.count == 1);
+        assert(mq.bufs[mq.head] == table);
+        assert(mq.bytes == table->size);
+        assert(mq_drop(&mq, MSG_CODE_BATCH) == -1);
+        assert(mq.count == 1);
+
+        mq_destroy(&mq);
+
+        /* Nor merged */
+        for (i = 0; i < 2; ++i) {
+                assert(mq_push(&mq, encode_text(MSG_CODE_RECV_PUBLIC, "one",
+                                                "bob")) == 0);
+                mq.bufs[(mq.head + i) % mq.size]->flags |= MSG_BUF_KEEP;
+        }
+
+        assert(mq_coalesce(&mq, MSG_CODE_RECV_PUBLIC) == -1);
+        assert(mq_drop(&mq, MSG_CODE_RECV_PUBLIC) == -1);
+        assert(mq.count == 2);
+
+        mq_destroy(&mq);
+        msg_buf_free(table);
+        msg_buf_free(batch);
+
+        for (i = 0; i < 3; ++i)
+                msg_buf_free(bufs[i]);
+}
+
+static void test_sealed(void)
+{
+        static const char *const msgs[] = {"hello there", "hello again",
+                                           "hello there"};
+        struct msgq mq = MSGQ_INIT;
+        struct msg_codec codec = MSG_CODEC_INIT;
+        struct msg_codec peer = MSG_CODEC_INIT;
+        struct msg_reader rd = MSG_READER_INIT;
+        struct msg_frame frame;
+        size_t raw = 0, bytes = 0, pos = 0;
+        int sv[2];
+        int i;
+
+        /* Messages queued before the codec go out as they are */
+        assert(mq_push(&mq, encode_text(MSG_CODE_RECV_PUBLIC, "one", "bob"))
+               == 0);
+        assert(mq_push(&mq, encode_text(MSG_CODE_RECV_PUBLIC, "two", "bob"))
+               == 0);
+
+        mq_set_codec(&mq, &codec);
+        assert(mq.sealed == 2);
+        assert(mq_coalesce(&mq, MSG_CODE_RECV_PUBLIC) == -1);
+        assert(mq_drop(&mq, MSG_CODE_RECV_PUBLIC) == -1);
+
+        /* The next ones may still change until written */
+        assert(mq_push(&mq, encode_v2("three", "bob")) == 0);
+        assert(mq_push(&mq, encode_v2("four", "bob")) == 0);
+        assert(mq_coalesce(&mq, MSG_CODE_RECV_PUBLIC) == 0);
+        assert((mq.count == 3) && (mq.sealed == 2));
+        assert(mq_drop(&mq, MSG_CODE_RECV_PUBLIC) == 0);
+        assert((mq.count == 2) && (mq.sealed == 2));
+
+        mq_destroy(&mq);
+        assert((mq.codec == NULL) && (mq.sealed == 0));
+
+        if (msg_codec_init(&codec, NULL) != 0) {
+                assert(errno == ENOTSUP);
+
+                return;
+        }
+
+        assert(msg_codec_init(&peer, NULL) == 0);
+        assert(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+
+        /* Compressed right before the first write, in order */
+        mq_set_codec(&mq, &codec);
+        assert(mq.sealed == 0);
+
+        for (i = 0; i < 3; ++i) {
+                assert(mq_push(&mq, encode_v2(msgs[i], "bob")) == 0);
+                raw = raw + mq.bufs[(mq.head + i) % mq.size]->size;
+        }
+
+        assert(mq.bytes == raw);
+        assert((mq_flush(&mq, sv[0]) > 0) && (mq.count == 0));
+        assert(mq.sealed == 0);
+
+        pos = drain(sv[1], pos);
+        assert(pos < raw);
+
+        rd.buf = stream;
+        rd.size = sizeof(stream);
+        rd.tail = pos;
+        rd.codec = &peer;
+
+        for (i = 0; i < 3; ++i) {
+                assert(msg_parse(&rd, &frame) == 1);
+                assert(frame.flags & MSG_FLAG_DEFLATE);
+                assert(frame.code == MSG_CODE_RECV_PUBLIC);
+                assert(frame.size[0] == strlen(msgs[i]));
+                assert(memcmp(frame.field[0], msgs[i], frame.size[0]) == 0);
+        }
+
+        /* Sealed, hence kept whole, when the write fails */
+        close(sv[1]);
+
+        for (i = 0; i < 3; ++i)
+                assert(mq_push(&mq, encode_v2(msgs[i], "bob")) == 0);
+
+        assert(mq_flush(&mq, sv[0]) == -1);
+        assert((mq.count == 3) && (mq.sealed == 3));
+
+        for (i = 0; i < 3; ++i)
+                bytes = bytes + mq.bufs[(mq.head + i) % mq.size]->size;
+
+        assert(mq.bytes == bytes);
+        assert(mq_coalesce(&mq, MSG_CODE_RECV_PUBLIC) == -1);
+        assert(mq_drop(&mq, MSG_CODE_RECV_PUBLIC) == -1);
+
+        mq_destroy(&mq);
+        msg_codec_destroy(&codec);
+        msg_codec_destroy(&peer);
+
+        close(sv[0]);
+}
+
+int main(void)
+{
+        test_flush();
+        test_wrap();
+        test_drop();
+        test_coalesce();
+        test_keep();
+        test_sealed();
+
+        return EXIT_SUCCESS;
+}
@@ -0,0 +1,91 @@
+#include <assert.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <cvb/msg.h>
+#include <cvb/slab.h>
+
+#define NOBJS 10000
+
+static void *objs[NOBJS];
+
+static void *free_all(void *arg)
+{
+        int i;
+
+        for (i = 0; i < NOBJS; ++i)
+                slab_free((struct slab *) arg, objs[i]);
+
+        return NULL;
+}
+
+int main(void)
+{
+        struct slab slab = SLAB_INIT;
+        struct msg_pool pool;
+        struct msg_field field;
+        struct msg_buf *buf;
+        pthread_t thread;
+        unsigned long nchunks;
+        void *obj;
+        int i;
+
+        assert(slab_init(&slab, 24, 0) == 0);
+        assert(slab.objsize == 32);
+
+        obj = slab_alloc(&slab);
+        assert(obj != NULL);
+        assert(slab.nchunks == 1);
+
+        slab_free(&slab, obj);
+        assert(slab.nfree == 1);
+
+        for (i = 0; i < NOBJS; ++i) {
+                objs[i] = slab_alloc(&slab);
+                assert(objs[i] != NULL);
+                memset(objs[i], 0xFF, 24);
+        }
+
+        assert(slab.nalloc == NOBJS + 1);
+
+        /* Objects freed by another thread are reused */
+        nchunks = slab.nchunks;
+        assert(pthread_create(&thread, NULL, &free_all, &slab) == 0);
+        assert(pthread_join(thread, NULL) == 0);
+        assert(slab.nfree == NOBJS + 1);
+
+        for (i = 0; i < NOBJS; ++i)
+                assert(slab_alloc(&slab) != NULL);
+
+        assert(slab.nchunks == nchunks);
+
+        slab_destroy(&slab);
+        assert(slab.chunks == NULL);
+
+        assert(slab_init(&slab, 100, SLAB_HUGEPAGE) == 0);
+        assert(slab_alloc(&slab) != NULL);
+        slab_destroy(&slab);
+
+        assert(msg_pool_init(&pool, 0) == 0);
+
+        field.data = "hello";
+        field.size = 5;
+
+        for (i = 0; i < NOBJS; ++i) {
+                buf = msg_buf_alloc(&pool, MSG_CODE_SEND_PUBLIC, &field, 1);
+                assert(buf != NULL);
+                assert(buf->size == 8);
+                assert(memcmp(buf->data + 3, "hello", 5) == 0);
+                msg_buf_free(msg_buf_ref(buf));
+                msg_buf_free(buf);
+        }
+
+        /* Steady state: a single object is recycled */
+        assert(pool.slabs[0].nchunks == 1);
+        assert(pool.nmalloc == 0);
+
+        msg_pool_destroy(&pool);
+
+        return EXIT_SUCCESS;
+}
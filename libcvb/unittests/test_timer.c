@@ -0,0 +1,179 @@
+#include <assert.h>
+#include <stdlib.h>
+
+#include <cvb/timer.h>
+
+#define NTIMERS 100000
+
+/* One tick per second, time goes by when the start goes back */
+#define TICK 1000
+
+static struct timer timers[NTIMERS];
+
+static int fired[NTIMERS];
+
+static void on_expire(void *arg)
+{
+        ++fired[(struct timer *) arg - timers];
+}
+
+static void advance(struct timerwheel *tw, long seconds)
+{
+        tw->start -= seconds;
+        tw_run(tw);
+}
+
+static void test_levels(void)
+{
+        static const long delays[] = {
+                1, 2, 63, 64, 65, 100, 4095, 4096, 4097, 5000, 262143, 262144,
+                300000
+        };
+        struct timerwheel tw = TIMERWHEEL_INIT;
+        long elapsed = 0;
+        int n = sizeof(delays) / sizeof(delays[0]);
+        int i;
+
+        assert(tw_init(&tw, TICK) == 0);
+        assert(tw_timeout(&tw) == -1);
+
+        for (i = 0; i < n; ++i) {
+                fired[i] = 0;
+                tw_timer(&timers[i], &on_expire, &timers[i]);
+                tw_add(&tw, &timers[i], delays[i] * TICK);
+        }
+
+        assert(tw.count == (unsigned long) n);
+
+        /* Never early, late by at most a tick */
+        for (i = 0; i < n; ++i) {
+                advance(&tw, delays[i] - 1 - elapsed);
+                elapsed = delays[i] - 1;
+                assert(fired[i] == 0);
+
+                advance(&tw, 2);
+                elapsed += 2;
+                assert(fired[i] == 1);
+                assert(!tw_pending(&timers[i]));
+        }
+
+        assert(tw.count == 0);
+        assert(tw_timeout(&tw) == -1);
+}
+
+static void rearm(void *arg)
+{
+        struct timerwheel *tw = (struct timerwheel *) arg;
+
+        ++fired[0];
+
+        if (fired[0] < 3)
+                tw_add(tw, &timers[0], 10 * TICK);
+}
+
+static void cancel_next(void *arg)
+{
+        struct timerwheel *tw = (struct timerwheel *) arg;
+
+        ++fired[1];
+        tw_cancel(tw, &timers[2]);
+        tw_cancel(tw, &timers[1]);
+}
+
+static void test_callbacks(void)
+{
+        struct timerwheel tw = TIMERWHEEL_INIT;
+        int timeout;
+
+        assert(tw_init(&tw, TICK) == 0);
+
+        /* Periodic timer */
+        fired[0] = 0;
+        tw_timer(&timers[0], &rearm, &tw);
+        tw_add(&tw, &timers[0], 10 * TICK);
+
+        timeout = tw_timeout(&tw);
+        assert((timeout > 9 * TICK) && (timeout <= 11 * TICK));
+
+        /* Armed again from the current time */
+        advance(&tw, 35);
+        assert(fired[0] == 1);
+
+        advance(&tw, 11);
+        advance(&tw, 11);
+        assert(fired[0] == 3);
+        assert(!tw_pending(&timers[0]));
+
+        /* Timers of the same slot cancelled from a callback */
+        fired[1] = 0;
+        fired[2] = 0;
+        tw_timer(&timers[1], &cancel_next, &tw);
+        tw_timer(&timers[2], &on_expire, &timers[2]);
+        tw_add(&tw, &timers[2], 5 * TICK);
+        tw_add(&tw, &timers[1], 5 * TICK);
+
+        advance(&tw, 10);
+        assert(fired[1] == 1);
+        assert(fired[2] == 0);
+        assert(tw.count == 0);
+
+        /* Armed again, pushed back */
+        fired[2] = 0;
+        tw_add(&tw, &timers[2], 5 * TICK);
+        tw_add(&tw, &timers[2], 50 * TICK);
+        assert(tw.count == 1);
+
+        advance(&tw, 10);
+        assert(fired[2] == 0);
+        assert(tw_pending(&timers[2]));
+
+        advance(&tw, 50);
+        assert(fired[2] == 1);
+}
+
+static void test_scale(void)
+{
+        struct timerwheel tw = TIMERWHEEL_INIT;
+        int level;
+        int i;
+
+        assert(tw_init(&tw, TICK) == 0);
+
+        for (i = 0; i < NTIMERS; ++i) {
+                fired[i] = 0;
+                tw_timer(&timers[i], &on_expire, &timers[i]);
+                tw_add(&tw, &timers[i], (i % 7000) * TICK);
+        }
+
+        assert(tw.count == NTIMERS);
+
+        for (i = 0; i < NTIMERS; i += 2)
+                tw_cancel(&tw, &timers[i]);
+
+        assert(tw.count == NTIMERS / 2);
+
+        advance(&tw, 7001);
+
+        for (i = 0; i < NTIMERS; ++i)
+                assert(fired[i] == (i % 2));
+
+        assert(tw.count == 0);
+
+        for (level = 0; level < TW_LEVELS; ++level)
+                assert(tw.used[level] == 0);
+
+        /* Clamped */
+        tw_add(&tw, &timers[0], (long) (TW_MAXTICKS + 10) * TICK);
+        assert(tw_pending(&timers[0]));
+        tw_cancel(&tw, &timers[0]);
+        assert(tw.count == 0);
+}
+
+int main(void)
+{
+        test_levels();
+        test_callbacks();
+        test_scale();
+
+        return EXIT_SUCCESS;
+}